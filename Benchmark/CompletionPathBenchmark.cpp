@@ -0,0 +1,379 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+//! @details
+//! Compares the ways a completion can get to its connection, over a range
+//! of thread counts:
+//!
+//!   map    - a copy of the connection from a std::map under one mutex, as
+//!            the server did before the slot table.
+//!   slot   - a copy from the slot table of CConnectionManager, as the
+//!            server did before the context pointed to its connection.
+//!   direct - CIocpContext::m_connection, as the server does now.
+//!
+//! Threads complete on random connections out of a few, so that they share
+//! the connections' cache lines as the IOCP threads do under load. Reports
+//! the completions per second over all threads, the CPU time and the locked
+//! operations (atomic read-modify-writes and mutex calls) per completion,
+//! and the cache misses per completion if the processor counts them.
+//!
+//! Usage: CompletionPathBenchmark [connections] [milliseconds per run]
+//!
+//! Contention only shows with as many processors as threads.
+
+#include "../IocpServer/ExternalLibraries.h"
+#include "../IocpServer/detail/ConnectionManager.h"
+#include "../IocpServer/detail/Connection.h"
+#include <boost/thread.hpp>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <cstdlib>
+#include <cstring>
+using namespace iocp;
+using namespace iocp::detail;
+
+namespace {
+
+	const uint32_t ThreadCounts[] =
+	{
+		1, 2, 4, 8, 16, 32, 64,
+	};
+
+	const uint32_t NumThreadCounts =
+		sizeof(ThreadCounts) / sizeof(ThreadCounts[0]);
+
+	double Seconds(timeval const &t)
+	{
+		return t.tv_sec + t.tv_usec / 1e6;
+	}
+
+	double Now()
+	{
+		timeval t;
+		gettimeofday(&t, NULL);
+		return Seconds(t);
+	}
+
+	double CpuSeconds()
+	{
+		rusage r;
+		getrusage(RUSAGE_SELF, &r);
+		return Seconds(r.ru_utime) + Seconds(r.ru_stime);
+	}
+
+	//! xorshift, one per thread.
+	uint32_t NextRandom(uint32_t &state)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+	//! @details
+	//! The cache misses of the process, threads started meanwhile included
+	//! once they are joined. Not available in most virtual machines.
+	class CCacheMisses
+	{
+	public:
+		CCacheMisses()
+		{
+			perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = PERF_COUNT_HW_CACHE_MISSES;
+			attr.disabled = 1;
+			attr.inherit = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+
+			m_fd = static_cast<int>(
+				syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+
+			if(-1 != m_fd)
+			{
+				ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+				ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+			}
+		}
+
+		~CCacheMisses()
+		{
+			if(-1 != m_fd)
+			{
+				close(m_fd);
+			}
+		}
+
+		//! Returns false if there is no counter.
+		bool Read(uint64_t &misses)
+		{
+			if(-1 == m_fd)
+			{
+				return false;
+			}
+
+			ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+			return sizeof(misses) == read(m_fd, &misses, sizeof(misses));
+		}
+
+	private:
+		int m_fd;
+	};
+
+	//! @details
+	//! A copy of the connection from a std::map under one mutex.
+	class CMapPath
+	{
+	public:
+		enum
+		{
+			//! Lock and unlock, then add and release a reference.
+			LockedOperations = 4,
+		};
+
+		explicit CMapPath(std::vector< intrusive_ptr<CConnection> > &connections)
+		{
+			for(size_t i = 0; i < connections.size(); ++i)
+			{
+				m_connMap.insert(
+					std::make_pair(connections[i]->m_id, connections[i]));
+			}
+		}
+
+		uint64_t Complete(CConnection &c)
+		{
+			intrusive_ptr<CConnection> pinned;
+			{
+				mutex::scoped_lock l(m_mutex);
+
+				std::map< uint64_t, intrusive_ptr<CConnection> >::iterator itr =
+					m_connMap.find(c.m_id);
+
+				if(m_connMap.end() != itr)
+				{
+					pinned = itr->second;
+				}
+			}
+
+			return (pinned == NULL) ? 0 : pinned->m_id;
+		}
+
+	private:
+		mutex m_mutex;
+		std::map< uint64_t, intrusive_ptr<CConnection> > m_connMap;
+	};
+
+	//! @details
+	//! A copy of the connection from CConnectionManager.
+	class CSlotPath
+	{
+	public:
+		enum
+		{
+			//! Take and drop the slot's access count, then add and release
+			//! a reference.
+			LockedOperations = 4,
+		};
+
+		explicit CSlotPath(std::vector< intrusive_ptr<CConnection> > &connections)
+			: m_connectionManager(0)
+		{
+			// A new table hands out the same ids, in the same order.
+			for(size_t i = 0; i < connections.size(); ++i)
+			{
+				uint64_t cid = m_connectionManager.NewId();
+				assert(cid == connections[i]->m_id);
+				(void)cid;
+				m_connectionManager.AddConnection(connections[i]);
+			}
+		}
+
+		uint64_t Complete(CConnection &c)
+		{
+			intrusive_ptr<CConnection> pinned =
+				m_connectionManager.GetConnection(c.m_id);
+
+			return (pinned == NULL) ? 0 : pinned->m_id;
+		}
+
+	private:
+		CConnectionManager m_connectionManager;
+	};
+
+	//! @details
+	//! The connection the context points to.
+	class CDirectPath
+	{
+	public:
+		enum
+		{
+			LockedOperations = 0,
+		};
+
+		explicit CDirectPath(std::vector< intrusive_ptr<CConnection> > &)
+		{
+		}
+
+		uint64_t Complete(CConnection &c)
+		{
+			return c.m_rcvContext.m_connection->m_id;
+		}
+	};
+
+	//! @details
+	//! One run: numThreads threads complete on the connections for the
+	//! duration.
+	template <class Path>
+	class CRun
+	{
+	public:
+		CRun(std::vector< intrusive_ptr<CConnection> > &connections)
+			: m_connections(connections)
+			, m_path(connections)
+			, m_stop(false)
+			, m_numCompletions(0)
+			, m_checksum(0)
+		{
+		}
+
+		void Execute(uint32_t numThreads, uint32_t milliseconds)
+		{
+			CCacheMisses cacheMisses;
+			double startCpu = CpuSeconds();
+			double start = Now();
+
+			{
+				boost::thread_group threads;
+				for(uint32_t i = 0; i < numThreads; ++i)
+				{
+					threads.create_thread(bind(&CRun::Complete, this, i + 1));
+				}
+
+				boost::this_thread::sleep(
+					boost::posix_time::milliseconds(milliseconds));
+				m_stop.store(true);
+				threads.join_all();
+			}
+
+			double elapsed = Now() - start;
+			double cpu = CpuSeconds() - startCpu;
+			double numCompletions = double(m_numCompletions.load());
+
+			char misses[32] = "n/a";
+			uint64_t numMisses = 0;
+			if(true == cacheMisses.Read(numMisses))
+			{
+				sprintf(misses, "%.3f", numMisses / numCompletions);
+			}
+
+			printf("%8u  %-6s  %14.0f  %12.1f  %10u  %12s\n",
+				numThreads,
+				Name(),
+				numCompletions / elapsed,
+				cpu * 1e9 / numCompletions,
+				static_cast<uint32_t>(Path::LockedOperations),
+				misses);
+			fflush(stdout);
+		}
+
+	private:
+		static char const *Name();
+
+		void Complete(uint32_t seed)
+		{
+			uint32_t random = seed * 2654435761u;
+			uint64_t numCompletions = 0;
+			uint64_t checksum = 0;
+
+			while(false == m_stop.load(boost::memory_order_relaxed))
+			{
+				for(uint32_t i = 0; i < 256; ++i)
+				{
+					CConnection &c =
+						*m_connections[NextRandom(random) % m_connections.size()];
+
+					checksum += m_path.Complete(c);
+				}
+				numCompletions += 256;
+			}
+
+			m_numCompletions.fetch_add(numCompletions);
+			m_checksum.fetch_add(checksum);
+		}
+
+		std::vector< intrusive_ptr<CConnection> > &m_connections;
+		Path m_path;
+		atomic<bool> m_stop;
+		atomic<uint64_t> m_numCompletions;
+
+		//! Keeps the completions from being optimized away.
+		atomic<uint64_t> m_checksum;
+	};
+
+	template <> char const *CRun<CMapPath>::Name() { return "map"; }
+	template <> char const *CRun<CSlotPath>::Name() { return "slot"; }
+	template <> char const *CRun<CDirectPath>::Name() { return "direct"; }
+
+	template <class Path>
+	void Run(
+		std::vector< intrusive_ptr<CConnection> > &connections,
+		uint32_t numThreads,
+		uint32_t milliseconds)
+	{
+		CRun<Path> run(connections);
+		run.Execute(numThreads, milliseconds);
+	}
+
+} // end namespace
+
+int main(int argc, char **argv)
+{
+	uint32_t numConnections = argc > 1 ? atoi(argv[1]) : 64;
+	uint32_t milliseconds = argc > 2 ? atoi(argv[2]) : 1000;
+
+	if(0 == numConnections || 0 == milliseconds)
+	{
+		fprintf(stderr,
+			"Usage: %s [connections] [milliseconds per run]\n",
+			argv[0]);
+		return 1;
+	}
+
+	// Ids as the slot table hands them out, so that every path finds the
+	// same connections.
+	CConnectionManager ids(0);
+	std::vector< intrusive_ptr<CConnection> > connections;
+	for(uint32_t i = 0; i < numConnections; ++i)
+	{
+		connections.push_back(intrusive_ptr<CConnection>(
+			new CConnection(INVALID_SOCKET, ids.NewId(), 0)));
+	}
+
+	printf("%u connections, %u processors\n",
+		numConnections,
+		boost::thread::hardware_concurrency());
+	printf("%8s  %-6s  %14s  %12s  %10s  %12s\n",
+		"threads",
+		"path",
+		"completions/s",
+		"CPU ns each",
+		"locked ops",
+		"cache misses");
+
+	for(uint32_t i = 0; i < NumThreadCounts; ++i)
+	{
+		Run<CMapPath>(connections, ThreadCounts[i], milliseconds);
+		Run<CSlotPath>(connections, ThreadCounts[i], milliseconds);
+		Run<CDirectPath>(connections, ThreadCounts[i], milliseconds);
+	}
+
+	return 0;
+}
@@ -0,0 +1,269 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+//! @details
+//! Compares connection lookups in the slot table of CConnectionManager with
+//! the std::map under one mutex that it replaced, over a range of thread
+//! counts. Lookup threads look up random connections, as the completions of
+//! the IOCP threads do, while one more thread keeps disconnecting and
+//! accepting connections. Reports the lookups per second over all threads.
+//!
+//! Usage: ConnectionTableBenchmark [connections] [milliseconds per run]
+//!
+//! Contention only shows with as many processors as threads.
+
+#include "../IocpServer/ExternalLibraries.h"
+#include "../IocpServer/detail/ConnectionManager.h"
+#include "../IocpServer/detail/Connection.h"
+#include <boost/thread.hpp>
+#include <sys/time.h>
+#include <stdio.h>
+#include <cstdlib>
+using namespace iocp;
+using namespace iocp::detail;
+
+namespace {
+
+	const uint32_t ThreadCounts[] =
+	{
+		1, 2, 4, 8, 16, 32, 64,
+	};
+
+	const uint32_t NumThreadCounts =
+		sizeof(ThreadCounts) / sizeof(ThreadCounts[0]);
+
+	double Now()
+	{
+		timeval t;
+		gettimeofday(&t, NULL);
+		return t.tv_sec + t.tv_usec / 1e6;
+	}
+
+	//! xorshift, one per thread.
+	uint32_t NextRandom(uint32_t &state)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+	//! @details
+	//! The connection table as it was: ids from a counter under a mutex,
+	//! and connections in a map under another.
+	class CMapTable
+	{
+	public:
+		CMapTable()
+			: m_currentId(0)
+		{
+		}
+
+		uint64_t Add()
+		{
+			uint64_t cid = 0;
+			{
+				mutex::scoped_lock l(m_cidMutex);
+				cid = ++m_currentId;
+			}
+
+			intrusive_ptr<CConnection> c(new CConnection(INVALID_SOCKET, cid, 0));
+
+			mutex::scoped_lock l(m_mutex);
+			m_connMap.insert(std::make_pair(cid, c));
+			return cid;
+		}
+
+		void Remove(uint64_t cid)
+		{
+			mutex::scoped_lock l(m_mutex);
+			m_connMap.erase(cid);
+		}
+
+		intrusive_ptr<CConnection> Get(uint64_t cid)
+		{
+			mutex::scoped_lock l(m_mutex);
+
+			std::map< uint64_t, intrusive_ptr<CConnection> >::iterator itr =
+				m_connMap.find(cid);
+
+			if(m_connMap.end() != itr)
+			{
+				return itr->second;
+			}
+
+			return intrusive_ptr<CConnection>();
+		}
+
+	private:
+		mutex m_cidMutex;
+		uint64_t m_currentId;
+
+		mutex m_mutex;
+		std::map< uint64_t, intrusive_ptr<CConnection> > m_connMap;
+	};
+
+	//! @details
+	//! CConnectionManager, with the calls the server makes around it.
+	class CSlotTable
+	{
+	public:
+		CSlotTable()
+			: m_connectionManager(0)
+		{
+		}
+
+		uint64_t Add()
+		{
+			uint64_t cid = m_connectionManager.NewId();
+
+			intrusive_ptr<CConnection> c(new CConnection(INVALID_SOCKET, cid, 0));
+			m_connectionManager.AddConnection(c);
+			return cid;
+		}
+
+		void Remove(uint64_t cid)
+		{
+			m_connectionManager.RemoveConnection(cid);
+		}
+
+		intrusive_ptr<CConnection> Get(uint64_t cid)
+		{
+			return m_connectionManager.GetConnection(cid);
+		}
+
+	private:
+		CConnectionManager m_connectionManager;
+	};
+
+	//! @details
+	//! One run: numThreads threads look up connections for the duration,
+	//! while the churn thread replaces one connection after the other.
+	template <class Table>
+	class CRun
+	{
+	public:
+		CRun(uint32_t numConnections)
+			: m_cids(numConnections)
+			, m_stop(false)
+			, m_numLookups(0)
+			, m_numFound(0)
+		{
+			for(uint32_t i = 0; i < numConnections; ++i)
+			{
+				m_cids[i].store(m_table.Add(), boost::memory_order_relaxed);
+			}
+		}
+
+		//! Returns the lookups per second.
+		double Execute(uint32_t numThreads, uint32_t milliseconds)
+		{
+			boost::thread_group threads;
+			for(uint32_t i = 0; i < numThreads; ++i)
+			{
+				threads.create_thread(bind(&CRun::Lookup, this, i + 1));
+			}
+			threads.create_thread(bind(&CRun::Churn, this));
+
+			double start = Now();
+			boost::this_thread::sleep(
+				boost::posix_time::milliseconds(milliseconds));
+			m_stop.store(true);
+			threads.join_all();
+			double elapsed = Now() - start;
+
+			// Every lookup is of a connection there a moment ago, so
+			// nearly all of them are found.
+			assert(m_numFound.load() * 2 >= m_numLookups.load());
+
+			return m_numLookups.load() / elapsed;
+		}
+
+	private:
+		void Lookup(uint32_t seed)
+		{
+			uint32_t random = seed * 2654435761u;
+			uint64_t numLookups = 0;
+			uint64_t numFound = 0;
+
+			while(false == m_stop.load(boost::memory_order_relaxed))
+			{
+				for(uint32_t i = 0; i < 256; ++i)
+				{
+					uint64_t cid = m_cids[NextRandom(random) % m_cids.size()]
+						.load(boost::memory_order_relaxed);
+
+					if(m_table.Get(cid) != NULL)
+					{
+						++numFound;
+					}
+				}
+				numLookups += 256;
+			}
+
+			m_numLookups.fetch_add(numLookups);
+			m_numFound.fetch_add(numFound);
+		}
+
+		void Churn()
+		{
+			uint32_t i = 0;
+			while(false == m_stop.load(boost::memory_order_relaxed))
+			{
+				uint64_t cid = m_cids[i].load(boost::memory_order_relaxed);
+				m_table.Remove(cid);
+				m_cids[i].store(m_table.Add(), boost::memory_order_relaxed);
+
+				i = (i + 1) % m_cids.size();
+			}
+		}
+
+		Table m_table;
+		std::vector< atomic<uint64_t> > m_cids;
+		atomic<bool> m_stop;
+		atomic<uint64_t> m_numLookups;
+		atomic<uint64_t> m_numFound;
+	};
+
+	template <class Table>
+	double Run(uint32_t numConnections, uint32_t numThreads, uint32_t milliseconds)
+	{
+		CRun<Table> run(numConnections);
+		return run.Execute(numThreads, milliseconds);
+	}
+
+} // end namespace
+
+int main(int argc, char **argv)
+{
+	uint32_t numConnections = argc > 1 ? atoi(argv[1]) : 10000;
+	uint32_t milliseconds = argc > 2 ? atoi(argv[2]) : 1000;
+
+	if(0 == numConnections || 0 == milliseconds)
+	{
+		fprintf(stderr,
+			"Usage: %s [connections] [milliseconds per run]\n",
+			argv[0]);
+		return 1;
+	}
+
+	printf("%u connections, %u processors\n",
+		numConnections,
+		boost::thread::hardware_concurrency());
+	printf("%8s  %14s  %14s\n", "threads", "map lookups/s", "slot lookups/s");
+
+	for(uint32_t i = 0; i < NumThreadCounts; ++i)
+	{
+		double mapRate =
+			Run<CMapTable>(numConnections, ThreadCounts[i], milliseconds);
+		double slotRate =
+			Run<CSlotTable>(numConnections, ThreadCounts[i], milliseconds);
+
+		printf("%8u  %14.0f  %14.0f\n", ThreadCounts[i], mapRate, slotRate);
+		fflush(stdout);
+	}
+
+	return 0;
+}
@@ -0,0 +1,139 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+//! @details
+//! Measures CTimerWheel with many timers armed at once, as with one timer
+//! per connection on a busy server. Timers are due at random ticks up to
+//! the range given, 100 ms each by default. Reports the time per timer to:
+//!
+//!   arm     - schedule a timer that is not scheduled.
+//!   reset   - move a scheduled timer to another tick.
+//!   cancel  - cancel a scheduled timer.
+//!   expire  - go through the ticks until every timer is due, cascades
+//!             between the levels included.
+//!
+//! and the time per tick that goes through with every timer armed and none
+//! due, which is what the worker threads pay between timeouts.
+//!
+//! Usage: TimerWheelBenchmark [timers] [ticks]
+
+#include "../IocpServer/ExternalLibraries.h"
+#include "../IocpServer/detail/TimerWheel.h"
+#include <sys/time.h>
+#include <stdio.h>
+#include <cstdlib>
+using namespace iocp;
+using namespace iocp::detail;
+
+namespace {
+
+	double Now()
+	{
+		timeval t;
+		gettimeofday(&t, NULL);
+		return t.tv_sec + t.tv_usec / 1e6;
+	}
+
+	//! xorshift
+	uint32_t NextRandom(uint32_t &state)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+	void Report(char const *operation, double seconds, double count)
+	{
+		printf("%-8s  %12.1f  %14.0f\n",
+			operation,
+			seconds * 1e9 / count,
+			count / seconds);
+		fflush(stdout);
+	}
+
+} // end namespace
+
+int main(int argc, char **argv)
+{
+	uint32_t numTimers = argc > 1 ? atoi(argv[1]) : 1000000;
+	uint32_t numTicks = argc > 2 ? atoi(argv[2]) : 36000;
+
+	if(0 == numTimers || 0 == numTicks)
+	{
+		fprintf(stderr, "Usage: %s [timers] [ticks]\n", argv[0]);
+		return 1;
+	}
+
+	std::vector<CTimerWheel::CTimer> timers(numTimers);
+	std::vector<uint64_t> ticks(numTimers);
+	std::vector<uint64_t> resetTicks(numTimers);
+
+	uint32_t random = 2654435761u;
+	for(uint32_t i = 0; i < numTimers; ++i)
+	{
+		ticks[i] = 1 + NextRandom(random) % numTicks;
+		resetTicks[i] = 1 + NextRandom(random) % numTicks;
+	}
+
+	printf("%u timers over %u ticks\n", numTimers, numTicks);
+	printf("%-8s  %12s  %14s\n", "", "ns each", "per second");
+
+	CTimerWheel wheel;
+
+	double start = Now();
+	for(uint32_t i = 0; i < numTimers; ++i)
+	{
+		wheel.Schedule(timers[i], ticks[i]);
+	}
+	Report("arm", Now() - start, numTimers);
+
+	start = Now();
+	for(uint32_t i = 0; i < numTimers; ++i)
+	{
+		wheel.Schedule(timers[i], resetTicks[i]);
+	}
+	Report("reset", Now() - start, numTimers);
+
+	start = Now();
+	for(uint32_t i = 0; i < numTimers; ++i)
+	{
+		wheel.Cancel(timers[i]);
+	}
+	Report("cancel", Now() - start, numTimers);
+
+	// Every timer due after the ticks measured below.
+	for(uint32_t i = 0; i < numTimers; ++i)
+	{
+		wheel.Schedule(timers[i], numTicks + ticks[i]);
+	}
+
+	CTimerWheel::TimerList_t expired;
+	expired.reserve(numTimers);
+
+	// Not a level boundary on the way, which would cascade.
+	uint32_t numEmptyTicks = std::min<uint32_t>(numTicks, CTimerWheel::NumSlots - 1);
+
+	start = Now();
+	for(uint32_t i = 1; i <= numEmptyTicks; ++i)
+	{
+		wheel.Advance(i, expired);
+	}
+	Report("tick", Now() - start, numEmptyTicks);
+
+	start = Now();
+	wheel.Advance(2 * static_cast<uint64_t>(numTicks), expired);
+	Report("expire", Now() - start, numTimers);
+
+	if( (expired.size() != numTimers) || (0 != wheel.GetNumTimers()) )
+	{
+		fprintf(stderr, "%u timers expired out of %u\n",
+			static_cast<uint32_t>(expired.size()),
+			numTimers);
+		return 1;
+	}
+
+	return 0;
+}
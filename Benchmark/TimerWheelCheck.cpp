@@ -0,0 +1,329 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+//! @details
+//! Checks that CTimerWheel, which CConnectionTimers runs the connection
+//! timeouts on, expires each timer at the tick it is due and in order:
+//!
+//!   boundaries - timers due on either side of the span of each level,
+//!                from a tick just short of the level boundaries, going
+//!                through one tick at a time.
+//!   reach      - timers due around and past the reach of the last level,
+//!                which wait in its furthest slot and are placed again.
+//!   order      - random timers moved and cancelled, then gone through in
+//!                one Advance.
+//!
+//! Prints what went wrong and returns 1 on a failure, 0 otherwise.
+//!
+//! Usage: TimerWheelCheck
+
+#include "../IocpServer/ExternalLibraries.h"
+#include "../IocpServer/detail/TimerWheel.h"
+#include <stdio.h>
+#include <algorithm>
+using namespace iocp;
+using namespace iocp::detail;
+
+namespace {
+
+	uint32_t numFailures = 0;
+
+	void Fail(char const *check, char const *what, uint64_t tick, uint64_t due)
+	{
+		fprintf(stderr, "%s: %s at tick %llu, due %llu\n",
+			check,
+			what,
+			static_cast<unsigned long long>(tick),
+			static_cast<unsigned long long>(due));
+		++numFailures;
+	}
+
+	void Report(char const *check, uint32_t numFailuresBefore)
+	{
+		printf("%-10s  %s\n",
+			check,
+			numFailuresBefore == numFailures ? "ok" : "FAILED");
+		fflush(stdout);
+	}
+
+	//! xorshift
+	uint32_t NextRandom(uint32_t &state)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+	uint64_t const Reach =
+		static_cast<uint64_t>(1) <<
+		(CTimerWheel::NumLevels * CTimerWheel::SlotBits);
+
+	//! The delays on either side of the span of each level.
+	std::vector<uint64_t> BoundaryDelays()
+	{
+		std::vector<uint64_t> delays;
+		delays.push_back(0);
+		delays.push_back(1);
+
+		for(uint32_t level = 1; level < CTimerWheel::NumLevels; ++level)
+		{
+			uint64_t span = static_cast<uint64_t>(1) <<
+				(level * CTimerWheel::SlotBits);
+
+			delays.push_back(span - 1);
+			delays.push_back(span);
+			delays.push_back(span + 1);
+			delays.push_back(2 * span - 1);
+			delays.push_back(2 * span);
+			delays.push_back(2 * span + 1);
+		}
+
+		return delays;
+	}
+
+	//! Go through the ticks one at a time, and check that every timer
+	//! expires at the tick it is due.
+	void CheckBoundaries()
+	{
+		uint32_t numFailuresBefore = numFailures;
+
+		// Just short of a boundary of every level, so that the first ticks
+		// cascade as well.
+		uint64_t const start =
+			(static_cast<uint64_t>(3) <<
+			((CTimerWheel::NumLevels - 1) * CTimerWheel::SlotBits)) - 3;
+
+		CTimerWheel wheel(start);
+
+		std::vector<uint64_t> delays = BoundaryDelays();
+
+		// Each delay from the start, and from each of the ticks after it,
+		// so that the timers are due on both sides of the boundaries.
+		uint32_t const numOffsets = 6;
+		std::vector<CTimerWheel::CTimer> timers(delays.size() * numOffsets);
+
+		uint64_t last = start;
+		uint32_t t = 0;
+		for(uint32_t offset = 0; offset < numOffsets; ++offset)
+		{
+			// Only the ones scheduled for the next tick are due yet.
+			CTimerWheel::TimerList_t expired;
+			wheel.Advance(start + offset, expired);
+			for(size_t i = 0; i < expired.size(); ++i)
+			{
+				uint64_t due = CTimerWheel::GetTick(*expired[i]);
+				if(due != start + offset)
+				{
+					Fail("boundaries", "expired off its tick",
+						start + offset, due);
+				}
+			}
+
+			for(size_t i = 0; i < delays.size(); ++i, ++t)
+			{
+				uint64_t due = start + offset + delays[i];
+
+				// A timer is never due before the next tick.
+				due = (std::max)(due, start + offset + 1);
+
+				wheel.Schedule(timers[t], due);
+				if(CTimerWheel::GetTick(timers[t]) != due)
+				{
+					Fail("boundaries", "scheduled elsewhere",
+						start + offset, due);
+				}
+
+				last = (std::max)(last, due);
+			}
+		}
+
+		CTimerWheel::TimerList_t expired;
+		for(uint64_t tick = start + numOffsets; tick <= last; ++tick)
+		{
+			expired.clear();
+			wheel.Advance(tick, expired);
+
+			for(size_t i = 0; i < expired.size(); ++i)
+			{
+				uint64_t due = CTimerWheel::GetTick(*expired[i]);
+				if(due != tick)
+				{
+					Fail("boundaries", "expired off its tick", tick, due);
+				}
+
+				if(true == CTimerWheel::IsScheduled(*expired[i]))
+				{
+					Fail("boundaries", "still scheduled", tick, due);
+				}
+			}
+		}
+
+		if(0 != wheel.GetNumTimers())
+		{
+			Fail("boundaries", "never expired", last, last);
+		}
+
+		Report("boundaries", numFailuresBefore);
+	}
+
+	//! Timers beyond the reach of the wheel. Advance goes straight to the
+	//! tick before each one is due, and then to the tick it is due.
+	void CheckReach()
+	{
+		uint32_t numFailuresBefore = numFailures;
+
+		std::vector<uint64_t> dues;
+		dues.push_back(Reach / 2);
+		dues.push_back(Reach - 1);
+		dues.push_back(Reach);
+		dues.push_back(Reach + 1);
+		dues.push_back(Reach + CTimerWheel::NumSlots + 1);
+		dues.push_back(Reach + Reach / 1024 + 3);
+
+		CTimerWheel wheel;
+
+		std::vector<CTimerWheel::CTimer> timers(dues.size());
+		for(size_t i = 0; i < dues.size(); ++i)
+		{
+			wheel.Schedule(timers[i], dues[i]);
+		}
+
+		CTimerWheel::TimerList_t expired;
+		for(size_t i = 0; i < dues.size(); ++i)
+		{
+			expired.clear();
+			wheel.Advance(dues[i] - 1, expired);
+			if(false == expired.empty())
+			{
+				Fail("reach", "expired before due",
+					dues[i] - 1, CTimerWheel::GetTick(*expired.front()));
+			}
+
+			wheel.Advance(dues[i], expired);
+			if( (1 != expired.size()) || (&timers[i] != expired.front()) )
+			{
+				Fail("reach", "not expired when due", dues[i], dues[i]);
+			}
+
+			if(dues.size() - i - 1 != wheel.GetNumTimers())
+			{
+				Fail("reach", "timers lost", dues[i], dues[i]);
+			}
+		}
+
+		Report("reach", numFailuresBefore);
+	}
+
+	//! The timers expired from first on, by end.
+	void CheckExpired(
+		CTimerWheel::TimerList_t const &expired, 
+		size_t first, 
+		uint64_t end)
+	{
+		for(size_t i = first; i < expired.size(); ++i)
+		{
+			uint64_t due = CTimerWheel::GetTick(*expired[i]);
+			if(due > end)
+			{
+				Fail("order", "expired before due", end, due);
+			}
+
+			if( (i > first) &&
+				(due < CTimerWheel::GetTick(*expired[i - 1])) )
+			{
+				Fail("order", "expired out of order", end, due);
+			}
+
+			if(NULL == expired[i]->m_owner)
+			{
+				Fail("order", "expired once cancelled", end, due);
+			}
+		}
+	}
+
+	//! Random timers, some of them moved or cancelled, gone through in a
+	//! single Advance. They must come out earliest first, and only the
+	//! ones due.
+	void CheckOrder()
+	{
+		uint32_t numFailuresBefore = numFailures;
+
+		uint32_t const numTimers = 100000;
+		uint64_t const range = 4 << (2 * CTimerWheel::SlotBits);
+
+		// The timers outlive the wheel, which unlinks the ones left.
+		std::vector<CTimerWheel::CTimer> timers(numTimers);
+		CTimerWheel wheel(12345);
+
+		uint32_t random = 2654435761u;
+		for(uint32_t i = 0; i < numTimers; ++i)
+		{
+			timers[i].m_owner = &timers[i];
+			wheel.Schedule(timers[i], 12345 + NextRandom(random) % range);
+		}
+
+		// Part of the way, then move some and cancel others.
+		CTimerWheel::TimerList_t expired;
+		wheel.Advance(12345 + range / 3, expired);
+		CheckExpired(expired, 0, wheel.GetTick());
+
+		uint32_t numCancelled = 0;
+		for(uint32_t i = 0; i < numTimers; ++i)
+		{
+			if(false == CTimerWheel::IsScheduled(timers[i]))
+			{
+				continue;
+			}
+
+			switch(NextRandom(random) % 3)
+			{
+			case 0:
+				wheel.Schedule(timers[i],
+					wheel.GetTick() + NextRandom(random) % range);
+				break;
+
+			case 1:
+				wheel.Cancel(timers[i]);
+				timers[i].m_owner = NULL;
+				++numCancelled;
+				break;
+			}
+		}
+
+		uint64_t const end = wheel.GetTick() + range / 2;
+		size_t const numBefore = expired.size();
+		wheel.Advance(end, expired);
+		CheckExpired(expired, numBefore, end);
+
+		// What is left is all due later.
+		for(uint32_t i = 0; i < numTimers; ++i)
+		{
+			if( (true == CTimerWheel::IsScheduled(timers[i])) &&
+				(CTimerWheel::GetTick(timers[i]) <= end) )
+			{
+				Fail("order", "not expired when due",
+					end, CTimerWheel::GetTick(timers[i]));
+			}
+		}
+
+		if(expired.size() + numCancelled + wheel.GetNumTimers() != numTimers)
+		{
+			Fail("order", "timers lost", end, end);
+		}
+
+		Report("order", numFailuresBefore);
+	}
+
+} // end namespace
+
+int main()
+{
+	CheckBoundaries();
+	CheckReach();
+	CheckOrder();
+
+	return 0 == numFailures ? 0 : 1;
+}
@@ -0,0 +1,330 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+//! @details
+//! Compares copying sends with zero-copy sends (see
+//! ServerOptions::m_zeroCopyThreshold) over a range of send sizes. For each
+//! size, a server streams the same shared buffer to a number of readers
+//! that discard it, once with zero-copy off and once on, and reports the
+//! throughput and the server's CPU time per GB sent.
+//!
+//! Usage: ZeroCopyBenchmark [connections] [megabytes per connection] [remote]
+//!
+//! By default the readers are child processes on loopback. Over loopback
+//! the kernel copies zero-copy sends anyway, so this only shows the cost of
+//! pinning the pages. Pass "remote" to wait for readers on another host
+//! instead, e.g. one "nc <server> <port> > /dev/null" per connection and per
+//! run, with the port printed before each run.
+
+#include "../IocpServer/ExternalLibraries.h"
+#include "../IocpServer/IocpServer.h"
+#include <boost/thread.hpp>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <cstdlib>
+#include <cstring>
+using namespace iocp;
+
+namespace {
+
+	//! The port of the first run. Each run listens on the next one, so
+	//! that a run never waits for the previous one's sockets to go away.
+	//! Below the usual ephemeral range, see IsConnectedToSelf.
+	const uint16_t FirstPort = 20100;
+
+	//! Bytes kept in flight per connection, and at least this many sends.
+	//! A zero-copy send only completes once the peer acknowledges it, so
+	//! a few small sends in flight would leave the connection idle.
+	const uint32_t BytesInFlight = 4 * 1024 * 1024;
+	const uint32_t MinSendsInFlight = 4;
+
+	const uint32_t SendSizes[] =
+	{
+		4096, 16384, 65536, 262144, 1048576, 4194304,
+	};
+
+	const uint32_t NumSendSizes = sizeof(SendSizes) / sizeof(SendSizes[0]);
+
+	//! Two runs per send size, copying then zero-copy.
+	const uint32_t NumRuns = NumSendSizes * 2;
+
+	double Seconds(timeval const &t)
+	{
+		return t.tv_sec + t.tv_usec / 1e6;
+	}
+
+	double Now()
+	{
+		timeval t;
+		gettimeofday(&t, NULL);
+		return Seconds(t);
+	}
+
+	double CpuSeconds()
+	{
+		rusage r;
+		getrusage(RUSAGE_SELF, &r);
+		return Seconds(r.ru_utime) + Seconds(r.ru_stime);
+	}
+
+	//! @details
+	//! A connect to a loopback port that nothing listens on yet may pick 
+	//! that same port as its own and connect to itself.
+	bool IsConnectedToSelf(int s)
+	{
+		sockaddr_in local;
+		socklen_t localSize = sizeof(local);
+		getsockname(s, (sockaddr *)&local, &localSize);
+
+		sockaddr_in remote;
+		socklen_t remoteSize = sizeof(remote);
+		getpeername(s, (sockaddr *)&remote, &remoteSize);
+
+		return local.sin_port == remote.sin_port;
+	}
+
+	//! @details
+	//! The reader side. Connect to every run in turn and read until the
+	//! server disconnects.
+	void RunReader()
+	{
+		std::vector<char> buffer(1024 * 1024);
+
+		for(uint32_t run = 0; run < NumRuns; ++run)
+		{
+			sockaddr_in address;
+			memset(&address, 0, sizeof(address));
+			address.sin_family = AF_INET;
+			address.sin_port = htons(FirstPort + run);
+			address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+			int s = -1;
+			for(;;)
+			{
+				s = socket(AF_INET, SOCK_STREAM, 0);
+				if(0 == connect(s, (sockaddr *)&address, sizeof(address)) &&
+					false == IsConnectedToSelf(s))
+				{
+					break;
+				}
+				close(s);
+				usleep(10 * 1000);
+			}
+
+			while(read(s, &buffer[0], buffer.size()) > 0)
+			{
+			}
+			close(s);
+		}
+	}
+
+	//! @details
+	//! Stream the same buffer to every connection until each one got its
+	//! share, then disconnect it.
+	class CStreamHandler : public CIocpHandler
+	{
+	public:
+		CStreamHandler(
+			std::vector<uint8_t> &data,
+			uint32_t numConnections,
+			uint64_t bytesPerConnection)
+			: m_data(data)
+			, m_sendsInFlight(std::max(
+				MinSendsInFlight, 
+				BytesInFlight / uint32_t(m_data.GetData().size())))
+			, m_numConnections(numConnections)
+			, m_bytesPerConnection(bytesPerConnection)
+			, m_numConnected(0)
+			, m_numDisconnected(0)
+			, m_startTime(0)
+			, m_startCpu(0)
+		{
+		}
+
+		//! Block until every connection is done. Returns the elapsed time
+		//! and CPU time since the first connection.
+		void Wait(double &elapsed, double &cpu)
+		{
+			mutex::scoped_lock l(m_mutex);
+			while(m_numDisconnected < m_numConnections)
+			{
+				m_done.wait(l);
+			}
+			elapsed = Now() - m_startTime;
+			cpu = CpuSeconds() - m_startCpu;
+		}
+
+		virtual void OnNewConnection(
+			uint64_t cid,
+			ConnectionInformation const &c)
+		{
+			{
+				mutex::scoped_lock l(m_mutex);
+				if(0 == m_numConnected++)
+				{
+					m_startTime = Now();
+					m_startCpu = CpuSeconds();
+				}
+				m_bytesLeft[cid] = m_bytesPerConnection;
+			}
+
+			for(uint32_t i = 0; i < m_sendsInFlight; ++i)
+			{
+				GetIocpServer().Send(cid, m_data);
+			}
+		}
+
+		virtual void OnSentData(uint64_t cid, uint64_t byteTransferred)
+		{
+			uint64_t inFlight = 
+				uint64_t(m_sendsInFlight) * m_data.GetData().size();
+			uint64_t left = 0;
+
+			{
+				mutex::scoped_lock l(m_mutex);
+				uint64_t &bytesLeft = m_bytesLeft[cid];
+				bytesLeft -= std::min(bytesLeft, byteTransferred);
+				left = bytesLeft;
+			}
+
+			if(0 == left)
+			{
+				GetIocpServer().Disconnect(cid);
+			}
+			else if(left >= inFlight)
+			{
+				GetIocpServer().Send(cid, m_data);
+			}
+		}
+
+		virtual void OnDisconnect(uint64_t cid, int32_t errorcode)
+		{
+			mutex::scoped_lock l(m_mutex);
+			++m_numDisconnected;
+			m_done.notify_all();
+		}
+
+	private:
+		CSharedBuffer m_data;
+		uint32_t m_sendsInFlight;
+		uint32_t m_numConnections;
+		uint64_t m_bytesPerConnection;
+
+		mutex m_mutex;
+		boost::condition_variable m_done;
+		std::map<uint64_t, uint64_t> m_bytesLeft;
+		uint32_t m_numConnected;
+		uint32_t m_numDisconnected;
+		double m_startTime;
+		double m_startCpu;
+	};
+
+	void RunServer(
+		uint32_t run,
+		uint32_t sendSize,
+		bool zeroCopy,
+		uint32_t numConnections,
+		uint64_t bytesPerConnection)
+	{
+		// Sends end on a buffer boundary, after the first ones in flight.
+		bytesPerConnection -= bytesPerConnection % sendSize;
+		bytesPerConnection = std::max<uint64_t>(
+			bytesPerConnection, 
+			uint64_t(BytesInFlight) + MinSendsInFlight * sendSize);
+
+		std::vector<uint8_t> data(sendSize, 'z');
+		boost::shared_ptr<CStreamHandler> h(
+			new CStreamHandler(data, numConnections, bytesPerConnection));
+
+		ServerOptions options;
+		options.m_zeroCopyThreshold = zeroCopy ? sendSize : 0;
+
+		double elapsed = 0;
+		double cpu = 0;
+		{
+			CIocpServer server(FirstPort + run, h, options);
+			h->Wait(elapsed, cpu);
+		}
+
+		double gigabytes =
+			double(bytesPerConnection) * numConnections / (1 << 30);
+
+		printf("%10u  %-9s  %10.0f  %10.3f\n",
+			sendSize,
+			zeroCopy ? "zero-copy" : "copy",
+			gigabytes * 1024 / elapsed,
+			cpu / gigabytes);
+		fflush(stdout);
+	}
+
+} // end namespace
+
+int main(int argc, char **argv)
+{
+	uint32_t numConnections = argc > 1 ? atoi(argv[1]) : 4;
+	uint64_t bytesPerConnection =
+		(argc > 2 ? atoi(argv[2]) : 256) * uint64_t(1024 * 1024);
+	bool remote = argc > 3 && 0 == strcmp(argv[3], "remote");
+
+	if(0 == numConnections || 0 == bytesPerConnection)
+	{
+		fprintf(stderr,
+			"Usage: %s [connections] [megabytes per connection] [remote]\n",
+			argv[0]);
+		return 1;
+	}
+
+	// Readers are forked before the server starts any thread, so that the
+	// server's CPU time is the only one counted.
+	std::vector<pid_t> readers;
+	for(uint32_t i = 0; false == remote && i < numConnections; ++i)
+	{
+		pid_t pid = fork();
+		if(0 == pid)
+		{
+			RunReader();
+			_exit(0);
+		}
+		readers.push_back(pid);
+	}
+
+	printf("%u connections, %u MB each, %s\n",
+		numConnections,
+		uint32_t(bytesPerConnection >> 20),
+		remote ? "remote readers" : "loopback");
+	printf("%10s  %-9s  %10s  %10s\n", "send size", "mode", "MB/s", "CPU s/GB");
+
+	for(uint32_t i = 0; i < NumSendSizes; ++i)
+	{
+		for(uint32_t zeroCopy = 0; zeroCopy < 2; ++zeroCopy)
+		{
+			uint32_t run = i * 2 + zeroCopy;
+			if(true == remote)
+			{
+				printf("waiting for %u readers on port %u\n",
+					numConnections,
+					FirstPort + run);
+				fflush(stdout);
+			}
+			RunServer(
+				run,
+				SendSizes[i],
+				0 != zeroCopy,
+				numConnections,
+				bytesPerConnection);
+		}
+	}
+
+	for(size_t i = 0; i < readers.size(); ++i)
+	{
+		waitpid(readers[i], NULL, 0);
+	}
+
+	return 0;
+}
@@ -1,18 +1,24 @@
-//! Copyright Alan Ning 2010
-//! Distributed under the Boost Software License, Version 1.0.
-//! (See accompanying file LICENSE_1_0.txt or copy at
-//! http://www.boost.org/LICENSE_1_0.txt)
-
-#ifdef IOCPSERVER_EXPORTS
-#define IOCPSERVER_API __declspec(dllexport)
-#else
-#define IOCPSERVER_API __declspec(dllimport)
-#endif
-
-#if defined(_WIN32)
-#	if !defined(_DLL) || !defined(_MT)
-#		error This library must be used with the multi-threaded DLL CRT
-#	endif
-#endif
-
-#pragma warning(disable:4251 4275)
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#if defined(_WIN32)
+#	ifdef IOCPSERVER_EXPORTS
+#		define IOCPSERVER_API __declspec(dllexport)
+#	else
+#		define IOCPSERVER_API __declspec(dllimport)
+#	endif
+#else
+#	define IOCPSERVER_API
+#endif
+
+#if defined(_WIN32)
+#	if !defined(_DLL) || !defined(_MT)
+#		error This library must be used with the multi-threaded DLL CRT
+#	endif
+#endif
+
+#if defined(_MSC_VER)
+#pragma warning(disable:4251 4275)
+#endif
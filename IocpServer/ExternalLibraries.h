@@ -1,73 +1,110 @@
-//! Copyright Alan Ning 2010
-//! Distributed under the Boost Software License, Version 1.0.
-//! (See accompanying file LICENSE_1_0.txt or copy at
-//! http://www.boost.org/LICENSE_1_0.txt)
-
-#ifndef EXTERNALLIBRARIES_H_2010_09_21_23_22_49
-#define EXTERNALLIBRARIES_H_2010_09_21_23_22_49
-
-// Disable Secure SCL for performance reason.
-#define _SECURE_SCL 0
-#define _SECURE_SCL_THROWS 0
-#define _HAS_ITERATOR_DEBUGGING 0
-
-// Exclude rarely-used stuff from Windows headers
-#define WIN32_LEAN_AND_MEAN		
-#include "windows.h"
-#include <WinSock2.h>
-#include <WS2tcpip.h>
-// Mswsock.h must be included after WinSock2.h
-#include <Mswsock.h>
-
-#include "Export.h"
-#include <iostream>
-
-// Disable boost datetime warnings where it is implicitly casting integer to short.
-#pragma warning(disable:4244)
-#include <boost/thread.hpp>
-#include <boost/bind.hpp>
-#include <boost/function.hpp>
-#include <boost/cstdint.hpp>
-#include <boost/noncopyable.hpp>
-#pragma warning(default:4244)
-
-#include <tchar.h>
-
-
-#pragma comment(lib, "ws2_32.lib")
-#pragma comment(lib, "Mswsock.lib")
-
-
-
-namespace iocp
-{
-	using boost::shared_ptr;
-	using boost::uint8_t;
-	using boost::uint16_t;
-	using boost::uint32_t;
-	using boost::uint64_t;
-	using boost::int8_t;
-	using boost::int16_t;
-	using boost::int32_t;
-	using boost::int64_t;
-	using boost::thread;
-	using boost::mutex;
-	using boost::bind;
-	using boost::function;
-	using boost::noncopyable;
-
-#ifdef _UNICODE
-	typedef std::wstring tstring;
-#else
-	typedef std::string tstring;
-#endif
-
-#ifndef UNICODE
-	#define tcout std::cout
-#else
-	#define tcout std::wcout
-#endif
-
-}
-
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef EXTERNALLIBRARIES_H_2010_09_21_23_22_49
+#define EXTERNALLIBRARIES_H_2010_09_21_23_22_49
+
+// Disable Secure SCL for performance reason.
+#define _SECURE_SCL 0
+#define _SECURE_SCL_THROWS 0
+#define _HAS_ITERATOR_DEBUGGING 0
+
+#if defined(_WIN32)
+// Exclude rarely-used stuff from Windows headers
+#define WIN32_LEAN_AND_MEAN		
+#include "windows.h"
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+// Mswsock.h must be included after WinSock2.h
+#include <Mswsock.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <cstring>
+#include <cassert>
+#include "PosixCompat.h"
+#endif
+
+#include "Export.h"
+#include <iostream>
+
+// Disable boost datetime warnings where it is implicitly casting integer to short.
+#if defined(_MSC_VER)
+#pragma warning(disable:4244)
+#endif
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/atomic.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/intrusive_ptr.hpp>
+#if defined(_MSC_VER)
+#pragma warning(default:4244)
+#endif
+
+#include <vector>
+#include <map>
+#include <deque>
+#include <list>
+#include <new>
+
+#if defined(_WIN32)
+#include <tchar.h>
+
+
+#pragma comment(lib, "ws2_32.lib")
+#pragma comment(lib, "Mswsock.lib")
+#endif
+
+
+
+namespace iocp
+{
+	using boost::shared_ptr;
+	using boost::weak_ptr;
+	using boost::intrusive_ptr;
+	using boost::uint8_t;
+	using boost::uint16_t;
+	using boost::uint32_t;
+	using boost::uint64_t;
+	using boost::int8_t;
+	using boost::int16_t;
+	using boost::int32_t;
+	using boost::int64_t;
+	using boost::thread;
+	using boost::mutex;
+	using boost::timed_mutex;
+	using boost::thread_specific_ptr;
+	using boost::bind;
+	using boost::function;
+	using boost::noncopyable;
+	using boost::atomic;
+
+#ifdef _UNICODE
+	typedef std::wstring tstring;
+#else
+	typedef std::string tstring;
+#endif
+
+#ifndef UNICODE
+	#define tcout std::cout
+#else
+	#define tcout std::wcout
+#endif
+
+}
+
 #endif // EXTERNALLIBRARIES_H_2010_09_21_23_22_49
\ No newline at end of file
@@ -1,65 +1,118 @@
-//! Copyright Alan Ning 2010
-//! Distributed under the Boost Software License, Version 1.0.
-//! (See accompanying file LICENSE_1_0.txt or copy at
-//! http://www.boost.org/LICENSE_1_0.txt)
-
-#include "StdAfx.h"
-#include "IocpHandler.h"
-#include "IocpServer.h"
-
-namespace iocp {
-
-
-void CIocpHandler::OnNewConnection( uint64_t, ConnectionInformation const & )
-{
-
-}
-
-void CIocpHandler::OnServerError( int /*errorCode*/ )
-{
-
-}
-
-void CIocpHandler::OnSentData( uint64_t /*cid*/, uint64_t /*byteTransferred*/ )
-{
-
-}
-
-void CIocpHandler::OnReceiveData( uint64_t /*cid*/, std::vector<uint8_t> const &/*data*/ )
-{
-
-}
-
-void iocp::CIocpHandler::OnClientDisconnect( uint64_t cid, int32_t )
-{
-	try
-	{
-		GetIocpServer().Shutdown(cid, SD_SEND);
-
-		GetIocpServer().Disconnect(cid);
-	}
-	catch (iocp::CWin32Exception const &)
-	{
-	}
-	catch (iocp::CIocpException const &)
-	{
-	}
-}
-
-void CIocpHandler::OnServerClose( int32_t /*errorCode*/ )
-{
-
-}
-
-void CIocpHandler::OnDisconnect( uint64_t /*cid*/, int32_t /*errorcode*/)
-{
-
-}
-
-
-CIocpServer & CIocpHandler::GetIocpServer()
-{
-	return *m_iocpServer;
-}
-
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#include "StdAfx.h"
+#include "IocpHandler.h"
+#include "IocpServer.h"
+
+namespace iocp {
+
+
+void CIocpHandler::OnNewConnection( uint64_t, ConnectionInformation const & )
+{
+
+}
+
+void CIocpHandler::OnNewConnection( uint64_t cid,
+								   ConnectionInformation const &c,
+								   void *&/*context*/ )
+{
+	OnNewConnection(cid, c);
+}
+
+void CIocpHandler::OnServerError( int /*errorCode*/ )
+{
+
+}
+
+void CIocpHandler::OnSentData( uint64_t /*cid*/, uint64_t /*byteTransferred*/ )
+{
+
+}
+
+void CIocpHandler::OnSentData( uint64_t cid, void *, uint64_t byteTransferred )
+{
+	OnSentData(cid, byteTransferred);
+}
+
+void CIocpHandler::OnWritable( uint64_t /*cid*/ )
+{
+
+}
+
+void CIocpHandler::OnWritable( uint64_t cid, void * )
+{
+	OnWritable(cid);
+}
+
+void CIocpHandler::OnTimeout( uint64_t cid, Timeout timeout )
+{
+	// The connection may be going already. The sends a write timeout is
+	// about would hold a graceful disconnect.
+	if(WriteTimeout == timeout)
+	{
+		GetIocpServer().Abort(cid, std::nothrow);
+	}
+	else
+	{
+		GetIocpServer().Disconnect(cid, std::nothrow);
+	}
+}
+
+void CIocpHandler::OnTimeout( uint64_t cid, void *, Timeout timeout )
+{
+	OnTimeout(cid, timeout);
+}
+
+void CIocpHandler::OnReceiveData( uint64_t /*cid*/, std::vector<uint8_t> const &/*data*/ )
+{
+
+}
+
+void CIocpHandler::OnReceiveBuffer( uint64_t cid, CReceiveBuffer &data )
+{
+	OnReceiveData(cid, data.GetData());
+}
+
+void CIocpHandler::OnReceiveBuffer( uint64_t cid, void *, CReceiveBuffer &data )
+{
+	OnReceiveBuffer(cid, data);
+}
+
+void iocp::CIocpHandler::OnClientDisconnect( uint64_t cid, int32_t )
+{
+	// The connection may be gone already. There is nothing to do then.
+	GetIocpServer().Shutdown(cid, SD_SEND, std::nothrow);
+
+	GetIocpServer().Disconnect(cid, std::nothrow);
+}
+
+void CIocpHandler::OnClientDisconnect( uint64_t cid, void *, int32_t errorcode )
+{
+	OnClientDisconnect(cid, errorcode);
+}
+
+void CIocpHandler::OnServerClose( int32_t /*errorCode*/ )
+{
+
+}
+
+void CIocpHandler::OnDisconnect( uint64_t /*cid*/, int32_t /*errorcode*/)
+{
+
+}
+
+void CIocpHandler::OnDisconnect( uint64_t cid, void *, int32_t errorcode )
+{
+	OnDisconnect(cid, errorcode);
+}
+
+
+CIocpServer & CIocpHandler::GetIocpServer()
+{
+	return *m_iocpServer;
+}
+
 } // end namespace
\ No newline at end of file
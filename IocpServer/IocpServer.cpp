@@ -1,393 +1,1499 @@
-//! Copyright Alan Ning 2010
-//! Distributed under the Boost Software License, Version 1.0.
-//! (See accompanying file LICENSE_1_0.txt or copy at
-//! http://www.boost.org/LICENSE_1_0.txt)
-
-#include "StdAfx.h"
-#include "IocpServer.h"
-#include "IocpException.h"
-
-#include "detail/WorkerThread.h"
-#include "detail/SharedIocpData.h"
-#include "detail/Connection.h"
-#include "detail/Utils.h"
-
-namespace iocp {
-
-class CIocpServer::CImpl
-{
-public:
-
-	enum { DefaultRcvBufferSize = 4096 };
-
-	CImpl(uint16_t port,
-		shared_ptr<CIocpHandler> iocpHandler,
-		uint32_t addressToListenOn,
-		uint32_t rcvbufferSize,
-		uint32_t numThread
-		)
-	{
-		// Initialize the port binding/listening first before setting the
-		// handler. This way, we will never fire callbacks prematurely
-		// to the user when the server is partially constructed.
-		Initialize(addressToListenOn, port, rcvbufferSize, numThread);
-
-		m_iocpData.m_iocpHandler = iocpHandler;
-	}
-	
-	~CImpl()
-	{
-		Uninitialize();
-	}
-
-	void Initialize(
-		uint32_t addressToListenOn, 
-		uint16_t port, 
-		uint32_t rcvbufferSize, 
-		uint32_t numThread)
-	{
-		try
-		{
-			if(0 == rcvbufferSize)
-			{
-				m_iocpData.m_rcvBufferSize = DefaultRcvBufferSize;
-			}
-			else
-			{
-				m_iocpData.m_rcvBufferSize = rcvbufferSize;
-			}
-
-			m_iocpData.m_shutdownEvent = CreateEvent(
-				NULL,  // lpEventAttributes
-				TRUE,  // bManualReset
-				FALSE, // bInitialState
-				NULL); // lpName
-
-			InitializeWinsock();
-
-			InitializeIocp();
-
-			InitializeThreadPool(numThread);
-
-			InitializeSocket(addressToListenOn, port);
-
-			InitializeAcceptEvent();
-		}
-		catch (...)
-		{
-			// Always uninitialize everything here upon all exception.
-			// This is to ensure that we don't leak any resources upon
-			// construction failure.
-			Uninitialize();
-
-			// Re-throw to notify the clients.
-			throw;
-		}
-	}
-
-	void InitializeThreadPool(uint32_t numThread) 
-	{
-		if(0 == numThread)
-		{
-			numThread = detail::GetNumIocpThreads();
-		}
-
-		m_threadPool.reserve(numThread);
-
-		for(uint32_t i=0; i<numThread; ++i)
-		{
-			m_threadPool.push_back(shared_ptr<detail::CWorkerThread>(
-				new detail::CWorkerThread(m_iocpData)) 
-				);
-		}
-	}
-
-	void InitializeIocp() 
-	{
-		//Create I/O completion port
-		// See http://msdn.microsoft.com/en-us/library/aa363862%28VS.85%29.aspx
-		m_iocpData.m_ioCompletionPort = detail::CreateIocp();
-
-		if (NULL == m_iocpData.m_ioCompletionPort)
-		{
-			throw CWin32Exception(WSAGetLastError());
-		}
-	}
-	void InitializeWinsock() 
-	{
-		// Initialize Winsock
-		WSADATA wsaData;
-		int nResult = WSAStartup(MAKEWORD(2,2), &wsaData);
-		if (NO_ERROR != nResult)
-		{
-			throw CWin32Exception(nResult);
-		}
-	}
-
-	void InitializeSocket(uint32_t addressToListenOn, uint16_t portNumber)
-	{
-		if (INVALID_SOCKET != m_iocpData.m_listenSocket)
-		{
-			closesocket(m_iocpData.m_listenSocket);
-		}
-
-		//Overlapped I/O follows the model established in Windows and can be performed only on 
-		//sockets created through the WSASocket function 
-		m_iocpData.m_listenSocket = detail::CreateOverlappedSocket();
-
-		if (INVALID_SOCKET == m_iocpData.m_listenSocket) 
-		{
-			throw CWin32Exception(WSAGetLastError());
-		}
-
-		//Cleanup and Init with 0 the ServerAddress
-		struct sockaddr_in serverAddress;
-		ZeroMemory((char *)&serverAddress, sizeof(serverAddress));
-
-		//Fill up the address structure
-		serverAddress.sin_family = AF_INET;
-		serverAddress.sin_addr.s_addr = addressToListenOn;
-		serverAddress.sin_port = htons(portNumber);    //comes from commandline
-
-		//Assign local address and port number
-		if (SOCKET_ERROR == ::bind(
-			m_iocpData.m_listenSocket, 
-			(struct sockaddr *) &serverAddress, 
-			sizeof(serverAddress))) 
-		{
-			closesocket(m_iocpData.m_listenSocket);
-			m_iocpData.m_listenSocket = INVALID_SOCKET;
-
-			throw CWin32Exception(WSAGetLastError());
-		}
-
-		//! @remark
-		//! The maximum length of the queue of pending connections. 
-		//! If set to SOMAXCONN, the underlying service provider responsible 
-		//! for socket s will set the backlog to a maximum reasonable value. 
-		//! There is no standard provision to obtain the actual backlog value.
-		if (SOCKET_ERROR == listen(m_iocpData.m_listenSocket,SOMAXCONN))
-		{
-			closesocket(m_iocpData.m_listenSocket);
-			m_iocpData.m_listenSocket = INVALID_SOCKET;
-
-			throw CWin32Exception(WSAGetLastError());
-		}
-
-		m_iocpData.m_acceptExFn = 
-			detail::LoadAcceptEx(m_iocpData.m_listenSocket);
-
-		if(NULL == m_iocpData.m_acceptExFn)
-		{
-			throw CWin32Exception(GetLastError());
-		}
-
-		detail::AssociateDevice((HANDLE)m_iocpData.m_listenSocket,m_iocpData);
-
-	}
-
-	void InitializeAcceptEvent()
-	{
-		m_iocpData.m_acceptContext.m_socket = 
-			detail::CreateOverlappedSocket();
-
-		detail::PostAccept(m_iocpData);
-	}
-
-	void Uninitialize()
-	{
-		if(INVALID_HANDLE_VALUE != m_iocpData.m_shutdownEvent)
-		{
-			// Set the shutdown event so all worker threads can quit when
-			// they unblock.
-			SetEvent(m_iocpData.m_shutdownEvent);
-		}
-
-		//! @remark
-		//! See Network Programming for Microsoft Windows, SE Chapter 5
-		//! for the following shutdown strategy.
-
-		// Close all socket handles to flush out all pending overlapped
-		// I/O operation.
-		m_iocpData.m_connectionManager.CloseAllConnections();
-
-		// Give out a NULL completion status to help unblock all worker
-		// threads. This is retract all I/O request made to the threads, and
-		// it may not be a graceful shutdown. It is the user's job to
-		// graceful shutdown all connection before shutting down the server.
-		ThreadPool_t::iterator itr = m_threadPool.begin();
-		for (; m_threadPool.end() != itr; ++itr)
-		{
-			//Help threads get out of blocking - GetQueuedCompletionStatus()
-			PostQueuedCompletionStatus(
-				m_iocpData.m_ioCompletionPort, 
-				0, 
-				(DWORD) 
-				NULL, 
-				NULL);
-		}
-
-		//! @remark
-		//! Some background information from Windows via CC++ by Mr. Richter.
-		//!
-		//! Before Windows Vista, when a thread issued an I/O request against 
-		//! a device associated with a completion port, it was mandatory that 
-		//! the thread remain alive until the request completed; otherwise, 
-		//! Windows canceled any outstanding requests made by the thread. With 
-		//! Windows Vista, this is no longer necessary: threads can now issue 
-		//! requests and terminate; the request will still be processed and 
-		//! the result will be queued to the completion port.
-		m_threadPool.clear();
-
-		if(INVALID_SOCKET != m_iocpData.m_listenSocket)
-		{
-			closesocket(m_iocpData.m_listenSocket);
-			m_iocpData.m_listenSocket = INVALID_SOCKET;
-		}
-
-		if(INVALID_HANDLE_VALUE != m_iocpData.m_shutdownEvent)
-		{
-			CloseHandle(m_iocpData.m_shutdownEvent);
-			m_iocpData.m_shutdownEvent = INVALID_HANDLE_VALUE;
-		}
-
-		if(INVALID_HANDLE_VALUE != m_iocpData.m_ioCompletionPort)
-		{
-			CloseHandle(m_iocpData.m_ioCompletionPort);
-			m_iocpData.m_ioCompletionPort = INVALID_HANDLE_VALUE;
-		}
-
-		if(m_iocpData.m_iocpHandler != NULL)
-		{
-			m_iocpData.m_iocpHandler->OnServerClose(0);
-			m_iocpData.m_iocpHandler.reset();
-		}
-	}
-
-	void Send(uint64_t cid, std::vector<uint8_t> &data )
-	{
-		shared_ptr<detail::CConnection> connection = 
-			m_iocpData.m_connectionManager.GetConnection(cid);
-		
-		if(connection == NULL)
-		{
-			throw CIocpException(tstring(_T("Connection does not exist")));
-			return;
-		}
-
-		shared_ptr<detail::CIocpContext> sendContext = 
-			connection->CreateSendContext();
-
-		// Take over user's data here and post it to the completion port.
-		sendContext->m_data.swap(data);
-		sendContext->ResetWsaBuf();
-
-		int lastError = detail::PostSend(*sendContext);
-		if(WSA_IO_PENDING != lastError)
-		{
-			connection->m_sendQueue.RemoveSendContext(sendContext.get());
-			
-			// Undo the swap here before throwing. This way, the user's
-			// data is untouched and they may proceed to recover.
-			data.swap(sendContext->m_data);
-
-			throw CWin32Exception(lastError);
-		}
-	}
-
-	void Shutdown( uint64_t cid, int how )
-	{
-		shared_ptr<detail::CConnection> connection = 
-			m_iocpData.m_connectionManager.GetConnection(cid);
-
-		if(connection == NULL)
-		{
-			throw CIocpException(tstring(_T("Connection does not exist")));
-			return;
-		}
-
-		::shutdown(connection->m_socket, how);
-	}
-
-	void Disconnect( uint64_t cid)
-	{
-		shared_ptr<detail::CConnection> c = 
-			m_iocpData.m_connectionManager.GetConnection(cid);
-
-		if(c == NULL)
-		{
-			throw CIocpException(tstring(_T("Connection does not exist")));
-			return;
-		}
-
-		Shutdown(cid, SD_BOTH);
-
-		::InterlockedIncrement(&c->m_disconnectPending);
-
-		// Disconnect context is special (hacked) because it is not
-		// tied to a connection. During graceful shutdown, it is very
-		// difficult to determine when exactly is a good time to 
-		// remove the connection. For example, a disconnect context 
-		// might have already been sent by the IOCP thread send handler, 
-		// and you wouldn't know it unless mutex are used. To keep it as 
-		// lock-free as possible, this disconnect context may be redundant.
-		// The disconnect handler will gracefully reject the redundant 
-		// disconnect context.
-		detail::PostDisconnect(m_iocpData, *c);
-	}
-
-public:
-
-	detail::CSharedIocpData m_iocpData;
-
-	typedef std::vector <
-		shared_ptr<detail::CWorkerThread>
-	> ThreadPool_t;
-
-	ThreadPool_t m_threadPool;
-
-	std::vector<uint8_t> outputBuffer_;
-};
-
-
-CIocpServer::CIocpServer(uint16_t port,
-						 shared_ptr<CIocpHandler> iocpHandler,
-						 uint32_t addressToListenOn /*= INADDR_ANY*/,
-						 uint32_t rcvbufferSize /*= 0*/,
-						 uint32_t numThread /*= 0*/
-						 )
-: m_impl(new CIocpServer::CImpl(
-		 port, 
-		 iocpHandler, 
-		 addressToListenOn, 
-		 rcvbufferSize, 
-		 numThread)
-		 )
-{
-	if(iocpHandler != NULL)
-	{
-		iocpHandler->m_iocpServer = this;
-	}
-}
-
-CIocpServer::~CIocpServer()
-{
-
-}
-
-void CIocpServer::Send(uint64_t cid, std::vector<uint8_t> &data )
-{
-	return m_impl->Send(cid, data);
-}
-
-void CIocpServer::Shutdown( uint64_t cid, int how )
-{
-	return m_impl->Shutdown(cid, how);
-}
-
-void CIocpServer::Disconnect( uint64_t cid)
-{
-	return m_impl->Disconnect(cid);
-}
-
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#include "StdAfx.h"
+#include "IocpServer.h"
+#include "IocpException.h"
+
+#include "detail/WorkerThread.h"
+#include "detail/SharedIocpData.h"
+#include "detail/Connection.h"
+#include "detail/Utils.h"
+
+#if !defined(_WIN32)
+#include "detail/EpollPort.h"
+#include "detail/UringPort.h"
+#endif
+
+namespace iocp {
+
+class CIocpServer::CImpl
+{
+public:
+
+	enum 
+	{ 
+		DefaultRcvBufferSize = 4096,
+		DefaultHostNameCacheSize = 1024,
+		DefaultMaxIdleRcvBuffers = 1024,
+
+		//! SendFile sends this much per context, and so per OnSentData.
+		SendFileChunkSize = 16 * 1024 * 1024,
+	};
+
+	typedef std::vector <
+		shared_ptr<detail::CSharedIocpData>
+	> ShardList_t;
+
+	typedef std::vector <
+		shared_ptr<detail::CWorkerThread>
+	> ThreadPool_t;
+
+	CImpl(uint16_t port,
+		shared_ptr<CIocpHandler> iocpHandler,
+		ServerOptions const &options
+		)
+	{
+		// Initialize the port binding/listening first before setting the
+		// handler. This way, we will never fire callbacks prematurely
+		// to the user when the server is partially constructed.
+		Initialize(port, options);
+
+		ShardList_t::iterator itr = m_shards.begin();
+		for (; m_shards.end() != itr; ++itr)
+		{
+			(*itr)->m_iocpHandler = iocpHandler;
+		}
+	}
+	
+	~CImpl()
+	{
+		Uninitialize();
+	}
+
+	void Initialize(uint16_t port, ServerOptions const &options)
+	{
+		try
+		{
+			uint32_t numShards = 1;
+			uint32_t numThread = options.m_numThread;
+
+#if !defined(_WIN32)
+			// Thread-per-core. Each shard is a complete server with one 
+			// thread, and the kernel spreads the connections over the
+			// shards' listen sockets.
+			bool sharded = (options.m_numShards > 0);
+			if(true == sharded)
+			{
+				numShards = options.m_numShards;
+				numThread = 1;
+			}
+
+			// The shard's index takes 16 bits of every connection id.
+			if(numShards > detail::CSharedIocpData::MaxShards)
+			{
+				throw CWin32Exception(EINVAL);
+			}
+#else
+			bool sharded = false;
+#endif
+
+#if defined(_WIN32)
+			InitializeWinsock();
+#endif
+
+			uint32_t rcvBufferSize = 0 == options.m_rcvBufferSize ? 
+				DefaultRcvBufferSize : 
+				options.m_rcvBufferSize;
+
+			// The bounds always include the initial size.
+			uint32_t minRcvBufferSize = 0 == options.m_minRcvBufferSize ?
+				rcvBufferSize :
+				(std::min)(options.m_minRcvBufferSize, rcvBufferSize);
+
+			uint32_t maxRcvBufferSize = 0 == options.m_maxRcvBufferSize ?
+				rcvBufferSize :
+				(std::max)(options.m_maxRcvBufferSize, rcvBufferSize);
+
+			// Each shard keeps its share of the idle buffers.
+			uint32_t maxIdleRcvBuffers = 0 == options.m_maxIdleRcvBuffers ?
+				DefaultMaxIdleRcvBuffers :
+				options.m_maxIdleRcvBuffers;
+			maxIdleRcvBuffers = (maxIdleRcvBuffers + numShards - 1) / numShards;
+
+			if(true == options.m_resolveHostNames)
+			{
+				m_hostNameCache.reset(new detail::CHostNameCache(
+					0 == options.m_hostNameCacheSize ? 
+						DefaultHostNameCacheSize : 
+						options.m_hostNameCacheSize));
+			}
+
+			if( (options.m_sendHighWatermark > 0) || 
+				(options.m_globalSendHighWatermark > 0) )
+			{
+				m_sendWatermarks.reset(new detail::CSendWatermarks(
+					options.m_sendHighWatermark,
+					LowWatermark(
+						options.m_sendHighWatermark, 
+						options.m_sendLowWatermark),
+					options.m_globalSendHighWatermark,
+					LowWatermark(
+						options.m_globalSendHighWatermark,
+						options.m_globalSendLowWatermark)));
+			}
+
+			for(uint32_t i = 0; i < numShards; ++i)
+			{
+				m_shards.push_back(shared_ptr<detail::CSharedIocpData>(
+					new detail::CSharedIocpData(i)));
+				m_threadPools.push_back(ThreadPool_t());
+
+				detail::CSharedIocpData &iocpData = *m_shards.back();
+
+				iocpData.m_hostNameCache = m_hostNameCache;
+
+				iocpData.m_rcvBufferSize = rcvBufferSize;
+				iocpData.m_minRcvBufferSize = minRcvBufferSize;
+				iocpData.m_maxRcvBufferSize = maxRcvBufferSize;
+				iocpData.m_bufferPool.reset(new detail::CBufferPool(
+					minRcvBufferSize,
+					maxRcvBufferSize,
+					maxIdleRcvBuffers));
+				iocpData.m_contextPool.reset(new detail::CContextPool);
+				iocpData.m_sendWatermarks = m_sendWatermarks;
+
+#if defined(_WIN32)
+				iocpData.m_shutdownEvent = CreateEvent(
+					NULL,  // lpEventAttributes
+					TRUE,  // bManualReset
+					FALSE, // bInitialState
+					NULL); // lpName
+#endif
+
+				InitializeIocp(iocpData, options);
+
+				// Shard i runs on processor i, wrapping around.
+				InitializeThreadPool(
+					iocpData, 
+					m_threadPools.back(), 
+					numThread, 
+					true == sharded ? static_cast<int>(i) : -1);
+
+				InitializeSocket(
+					iocpData, 
+					options.m_addressToListenOn, 
+					port, 
+					sharded);
+
+				InitializeAcceptEvent(
+					iocpData, 
+					0 == options.m_numAccepts ? 
+						static_cast<uint32_t>(m_threadPools.back().size()) : 
+						options.m_numAccepts);
+			}
+		}
+		catch (...)
+		{
+			// Always uninitialize everything here upon all exception.
+			// This is to ensure that we don't leak any resources upon
+			// construction failure.
+			Uninitialize();
+
+			// Re-throw to notify the clients.
+			throw;
+		}
+	}
+
+	void InitializeThreadPool(detail::CSharedIocpData &iocpData,
+		ThreadPool_t &threadPool,
+		uint32_t numThread,
+		int cpu) 
+	{
+		if(0 == numThread)
+		{
+			numThread = detail::GetNumIocpThreads();
+		}
+
+		threadPool.reserve(numThread);
+
+		for(uint32_t i=0; i<numThread; ++i)
+		{
+			threadPool.push_back(shared_ptr<detail::CWorkerThread>(
+				new detail::CWorkerThread(iocpData, cpu)) 
+				);
+		}
+	}
+
+	void InitializeIocp(detail::CSharedIocpData &iocpData,
+		ServerOptions const &options) 
+	{
+		iocpData.m_zeroByteReceive = options.m_zeroByteReceive;
+		iocpData.m_coalesceSends = options.m_coalesceSends;
+		iocpData.m_sendWindow = options.m_sendWindow;
+		iocpData.m_timers.Configure(options);
+#if !defined(_WIN32)
+		iocpData.m_zeroCopyThreshold = options.m_zeroCopyThreshold;
+#endif
+
+#if defined(_WIN32)
+		//Create I/O completion port
+		// See http://msdn.microsoft.com/en-us/library/aa363862%28VS.85%29.aspx
+		iocpData.m_ioCompletionPort = detail::CreateIocp();
+
+		if (NULL == iocpData.m_ioCompletionPort)
+		{
+			throw CWin32Exception(WSAGetLastError());
+		}
+#else
+		if(ServerOptions::UringEngine == options.m_engine)
+		{
+			iocpData.m_completionPort.reset(
+				new detail::CUringPort(
+					iocpData, 
+					options.m_uringMultishot));
+
+			// io_uring may be missing, or disabled by policy. epoll always
+			// works, so fall back silently.
+			if(NO_ERROR != iocpData.m_completionPort->Create())
+			{
+				iocpData.m_completionPort.reset();
+			}
+			else if(true == options.m_uringMultishot)
+			{
+				// Multishot receives pick their buffer from the provided
+				// ones, once the data is there.
+				iocpData.m_zeroByteReceive = false;
+			}
+		}
+
+		if(iocpData.m_completionPort == NULL)
+		{
+			// epoll always waits for readiness before it takes a buffer.
+			iocpData.m_zeroByteReceive = false;
+
+			iocpData.m_completionPort.reset(
+				new detail::CEpollPort(iocpData));
+
+			int lastError = iocpData.m_completionPort->Create();
+
+			if (NO_ERROR != lastError)
+			{
+				throw CWin32Exception(lastError);
+			}
+		}
+#endif
+	}
+
+#if defined(_WIN32)
+	void InitializeWinsock() 
+	{
+		// Initialize Winsock
+		WSADATA wsaData;
+		int nResult = WSAStartup(MAKEWORD(2,2), &wsaData);
+		if (NO_ERROR != nResult)
+		{
+			throw CWin32Exception(nResult);
+		}
+	}
+#endif
+
+	void InitializeSocket(detail::CSharedIocpData &iocpData, 
+		uint32_t addressToListenOn, 
+		uint16_t portNumber,
+		bool reusePort)
+	{
+		if (INVALID_SOCKET != iocpData.m_listenSocket)
+		{
+			closesocket(iocpData.m_listenSocket);
+		}
+
+		//Overlapped I/O follows the model established in Windows and can be performed only on 
+		//sockets created through the WSASocket function 
+		iocpData.m_listenSocket = detail::CreateOverlappedSocket();
+
+		if (INVALID_SOCKET == iocpData.m_listenSocket) 
+		{
+			throw CWin32Exception(WSAGetLastError());
+		}
+
+		//Cleanup and Init with 0 the ServerAddress
+		struct sockaddr_in serverAddress;
+		memset(&serverAddress, 0, sizeof(serverAddress));
+
+		//Fill up the address structure
+		serverAddress.sin_family = AF_INET;
+		serverAddress.sin_addr.s_addr = addressToListenOn;
+		serverAddress.sin_port = htons(portNumber);    //comes from commandline
+
+#if !defined(_WIN32)
+		// Allow an immediate restart while old connections sit in 
+		// TIME_WAIT. On Windows, SO_REUSEADDR means something else entirely
+		// (port hijacking), so it is only set here.
+		int reuseAddress = 1;
+		setsockopt(
+			iocpData.m_listenSocket, 
+			SOL_SOCKET, 
+			SO_REUSEADDR, 
+			&reuseAddress, 
+			sizeof(reuseAddress));
+
+		// Every shard listens on the same port.
+		if(true == reusePort)
+		{
+			int reusePortOption = 1;
+			if(SOCKET_ERROR == setsockopt(
+				iocpData.m_listenSocket, 
+				SOL_SOCKET, 
+				SO_REUSEPORT, 
+				&reusePortOption, 
+				sizeof(reusePortOption)))
+			{
+				int lastError = WSAGetLastError();
+
+				closesocket(iocpData.m_listenSocket);
+				iocpData.m_listenSocket = INVALID_SOCKET;
+
+				throw CWin32Exception(lastError);
+			}
+		}
+#endif
+
+		//Assign local address and port number
+		if (SOCKET_ERROR == ::bind(
+			iocpData.m_listenSocket, 
+			(struct sockaddr *) &serverAddress, 
+			sizeof(serverAddress))) 
+		{
+			closesocket(iocpData.m_listenSocket);
+			iocpData.m_listenSocket = INVALID_SOCKET;
+
+			throw CWin32Exception(WSAGetLastError());
+		}
+
+		//! @remark
+		//! The maximum length of the queue of pending connections. 
+		//! If set to SOMAXCONN, the underlying service provider responsible 
+		//! for socket s will set the backlog to a maximum reasonable value. 
+		//! There is no standard provision to obtain the actual backlog value.
+		if (SOCKET_ERROR == listen(iocpData.m_listenSocket,SOMAXCONN))
+		{
+			closesocket(iocpData.m_listenSocket);
+			iocpData.m_listenSocket = INVALID_SOCKET;
+
+			throw CWin32Exception(WSAGetLastError());
+		}
+
+#if defined(_WIN32)
+		iocpData.m_acceptExFn = 
+			detail::LoadAcceptEx(iocpData.m_listenSocket);
+
+		if(NULL == iocpData.m_acceptExFn)
+		{
+			throw CWin32Exception(GetLastError());
+		}
+
+		iocpData.m_transmitFileFn = 
+			detail::LoadTransmitFile(iocpData.m_listenSocket);
+
+		if(NULL == iocpData.m_transmitFileFn)
+		{
+			throw CWin32Exception(GetLastError());
+		}
+#endif
+
+		detail::AssociateDevice(iocpData.m_listenSocket, NULL, iocpData);
+
+	}
+
+	void InitializeAcceptEvent(
+		detail::CSharedIocpData &iocpData, 
+		uint32_t numAccepts)
+	{
+#if defined(_WIN32)
+		// AcceptEx writes the local and remote addresses here, each one 
+		// 16 bytes more than the largest address.
+		uint32_t const addressBufferSize = 2 * (sizeof(sockaddr_in) + 16);
+#else
+		// accept4() needs no buffer.
+		uint32_t const addressBufferSize = 0;
+#endif
+
+		for(uint32_t i = 0; i < numAccepts; ++i)
+		{
+			shared_ptr<detail::CIocpContext> acceptContext(
+				new detail::CIocpContext(
+					INVALID_SOCKET, 
+					detail::CSharedIocpData::ListenKey, 
+					detail::CIocpContext::Accept, 
+					addressBufferSize));
+
+			iocpData.m_acceptContexts.push_back(acceptContext);
+		}
+
+		// All the contexts must be in place before the first accept can
+		// complete.
+		for(uint32_t i = 0; i < numAccepts; ++i)
+		{
+			detail::CIocpContext &acceptContext = 
+				*iocpData.m_acceptContexts[i];
+
+#if defined(_WIN32)
+			acceptContext.m_socket = detail::CreateOverlappedSocket();
+			if(INVALID_SOCKET == acceptContext.m_socket)
+			{
+				throw CWin32Exception(WSAGetLastError());
+			}
+#endif
+
+			detail::PostAccept(iocpData, acceptContext);
+		}
+	}
+
+	void Uninitialize()
+	{
+		for(size_t i = 0; i < m_shards.size(); ++i)
+		{
+			UninitializeShard(*m_shards[i], m_threadPools[i]);
+		}
+
+		// The handler is shared by all shards.
+		if(false == m_shards.empty() && m_shards[0]->m_iocpHandler != NULL)
+		{
+			m_shards[0]->m_iocpHandler->OnServerClose(0);
+		}
+
+		ShardList_t::iterator itr = m_shards.begin();
+		for (; m_shards.end() != itr; ++itr)
+		{
+			(*itr)->m_iocpHandler.reset();
+		}
+	}
+
+	void UninitializeShard(detail::CSharedIocpData &iocpData, 
+		ThreadPool_t &threadPool)
+	{
+#if defined(_WIN32)
+		if(INVALID_HANDLE_VALUE != iocpData.m_shutdownEvent)
+		{
+			// Set the shutdown event so all worker threads can quit when
+			// they unblock.
+			SetEvent(iocpData.m_shutdownEvent);
+		}
+#endif
+
+		//! @remark
+		//! See Network Programming for Microsoft Windows, SE Chapter 5
+		//! for the following shutdown strategy.
+
+		// Close all socket handles to flush out all pending overlapped
+		// I/O operation.
+		iocpData.m_connectionManager.CloseAllConnections();
+
+		// Give out a NULL completion status to help unblock all worker
+		// threads. This is retract all I/O request made to the threads, and
+		// it may not be a graceful shutdown. It is the user's job to
+		// graceful shutdown all connection before shutting down the server.
+		ThreadPool_t::iterator itr = threadPool.begin();
+		for (; threadPool.end() != itr; ++itr)
+		{
+#if defined(_WIN32)
+			//Help threads get out of blocking - GetQueuedCompletionStatus()
+			PostQueuedCompletionStatus(
+				iocpData.m_ioCompletionPort, 
+				0, 
+				(DWORD) 
+				NULL, 
+				NULL);
+#else
+			iocpData.m_completionPort->PostCompletion(NULL, 0);
+#endif
+		}
+
+		//! @remark
+		//! Some background information from Windows via CC++ by Mr. Richter.
+		//!
+		//! Before Windows Vista, when a thread issued an I/O request against 
+		//! a device associated with a completion port, it was mandatory that 
+		//! the thread remain alive until the request completed; otherwise, 
+		//! Windows canceled any outstanding requests made by the thread. With 
+		//! Windows Vista, this is no longer necessary: threads can now issue 
+		//! requests and terminate; the request will still be processed and 
+		//! the result will be queued to the completion port.
+		threadPool.clear();
+
+		// The connections the worker threads did not get to disconnect. 
+		// The handler still gets the last callback of each, to free its
+		// context.
+		std::vector< intrusive_ptr<detail::CConnection> > remaining;
+		iocpData.m_connectionManager.RemoveAllConnections(remaining);
+		for(size_t i = 0; i < remaining.size(); ++i)
+		{
+			if(iocpData.m_iocpHandler != NULL)
+			{
+				iocpData.m_iocpHandler->OnDisconnect(
+					remaining[i]->m_id, 
+					remaining[i]->m_userContext, 
+					0);
+			}
+		}
+		remaining.clear();
+
+		if(INVALID_SOCKET != iocpData.m_listenSocket)
+		{
+#if !defined(_WIN32)
+			// io_uring tears down its requests asynchronously, and a
+			// pending accept keeps the socket open until then. Stop
+			// listening now so that the port can be bound again right away.
+			::shutdown(iocpData.m_listenSocket, SD_BOTH);
+#endif
+			closesocket(iocpData.m_listenSocket);
+			iocpData.m_listenSocket = INVALID_SOCKET;
+		}
+
+#if defined(_WIN32)
+		if(INVALID_HANDLE_VALUE != iocpData.m_shutdownEvent)
+		{
+			CloseHandle(iocpData.m_shutdownEvent);
+			iocpData.m_shutdownEvent = INVALID_HANDLE_VALUE;
+		}
+
+		if(INVALID_HANDLE_VALUE != iocpData.m_ioCompletionPort)
+		{
+			CloseHandle(iocpData.m_ioCompletionPort);
+			iocpData.m_ioCompletionPort = INVALID_HANDLE_VALUE;
+		}
+#else
+		if(iocpData.m_completionPort != NULL)
+		{
+			iocpData.m_completionPort->Close();
+		}
+#endif
+
+		// Sockets created for pending AcceptEx calls, or accepted but never
+		// handed to a connection.
+		detail::CSharedIocpData::AcceptContextList_t::iterator acceptItr = 
+			iocpData.m_acceptContexts.begin();
+		for (; iocpData.m_acceptContexts.end() != acceptItr; ++acceptItr)
+		{
+			if(INVALID_SOCKET != (*acceptItr)->m_socket)
+			{
+				closesocket((*acceptItr)->m_socket);
+				(*acceptItr)->m_socket = INVALID_SOCKET;
+			}
+		}
+	}
+
+	detail::CSharedIocpData &GetShard(uint64_t cid)
+	{
+		// An id that belongs to no shard is not found in the first one.
+		uint32_t shard = detail::CSharedIocpData::ShardOf(cid);
+
+		return *m_shards[shard < m_shards.size() ? shard : 0];
+	}
+
+	void Send(uint64_t cid, std::vector<uint8_t> &data )
+	{
+		ThrowOnError(Send(cid, data, std::nothrow));
+	}
+
+	int Send(uint64_t cid, 
+		std::vector<uint8_t> &data, 
+		std::nothrow_t const &)
+	{
+		detail::CSharedIocpData &iocpData = GetShard(cid);
+
+		intrusive_ptr<detail::CConnection> connection = 
+			iocpData.m_connectionManager.GetConnection(cid);
+		
+		if(connection == NULL)
+		{
+			return CIocpServer::ConnectionNotFound;
+		}
+
+		return SendData(iocpData, *connection, data);
+	}
+
+	bool TrySend(uint64_t cid, std::vector<uint8_t> &data )
+	{
+		return ThrowOnError(TrySend(cid, data, std::nothrow));
+	}
+
+	int TrySend(uint64_t cid, 
+		std::vector<uint8_t> &data, 
+		std::nothrow_t const &)
+	{
+		detail::CSharedIocpData &iocpData = GetShard(cid);
+
+		intrusive_ptr<detail::CConnection> connection = 
+			iocpData.m_connectionManager.GetConnection(cid);
+		
+		if(connection == NULL)
+		{
+			return CIocpServer::ConnectionNotFound;
+		}
+
+		if( (m_sendWatermarks != NULL) && 
+			(false == m_sendWatermarks->CanQueue(*connection)) )
+		{
+			return CIocpServer::SendRefused;
+		}
+
+		return SendData(iocpData, *connection, data);
+	}
+
+	void Send(uint64_t cid, std::vector< std::vector<uint8_t> > &buffers )
+	{
+		ThrowOnError(Send(cid, buffers, std::nothrow));
+	}
+
+	int Send(uint64_t cid, 
+		std::vector< std::vector<uint8_t> > &buffers, 
+		std::nothrow_t const &)
+	{
+		detail::CSharedIocpData &iocpData = GetShard(cid);
+
+		intrusive_ptr<detail::CConnection> connection = 
+			iocpData.m_connectionManager.GetConnection(cid);
+		
+		if(connection == NULL)
+		{
+			return CIocpServer::ConnectionNotFound;
+		}
+
+		// Nothing to send. A context would carry no WSA buffer at all.
+		size_t numBytes = 0;
+		for(size_t i = 0; i < buffers.size(); ++i)
+		{
+			numBytes += buffers[i].size();
+		}
+
+		if(0 == numBytes)
+		{
+			buffers.clear();
+			return NO_ERROR;
+		}
+
+		int lastError = WSA_IO_PENDING;
+
+		if(true == iocpData.m_coalesceSends)
+		{
+			mutex::scoped_lock l(connection->m_sendBatchMutex);
+
+			if(connection->m_sendQueue.NumOutstandingContext() > 0)
+			{
+				for(size_t i = 0; i < buffers.size(); ++i)
+				{
+					if(false == buffers[i].empty())
+					{
+						CountQueued(*connection, 
+							static_cast<int64_t>(buffers[i].size()));
+						connection->AddToSendBatch(
+							buffers[i], 
+							*iocpData.m_contextPool);
+					}
+				}
+				buffers.clear();
+				return NO_ERROR;
+			}
+
+			lastError = PostGatherData(iocpData, *connection, buffers);
+		}
+		else
+		{
+			lastError = PostGatherData(iocpData, *connection, buffers);
+		}
+
+		return WSA_IO_PENDING == lastError ? NO_ERROR : lastError;
+	}
+
+	void Send(uint64_t cid, CSharedBuffer const &data )
+	{
+		ThrowOnError(Send(cid, data, std::nothrow));
+	}
+
+	int Send(uint64_t cid, 
+		CSharedBuffer const &data, 
+		std::nothrow_t const &)
+	{
+		detail::CSharedIocpData &iocpData = GetShard(cid);
+
+		intrusive_ptr<detail::CConnection> connection = 
+			iocpData.m_connectionManager.GetConnection(cid);
+		
+		if(connection == NULL)
+		{
+			return CIocpServer::ConnectionNotFound;
+		}
+
+		int lastError = PostSharedData(iocpData, *connection, data);
+		return WSA_IO_PENDING == lastError ? NO_ERROR : lastError;
+	}
+
+	bool TrySend(uint64_t cid, CSharedBuffer const &data )
+	{
+		return ThrowOnError(TrySend(cid, data, std::nothrow));
+	}
+
+	int TrySend(uint64_t cid, 
+		CSharedBuffer const &data, 
+		std::nothrow_t const &)
+	{
+		detail::CSharedIocpData &iocpData = GetShard(cid);
+
+		intrusive_ptr<detail::CConnection> connection = 
+			iocpData.m_connectionManager.GetConnection(cid);
+		
+		if(connection == NULL)
+		{
+			return CIocpServer::ConnectionNotFound;
+		}
+
+		if( (m_sendWatermarks != NULL) && 
+			(false == m_sendWatermarks->CanQueue(*connection)) )
+		{
+			return CIocpServer::SendRefused;
+		}
+
+		int lastError = PostSharedData(iocpData, *connection, data);
+		return WSA_IO_PENDING == lastError ? NO_ERROR : lastError;
+	}
+
+	void SendUrgent(uint64_t cid, std::vector<uint8_t> &data )
+	{
+		ThrowOnError(SendUrgent(cid, data, std::nothrow));
+	}
+
+	int SendUrgent(uint64_t cid, 
+		std::vector<uint8_t> &data, 
+		std::nothrow_t const &)
+	{
+		detail::CSharedIocpData &iocpData = GetShard(cid);
+
+		intrusive_ptr<detail::CConnection> connection = 
+			iocpData.m_connectionManager.GetConnection(cid);
+		
+		if(connection == NULL)
+		{
+			return CIocpServer::ConnectionNotFound;
+		}
+
+		// Never held back by coalescing either.
+		int lastError = PostSendData(iocpData, *connection, data, true);
+		return WSA_IO_PENDING == lastError ? NO_ERROR : lastError;
+	}
+
+	void SendUrgent(uint64_t cid, CSharedBuffer const &data )
+	{
+		ThrowOnError(SendUrgent(cid, data, std::nothrow));
+	}
+
+	int SendUrgent(uint64_t cid, 
+		CSharedBuffer const &data, 
+		std::nothrow_t const &)
+	{
+		detail::CSharedIocpData &iocpData = GetShard(cid);
+
+		intrusive_ptr<detail::CConnection> connection = 
+			iocpData.m_connectionManager.GetConnection(cid);
+		
+		if(connection == NULL)
+		{
+			return CIocpServer::ConnectionNotFound;
+		}
+
+		int lastError = PostSharedData(iocpData, *connection, data, true);
+		return WSA_IO_PENDING == lastError ? NO_ERROR : lastError;
+	}
+
+	void SendFile(uint64_t cid, HANDLE file, uint64_t offset, uint64_t length)
+	{
+		detail::CSharedIocpData &iocpData = GetShard(cid);
+
+		intrusive_ptr<detail::CConnection> connection = 
+			iocpData.m_connectionManager.GetConnection(cid);
+		
+		if(connection == NULL)
+		{
+			throw CIocpException(tstring(_T("Connection does not exist")));
+			return;
+		}
+
+		if(0 == length)
+		{
+			return;
+		}
+
+		shared_ptr<detail::CFileHandle> fileHandle = 
+			detail::CFileHandle::Duplicate(file);
+
+		if(fileHandle == NULL)
+		{
+			throw CWin32Exception(GetLastError());
+		}
+
+		// One context per chunk, so that OnSentData reports the progress 
+		// of large files. They are queued at once, so that nothing is sent
+		// in between.
+		detail::CIocpContext *first = NULL;
+		detail::CIocpContext *last = NULL;
+		uint32_t numContexts = 0;
+
+		for(uint64_t sent = 0; sent < length; ++numContexts)
+		{
+			detail::CIocpContext *sendContext = 
+				connection->CreateSendContext(*iocpData.m_contextPool);
+
+			sendContext->m_file = fileHandle;
+			sendContext->m_fileOffset = offset + sent;
+			sendContext->m_fileSize = static_cast<uint32_t>(
+				(std::min<uint64_t>)(length - sent, SendFileChunkSize));
+			sendContext->m_fileRemaining = sendContext->m_fileSize;
+
+			sent += sendContext->m_fileSize;
+
+			if(NULL == first)
+			{
+				first = sendContext;
+			}
+			else
+			{
+				last->m_next.store(sendContext, boost::memory_order_relaxed);
+			}
+			last = sendContext;
+		}
+
+		CountQueued(*connection, static_cast<int64_t>(length));
+
+		int lastError = WSA_IO_PENDING;
+
+		if(true == iocpData.m_coalesceSends)
+		{
+			mutex::scoped_lock l(connection->m_sendBatchMutex);
+
+			// Whatever is held back goes first, to keep the order.
+			detail::QueueSendBatch(iocpData, *connection);
+			lastError = detail::QueueWindowedSend(
+				iocpData, *connection, *first, *last, numContexts);
+		}
+		else
+		{
+			lastError = detail::QueueWindowedSend(
+				iocpData, *connection, *first, *last, numContexts);
+		}
+
+		// The other chunks are queued regardless, and complete as failed 
+		// sends once the connection is gone.
+		if(WSA_IO_PENDING != lastError)
+		{
+			CountQueued(
+				*connection, 
+				-static_cast<int64_t>(first->GetSendSize()));
+			iocpData.m_contextPool->Put(first);
+			throw CWin32Exception(lastError);
+		}
+	}
+
+	uint32_t Send(std::vector<uint64_t> const &cids, CSharedBuffer const &data )
+	{
+		uint32_t numSent = 0;
+
+		std::vector<uint64_t>::const_iterator itr = cids.begin();
+		for(; cids.end() != itr; ++itr)
+		{
+			detail::CSharedIocpData &iocpData = GetShard(*itr);
+
+			intrusive_ptr<detail::CConnection> connection = 
+				iocpData.m_connectionManager.GetConnection(*itr);
+
+			// Connections come and go. The others still get the data.
+			if(connection == NULL)
+			{
+				continue;
+			}
+
+			if(WSA_IO_PENDING == PostSharedData(iocpData, *connection, data))
+			{
+				++numSent;
+			}
+		}
+
+		return numSent;
+	}
+
+	void Flush( uint64_t cid )
+	{
+		ThrowOnError(Flush(cid, std::nothrow));
+	}
+
+	int Flush( uint64_t cid, std::nothrow_t const & )
+	{
+		detail::CSharedIocpData &iocpData = GetShard(cid);
+
+		intrusive_ptr<detail::CConnection> connection = 
+			iocpData.m_connectionManager.GetConnection(cid);
+
+		if(connection == NULL)
+		{
+			return CIocpServer::ConnectionNotFound;
+		}
+
+		mutex::scoped_lock l(connection->m_sendBatchMutex);
+		detail::QueueSendBatch(iocpData, *connection);
+		return NO_ERROR;
+	}
+
+	void Shutdown( uint64_t cid, int how )
+	{
+		ThrowOnError(Shutdown(cid, how, std::nothrow));
+	}
+
+	int Shutdown( uint64_t cid, int how, std::nothrow_t const & )
+	{
+		intrusive_ptr<detail::CConnection> connection = 
+			GetShard(cid).m_connectionManager.GetConnection(cid);
+
+		if(connection == NULL)
+		{
+			return CIocpServer::ConnectionNotFound;
+		}
+
+		// Held back sends go before the shutdown, which waits for them.
+		if(SD_RECEIVE != how)
+		{
+			mutex::scoped_lock l(connection->m_sendBatchMutex);
+			detail::QueueSendBatch(GetShard(cid), *connection);
+		}
+
+		return detail::ShutdownSocket(*connection, how);
+	}
+
+	void Disconnect( uint64_t cid)
+	{
+		ThrowOnError(Disconnect(cid, std::nothrow));
+	}
+
+	int Disconnect( uint64_t cid, std::nothrow_t const & )
+	{
+		detail::CSharedIocpData &iocpData = GetShard(cid);
+
+		intrusive_ptr<detail::CConnection> c = 
+			iocpData.m_connectionManager.GetConnection(cid);
+
+		if(c == NULL)
+		{
+			return CIocpServer::ConnectionNotFound;
+		}
+
+		Shutdown(cid, SD_BOTH, std::nothrow);
+
+		::InterlockedIncrement(&c->m_disconnectPending);
+
+		// Disconnect context is special (hacked) because it is not
+		// tied to a connection. During graceful shutdown, it is very
+		// difficult to determine when exactly is a good time to 
+		// remove the connection. For example, a disconnect context 
+		// might have already been sent by the IOCP thread send handler, 
+		// and you wouldn't know it unless mutex are used. To keep it as 
+		// lock-free as possible, this disconnect context may be redundant.
+		// The disconnect handler will gracefully reject the redundant 
+		// disconnect context.
+		detail::PostDisconnect(iocpData, *c);
+		return NO_ERROR;
+	}
+
+	void Abort( uint64_t cid )
+	{
+		ThrowOnError(Abort(cid, std::nothrow));
+	}
+
+	int Abort( uint64_t cid, std::nothrow_t const & )
+	{
+		detail::CSharedIocpData &iocpData = GetShard(cid);
+
+		intrusive_ptr<detail::CConnection> c = 
+			iocpData.m_connectionManager.GetConnection(cid);
+
+		if(c == NULL)
+		{
+			return CIocpServer::ConnectionNotFound;
+		}
+
+		detail::AbortSocket(*c);
+
+		::InterlockedIncrement(&c->m_disconnectPending);
+
+		// Redundant, like the one Disconnect posts, if the last send 
+		// fails meanwhile.
+		detail::PostDisconnect(iocpData, *c);
+		return NO_ERROR;
+	}
+
+	void SetTimeout( uint64_t cid, Timeout timeout, uint32_t milliseconds )
+	{
+		ThrowOnError(SetTimeout(cid, timeout, milliseconds, std::nothrow));
+	}
+
+	int SetTimeout( uint64_t cid, 
+		Timeout timeout, 
+		uint32_t milliseconds, 
+		std::nothrow_t const & )
+	{
+		detail::CSharedIocpData &iocpData = GetShard(cid);
+
+		intrusive_ptr<detail::CConnection> c = 
+			iocpData.m_connectionManager.GetConnection(cid);
+
+		if(c == NULL)
+		{
+			return CIocpServer::ConnectionNotFound;
+		}
+
+		if(true == iocpData.m_timers.SetTimeout(*c, timeout, milliseconds))
+		{
+			// The worker threads wait without a timeout while no timer is
+			// scheduled. One of them has to wait with one now.
+#if defined(_WIN32)
+			PostQueuedCompletionStatus(
+				iocpData.m_ioCompletionPort, 
+				0, 
+				(ULONG_PTR)&iocpData, 
+				&iocpData.m_timerContext);
+#else
+			iocpData.m_completionPort->PostCompletion(
+				&iocpData.m_timerContext, 0);
+#endif
+		}
+
+		return NO_ERROR;
+	}
+
+	bool ResolveHostName(ConnectionInformation &c)
+	{
+		if(m_hostNameCache == NULL)
+		{
+			return false;
+		}
+
+		return m_hostNameCache->Resolve(c.m_remoteAddress, c.m_remoteHostName);
+	}
+
+	std::vector<ReceiveBufferStatistics> GetReceiveBufferStatistics()
+	{
+		// The pools of the shards have the same size classes. Add them up.
+		std::vector<ReceiveBufferStatistics> stats;
+
+		ShardList_t::iterator itr = m_shards.begin();
+		for (; m_shards.end() != itr; ++itr)
+		{
+			std::vector<ReceiveBufferStatistics> shardStats = 
+				(*itr)->m_bufferPool->GetStatistics();
+
+			if(true == stats.empty())
+			{
+				stats.swap(shardStats);
+				continue;
+			}
+
+			for(size_t i = 0; i < stats.size(); ++i)
+			{
+				stats[i].m_numAllocated += shardStats[i].m_numAllocated;
+				stats[i].m_numReused += shardStats[i].m_numReused;
+				stats[i].m_numDiscarded += shardStats[i].m_numDiscarded;
+				stats[i].m_numIdle += shardStats[i].m_numIdle;
+				stats[i].m_maxIdle += shardStats[i].m_maxIdle;
+			}
+		}
+
+		return stats;
+	}
+
+	//! Turn the status of a call that takes std::nothrow into the 
+	//! exception the throwing call reports. Returns false if TrySend 
+	//! refused the data, true otherwise.
+	static bool ThrowOnError(int lastError)
+	{
+		switch(lastError)
+		{
+		case NO_ERROR:
+			return true;
+		case CIocpServer::SendRefused:
+			return false;
+		case CIocpServer::ConnectionNotFound:
+			throw CIocpException(tstring(_T("Connection does not exist")));
+		default:
+			throw CWin32Exception(lastError);
+		}
+	}
+
+	//! Send data on a connection, or hold it back while a send is in 
+	//! flight if sends are coalesced. Returns NO_ERROR or the error.
+	int SendData(detail::CSharedIocpData &iocpData, 
+		detail::CConnection &connection, 
+		std::vector<uint8_t> &data)
+	{
+		int lastError = WSA_IO_PENDING;
+
+		if(true == iocpData.m_coalesceSends)
+		{
+			mutex::scoped_lock l(connection.m_sendBatchMutex);
+
+			// A send is in flight. This data goes out with the next batch.
+			if(connection.m_sendQueue.NumOutstandingContext() > 0)
+			{
+				CountQueued(connection, static_cast<int64_t>(data.size()));
+				connection.AddToSendBatch(data, *iocpData.m_contextPool);
+				return NO_ERROR;
+			}
+
+			lastError = PostSendData(iocpData, connection, data);
+		}
+		else
+		{
+			lastError = PostSendData(iocpData, connection, data);
+		}
+
+		return WSA_IO_PENDING == lastError ? NO_ERROR : lastError;
+	}
+
+	//! Count data queued on a connection against the send watermarks.
+	//! Negative to take it back.
+	void CountQueued(detail::CConnection &connection, int64_t numBytes)
+	{
+		if(m_sendWatermarks != NULL)
+		{
+			m_sendWatermarks->Queued(connection, numBytes);
+		}
+	}
+
+	//! The low watermark for a high one, see ServerOptions.
+	static uint64_t LowWatermark(uint64_t high, uint64_t low)
+	{
+		if(0 == high)
+		{
+			return 0;
+		}
+		return 0 == low ? high / 2 : (std::min)(low, high);
+	}
+
+	//! Queue a send context behind the send window, or ahead of what 
+	//! waits for it if urgent.
+	static int QueueSend(detail::CSharedIocpData &iocpData, 
+		detail::CConnection &connection, 
+		detail::CIocpContext &sendContext,
+		bool urgent)
+	{
+		if(true == urgent)
+		{
+			return detail::QueueSend(iocpData, connection, sendContext);
+		}
+
+		return detail::QueueWindowedSend(iocpData, connection, sendContext);
+	}
+
+	//! Queue data in a new send context. If this fails, the data is left 
+	//! as is and the error is returned.
+	int PostSendData(detail::CSharedIocpData &iocpData, 
+		detail::CConnection &connection, 
+		std::vector<uint8_t> &data,
+		bool urgent = false)
+	{
+		detail::CIocpContext *sendContext = 
+			connection.CreateSendContext(*iocpData.m_contextPool);
+
+		// Take over user's data here and post it to the completion port.
+		sendContext->m_data.swap(data);
+		sendContext->ResetWsaBuf();
+
+		int64_t numBytes = static_cast<int64_t>(sendContext->GetSendSize());
+		CountQueued(connection, numBytes);
+
+		int lastError = QueueSend(iocpData, connection, *sendContext, urgent);
+		if(WSA_IO_PENDING != lastError)
+		{
+			// Undo the swap here before throwing. This way, the user's
+			// data is untouched and they may proceed to recover.
+			CountQueued(connection, -numBytes);
+			data.swap(sendContext->m_data);
+			iocpData.m_contextPool->Put(sendContext);
+		}
+
+		return lastError;
+	}
+
+	//! Same as PostSendData, with all the buffers in one context.
+	int PostGatherData(detail::CSharedIocpData &iocpData, 
+		detail::CConnection &connection, 
+		std::vector< std::vector<uint8_t> > &buffers,
+		bool urgent = false)
+	{
+		detail::CIocpContext *sendContext = 
+			connection.CreateSendContext(*iocpData.m_contextPool);
+
+		sendContext->m_gatherData.swap(buffers);
+		sendContext->ResetWsaBuf();
+
+		int64_t numBytes = static_cast<int64_t>(sendContext->GetSendSize());
+		CountQueued(connection, numBytes);
+
+		int lastError = QueueSend(iocpData, connection, *sendContext, urgent);
+		if(WSA_IO_PENDING != lastError)
+		{
+			CountQueued(connection, -numBytes);
+			buffers.swap(sendContext->m_gatherData);
+			iocpData.m_contextPool->Put(sendContext);
+		}
+
+		return lastError;
+	}
+
+	//! Queue shared data in a new send context, referencing it rather than
+	//! copying it.
+	int PostSharedData(detail::CSharedIocpData &iocpData, 
+		detail::CConnection &connection, 
+		CSharedBuffer const &data,
+		bool urgent = false)
+	{
+		detail::CIocpContext *sendContext = 
+			connection.CreateSendContext(*iocpData.m_contextPool);
+
+		sendContext->m_sharedData = data;
+		sendContext->ResetWsaBuf();
+
+		int64_t numBytes = static_cast<int64_t>(sendContext->GetSendSize());
+		CountQueued(connection, numBytes);
+
+		int lastError = WSA_IO_PENDING;
+
+		if( (true == iocpData.m_coalesceSends) && (false == urgent) )
+		{
+			mutex::scoped_lock l(connection.m_sendBatchMutex);
+
+			// Shared data does not join a batch, since that takes a copy. 
+			// Whatever is held back goes first, to keep the order.
+			detail::QueueSendBatch(iocpData, connection);
+			lastError = QueueSend(iocpData, connection, *sendContext, urgent);
+		}
+		else
+		{
+			lastError = QueueSend(iocpData, connection, *sendContext, urgent);
+		}
+
+		if(WSA_IO_PENDING != lastError)
+		{
+			CountQueued(connection, -numBytes);
+			iocpData.m_contextPool->Put(sendContext);
+		}
+
+		return lastError;
+	}
+
+public:
+
+	//! One shard unless ServerOptions::m_numShards is set.
+	ShardList_t m_shards;
+
+	//! The worker threads of each shard, in the same order.
+	std::vector<ThreadPool_t> m_threadPools;
+
+	//! NULL if ServerOptions::m_resolveHostNames is false.
+	shared_ptr<detail::CHostNameCache> m_hostNameCache;
+
+	//! NULL if no send watermark is set. Shared by the shards, but only
+	//! written to by them with a server wide watermark, which counts over
+	//! every shard.
+	shared_ptr<detail::CSendWatermarks> m_sendWatermarks;
+
+	std::vector<uint8_t> outputBuffer_;
+};
+
+
+CIocpServer::CIocpServer(uint16_t port,
+						 shared_ptr<CIocpHandler> iocpHandler,
+						 uint32_t addressToListenOn /*= INADDR_ANY*/,
+						 uint32_t rcvbufferSize /*= 0*/,
+						 uint32_t numThread /*= 0*/
+						 )
+{
+	ServerOptions options;
+	options.m_addressToListenOn = addressToListenOn;
+	options.m_rcvBufferSize = rcvbufferSize;
+	options.m_numThread = numThread;
+
+	m_impl.reset(new CIocpServer::CImpl(port, iocpHandler, options));
+
+	if(iocpHandler != NULL)
+	{
+		iocpHandler->m_iocpServer = this;
+	}
+}
+
+CIocpServer::CIocpServer(uint16_t port,
+						 shared_ptr<CIocpHandler> iocpHandler,
+						 ServerOptions const &options
+						 )
+: m_impl(new CIocpServer::CImpl(port, iocpHandler, options))
+{
+	if(iocpHandler != NULL)
+	{
+		iocpHandler->m_iocpServer = this;
+	}
+}
+
+CIocpServer::~CIocpServer()
+{
+
+}
+
+void CIocpServer::Send(uint64_t cid, std::vector<uint8_t> &data )
+{
+	return m_impl->Send(cid, data);
+}
+
+int CIocpServer::Send(uint64_t cid, 
+					  std::vector<uint8_t> &data, 
+					  std::nothrow_t const &nothrow )
+{
+	return m_impl->Send(cid, data, nothrow);
+}
+
+bool CIocpServer::TrySend(uint64_t cid, std::vector<uint8_t> &data )
+{
+	return m_impl->TrySend(cid, data);
+}
+
+int CIocpServer::TrySend(uint64_t cid, 
+						 std::vector<uint8_t> &data, 
+						 std::nothrow_t const &nothrow )
+{
+	return m_impl->TrySend(cid, data, nothrow);
+}
+
+void CIocpServer::Send(uint64_t cid, std::vector< std::vector<uint8_t> > &buffers )
+{
+	return m_impl->Send(cid, buffers);
+}
+
+int CIocpServer::Send(uint64_t cid, 
+					  std::vector< std::vector<uint8_t> > &buffers, 
+					  std::nothrow_t const &nothrow )
+{
+	return m_impl->Send(cid, buffers, nothrow);
+}
+
+void CIocpServer::Send(uint64_t cid, CSharedBuffer const &data )
+{
+	return m_impl->Send(cid, data);
+}
+
+int CIocpServer::Send(uint64_t cid, 
+					  CSharedBuffer const &data, 
+					  std::nothrow_t const &nothrow )
+{
+	return m_impl->Send(cid, data, nothrow);
+}
+
+bool CIocpServer::TrySend(uint64_t cid, CSharedBuffer const &data )
+{
+	return m_impl->TrySend(cid, data);
+}
+
+int CIocpServer::TrySend(uint64_t cid, 
+						 CSharedBuffer const &data, 
+						 std::nothrow_t const &nothrow )
+{
+	return m_impl->TrySend(cid, data, nothrow);
+}
+
+void CIocpServer::SendUrgent(uint64_t cid, std::vector<uint8_t> &data )
+{
+	return m_impl->SendUrgent(cid, data);
+}
+
+int CIocpServer::SendUrgent(uint64_t cid, 
+							std::vector<uint8_t> &data, 
+							std::nothrow_t const &nothrow )
+{
+	return m_impl->SendUrgent(cid, data, nothrow);
+}
+
+void CIocpServer::SendUrgent(uint64_t cid, CSharedBuffer const &data )
+{
+	return m_impl->SendUrgent(cid, data);
+}
+
+int CIocpServer::SendUrgent(uint64_t cid, 
+							CSharedBuffer const &data, 
+							std::nothrow_t const &nothrow )
+{
+	return m_impl->SendUrgent(cid, data, nothrow);
+}
+
+uint32_t CIocpServer::Send(std::vector<uint64_t> const &cids, CSharedBuffer const &data )
+{
+	return m_impl->Send(cids, data);
+}
+
+void CIocpServer::SendFile(uint64_t cid, HANDLE file, uint64_t offset, uint64_t length)
+{
+	return m_impl->SendFile(cid, file, offset, length);
+}
+
+void CIocpServer::Flush(uint64_t cid)
+{
+	return m_impl->Flush(cid);
+}
+
+int CIocpServer::Flush(uint64_t cid, std::nothrow_t const &nothrow)
+{
+	return m_impl->Flush(cid, nothrow);
+}
+
+void CIocpServer::Shutdown( uint64_t cid, int how )
+{
+	return m_impl->Shutdown(cid, how);
+}
+
+int CIocpServer::Shutdown( uint64_t cid, int how, std::nothrow_t const &nothrow )
+{
+	return m_impl->Shutdown(cid, how, nothrow);
+}
+
+void CIocpServer::Disconnect( uint64_t cid)
+{
+	return m_impl->Disconnect(cid);
+}
+
+int CIocpServer::Disconnect( uint64_t cid, std::nothrow_t const &nothrow )
+{
+	return m_impl->Disconnect(cid, nothrow);
+}
+
+void CIocpServer::Abort( uint64_t cid )
+{
+	return m_impl->Abort(cid);
+}
+
+int CIocpServer::Abort( uint64_t cid, std::nothrow_t const &nothrow )
+{
+	return m_impl->Abort(cid, nothrow);
+}
+
+void CIocpServer::SetTimeout( uint64_t cid, 
+							 Timeout timeout, 
+							 uint32_t milliseconds )
+{
+	m_impl->SetTimeout(cid, timeout, milliseconds);
+}
+
+int CIocpServer::SetTimeout( uint64_t cid, 
+							Timeout timeout, 
+							uint32_t milliseconds, 
+							std::nothrow_t const &nothrow )
+{
+	return m_impl->SetTimeout(cid, timeout, milliseconds, nothrow);
+}
+
+bool CIocpServer::ResolveHostName( ConnectionInformation &c )
+{
+	return m_impl->ResolveHostName(c);
+}
+
+std::vector<ReceiveBufferStatistics> CIocpServer::GetReceiveBufferStatistics()
+{
+	return m_impl->GetReceiveBufferStatistics();
+}
+
 } // end namespace
\ No newline at end of file
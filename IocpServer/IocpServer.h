@@ -1,189 +1,609 @@
-//! Copyright Alan Ning 2010
-//! Distributed under the Boost Software License, Version 1.0.
-//! (See accompanying file LICENSE_1_0.txt or copy at
-//! http://www.boost.org/LICENSE_1_0.txt)
-
-#ifndef IOCPSERVER_H_2010_09_25_14_37_36
-#define IOCPSERVER_H_2010_09_25_14_37_36
-
-#include "Export.h"
-#include "IocpHandler.h"
-
-//////////////////////////////////////////////////////////////////////////
-//
-// History
-// Oct. 26 2010
-// Version 1.0
-// Creation
-//
-// Dec. 10 2010 
-// Version 1.1 
-// Fixed a bug where the IOCP server stops accepting connection when
-// setsockopt() fails.
-//
-// Removed an unnecessary event per Len Holgate's suggestion.
-//
-//////////////////////////////////////////////////////////////////////////
-
-namespace iocp {
-
-class IOCPSERVER_API CIocpServer
-{
-public:
-	//!***************************************************************************
-	//! @details
-	//! Constructor
-	//! Upon construction, CIocpServer will bind to the indicated port 
-	//! and the provided address.
-	//!
-	//! @param[in] port
-	//! The port to listen on.
-	//!
-	//! @param[in,out] iocpHander
-	//! The handler for IOCP server events. This must be supplied, and IOCP
-	//! server will hold a shared_ptr until its destruction.
-	//!
-	//! @param[in] addressToListenOn
-	//! The IP address that the server will listen to.
-	//!
-	//! @param[in] rcvbufferSize
-	//! The buffer size for receive. 0 = default = 4096 bytes.
-	//!
-	//! @param[in] numThread
-	//! The number of IOCP threads in thread pool. 
-	//! 0 = default = Number of processor *2.
-	//!
-	//! @throw
-	//! CWin32Exception for any initialization failure.
-	//!
-	//!***************************************************************************
-	CIocpServer(
-		uint16_t port,
-		shared_ptr<CIocpHandler> iocpHandler,
-		uint32_t addressToListenOn = INADDR_ANY,
-		uint32_t rcvbufferSize = 0,
-		uint32_t numThread = 0
-		);
-
-	//!***************************************************************************
-	//! @details
-	//! Destructor
-	//! Closes down the IO completion port, as well as ending all worker thread.
-	//! All active connections will be shutdown abortively, and all outstanding 
-	//! sends are discarded. OnDisconnect callback will not be invoked if there 
-	//! are remaining connection in the IOCP server. 
-	//!
-	//! For graceful shutdown, it is the user's responsibility to ensure that 
-	//! all connections are closed gracefully prior to destroying the IOCP server.
-	//!
-	//! OnServerClosed callback will be invoked when the server exits.
-	//!
-	//!***************************************************************************
-	~CIocpServer();
-
-	//!***************************************************************************
-	//! @details
-	//! Send data to a connected client. IOCP server will automatically queue
-	//! up packets and send them in order when ready. A corresponding 
-	//! OnSentData will be called when data are sent. 
-	//!
-	//! @param[in,out] cid
-	//! The connection id to send the data to.
-	//!
-	//! @param[in,out] data
-	//! Data to send. IOCP server will use the memory as is, and will not
-	//! allocate another copy. 
-	//! 
-	//! If the function operate successfully, swap() will be called on the 
-	//! vector, and the buffer will be emptied after this function returned.
-	//!
-	//! If the function fails (exception thrown), the data will be left 
-	//! as is.
-	//!
-	//! @throw
-	//! CIocpException if connection no longer exists.
-	//!
-	//! CWin32Exception if the IOCP server failed to post this data to the
-	//! IO Completion port.
-	//!
-	//! @remark
-	//! Send should not be called on the same connection simultaneously from 
-	//! different threads, because it can result in an unpredictable send order.
-	//! If Send() must be invoked from multiple threads , user should 
-	//! implement custom critical section on top of Send() for each connection.
-	//!
-	//!***************************************************************************
-	void Send(uint64_t cid, std::vector<uint8_t> &data);
-
-	//!***************************************************************************
-	//! @details
-	//! Shutdown certain operation on the socket.
-	//!
-	//! @param[in,out] cid
-	//! The id of the connection to shut down.
-	//!
-	//! @param[in,out] how
-	//! A flag that describes what types of operation will no longer be 
-	//! allowed. Possible values for this flag are listed in the Winsock2.h 
-	//! header file.
-	//!
-	//! SD_RECEIVE - Shutdown receive operations.
-	//! SD_SEND - Shutdown send operations.
-	//! SD_BOTH - Shutdown both send and receive operations.
-	//!
-	//! @throw
-	//! CIocpException if connection no longer exists.
-	//!
-	//! CWin32Exception if the IOCP server failed to post this data to the
-	//! IO Completion port.
-	//!
-	//! @post
-	//! If the function completes successfully, the specified operation
-	//! on the socket will no longer be allowed.
-	//!
-	//! @remark
-	//! Shutdown should not be called on the same connection simultaneously from 
-	//! different threads. Otherwise, the post condition is undefined.
-	//!
-	//!***************************************************************************
-	void Shutdown(uint64_t cid, int how);
-
-	//!***************************************************************************
-	//! @details
-	//! Fully disconnect from a connected client. Once all outstanding sends
-	//! are completed, a corresponding OnDisconnect callback will be invoked.
-	//!
-	//! @throw
-	//! CIocpException if connection no longer exists.
-	//!
-	//! @param[in,out] cid
-	//! The connection to disconnect from.
-	//!
-	//! @post
-	//! If this function completes successfully, the socket will no longer
-	//! be capable of sending or receiving new data (queued data prior to 
-	//! disconnect will be sent).
-	//!
-	//! @remark
-	//! If the server is initiating the disconnect, it is recommended to call 
-	//! Shutdown(cid, SD_BOTH) and wait for OnClientDisconnected() callback prior 
-	//! to calling Disconnect(). Otherwise, it is possible OnReceiveData() callback 
-	//! to be called simultaneously with OnDisconnect() callback. After all, the 
-	//! client may simultaneously send data to this server during the 
-	//! Disconnect() call. In such scenario, you need to provide mutexes and
-	//! additional logic to ignore the last sets of packets.
-	//!
-	//! Shutdown should not be called on the same connection simultaneously from 
-	//! different threads. Otherwise, the post condition is undefined.
-	//!
-	//!***************************************************************************
-	void Disconnect(uint64_t cid);
-
-private:
-
-	class CImpl;
-	shared_ptr<CImpl> m_impl;
-};
-
-} // end namespace
-#endif // IOCPSERVER_H_2010_09_25_14_37_36
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef IOCPSERVER_H_2010_09_25_14_37_36
+#define IOCPSERVER_H_2010_09_25_14_37_36
+
+#include "Export.h"
+#include "IocpHandler.h"
+#include "ServerOptions.h"
+#include "SharedBuffer.h"
+
+//////////////////////////////////////////////////////////////////////////
+//
+// History
+// Oct. 26 2010
+// Version 1.0
+// Creation
+//
+// Dec. 10 2010 
+// Version 1.1 
+// Fixed a bug where the IOCP server stops accepting connection when
+// setsockopt() fails.
+//
+// Removed an unnecessary event per Len Holgate's suggestion.
+//
+//////////////////////////////////////////////////////////////////////////
+
+namespace iocp {
+
+class IOCPSERVER_API CIocpServer
+{
+public:
+
+	//! Status codes of the calls that take std::nothrow, besides NO_ERROR
+	//! and the system error codes. Those are all positive, so these never
+	//! collide with them.
+	enum
+	{
+		//! The connection no longer exists. The throwing calls throw 
+		//! CIocpException instead.
+		ConnectionNotFound = -100,
+
+		//! TrySend refused the data. The throwing TrySend returns false.
+		SendRefused = -101,
+	};
+	//!***************************************************************************
+	//! @details
+	//! Constructor
+	//! Upon construction, CIocpServer will bind to the indicated port 
+	//! and the provided address.
+	//!
+	//! @param[in] port
+	//! The port to listen on.
+	//!
+	//! @param[in,out] iocpHander
+	//! The handler for IOCP server events. This must be supplied, and IOCP
+	//! server will hold a shared_ptr until its destruction.
+	//!
+	//! @param[in] addressToListenOn
+	//! The IP address that the server will listen to.
+	//!
+	//! @param[in] rcvbufferSize
+	//! The buffer size for receive. 0 = default = 4096 bytes.
+	//!
+	//! @param[in] numThread
+	//! The number of IOCP threads in thread pool. 
+	//! 0 = default = Number of processor *2.
+	//!
+	//! @throw
+	//! CWin32Exception for any initialization failure.
+	//!
+	//!***************************************************************************
+	CIocpServer(
+		uint16_t port,
+		shared_ptr<CIocpHandler> iocpHandler,
+		uint32_t addressToListenOn = INADDR_ANY,
+		uint32_t rcvbufferSize = 0,
+		uint32_t numThread = 0
+		);
+
+	//!***************************************************************************
+	//! @details
+	//! Constructor
+	//! Same as above, with every tunable supplied through ServerOptions.
+	//!
+	//! @param[in] port
+	//! The port to listen on.
+	//!
+	//! @param[in,out] iocpHander
+	//! The handler for IOCP server events. This must be supplied, and IOCP
+	//! server will hold a shared_ptr until its destruction.
+	//!
+	//! @param[in] options
+	//! Server tunables. See ServerOptions.
+	//!
+	//! @throw
+	//! CWin32Exception for any initialization failure.
+	//!
+	//!***************************************************************************
+	CIocpServer(
+		uint16_t port,
+		shared_ptr<CIocpHandler> iocpHandler,
+		ServerOptions const &options
+		);
+
+	//!***************************************************************************
+	//! @details
+	//! Destructor
+	//! Closes down the IO completion port, as well as ending all worker thread.
+	//! All active connections will be shutdown abortively, and all outstanding 
+	//! sends are discarded. OnDisconnect is still invoked for each of them,
+	//! from the thread destroying the server, once the worker threads have
+	//! exited, and before OnServerClose. No other callback comes for them.
+	//!
+	//! For graceful shutdown, it is the user's responsibility to ensure that 
+	//! all connections are closed gracefully prior to destroying the IOCP server.
+	//!
+	//! OnServerClosed callback will be invoked when the server exits.
+	//!
+	//!***************************************************************************
+	~CIocpServer();
+
+	//!***************************************************************************
+	//! @details
+	//! Send data to a connected client. IOCP server will automatically queue
+	//! up packets and send them in order when ready. A corresponding 
+	//! OnSentData will be called when data are sent. 
+	//!
+	//! @param[in,out] cid
+	//! The connection id to send the data to.
+	//!
+	//! @param[in,out] data
+	//! Data to send. IOCP server will use the memory as is, and will not
+	//! allocate another copy. 
+	//! 
+	//! If the function operate successfully, swap() will be called on the 
+	//! vector, and the buffer will be emptied after this function returned.
+	//!
+	//! If the function fails (exception thrown), the data will be left 
+	//! as is.
+	//!
+	//! @throw
+	//! CIocpException if connection no longer exists.
+	//!
+	//! CWin32Exception if the IOCP server failed to post this data to the
+	//! IO Completion port.
+	//!
+	//! @remark
+	//! Send may be called on the same connection from several threads at 
+	//! once. Each connection has one send in flight at a time, and the others
+	//! wait in a lock free queue, so the data goes out in the order the 
+	//! calls were made and never interleaved.
+	//!
+	//!***************************************************************************
+	void Send(uint64_t cid, std::vector<uint8_t> &data);
+
+	//!***************************************************************************
+	//! @details
+	//! Same as Send() above, without exceptions. Meant for servers that 
+	//! often send to connections as they go away, where throwing and 
+	//! catching would cost far more than the send itself.
+	//!
+	//! The calls below that take std::nothrow all work this way.
+	//!
+	//! @return int
+	//! NO_ERROR if the data is queued. ConnectionNotFound if the 
+	//! connection no longer exists. Otherwise, the error a CWin32Exception 
+	//! would carry. The data is left as is on any error.
+	//!
+	//!***************************************************************************
+	int Send(
+		uint64_t cid, 
+		std::vector<uint8_t> &data, 
+		std::nothrow_t const &);
+
+	//!***************************************************************************
+	//! @details
+	//! Gather send. Send several buffers to a connected client as one 
+	//! message, in order, with a single WSASend (or sendmsg on Linux). A 
+	//! header and a body can then be sent from their own buffers, without
+	//! copying them into one. A single OnSentData is called with the total
+	//! size once all of them are sent.
+	//!
+	//! @param[in,out] cid
+	//! The connection id to send the data to.
+	//!
+	//! @param[in,out] buffers
+	//! Buffers to send, first to last. Empty buffers are skipped. Same as 
+	//! Send() above, the memory is used as is and the vector is emptied if
+	//! the function succeeds, and left as is if it throws. If there is no
+	//! data at all, nothing is sent, OnSentData is not called, and the 
+	//! vector is emptied.
+	//!
+	//! @throw
+	//! Same as Send() above.
+	//!
+	//!***************************************************************************
+	void Send(uint64_t cid, std::vector< std::vector<uint8_t> > &buffers);
+
+	//!***************************************************************************
+	//! @details
+	//! Same as the gather Send() above, without exceptions.
+	//!
+	//! @return int
+	//! Same as the Send() above that takes std::nothrow. The buffers are 
+	//! left as is on any error.
+	//!
+	//!***************************************************************************
+	int Send(
+		uint64_t cid, 
+		std::vector< std::vector<uint8_t> > &buffers, 
+		std::nothrow_t const &);
+
+	//!***************************************************************************
+	//! @details
+	//! Send shared data to a connected client. The data is referenced, not
+	//! copied, and the buffer can be sent again, to this or any other 
+	//! connection. Otherwise the same as Send() above.
+	//!
+	//! @param[in] cid
+	//! The connection id to send the data to.
+	//!
+	//! @param[in] data
+	//! Data to send. It is held until the send completes.
+	//!
+	//! @throw
+	//! Same as Send() above.
+	//!
+	//!***************************************************************************
+	void Send(uint64_t cid, CSharedBuffer const &data);
+
+	//!***************************************************************************
+	//! @details
+	//! Same as the Send() above with shared data, without exceptions.
+	//!
+	//! @return int
+	//! Same as the Send() above that takes std::nothrow.
+	//!
+	//!***************************************************************************
+	int Send(
+		uint64_t cid, 
+		CSharedBuffer const &data, 
+		std::nothrow_t const &);
+
+	//!***************************************************************************
+	//! @details
+	//! Send data unless the connection is over a send watermark (see 
+	//! ServerOptions::m_sendHighWatermark). A refused connection is 
+	//! reported through CIocpHandler::OnWritable once it is back under its
+	//! low watermarks, and TrySend may be called again from there. Without
+	//! watermarks, this is the same as Send().
+	//!
+	//! @param[in] cid
+	//! The connection id to send the data to.
+	//!
+	//! @param[in,out] data
+	//! Data to send. Same as Send(), except that it is also left as is if
+	//! the data is refused.
+	//!
+	//! @return bool
+	//! false if the data is refused.
+	//!
+	//! @throw
+	//! Same as Send().
+	//!
+	//!***************************************************************************
+	bool TrySend(uint64_t cid, std::vector<uint8_t> &data);
+
+	//!***************************************************************************
+	//! @details
+	//! Same as TrySend() above, with shared data.
+	//!
+	//!***************************************************************************
+	bool TrySend(uint64_t cid, CSharedBuffer const &data);
+
+	//!***************************************************************************
+	//! @details
+	//! Same as the TrySend() calls above, without exceptions.
+	//!
+	//! @return int
+	//! SendRefused if the data is refused. Otherwise, the same as the 
+	//! Send() that takes std::nothrow.
+	//!
+	//!***************************************************************************
+	int TrySend(
+		uint64_t cid, 
+		std::vector<uint8_t> &data, 
+		std::nothrow_t const &);
+
+	int TrySend(
+		uint64_t cid, 
+		CSharedBuffer const &data, 
+		std::nothrow_t const &);
+
+	//!***************************************************************************
+	//! @details
+	//! Send a message ahead of the data that waits to be sent on the 
+	//! connection, such as a heartbeat or a cancel behind bulk data. It is
+	//! never held back by ServerOptions::m_coalesceSends or 
+	//! ServerOptions::m_sendWindow, so it only follows the data already 
+	//! handed to the system, at most the send window. Messages are never 
+	//! split: it goes before or after each of the others, whole.
+	//!
+	//! @param[in] cid
+	//! The connection id to send the data to.
+	//!
+	//! @param[in,out] data
+	//! Data to send. Same as Send().
+	//!
+	//! @throw
+	//! Same as Send().
+	//!
+	//! @remark
+	//! Urgent messages keep their order among themselves, not with the 
+	//! others. Without a send window, the data handed to the system is 
+	//! every message not held back by coalescing.
+	//!
+	//!***************************************************************************
+	void SendUrgent(uint64_t cid, std::vector<uint8_t> &data);
+
+	//!***************************************************************************
+	//! @details
+	//! Same as SendUrgent() above, with shared data.
+	//!
+	//!***************************************************************************
+	void SendUrgent(uint64_t cid, CSharedBuffer const &data);
+
+	//!***************************************************************************
+	//! @details
+	//! Same as the SendUrgent() calls above, without exceptions.
+	//!
+	//! @return int
+	//! Same as the Send() that takes std::nothrow.
+	//!
+	//!***************************************************************************
+	int SendUrgent(
+		uint64_t cid, 
+		std::vector<uint8_t> &data, 
+		std::nothrow_t const &);
+
+	int SendUrgent(
+		uint64_t cid, 
+		CSharedBuffer const &data, 
+		std::nothrow_t const &);
+
+	//!***************************************************************************
+	//! @details
+	//! Send the same data to many connections. Every connection's send 
+	//! references the one copy of the data, which is freed once the last of
+	//! them completes.
+	//!
+	//! @param[in] cids
+	//! The connection ids to send the data to. Connections that no longer
+	//! exist, or fail to send, are skipped.
+	//!
+	//! @param[in] data
+	//! Data to send.
+	//!
+	//! @return uint32_t
+	//! The number of connections the data is sent to.
+	//!
+	//!***************************************************************************
+	uint32_t Send(std::vector<uint64_t> const &cids, CSharedBuffer const &data);
+
+	//!***************************************************************************
+	//! @details
+	//! Send part of a file to a connected client, straight from the file 
+	//! to the socket, with TransmitFile on Windows and sendfile (or splice,
+	//! with io_uring) on Linux. The data is never read into memory. It is 
+	//! ordered with Send the same way as any other send. OnSentData 
+	//! reports the progress, every 16 MB at most.
+	//!
+	//! @param[in] cid
+	//! The connection id to send the file to.
+	//!
+	//! @param[in] file
+	//! The file to send, a file handle on Windows and a file descriptor on
+	//! Linux. The server uses a duplicate of it, so it may be closed as 
+	//! soon as this returns. Its position is not changed.
+	//!
+	//! @param[in] offset
+	//! The position in the file of the first byte to send.
+	//!
+	//! @param[in] length
+	//! The number of bytes to send. The file must be at least offset + 
+	//! length bytes long. Nothing is sent if 0.
+	//!
+	//! @throw
+	//! CIocpException if connection no longer exists.
+	//!
+	//! CWin32Exception if the file handle could not be duplicated, or the 
+	//! IOCP server failed to post the send.
+	//!
+	//!***************************************************************************
+	void SendFile(uint64_t cid, HANDLE file, uint64_t offset, uint64_t length);
+
+	//!***************************************************************************
+	//! @details
+	//! With ServerOptions::m_coalesceSends, send the data held back on this 
+	//! connection now, rather than once the send in flight completes. 
+	//! Otherwise, this does nothing.
+	//!
+	//! @param[in] cid
+	//! The connection id to flush.
+	//!
+	//! @throw
+	//! CIocpException if connection no longer exists.
+	//!
+	//! CWin32Exception if the IOCP server failed to post the data to the
+	//! IO Completion port. The data stays held back.
+	//!
+	//!***************************************************************************
+	void Flush(uint64_t cid);
+
+	int Flush(uint64_t cid, std::nothrow_t const &);
+
+	//!***************************************************************************
+	//! @details
+	//! Shutdown certain operation on the socket.
+	//!
+	//! @param[in,out] cid
+	//! The id of the connection to shut down.
+	//!
+	//! @param[in,out] how
+	//! A flag that describes what types of operation will no longer be 
+	//! allowed. Possible values for this flag are listed in the Winsock2.h 
+	//! header file.
+	//!
+	//! SD_RECEIVE - Shutdown receive operations.
+	//! SD_SEND - Shutdown send operations.
+	//! SD_BOTH - Shutdown both send and receive operations.
+	//!
+	//! @throw
+	//! CIocpException if connection no longer exists.
+	//!
+	//! CWin32Exception if the socket failed to shut down. The sending side
+	//! waits for the sends queued before, if any, and a failure then is
+	//! not reported.
+	//!
+	//! @post
+	//! If the function completes successfully, the specified operation
+	//! on the socket will no longer be allowed. For the receiving side,
+	//! data received from then on is dropped, a receive callback already
+	//! running is the last, and OnClientDisconnect() follows. The sending 
+	//! side is closed once the sends queued before are sent.
+	//!
+	//! @remark
+	//! Shutdown should not be called on the same connection simultaneously from 
+	//! different threads. Otherwise, the post condition is undefined.
+	//!
+	//!***************************************************************************
+	void Shutdown(uint64_t cid, int how);
+
+	//!***************************************************************************
+	//! @details
+	//! Same as Shutdown() above, without exceptions.
+	//!
+	//! @return int
+	//! NO_ERROR. ConnectionNotFound if the connection no longer exists. 
+	//! Otherwise, the error a CWin32Exception would carry.
+	//!
+	//!***************************************************************************
+	int Shutdown(uint64_t cid, int how, std::nothrow_t const &);
+
+	//!***************************************************************************
+	//! @details
+	//! Fully disconnect from a connected client. Once all outstanding sends
+	//! are completed, a corresponding OnDisconnect callback will be invoked.
+	//!
+	//! @throw
+	//! CIocpException if connection no longer exists.
+	//!
+	//! @param[in,out] cid
+	//! The connection to disconnect from.
+	//!
+	//! @post
+	//! If this function completes successfully, the socket will no longer
+	//! be capable of sending or receiving new data (queued data prior to 
+	//! disconnect will be sent). Data received from then on is dropped.
+	//!
+	//! @remark
+	//! A receive callback may still be running on another thread when
+	//! Disconnect() is called. OnDisconnect() comes after it returns.
+	//!
+	//! Shutdown should not be called on the same connection simultaneously from 
+	//! different threads. Otherwise, the post condition is undefined.
+	//!
+	//!***************************************************************************
+	void Disconnect(uint64_t cid);
+
+	//!***************************************************************************
+	//! @details
+	//! Same as Disconnect() above, without exceptions.
+	//!
+	//! @return int
+	//! NO_ERROR, or ConnectionNotFound if the connection no longer exists.
+	//!
+	//!***************************************************************************
+	int Disconnect(uint64_t cid, std::nothrow_t const &);
+
+	//!***************************************************************************
+	//! @details
+	//! Disconnect from a client without waiting for the queued sends. The 
+	//! socket is shut down right away, the sends not yet out fail, and the
+	//! OnDisconnect callback follows. This is how a client that stopped
+	//! reading is dropped.
+	//!
+	//! @throw
+	//! CIocpException if connection no longer exists.
+	//!
+	//! @param[in] cid
+	//! The connection to abort.
+	//!
+	//!***************************************************************************
+	void Abort(uint64_t cid);
+
+	//!***************************************************************************
+	//! @details
+	//! Same as Abort() above, without exceptions.
+	//!
+	//! @return int
+	//! NO_ERROR, or ConnectionNotFound if the connection no longer exists.
+	//!
+	//!***************************************************************************
+	int Abort(uint64_t cid, std::nothrow_t const &);
+
+	//!***************************************************************************
+	//! @details
+	//! Change a timeout of a connection, counted from now. The ones not 
+	//! changed are those of ServerOptions until then. OnTimeout is invoked
+	//! when it passes.
+	//!
+	//! @param[in] cid
+	//! The connection.
+	//!
+	//! @param[in] timeout
+	//! The timeout to change.
+	//!
+	//! @param[in] milliseconds
+	//! The new timeout, rounded up to ServerOptions::m_timeoutResolution. 
+	//! 0 = none.
+	//!
+	//! @throw
+	//! CIocpException if connection no longer exists.
+	//!
+	//! @remark
+	//! This may be called from OnNewConnection, before the connection 
+	//! receives anything.
+	//!
+	//!***************************************************************************
+	void SetTimeout(uint64_t cid, Timeout timeout, uint32_t milliseconds);
+
+	//!***************************************************************************
+	//! @details
+	//! Same as SetTimeout() above, without exceptions.
+	//!
+	//! @return int
+	//! NO_ERROR, or ConnectionNotFound if the connection no longer exists.
+	//!
+	//!***************************************************************************
+	int SetTimeout(uint64_t cid, 
+		Timeout timeout, 
+		uint32_t milliseconds, 
+		std::nothrow_t const &);
+
+	//!***************************************************************************
+	//! @details
+	//! Look up the host name of a remote address, from a cache of the most 
+	//! recently resolved ones, or through reverse DNS.
+	//!
+	//! @param[in,out] c
+	//! The connection information given to OnNewConnection. 
+	//! m_remoteHostName is filled in.
+	//!
+	//! @return
+	//! false if the address has no name, or if ServerOptions::m_resolveHostNames
+	//! is false.
+	//!
+	//! @remark
+	//! A reverse DNS lookup may block for seconds. Avoid calling this from a
+	//! callback: it would hold up an IOCP thread, and every connection 
+	//! waiting on it.
+	//!
+	//!***************************************************************************
+	bool ResolveHostName(ConnectionInformation &c);
+
+	//!***************************************************************************
+	//! @details
+	//! Usage of the receive buffer pool shared by all connections. Useful 
+	//! to size ServerOptions::m_maxIdleRcvBuffers: buffers keep being 
+	//! allocated and discarded if it is too small.
+	//!
+	//! @return
+	//! One entry per buffer size, smallest first. There is only one unless
+	//! ServerOptions::m_minRcvBufferSize or m_maxRcvBufferSize is set.
+	//!
+	//!***************************************************************************
+	std::vector<ReceiveBufferStatistics> GetReceiveBufferStatistics();
+
+private:
+
+	class CImpl;
+	shared_ptr<CImpl> m_impl;
+};
+
+} // end namespace
+#endif // IOCPSERVER_H_2010_09_25_14_37_36
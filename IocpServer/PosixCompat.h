@@ -0,0 +1,98 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef POSIXCOMPAT_H_2026_10_18_09_12_40
+#define POSIXCOMPAT_H_2026_10_18_09_12_40
+
+//! @details
+//! The public interface and most of detail/ are written against the
+//! Winsock vocabulary (SOCKET, SD_SEND, Interlocked*, ...). This header
+//! provides the small subset of it that the library uses, so that the
+//! same code compiles on POSIX systems. Only include it through
+//! ExternalLibraries.h.
+
+typedef int SOCKET;
+typedef unsigned int DWORD;
+typedef char TCHAR;
+
+//! A file descriptor, for CIocpServer::SendFile.
+typedef int HANDLE;
+
+#define INVALID_SOCKET (-1)
+#define INVALID_HANDLE_VALUE (-1)
+#define SOCKET_ERROR (-1)
+
+#define NO_ERROR 0
+
+//! Returned by the Post* functions when the operation has been queued.
+//! errno values are always positive, so this cannot collide.
+#define WSA_IO_PENDING (-1)
+
+#define SD_RECEIVE SHUT_RD
+#define SD_SEND SHUT_WR
+#define SD_BOTH SHUT_RDWR
+
+#define WSAENOBUFS ENOBUFS
+
+//! Waits without a timeout, and the result of one that timed out. 
+//! ETIMEDOUT cannot be returned by a wait for any other reason.
+#define INFINITE 0xFFFFFFFF
+#define WAIT_TIMEOUT ETIMEDOUT
+
+#define _T(x) x
+
+//! @remark
+//! The field order differs from Winsock on purpose. This layout matches
+//! struct iovec, so an array of WSABUF can be handed to writev/sendmsg.
+struct WSABUF
+{
+	char *buf;
+	size_t len;
+};
+
+inline int closesocket(SOCKET s)
+{
+	return ::close(s);
+}
+
+inline int WSAGetLastError()
+{
+	return errno;
+}
+
+inline int GetLastError()
+{
+	return errno;
+}
+
+inline long InterlockedIncrement(long volatile *addend)
+{
+	return __sync_add_and_fetch(addend, 1);
+}
+
+inline long InterlockedDecrement(long volatile *addend)
+{
+	return __sync_sub_and_fetch(addend, 1);
+}
+
+inline long InterlockedExchange(long volatile *target, long value)
+{
+	return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+}
+
+inline long InterlockedExchangeAdd(long volatile *addend, long value)
+{
+	return __sync_fetch_and_add(addend, value);
+}
+
+inline long InterlockedCompareExchange(
+	long volatile *destination,
+	long exchange,
+	long comparand)
+{
+	return __sync_val_compare_and_swap(destination, comparand, exchange);
+}
+
+#endif // POSIXCOMPAT_H_2026_10_18_09_12_40
@@ -0,0 +1,35 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#include "StdAfx.h"
+#include "ReceiveBuffer.h"
+
+#include "detail/BufferPool.h"
+
+namespace iocp {
+
+CReceiveBuffer::CReceiveBuffer(std::vector<uint8_t> &buffer, 
+							   detail::CBufferPool &pool)
+: m_buffer(buffer)
+, m_pool(pool)
+{
+}
+
+std::vector<uint8_t> const & CReceiveBuffer::GetData() const
+{
+	return m_buffer;
+}
+
+void CReceiveBuffer::TakeOwnership( std::vector<uint8_t> &data )
+{
+	data.clear();
+	data.swap(m_buffer);
+
+	// Whatever the vector held before goes to the pool, or away. The
+	// receive context gets a new buffer on its next receive.
+	m_pool.Put(m_buffer);
+}
+
+} // end namespace
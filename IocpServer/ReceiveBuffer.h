@@ -0,0 +1,94 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef RECEIVEBUFFER_H_2026_10_18_16_28_50
+#define RECEIVEBUFFER_H_2026_10_18_16_28_50
+
+namespace iocp { namespace detail { class CBufferPool; } };
+namespace iocp { namespace detail { class CWorkerThread; } };
+
+namespace iocp {
+
+//! @details
+//! Usage of one size of buffer in the server's receive buffer pool. See 
+//! CIocpServer::GetReceiveBufferStatistics. The counters of each thread 
+//! are added up every few dozen buffers, so they lag slightly.
+class ReceiveBufferStatistics
+{
+public:
+	ReceiveBufferStatistics()
+		: m_bufferSize(0)
+		, m_numAllocated(0)
+		, m_numReused(0)
+		, m_numDiscarded(0)
+		, m_numIdle(0)
+		, m_maxIdle(0)
+	{
+
+	}
+
+	//! The size of each buffer.
+	uint32_t m_bufferSize;
+
+	//! Buffers allocated because the pool was empty.
+	uint64_t m_numAllocated;
+
+	//! Buffers served from the pool.
+	uint64_t m_numReused;
+
+	//! Buffers freed because the pool was full.
+	uint64_t m_numDiscarded;
+
+	//! Buffers in the pool right now, not counting the few cached by each
+	//! thread.
+	uint64_t m_numIdle;
+
+	//! ServerOptions::m_maxIdleRcvBuffers.
+	uint64_t m_maxIdle;
+};
+
+//! @details
+//! The data of one receive, as handed to CIocpHandler::OnReceiveBuffer. 
+//! This is a view over the server's own receive buffer: nothing is 
+//! copied to build it, and it is only valid during the callback.
+//!
+//! To keep the data, take the buffer over instead of copying it. The 
+//! server puts a spare buffer in its place for the next receive.
+class IOCPSERVER_API CReceiveBuffer : boost::noncopyable
+{
+public:
+
+	//!***************************************************************************
+	//! @details
+	//! The received data. Empty once the buffer has been taken over.
+	//!
+	//!***************************************************************************
+	std::vector<uint8_t> const &GetData() const;
+
+	//!***************************************************************************
+	//! @details
+	//! Take the received data over without copying it. The vector can be
+	//! kept for as long as needed, or given to CIocpServer::Send as is.
+	//!
+	//! @param[out] data
+	//! Receives the buffer. It holds exactly the received bytes. Whatever
+	//! it held before is discarded.
+	//!
+	//!***************************************************************************
+	void TakeOwnership(std::vector<uint8_t> &data);
+
+private:
+
+	friend class detail::CWorkerThread;
+
+	CReceiveBuffer(std::vector<uint8_t> &buffer, detail::CBufferPool &pool);
+
+	std::vector<uint8_t> &m_buffer;
+
+	detail::CBufferPool &m_pool;
+};
+
+} // end namespace
+#endif // RECEIVEBUFFER_H_2026_10_18_16_28_50
@@ -0,0 +1,189 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef SERVEROPTIONS_H_2026_10_18_13_21_07
+#define SERVEROPTIONS_H_2026_10_18_13_21_07
+
+namespace iocp {
+
+	//! @details
+	//! Tunables for CIocpServer. Default constructed options give the same
+	//! server as CIocpServer(port, handler).
+	class ServerOptions
+	{
+	public:
+
+		enum Engine
+		{
+			//! IO completion port on Windows, epoll on Linux.
+			DefaultEngine,
+
+			//! Linux only. Readiness based, see detail/EpollPort.h.
+			EpollEngine,
+
+			//! Linux only. Completion based, see detail/UringPort.h.
+			//! Falls back to epoll if the kernel does not support io_uring.
+			UringEngine,
+		};
+
+		ServerOptions()
+			: m_addressToListenOn(INADDR_ANY)
+			, m_rcvBufferSize(0)
+			, m_numThread(0)
+			, m_engine(DefaultEngine)
+			, m_uringMultishot(false)
+			, m_numShards(0)
+			, m_numAccepts(0)
+			, m_resolveHostNames(true)
+			, m_hostNameCacheSize(0)
+			, m_maxIdleRcvBuffers(0)
+			, m_zeroByteReceive(false)
+			, m_minRcvBufferSize(0)
+			, m_maxRcvBufferSize(0)
+			, m_coalesceSends(false)
+			, m_sendHighWatermark(0)
+			, m_sendLowWatermark(0)
+			, m_globalSendHighWatermark(0)
+			, m_globalSendLowWatermark(0)
+			, m_zeroCopyThreshold(0)
+			, m_sendWindow(0)
+			, m_idleTimeout(0)
+			, m_readTimeout(0)
+			, m_writeTimeout(0)
+			, m_timeoutResolution(0)
+		{
+
+		}
+
+		//! The IP address that the server will listen to.
+		uint32_t m_addressToListenOn;
+
+		//! The buffer size for receive. 0 = default = 4096 bytes.
+		uint32_t m_rcvBufferSize;
+
+		//! The number of IOCP threads in thread pool.
+		//! 0 = default = Number of processor *2.
+		uint32_t m_numThread;
+
+		//! The completion engine. Ignored on Windows.
+		Engine m_engine;
+
+		//! io_uring only, Linux 6.0 or later. Keep one multishot accept 
+		//! armed on the listen socket and one multishot receive armed per
+		//! connection, instead of posting a new request after every 
+		//! completion. Data is received into buffers owned by the server, 
+		//! each m_rcvBufferSize bytes, and the buffer is handed to 
+		//! OnReceiveData as is.
+		bool m_uringMultishot;
+
+		//! Linux only. 0 = default = one engine shared by m_numThread 
+		//! threads. Otherwise, run this many independent shards, typically 
+		//! one per processor. Each shard has one thread pinned to its own 
+		//! processor, its own SO_REUSEPORT listen socket, engine, connection 
+		//! table, receive buffer pool and send context pool, so a connection
+		//! is handled by one processor from accept to disconnect. 
+		//! m_numThread is ignored. At most 65536, the server fails to start
+		//! with EINVAL otherwise.
+		uint32_t m_numShards;
+
+		//! The number of accepts kept outstanding on the listen socket, per 
+		//! shard. 0 = default = one per IOCP thread. On Windows, each one 
+		//! holds a socket created ahead of the connection. On Linux, this 
+		//! is how many connections are taken off the backlog per wake up.
+		//! Raise it for servers that see bursts of new connections.
+		uint32_t m_numAccepts;
+
+		//! Allow CIocpServer::ResolveHostName. When false, no reverse DNS 
+		//! lookup is ever made and m_remoteHostName is always empty.
+		bool m_resolveHostNames;
+
+		//! The number of resolved addresses kept, least recently used 
+		//! first out. 0 = default = 1024.
+		uint32_t m_hostNameCacheSize;
+
+		//! Receive buffers come from a pool shared by all connections, and 
+		//! a connection only holds one while it is receiving. This is the 
+		//! number of unused buffers the pool keeps, beyond a few per thread.
+		//! With m_numShards, each shard's pool keeps its share of them.
+		//! 0 = default = 1024.
+		uint32_t m_maxIdleRcvBuffers;
+
+		//! Wait for data with a zero byte read (Windows) or a poll 
+		//! (io_uring) that holds no buffer, and only then read it into a 
+		//! receive buffer. Idle connections then hold no receive buffer at 
+		//! all, at the cost of one more completion per read. Meant for 
+		//! large numbers of mostly idle connections. epoll and multishot 
+		//! io_uring always work this way.
+		bool m_zeroByteReceive;
+
+		//! Bounds of the receive size of each connection. Every connection 
+		//! starts reading m_rcvBufferSize bytes at a time. A connection 
+		//! that fills its buffer reads twice as much the next time; one 
+		//! that keeps using a small part of it reads half as much. Buffers 
+		//! come from a pool per size, doubling from m_minRcvBufferSize. 
+		//! 0 = default = m_rcvBufferSize, that is, a fixed size. Ignored 
+		//! with m_uringMultishot, whose buffers are all m_rcvBufferSize.
+		uint32_t m_minRcvBufferSize;
+		uint32_t m_maxRcvBufferSize;
+
+		//! Coalesce small sends. While a send is in flight on a connection,
+		//! further sends are held back and go out together, in one gather 
+		//! send, when it completes or on CIocpServer::Flush. This saves a 
+		//! system call and a completion per send, but OnSentData is then 
+		//! called once per batch, with the total size.
+		bool m_coalesceSends;
+
+		//! Send backpressure, in bytes queued and not yet sent, per 
+		//! connection and over the whole server. Once either count reaches
+		//! its high watermark, CIocpServer::TrySend refuses more data for 
+		//! the connection, until both are back down to their low watermark
+		//! and CIocpHandler::OnWritable is called. Send is never refused.
+		//! High watermark 0 = default = no limit. Low watermark 0 = 
+		//! default = half of the high watermark.
+		uint64_t m_sendHighWatermark;
+		uint64_t m_sendLowWatermark;
+		uint64_t m_globalSendHighWatermark;
+		uint64_t m_globalSendLowWatermark;
+
+		//! Linux only. Sends of at least this many bytes go out without 
+		//! the kernel copying them (MSG_ZEROCOPY with epoll, a zero-copy 
+		//! send with io_uring, Linux 6.0 or later). Their completion, and
+		//! OnSentData, then waits until the kernel is done with the buffer,
+		//! which is usually once the peer acknowledges the data. Pinning 
+		//! the pages costs more than copying small buffers; measure with 
+		//! Benchmark/ZeroCopyBenchmark, typically tens of KB and up. Over
+		//! loopback the kernel copies anyway. 0 = default = never.
+		uint32_t m_zeroCopyThreshold;
+
+		//! The most bytes of Send and SendFile data in flight per 
+		//! connection, that is, handed to the system and not completed. 
+		//! The rest waits in the server, in order. CIocpServer::SendUrgent 
+		//! data skips that wait, so it is sent after at most this much 
+		//! (or one message, if larger; a file counts as one). Without a 
+		//! window, it only skips data held back by m_coalesceSends. A 
+		//! window of a few times the socket send buffer keeps bulk 
+		//! connections busy. 0 = default = no limit.
+		uint32_t m_sendWindow;
+
+		//! Deadlines of every connection, in milliseconds, from its 
+		//! accept on. See Timeout for what each one watches. Once one 
+		//! passes, CIocpHandler::OnTimeout is called, which disconnects 
+		//! unless overridden, and the deadline is not reported again until
+		//! the connection is active again. CIocpServer::SetTimeout changes
+		//! them per connection. 0 = default = none.
+		uint32_t m_idleTimeout;
+		uint32_t m_readTimeout;
+		uint32_t m_writeTimeout;
+
+		//! The length of a tick of the connection timers, in milliseconds.
+		//! Deadlines are counted in whole ticks, and reported up to a tick
+		//! late. While any is set, the IOCP threads wake up once per tick.
+		//! 0 = default = 100.
+		uint32_t m_timeoutResolution;
+	};
+
+} // end namespace
+
+#endif // SERVEROPTIONS_H_2026_10_18_13_21_07
@@ -0,0 +1,38 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#include "StdAfx.h"
+#include "SharedBuffer.h"
+
+namespace iocp {
+
+namespace {
+
+	std::vector<uint8_t> const g_noData;
+}
+
+CSharedBuffer::CSharedBuffer()
+{
+}
+
+CSharedBuffer::CSharedBuffer( std::vector<uint8_t> &data )
+{
+	shared_ptr< std::vector<uint8_t> > sharedData(new std::vector<uint8_t>);
+	sharedData->swap(data);
+
+	m_data = sharedData;
+}
+
+std::vector<uint8_t> const & CSharedBuffer::GetData() const
+{
+	return m_data != NULL ? *m_data : g_noData;
+}
+
+bool CSharedBuffer::IsEmpty() const
+{
+	return m_data == NULL || m_data->empty();
+}
+
+} // end namespace
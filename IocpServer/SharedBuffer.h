@@ -0,0 +1,45 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef SHAREDBUFFER_H_2026_10_18_19_02_14
+#define SHAREDBUFFER_H_2026_10_18_19_02_14
+
+namespace iocp {
+
+//! @details
+//! Data that can be sent to any number of connections without being 
+//! copied, see CIocpServer::Send. The data cannot change once the buffer
+//! is built. Copies of a CSharedBuffer refer to the same data, and every 
+//! send in progress holds a copy; the data is freed when the last one
+//! goes away.
+class IOCPSERVER_API CSharedBuffer
+{
+public:
+
+	//! An empty buffer.
+	CSharedBuffer();
+
+	//!***************************************************************************
+	//! @details
+	//! Take the data over without copying it.
+	//!
+	//! @param[in,out] data
+	//! The data to share. swap() is called on the vector, so it is empty 
+	//! afterwards.
+	//!
+	//!***************************************************************************
+	explicit CSharedBuffer(std::vector<uint8_t> &data);
+
+	std::vector<uint8_t> const &GetData() const;
+
+	bool IsEmpty() const;
+
+private:
+
+	shared_ptr< std::vector<uint8_t> const > m_data;
+};
+
+} // end namespace
+#endif // SHAREDBUFFER_H_2026_10_18_19_02_14
@@ -0,0 +1,31 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef TIMEOUT_H_2026_10_19_09_40_18
+#define TIMEOUT_H_2026_10_19_09_40_18
+
+namespace iocp {
+
+	//! @details
+	//! The deadlines the server keeps for each connection. See 
+	//! ServerOptions::m_idleTimeout, CIocpServer::SetTimeout and 
+	//! CIocpHandler::OnTimeout.
+	enum Timeout
+	{
+		//! Nothing received, and no send completed, for that long.
+		IdleTimeout,
+
+		//! Nothing received for that long.
+		ReadTimeout,
+
+		//! Sends outstanding, and none completed, for that long.
+		WriteTimeout,
+
+		NumTimeouts,
+	};
+
+} // end namespace
+
+#endif // TIMEOUT_H_2026_10_19_09_40_18
@@ -0,0 +1,237 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#include "StdAfx.h"
+#include "BufferPool.h"
+#include "IocpContext.h"
+
+namespace iocp { namespace detail {
+
+CBufferPool::CClassCache::CClassCache()
+: m_numReused(0)
+, m_numAllocated(0)
+{
+}
+
+CBufferPool::CSizeClass::CSizeClass(uint32_t bufferSize)
+: m_bufferSize(bufferSize)
+, m_numReused(0)
+, m_numAllocated(0)
+, m_numDiscarded(0)
+{
+}
+
+CBufferPool::CBufferPool(uint32_t minBufferSize, 
+						 uint32_t maxBufferSize, 
+						 uint32_t maxIdle)
+: m_maxIdle(maxIdle)
+{
+	assert(minBufferSize > 0);
+	assert(minBufferSize <= maxBufferSize);
+
+	// Doubling from the smallest, and the largest exactly.
+	uint32_t bufferSize = minBufferSize;
+	while(bufferSize < maxBufferSize)
+	{
+		m_classes.push_back(CSizeClass(bufferSize));
+
+		if(bufferSize > maxBufferSize / 2)
+		{
+			break;
+		}
+		bufferSize *= 2;
+	}
+	m_classes.push_back(CSizeClass(maxBufferSize));
+
+	// Never grown, so the buffers are not copied around.
+	for(size_t i = 0; i < m_classes.size(); ++i)
+	{
+		m_classes[i].m_depot.reserve(m_maxIdle);
+	}
+}
+
+CBufferPool::~CBufferPool()
+{
+}
+
+uint32_t CBufferPool::GetClassSize(uint32_t bufferSize) const
+{
+	return m_classes[GetClassIndex(bufferSize)].m_bufferSize;
+}
+
+void CBufferPool::Get(std::vector<uint8_t> &buffer, uint32_t bufferSize)
+{
+	size_t index = GetClassIndex(bufferSize);
+	CSizeClass &sizeClass = m_classes[index];
+	CClassCache &cache = GetThreadCache()[index];
+
+	if(true == cache.m_buffers.empty())
+	{
+		mutex::scoped_lock l(m_mutex);
+
+		FoldCounters(sizeClass, cache);
+
+		// Refill half of the cache, so that the next few calls stay away 
+		// from the depot whether they get or put.
+		size_t count = (std::min)(
+			sizeClass.m_depot.size(), 
+			static_cast<size_t>(ThreadCacheSize / 2));
+
+		for(size_t i = 0; i < count; ++i)
+		{
+			cache.m_buffers.push_back(std::vector<uint8_t>());
+			cache.m_buffers.back().swap(sizeClass.m_depot.back());
+			sizeClass.m_depot.pop_back();
+		}
+	}
+
+	if(true == cache.m_buffers.empty())
+	{
+		++cache.m_numAllocated;
+
+		std::vector<uint8_t> fresh(sizeClass.m_bufferSize);
+		buffer.swap(fresh);
+		return;
+	}
+
+	++cache.m_numReused;
+
+	buffer.swap(cache.m_buffers.back());
+	cache.m_buffers.pop_back();
+
+	buffer.resize(sizeClass.m_bufferSize);
+}
+
+void CBufferPool::Put(std::vector<uint8_t> &buffer)
+{
+	std::vector<uint8_t> spare;
+	spare.swap(buffer);
+
+	if( spare.capacity() < m_classes.front().m_bufferSize ||
+		spare.capacity() > m_classes.back().m_bufferSize * MaxSizeRatio )
+	{
+		return;
+	}
+
+	// The largest class that fits in the buffer.
+	size_t index = m_classes.size() - 1;
+	while(m_classes[index].m_bufferSize > spare.capacity())
+	{
+		--index;
+	}
+
+	CClassCache &cache = GetThreadCache()[index];
+
+	if(cache.m_buffers.size() >= ThreadCacheSize)
+	{
+		Spill(index, cache, ThreadCacheSize / 2);
+	}
+
+	// Swapped in, so only the vector header is copied.
+	cache.m_buffers.push_back(std::vector<uint8_t>());
+	cache.m_buffers.back().swap(spare);
+}
+
+void CBufferPool::Bind(CIocpContext &rcvContext)
+{
+	if(true == rcvContext.m_data.empty())
+	{
+		Get(rcvContext.m_data, rcvContext.m_rcvBufferSize);
+		rcvContext.ResetWsaBuf();
+	}
+}
+
+void CBufferPool::Release(CIocpContext &rcvContext)
+{
+	Put(rcvContext.m_data);
+	rcvContext.ResetWsaBuf();
+}
+
+void CBufferPool::FlushThreadCache()
+{
+	ThreadCache_t &caches = GetThreadCache();
+	for(size_t i = 0; i < caches.size(); ++i)
+	{
+		Spill(i, caches[i], caches[i].m_buffers.size());
+	}
+}
+
+std::vector<ReceiveBufferStatistics> CBufferPool::GetStatistics()
+{
+	std::vector<ReceiveBufferStatistics> stats(m_classes.size());
+
+	mutex::scoped_lock l(m_mutex);
+
+	for(size_t i = 0; i < m_classes.size(); ++i)
+	{
+		stats[i].m_bufferSize = m_classes[i].m_bufferSize;
+		stats[i].m_numAllocated = m_classes[i].m_numAllocated;
+		stats[i].m_numReused = m_classes[i].m_numReused;
+		stats[i].m_numDiscarded = m_classes[i].m_numDiscarded;
+		stats[i].m_numIdle = m_classes[i].m_depot.size();
+		stats[i].m_maxIdle = m_maxIdle;
+	}
+
+	return stats;
+}
+
+CBufferPool::ThreadCache_t & CBufferPool::GetThreadCache()
+{
+	ThreadCache_t *caches = m_threadCache.get();
+	if(NULL == caches)
+	{
+		caches = new ThreadCache_t(m_classes.size());
+		m_threadCache.reset(caches);
+	}
+
+	return *caches;
+}
+
+size_t CBufferPool::GetClassIndex(uint32_t bufferSize) const
+{
+	size_t index = 0;
+	while( index + 1 < m_classes.size() &&
+		   m_classes[index].m_bufferSize < bufferSize )
+	{
+		++index;
+	}
+
+	return index;
+}
+
+void CBufferPool::FoldCounters(CSizeClass &sizeClass, CClassCache &cache)
+{
+	sizeClass.m_numReused += cache.m_numReused;
+	sizeClass.m_numAllocated += cache.m_numAllocated;
+
+	cache.m_numReused = 0;
+	cache.m_numAllocated = 0;
+}
+
+void CBufferPool::Spill(size_t index, CClassCache &cache, size_t count)
+{
+	CSizeClass &sizeClass = m_classes[index];
+
+	mutex::scoped_lock l(m_mutex);
+
+	FoldCounters(sizeClass, cache);
+
+	for(size_t i = 0; i < count; ++i)
+	{
+		if(sizeClass.m_depot.size() < m_maxIdle)
+		{
+			sizeClass.m_depot.push_back(std::vector<uint8_t>());
+			sizeClass.m_depot.back().swap(cache.m_buffers.back());
+		}
+		else
+		{
+			++sizeClass.m_numDiscarded;
+		}
+
+		cache.m_buffers.pop_back();
+	}
+}
+
+} } // end namespace
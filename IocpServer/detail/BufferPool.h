@@ -0,0 +1,131 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef BUFFERPOOL_H_2026_10_18_16_31_09
+#define BUFFERPOOL_H_2026_10_18_16_31_09
+
+#include "../ReceiveBuffer.h"
+
+namespace iocp { namespace detail { class CIocpContext; } };
+
+namespace iocp { namespace detail {
+
+//! @details
+//! Receive buffers shared by every connection of the server. A connection
+//! only holds one while a receive is outstanding on it, or while the data
+//! is delivered, so idle connections cost no buffer memory.
+//!
+//! Buffers come in size classes, doubling from the smallest receive size
+//! to the largest, so that connections reading at different sizes do not
+//! waste each other's buffers. Each class is pooled separately.
+//!
+//! Each thread keeps a small cache of buffers per class and only goes to
+//! the shared depot, under its lock, to refill or spill half of it at a 
+//! time. The buffers of completed sends come back here too, so a server 
+//! that sends what it receives allocates nothing once the pool is warm.
+class CBufferPool : boost::noncopyable
+{
+public:
+
+	enum 
+	{ 
+		//! Buffers kept by each thread, per size class.
+		ThreadCacheSize = 64,
+
+		//! Buffers bigger than this many times the largest class are not
+		//! kept.
+		MaxSizeRatio = 4,
+	};
+
+	//! maxIdle is the number of buffers kept in the depot of each class.
+	//! The thread caches hold up to ThreadCacheSize more each.
+	CBufferPool(uint32_t minBufferSize, 
+		uint32_t maxBufferSize, 
+		uint32_t maxIdle);
+
+	~CBufferPool();
+
+	//! The size class that holds bufferSize bytes, clamped to the
+	//! smallest and largest class.
+	uint32_t GetClassSize(uint32_t bufferSize) const;
+
+	//! The vector gets a buffer of GetClassSize(bufferSize) bytes.
+	//! Whatever it held before is discarded.
+	void Get(std::vector<uint8_t> &buffer, uint32_t bufferSize);
+
+	//! Take the vector's memory into the largest class it can hold, if it
+	//! is suitable and the pool is not full. The vector is empty 
+	//! afterwards either way.
+	void Put(std::vector<uint8_t> &buffer);
+
+	//! Give a receive context a buffer of its m_rcvBufferSize, if it has 
+	//! none.
+	void Bind(CIocpContext &rcvContext);
+
+	//! Take the receive context's buffer back.
+	void Release(CIocpContext &rcvContext);
+
+	//! Move the calling thread's cache into the depot. Threads call this
+	//! before they exit; otherwise, their cache is freed with them.
+	void FlushThreadCache();
+
+	//! One per size class, smallest first.
+	std::vector<ReceiveBufferStatistics> GetStatistics();
+
+private:
+
+	typedef std::vector< 
+		std::vector<uint8_t> 
+	> BufferList_t;
+
+	//! A thread's cache of one size class.
+	struct CClassCache
+	{
+		CClassCache();
+
+		BufferList_t m_buffers;
+
+		//! folded into the class's counters whenever the depot is visited
+		uint64_t m_numReused;
+		uint64_t m_numAllocated;
+	};
+
+	typedef std::vector<CClassCache> ThreadCache_t;
+
+	struct CSizeClass
+	{
+		CSizeClass(uint32_t bufferSize);
+
+		uint32_t m_bufferSize;
+
+		BufferList_t m_depot;
+
+		uint64_t m_numReused;
+		uint64_t m_numAllocated;
+		uint64_t m_numDiscarded;
+	};
+
+	ThreadCache_t &GetThreadCache();
+
+	size_t GetClassIndex(uint32_t bufferSize) const;
+
+	//! m_mutex must be held.
+	void FoldCounters(CSizeClass &sizeClass, CClassCache &cache);
+
+	//! Move up to count buffers from the cache to the depot.
+	void Spill(size_t index, CClassCache &cache, size_t count);
+
+	size_t m_maxIdle;
+
+	thread_specific_ptr<ThreadCache_t> m_threadCache;
+
+	//! Guards the depots and counters of every class.
+	mutex m_mutex;
+
+	std::vector<CSizeClass> m_classes;
+};
+
+} } // end namespace
+#endif // BUFFERPOOL_H_2026_10_18_16_31_09
@@ -0,0 +1,106 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef COMPLETIONPORT_H_2026_10_18_13_05_31
+#define COMPLETIONPORT_H_2026_10_18_13_05_31
+
+namespace iocp { namespace detail { class CIocpContext; } };
+namespace iocp { namespace detail { class CConnection; } };
+
+namespace iocp { namespace detail {
+
+//! @details
+//! The completion engine behind the worker threads on POSIX. An engine
+//! turns the contexts posted by the server into completion packets, the
+//! same way an IO completion port does on Windows. See CEpollPort and
+//! CUringPort.
+class CCompletionPort : boost::noncopyable
+{
+public:
+
+	//! The equivalent of what GetQueuedCompletionStatus returns. A NULL
+	//! context asks the worker thread to exit.
+	struct Packet
+	{
+		Packet(CIocpContext *context, 
+			DWORD bytesTransferred, 
+			std::vector<uint8_t> *buffer = NULL)
+			: m_context(context)
+			, m_bytesTransferred(bytesTransferred)
+			, m_buffer(buffer)
+		{
+		}
+
+		CIocpContext *m_context;
+		DWORD m_bytesTransferred;
+
+		//! Receive completions only. When set, the data was received into
+		//! this engine owned buffer rather than the context's m_data.
+		std::vector<uint8_t> *m_buffer;
+	};
+
+	typedef std::vector<Packet> PacketList_t;
+
+	virtual ~CCompletionPort() {}
+
+	//! Create the kernel objects behind the port. Returns NO_ERROR or errno.
+	virtual int Create() = 0;
+
+	//! Release the kernel objects. All worker threads must be gone.
+	virtual void Close() = 0;
+
+	//! Register a socket with the port, for its connection, or NULL for 
+	//! the listen socket.
+	virtual int Associate(SOCKET s, CConnection *c) = 0;
+
+	//! Wait for the next connection on the listen socket. Several accept
+	//! contexts may be posted at once; each one completes with its own
+	//! accepted socket in m_socket.
+	virtual int PostAccept(CIocpContext &acceptContext) = 0;
+
+	//! Wait for data on the connection's receive context.
+	//! Returns WSA_IO_PENDING on success.
+	virtual int PostRecv(CConnection &c) = 0;
+
+	//! Send the context after all the sends queued ahead of it.
+	//! Returns WSA_IO_PENDING on success.
+	virtual int PostSend(CConnection &c, CIocpContext &sendContext) = 0;
+
+	//! Queue a completion packet directly.
+	virtual void PostCompletion(CIocpContext *context, DWORD bytesTransferred) = 0;
+
+	//! Block until at least one completion packet is available, or for
+	//! timeout milliseconds at most (INFINITE = no limit). Returns 
+	//! NO_ERROR, WAIT_TIMEOUT if there is no packet, possibly before the
+	//! timeout, or errno.
+	virtual int GetQueuedCompletions(PacketList_t &packets, DWORD timeout) = 0;
+
+	//! Give a Packet::m_buffer back to the engine once the handler is done
+	//! with it.
+	virtual void RecycleBuffer(std::vector<uint8_t> *buffer)
+	{
+		assert(false);
+	}
+
+	//! Engines that can complete several receives on the same connection
+	//! at once hand them out one at a time. After a packet with m_buffer
+	//! is processed, the worker thread calls this until it returns false
+	//! to deliver the ones that completed meanwhile, in order.
+	virtual bool NextReceive(CConnection &c, Packet &packet)
+	{
+		return false;
+	}
+
+	//! Engines that set themselves as CConnection::m_completionPort get the
+	//! connection here once its last reference is gone, instead of it 
+	//! being deleted, to free it when no thread can reach it any more.
+	virtual void Retire(CConnection *c)
+	{
+		assert(false);
+	}
+};
+
+} } // end namespace
+#endif // COMPLETIONPORT_H_2026_10_18_13_05_31
@@ -1,77 +1,275 @@
-//! Copyright Alan Ning 2010
-//! Distributed under the Boost Software License, Version 1.0.
-//! (See accompanying file LICENSE_1_0.txt or copy at
-//! http://www.boost.org/LICENSE_1_0.txt)
-
-#include "StdAfx.h"
-#include "Connection.h"
-#include "IocpContext.h"
-
-// Using "this" ptr in initializer list. Yes, it is safe..
-#pragma warning(disable : 4355)
-
-namespace iocp { namespace detail {
-
-CConnection::CConnection(SOCKET socket, uint64_t cid, uint32_t rcvBufferSize)
-: m_socket(socket)
-, m_id(cid)
-, m_disconnectPending(false)
-, m_sendClosePending(false)
-, m_rcvClosed(false)
-, m_rcvContext(m_socket, m_id, CIocpContext::Rcv, rcvBufferSize)
-, m_disconnectContext(m_socket, m_id, CIocpContext::Disconnect, 0)
-{
-	
-}
-
-CConnection::~CConnection()
-{
-	closesocket(m_socket);
-}
-
-shared_ptr<CIocpContext> CConnection::CreateSendContext()
-{
-	shared_ptr<CIocpContext> c (new CIocpContext(
-		m_socket, 
-		m_id, 
-		CIocpContext::Send,
-		0)
-		);
-
-	m_sendQueue.AddSendContext(c);
-
-	return c;
-}
-
-bool CConnection::HasOutstandingContext()
-{
-
-	if(::InterlockedExchangeAdd(&m_rcvClosed, 0) == 0)
-	{
-		return true;
-	}
-
-	if(m_sendQueue.NumOutstandingContext() > 0)
-	{
-		return true;
-	}
-
-	return false;
-}
-
-
-bool CConnection::CloseRcvContext()
-{
-	if (0 == ::InterlockedExchange(&m_rcvClosed, 1))
-	{
-		if(INVALID_HANDLE_VALUE != m_rcvContext.hEvent )
-		{
-			CloseHandle(m_rcvContext.hEvent);
-			m_rcvContext.hEvent = INVALID_HANDLE_VALUE;
-		}
-		return true;
-	}
-
-	return false;
-}
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#include "StdAfx.h"
+#include "Connection.h"
+#include "IocpContext.h"
+
+// Using "this" ptr in initializer list. Yes, it is safe..
+#if defined(_MSC_VER)
+#pragma warning(disable : 4355)
+#endif
+
+namespace iocp { namespace detail {
+
+CConnection::CConnection(SOCKET socket, uint64_t cid, uint32_t rcvBufferSize)
+: m_socket(socket)
+, m_id(cid)
+, m_userContext(NULL)
+, m_refCount(0)
+, m_disconnectPending(false)
+, m_sendClosePending(false)
+, m_rcvClosed(false)
+, m_rcvShutdown(false)
+, m_rcvContext(m_socket, m_id, CIocpContext::Rcv, rcvBufferSize)
+, m_numSmallReceives(0)
+, m_disconnectContext(m_socket, m_id, CIocpContext::Disconnect, 0)
+, m_pendingShutdown(-1)
+, m_sendBatch(NULL)
+, m_numBytesQueued(0)
+, m_writeBlocked(0)
+, m_numBytesInWindow(0)
+, m_numTimeoutsReporting(0)
+, m_timersStopped(false)
+, m_disconnectDeferred(false)
+, m_lastReceive(0)
+, m_lastSend(0)
+#if !defined(_WIN32)
+, m_rcvPosted(false)
+, m_pollEvents(0)
+, m_rcvDelivering(false)
+, m_zeroCopy(0)
+, m_zeroCopySeq(0)
+#endif
+{
+	m_rcvContext.m_connection = this;
+	m_timer.m_owner = this;
+
+	for(uint32_t i = 0; i < NumTimeouts; ++i)
+	{
+		m_timeouts[i] = 0;
+		m_timeoutStarts[i] = 0;
+		m_timedOut[i] = 0;
+	}
+}
+
+CConnection::~CConnection()
+{
+	delete m_sendBatch;
+
+	while(false == m_windowedSends.empty())
+	{
+		CIocpContext *sendContext = m_windowedSends.front().m_first;
+		for(uint32_t i = 0; i < m_windowedSends.front().m_numContexts; ++i)
+		{
+			CIocpContext *next = sendContext->Next();
+			delete sendContext;
+			sendContext = next;
+		}
+		m_windowedSends.pop_front();
+	}
+
+	closesocket(m_socket);
+}
+
+CIocpContext * CConnection::CreateSendContext(CContextPool &contextPool)
+{
+	CIocpContext *sendContext = contextPool.Get(m_socket, m_id);
+	sendContext->m_connection = this;
+	return sendContext;
+}
+
+void CConnection::AddToSendBatch(std::vector<uint8_t> &data, 
+								 CContextPool &contextPool)
+{
+	// There is a send in flight, so the connection is not disconnected 
+	// before the batch goes out.
+	if(NULL == m_sendBatch)
+	{
+		m_sendBatch = CreateSendContext(contextPool);
+	}
+
+	std::vector< std::vector<uint8_t> > &gatherData = 
+		m_sendBatch->m_gatherData;
+
+	gatherData.push_back(std::vector<uint8_t>());
+	gatherData.back().swap(data);
+}
+
+bool CConnection::HasOutstandingContext()
+{
+
+	if(::InterlockedExchangeAdd(&m_rcvClosed, 0) == 0)
+	{
+		return true;
+	}
+
+	if(m_sendQueue.NumOutstandingContext() > 0)
+	{
+		return true;
+	}
+
+	return false;
+}
+
+void CConnection::AdaptRcvBufferSize(uint32_t bytesTransferred, 
+									 uint32_t minSize, 
+									 uint32_t maxSize)
+{
+	uint32_t &rcvBufferSize = m_rcvContext.m_rcvBufferSize;
+
+	// The buffer was full, so there was probably more waiting. Read more
+	// at once next time.
+	if(bytesTransferred >= rcvBufferSize)
+	{
+		m_numSmallReceives = 0;
+
+		rcvBufferSize = rcvBufferSize > maxSize / 2 ? 
+			maxSize : 
+			rcvBufferSize * 2;
+		return;
+	}
+
+	if(bytesTransferred > rcvBufferSize / SmallReceiveRatio)
+	{
+		m_numSmallReceives = 0;
+		return;
+	}
+
+	// A single small message may be the tail of a bulk transfer. Only
+	// shrink on a steady stream of them.
+	if(++m_numSmallReceives >= ShrinkAfter)
+	{
+		m_numSmallReceives = 0;
+
+		rcvBufferSize = (std::max)(rcvBufferSize / 2, minSize);
+	}
+}
+
+
+uint32_t CConnection::CompleteSend(intrusive_ptr<CConnection> *pin)
+{
+	// The sends still outstanding keep the connection.
+	uint32_t outstandingSend = m_sendQueue.CompleteUnlessLast();
+	if(0 != outstandingSend)
+	{
+		return outstandingSend;
+	}
+
+	if(NULL != pin)
+	{
+		*pin = this;
+	}
+
+	outstandingSend = m_sendQueue.Complete();
+
+	// ShutdownSocket checks the count after it sets m_pendingShutdown, and
+	// this checks m_pendingShutdown after the count drops, so one of the 
+	// two sees the other.
+	if( (0 == outstandingSend) &&
+		(-1 != ::InterlockedExchangeAdd(&m_pendingShutdown, 0)) )
+	{
+		mutex::scoped_lock l(m_connectionMutex);
+
+		long how = ::InterlockedExchange(&m_pendingShutdown, -1);
+		if(-1 != how)
+		{
+			::shutdown(m_socket, static_cast<int>(how));
+		}
+	}
+
+	return outstandingSend;
+}
+
+#if !defined(_WIN32)
+bool CConnection::HoldZeroCopySend( CCompletionPort::Packet const &packet )
+{
+	CIocpContext &sendContext = *packet.m_context;
+	if(sendContext.m_zeroCopyDone == sendContext.m_zeroCopyCalls)
+	{
+		return false;
+	}
+
+	m_zeroCopySends.push_back(packet);
+	return true;
+}
+
+namespace
+{
+	//! The number of calls numbered first to last that the context made.
+	uint32_t CountCalls(CIocpContext &sendContext, uint32_t first, uint32_t last)
+	{
+		if(0 == sendContext.m_zeroCopyCalls)
+		{
+			return 0;
+		}
+
+		uint32_t begin = sendContext.m_zeroCopyFirst;
+		uint32_t end = begin + sendContext.m_zeroCopyCalls - 1;
+
+		// Signed differences, so that the numbers may wrap around.
+		uint32_t from = static_cast<int32_t>(first - begin) > 0 ? first : begin;
+		uint32_t to = static_cast<int32_t>(end - last) > 0 ? last : end;
+
+		return static_cast<int32_t>(to - from) < 0 ? 0 : to - from + 1;
+	}
+}
+
+void CConnection::ZeroCopyNotified( uint32_t first, uint32_t last )
+{
+	// The context being written may have made calls already.
+	if(false == m_pendingSends.empty())
+	{
+		CIocpContext &sendContext = *m_pendingSends.front();
+		sendContext.m_zeroCopyDone += CountCalls(sendContext, first, last);
+	}
+
+	for(size_t i = 0; i < m_zeroCopySends.size(); ++i)
+	{
+		CIocpContext &sendContext = *m_zeroCopySends[i].m_context;
+		sendContext.m_zeroCopyDone += CountCalls(sendContext, first, last);
+	}
+}
+
+void CConnection::ReleaseZeroCopySends( CCompletionPort::PacketList_t &packets )
+{
+	// Go around the queue once. Those still held go to the back again, in
+	// the same order, into slots just freed.
+	size_t numHeld = m_zeroCopySends.size();
+	for(size_t i = 0; i < numHeld; ++i)
+	{
+		CCompletionPort::Packet packet = m_zeroCopySends.front();
+		m_zeroCopySends.pop_front();
+
+		CIocpContext &sendContext = *packet.m_context;
+		if(sendContext.m_zeroCopyDone == sendContext.m_zeroCopyCalls)
+		{
+			packets.push_back(packet);
+		}
+		else
+		{
+			m_zeroCopySends.push_back(packet);
+		}
+	}
+}
+#endif
+
+bool CConnection::CloseRcvContext()
+{
+	if (0 == ::InterlockedExchange(&m_rcvClosed, 1))
+	{
+#if defined(_WIN32)
+		if(INVALID_HANDLE_VALUE != m_rcvContext.hEvent )
+		{
+			CloseHandle(m_rcvContext.hEvent);
+			m_rcvContext.hEvent = INVALID_HANDLE_VALUE;
+		}
+#endif
+		return true;
+	}
+
+	return false;
+}
 } } // end namespace
\ No newline at end of file
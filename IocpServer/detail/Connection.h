@@ -1,43 +1,259 @@
-//! Copyright Alan Ning 2010
-//! Distributed under the Boost Software License, Version 1.0.
-//! (See accompanying file LICENSE_1_0.txt or copy at
-//! http://www.boost.org/LICENSE_1_0.txt)
-
-#ifndef CONNECTION_H_2010_09_25_17_15_00
-#define CONNECTION_H_2010_09_25_17_15_00
-
-#include "IocpContext.h"
-#include "SendQueue.h"
-
-namespace iocp { namespace detail {
-
-class CConnection
-{
-public:
-
-	CConnection(SOCKET socket, uint64_t cid, uint32_t rcvBufferSize);
-	~CConnection();
-	bool CloseRcvContext();
-
-	shared_ptr<CIocpContext> CreateSendContext();
-
-	bool HasOutstandingContext();
-
-	SOCKET m_socket;
-	uint64_t m_id;
-
-	long m_disconnectPending;
-	long m_sendClosePending;
-	long m_rcvClosed;  
-
-	CIocpContext m_rcvContext;
-
-	CSendQueue m_sendQueue;
-
-	CIocpContext m_disconnectContext;
-
-	mutex m_connectionMutex;
-};
-
-} } // end namespace
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef CONNECTION_H_2010_09_25_17_15_00
+#define CONNECTION_H_2010_09_25_17_15_00
+
+#include "IocpContext.h"
+#include "SendQueue.h"
+#include "ContextPool.h"
+#include "RingQueue.h"
+#include "TimerWheel.h"
+#include "../Timeout.h"
+
+#if !defined(_WIN32)
+#include "CompletionPort.h"
+#endif
+
+namespace iocp { namespace detail {
+
+//! @details
+//! A connection is held by intrusive_ptr, its count in the object itself.
+//! The table of its shard holds it from the accept until it is removed, 
+//! which is never while a receive or a send is outstanding. Completions 
+//! reach it through CIocpContext::m_connection meanwhile, without taking a
+//! reference. Only what runs after the last of them is counted out, and 
+//! callers outside the worker threads, hold one.
+//!
+//! With epoll, events reach it by address, and one may still be on its 
+//! way once the last reference is gone. The port then frees it later, 
+//! see CEpollPort::Retire.
+class CConnection
+{
+public:
+
+	//! A receive is small if it uses at most 1/SmallReceiveRatio of the
+	//! buffer. The receive size is halved after ShrinkAfter of them in a
+	//! row.
+	enum 
+	{
+		SmallReceiveRatio = 4,
+		ShrinkAfter = 4,
+	};
+
+	CConnection(SOCKET socket, uint64_t cid, uint32_t rcvBufferSize);
+	~CConnection();
+	bool CloseRcvContext();
+
+	//! A send context for this connection, from the pool.
+	CIocpContext *CreateSendContext(CContextPool &contextPool);
+
+	//! Add data to m_sendBatch, creating it if needed. The data is swapped
+	//! in. Call with m_sendBatchMutex held.
+	void AddToSendBatch(
+		std::vector<uint8_t> &data, 
+		CContextPool &contextPool);
+
+	bool HasOutstandingContext();
+
+	//! Pick the size of the next receive from the one that just completed,
+	//! within [minSize, maxSize]. Only the thread that handles the 
+	//! receive calls this.
+	void AdaptRcvBufferSize(
+		uint32_t bytesTransferred, 
+		uint32_t minSize, 
+		uint32_t maxSize);
+
+	//! Count a send context out of m_sendQueue once it has completed. 
+	//! Returns the number still outstanding. When none are left, carry out
+	//! a shutdown deferred by ShutdownSocket.
+	//!
+	//! The connection may be removed as soon as the last send is counted 
+	//! out. A caller that holds no reference to it passes pin, which then 
+	//! holds one if this was the last.
+	uint32_t CompleteSend(intrusive_ptr<CConnection> *pin = NULL);
+
+#if !defined(_WIN32)
+	//! Hold back the completion of a zero-copy send until the kernel is 
+	//! done with its buffers. Returns false if there is no need to. Call 
+	//! with m_connectionMutex held, as the two below.
+	bool HoldZeroCopySend(CCompletionPort::Packet const &packet);
+
+	//! Count the zero-copy calls the kernel notified, numbered first to 
+	//! last, against the contexts that made them (epoll).
+	void ZeroCopyNotified(uint32_t first, uint32_t last);
+
+	//! Add the held back completions that may now go to packets.
+	void ReleaseZeroCopySends(CCompletionPort::PacketList_t &packets);
+#endif
+
+	SOCKET m_socket;
+	uint64_t m_id;
+
+	//! The handler's, see CIocpHandler::OnNewConnection.
+	void *m_userContext;
+
+	//! References, see intrusive_ptr_add_ref.
+	long m_refCount;
+
+	long m_disconnectPending;
+	long m_sendClosePending;
+	long m_rcvClosed;  
+
+	//! The receiving side was shut down by the server. Data received from
+	//! then on is dropped.
+	long m_rcvShutdown;
+
+	CIocpContext m_rcvContext;
+
+	//! consecutive receives that used a small part of the buffer
+	uint32_t m_numSmallReceives;
+
+	CSendQueue m_sendQueue;
+
+	CIocpContext m_disconnectContext;
+
+	mutex m_connectionMutex;
+
+	//! SD_SEND, the sending side's shutdown deferred while m_sendQueue was
+	//! not empty. -1 = none. Set and carried out with m_connectionMutex held.
+	long m_pendingShutdown;
+
+	//! @remark
+	//! Coalesced sends only. Guarded by m_sendBatchMutex, which is taken
+	//! before m_connectionMutex.
+	mutex m_sendBatchMutex;
+
+	//! the data sent while m_sendQueue is not empty, to go out in one 
+	//! gather send once the send in flight completes, or on Flush. 
+	//! NULL = none.
+	CIocpContext *m_sendBatch;
+
+	//! Bytes queued for sending and not yet completed. Counted only if
+	//! send watermarks are set, see CSendWatermarks.
+	atomic<int64_t> m_numBytesQueued;
+
+	//! 1 while TrySend is refused, until OnWritable is reported.
+	long m_writeBlocked;
+
+	//! Sends held back by the send window, in order. A file is one of 
+	//! them, all of its contexts linked through m_next.
+	struct CWindowedSend
+	{
+		CIocpContext *m_first;
+		CIocpContext *m_last;
+		uint32_t m_numContexts;
+		uint64_t m_numBytes;
+	};
+
+	//! @remark
+	//! Windowed sends only, see QueueWindowedSend. Guarded by 
+	//! m_windowMutex, which is taken after m_sendBatchMutex and before
+	//! m_connectionMutex.
+	mutex m_windowMutex;
+
+	CRingQueue<CWindowedSend> m_windowedSends;
+
+	//! Bytes of the windowed contexts in m_sendQueue.
+	uint64_t m_numBytesInWindow;
+
+	//! @remark
+	//! Timeouts, see CConnectionTimers. Guarded by its mutex, except the
+	//! activity ticks, which completions store without a lock.
+
+	//! Due at the earliest deadline.
+	CTimerWheel::CTimer m_timer;
+
+	//! In ticks, 0 = none.
+	uint32_t m_timeouts[NumTimeouts];
+
+	//! The tick each timeout was set.
+	uint64_t m_timeoutStarts[NumTimeouts];
+
+	//! The activity tick each timeout was last reported for. 0 = never.
+	uint64_t m_timedOut[NumTimeouts];
+
+	//! Timeouts handed out by CConnectionTimers::Expire and not reported
+	//! yet.
+	uint32_t m_numTimeoutsReporting;
+
+	//! Once set, the timer is never scheduled again.
+	bool m_timersStopped;
+
+	//! The disconnect was refused while a timeout was being reported.
+	bool m_disconnectDeferred;
+
+	//! The ticks of the last receive and send.
+	atomic<uint64_t> m_lastReceive;
+	atomic<uint64_t> m_lastSend;
+
+#if !defined(_WIN32)
+	//! @remark
+	//! Bookkeeping for the POSIX engines. All of it is guarded by
+	//! m_connectionMutex.
+
+	//! epoll: true while m_rcvContext is waiting for data
+	bool m_rcvPosted;
+
+	//! epoll: events currently armed for m_socket (0 = disarmed)
+	uint32_t m_pollEvents;
+
+	//! send contexts that are not fully written yet, in order. With
+	//! io_uring, the front one is the send in flight.
+	CRingQueue<CIocpContext *> m_pendingSends;
+
+	//! io_uring multishot receive: true while a worker thread delivers
+	//! this connection's data. Receives that complete meanwhile wait in
+	//! m_rcvBacklog, so that OnReceiveData is never called concurrently
+	//! or out of order. Stays set after the end of stream.
+	bool m_rcvDelivering;
+
+	CRingQueue<CCompletionPort::Packet> m_rcvBacklog;
+
+	//! Zero-copy sends that are done, held back until the kernel has 
+	//! notified that it no longer reads their buffers.
+	CRingQueue<CCompletionPort::Packet> m_zeroCopySends;
+
+	//! Set by the engines that retire connections, see 
+	//! CCompletionPort::Retire. NULL = deleted with the last reference.
+	shared_ptr<CCompletionPort> m_completionPort;
+
+	//! epoll: SO_ZEROCOPY on m_socket. 0 = not tried yet, 1 = on, 
+	//! -1 = not supported. The sequence number of the next MSG_ZEROCOPY
+	//! call.
+	int m_zeroCopy;
+	uint32_t m_zeroCopySeq;
+#endif
+};
+
+inline void intrusive_ptr_add_ref(CConnection *c)
+{
+	::InterlockedIncrement(&c->m_refCount);
+}
+
+inline void intrusive_ptr_release(CConnection *c)
+{
+	if(0 != ::InterlockedDecrement(&c->m_refCount))
+	{
+		return;
+	}
+
+#if !defined(_WIN32)
+	if(c->m_completionPort != NULL)
+	{
+		// Otherwise, the connection might hold the last reference to the
+		// port that holds it.
+		shared_ptr<CCompletionPort> completionPort;
+		completionPort.swap(c->m_completionPort);
+		completionPort->Retire(c);
+		return;
+	}
+#endif
+
+	delete c;
+}
+
+} } // end namespace
 #endif // CONNECTION_H_2010_09_25_17_15_00
\ No newline at end of file
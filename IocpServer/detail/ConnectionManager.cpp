@@ -1,55 +1,380 @@
-//! Copyright Alan Ning 2010
-//! Distributed under the Boost Software License, Version 1.0.
-//! (See accompanying file LICENSE_1_0.txt or copy at
-//! http://www.boost.org/LICENSE_1_0.txt)
-
-#include "StdAfx.h"
-#include "ConnectionManager.h"
-#include "Connection.h"
-
-namespace iocp { namespace detail {
-
-void CConnectionManager::AddConnection( shared_ptr<CConnection> client )
-{
-	mutex::scoped_lock lock(m_mutex);
-
-	bool inserted = m_connMap.insert(std::make_pair(
-		client->m_id, client
-		)).second;
-
-	assert(true == inserted);
-}
-
-bool CConnectionManager::RemoveConnection( uint64_t clientId )
-{
-	mutex::scoped_lock lock(m_mutex);
-
-	return (m_connMap.erase(clientId) > 0);
-}
-
-shared_ptr<CConnection> CConnectionManager::GetConnection( uint64_t clientId )
-{
-	mutex::scoped_lock lock(m_mutex);
-
-	ConnMap_t::iterator itr = m_connMap.find(clientId);
-
-	if(m_connMap.end() != itr)
-	{
-		return itr->second;
-	}
-
-	return shared_ptr<CConnection>();
-}
-
-void CConnectionManager::CloseAllConnections()
-{
-	mutex::scoped_lock lock(m_mutex);
-
-	ConnMap_t::iterator itr = m_connMap.begin();
-	while(m_connMap.end() != itr)
-	{
-		CancelIo((HANDLE)itr->second->m_socket);
-		++itr;
-	}
-}
-} } // end namespace
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#include "StdAfx.h"
+#include "ConnectionManager.h"
+#include "Connection.h"
+
+namespace iocp { namespace detail {
+
+namespace {
+
+	uint32_t const IndexMask = CConnectionManager::MaxConnections - 1;
+
+	uint32_t const GenerationMask =
+		(1 << CConnectionManager::GenerationBits) - 1;
+
+	uint64_t const FreeTopMask = 0xffffffff;
+
+	uint64_t const FreeCountStep = static_cast<uint64_t>(1) << 32;
+
+	//! A slot's lookups are counted above the connection's pointer, which
+	//! takes 48 bits at most.
+	int const LookupShift = 48;
+
+	uint64_t const LookupStep = static_cast<uint64_t>(1) << LookupShift;
+
+	uint64_t const PointerMask = LookupStep - 1;
+
+	CConnection *PointerOf(uint64_t value)
+	{
+		return reinterpret_cast<CConnection *>(
+			static_cast<uintptr_t>(value & PointerMask));
+	}
+}
+
+CConnectionManager::CSlot::CSlot()
+: m_connection(0)
+, m_id(0)
+, m_generation(1)
+, m_nextFree(0)
+{
+
+}
+
+intrusive_ptr<CConnection> CConnectionManager::CSlot::Load()
+{
+	// Counted in the slot first. While the count is up, the slot's own
+	// reference keeps the connection, and the thread that takes it out of
+	// the slot adds the count to its references.
+	uint64_t value = m_connection.load(boost::memory_order_acquire);
+	do
+	{
+		if(0 == (value & PointerMask))
+		{
+			return intrusive_ptr<CConnection>();
+		}
+	}
+	while(false == m_connection.compare_exchange_weak(
+		value, 
+		value + LookupStep, 
+		boost::memory_order_acquire,
+		boost::memory_order_acquire));
+
+	CConnection *connection = PointerOf(value);
+	intrusive_ptr<CConnection> c(connection);
+
+	// Take the count back from where it is now.
+	value += LookupStep;
+	for(;;)
+	{
+		if(PointerOf(value) != connection)
+		{
+			::InterlockedDecrement(&connection->m_refCount);
+			break;
+		}
+
+		if(true == m_connection.compare_exchange_weak(
+			value, 
+			value - LookupStep, 
+			boost::memory_order_release,
+			boost::memory_order_relaxed))
+		{
+			break;
+		}
+	}
+
+	return c;
+}
+
+bool CConnectionManager::CSlot::Exchange( 
+	uint64_t expectedId, 
+	intrusive_ptr<CConnection> c )
+{
+	// Only one of the threads exchanging the same connection at once gets
+	// to.
+	uint64_t id = (c == NULL) ? 0 : c->m_id;
+	if(false == m_id.compare_exchange_strong(
+		expectedId, 
+		id, 
+		boost::memory_order_acq_rel))
+	{
+		return false;
+	}
+
+	uint64_t value = static_cast<uint64_t>(
+		reinterpret_cast<uintptr_t>(c.get()));
+	assert(0 == (value & ~PointerMask));
+
+	if(c != NULL)
+	{
+		intrusive_ptr_add_ref(c.get());
+	}
+
+	value = m_connection.exchange(value, boost::memory_order_acq_rel);
+
+	// The lookups still counted in the slot give their count back to the
+	// connection.
+	CConnection *replaced = PointerOf(value);
+	if(NULL != replaced)
+	{
+		::InterlockedExchangeAdd(
+			&replaced->m_refCount, 
+			static_cast<long>(value >> LookupShift));
+		intrusive_ptr_release(replaced);
+	}
+
+	return true;
+}
+
+CConnectionManager::CConnectionManager(uint64_t idBase)
+: m_idBase(idBase)
+, m_segments(new atomic<CSlot *>[NumSegments])
+, m_numSlots(0)
+, m_freeSlots(0)
+{
+	for(uint32_t i = 0; i < NumSegments; ++i)
+	{
+		m_segments[i].store(NULL, boost::memory_order_relaxed);
+	}
+}
+
+CConnectionManager::~CConnectionManager()
+{
+	for(uint32_t i = 0; i < NumSegments; ++i)
+	{
+		delete [] m_segments[i].load(boost::memory_order_relaxed);
+	}
+
+	delete [] m_segments;
+}
+
+uint64_t CConnectionManager::NewId()
+{
+	uint32_t index = 0;
+
+	uint64_t freeSlots = m_freeSlots.load(boost::memory_order_acquire);
+	for(;;)
+	{
+		uint32_t top = static_cast<uint32_t>(freeSlots & FreeTopMask);
+		if(0 == top)
+		{
+			if(false == AllocateSlot(index))
+			{
+				return 0;
+			}
+			break;
+		}
+
+		// The top slot may be popped and reused meanwhile, in which case
+		// this reads garbage and the exchange fails.
+		uint32_t next = GetSlot(top - 1)->m_nextFree.load(
+			boost::memory_order_relaxed);
+
+		uint64_t popped =
+			((freeSlots & ~FreeTopMask) + FreeCountStep) | next;
+
+		if(true == m_freeSlots.compare_exchange_weak(
+			freeSlots,
+			popped,
+			boost::memory_order_acquire,
+			boost::memory_order_acquire))
+		{
+			index = top - 1;
+			break;
+		}
+	}
+
+	uint64_t generation = GetSlot(index)->m_generation;
+
+	return m_idBase | (generation << IndexBits) | index;
+}
+
+void CConnectionManager::AddConnection( intrusive_ptr<CConnection> client )
+{
+	CSlot *slot = GetSlot(static_cast<uint32_t>(client->m_id & IndexMask));
+
+	assert(NULL != slot);
+
+	bool added = slot->Exchange(0, client);
+
+	assert(true == added);
+	(void)added;
+}
+
+bool CConnectionManager::RemoveConnection( uint64_t clientId )
+{
+	uint32_t index = static_cast<uint32_t>(clientId & IndexMask);
+
+	CSlot *slot = GetSlot(index);
+	if(NULL == slot)
+	{
+		return false;
+	}
+
+	// Only one of the threads removing it at once gets to free the slot.
+	if(false == slot->Exchange(clientId, intrusive_ptr<CConnection>()))
+	{
+		return false;
+	}
+
+	FreeSlot(index);
+	return true;
+}
+
+intrusive_ptr<CConnection> CConnectionManager::GetConnection( uint64_t clientId )
+{
+	CSlot *slot = GetSlot(static_cast<uint32_t>(clientId & IndexMask));
+	if(NULL == slot)
+	{
+		return intrusive_ptr<CConnection>();
+	}
+
+	intrusive_ptr<CConnection> c = slot->Load();
+
+	// The slot is free, or holds a newer connection.
+	if( (c == NULL) || (c->m_id != clientId) )
+	{
+		return intrusive_ptr<CConnection>();
+	}
+
+	return c;
+}
+
+void CConnectionManager::CloseAllConnections()
+{
+	uint32_t numSlots = m_numSlots.load(boost::memory_order_acquire);
+
+	for(uint32_t i = 0; i < numSlots; ++i)
+	{
+		CSlot *slot = GetSlot(i);
+		if(NULL == slot)
+		{
+			continue;
+		}
+
+		intrusive_ptr<CConnection> c = slot->Load();
+		if(c == NULL)
+		{
+			continue;
+		}
+
+#if defined(_WIN32)
+		CancelIo((HANDLE)c->m_socket);
+#else
+		// There is no pending system call to cancel with a reactor. Shutting
+		// down both directions makes the outstanding receive complete
+		// and flushes the connection through the usual disconnect path.
+		::shutdown(c->m_socket, SD_BOTH);
+#endif
+	}
+}
+
+void CConnectionManager::RemoveAllConnections( 
+	std::vector< intrusive_ptr<CConnection> > &connections )
+{
+	uint32_t numSlots = m_numSlots.load(boost::memory_order_acquire);
+
+	for(uint32_t i = 0; i < numSlots; ++i)
+	{
+		CSlot *slot = GetSlot(i);
+		if(NULL == slot)
+		{
+			continue;
+		}
+
+		intrusive_ptr<CConnection> c = slot->Load();
+		if( (c != NULL) && (true == RemoveConnection(c->m_id)) )
+		{
+			connections.push_back(c);
+		}
+	}
+}
+
+CConnectionManager::CSlot * CConnectionManager::GetSlot( uint32_t index )
+{
+	if(index >= MaxConnections)
+	{
+		return NULL;
+	}
+
+	CSlot *segment =
+		m_segments[index / SegmentSize].load(boost::memory_order_acquire);
+
+	if(NULL == segment)
+	{
+		return NULL;
+	}
+
+	return &segment[index % SegmentSize];
+}
+
+bool CConnectionManager::AllocateSlot( uint32_t &index )
+{
+	uint32_t numSlots = m_numSlots.load(boost::memory_order_relaxed);
+	do
+	{
+		if(numSlots >= MaxConnections)
+		{
+			return false;
+		}
+	}
+	while(false == m_numSlots.compare_exchange_weak(
+		numSlots,
+		numSlots + 1,
+		boost::memory_order_relaxed));
+
+	index = numSlots;
+
+	atomic<CSlot *> &segment = m_segments[index / SegmentSize];
+	if(NULL == segment.load(boost::memory_order_acquire))
+	{
+		// Another thread may be allocating the same segment. The first
+		// one to store it wins.
+		CSlot *newSegment = new CSlot[SegmentSize];
+		CSlot *expected = NULL;
+
+		if(false == segment.compare_exchange_strong(
+			expected,
+			newSegment,
+			boost::memory_order_acq_rel))
+		{
+			delete [] newSegment;
+		}
+	}
+
+	return true;
+}
+
+void CConnectionManager::FreeSlot( uint32_t index )
+{
+	CSlot *slot = GetSlot(index);
+
+	// The ids of the slot's last connection are stale from now on.
+	// Generation 0 is skipped, so that no id is 0.
+	slot->m_generation = (slot->m_generation + 1) & GenerationMask;
+	if(0 == slot->m_generation)
+	{
+		slot->m_generation = 1;
+	}
+
+	uint64_t freeSlots = m_freeSlots.load(boost::memory_order_relaxed);
+	uint64_t pushed = 0;
+	do
+	{
+		slot->m_nextFree.store(
+			static_cast<uint32_t>(freeSlots & FreeTopMask),
+			boost::memory_order_relaxed);
+
+		pushed = ((freeSlots & ~FreeTopMask) + FreeCountStep) | (index + 1);
+	}
+	while(false == m_freeSlots.compare_exchange_weak(
+		freeSlots,
+		pushed,
+		boost::memory_order_release,
+		boost::memory_order_relaxed));
+}
+
+} } // end namespace
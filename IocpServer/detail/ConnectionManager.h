@@ -1,36 +1,126 @@
-//! Copyright Alan Ning 2010
-//! Distributed under the Boost Software License, Version 1.0.
-//! (See accompanying file LICENSE_1_0.txt or copy at
-//! http://www.boost.org/LICENSE_1_0.txt)
-
-#ifndef CLIENTMANAGER_H_2010_09_25_00_05_01
-#define CLIENTMANAGER_H_2010_09_25_00_05_01
-
-namespace iocp { namespace detail { class CConnection; } };
-namespace iocp { namespace detail {
-
-class CConnectionManager
-{
-public:
-	void AddConnection(shared_ptr<CConnection> client);
-
-	bool RemoveConnection(uint64_t clientId);
-
-	shared_ptr<CConnection> GetConnection(uint64_t clientId);
-
-	void CloseAllConnections();
-
-private:
-
-	typedef std::map<
-		uint64_t,
-		shared_ptr<CConnection>
-	> ConnMap_t;
-
-	ConnMap_t m_connMap;
-
-	mutex m_mutex;
-};
-
-} } // end namespace
-#endif // CLIENTMANAGER_H_2010_09_25_00_05_01
\ No newline at end of file
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef CLIENTMANAGER_H_2010_09_25_00_05_01
+#define CLIENTMANAGER_H_2010_09_25_00_05_01
+
+namespace iocp { namespace detail { class CConnection; } };
+namespace iocp { namespace detail {
+
+//! @details
+//! The connections of a shard, in a table of slots indexed by connection
+//! id. An id is the slot's index and its generation, which changes each
+//! time the slot is freed, so that the id of a connection that is gone
+//! finds nothing even once its slot is reused:
+//!
+//!   shard (16 bits) | generation (24 bits) | slot index (24 bits)
+//!
+//! Lookups take no lock and never wait. They count themselves in the 
+//! slot while they take a reference to its connection, see CSlot::Load.
+//! Slots are allocated in segments that are never freed nor moved, and 
+//! free ones are reused first, from a lock free stack.
+class CConnectionManager : boost::noncopyable
+{
+public:
+
+	enum
+	{
+		IndexBits = 24,
+		GenerationBits = 24,
+
+		//! The bits of an id below the shard index.
+		IdBits = IndexBits + GenerationBits,
+
+		//! Connections open at once, per shard.
+		MaxConnections = 1 << IndexBits,
+
+		//! Slots are allocated this many at a time.
+		SegmentSize = 4096,
+		NumSegments = MaxConnections / SegmentSize,
+	};
+
+	//! idBase is the shard's part of every id.
+	explicit CConnectionManager(uint64_t idBase);
+
+	~CConnectionManager();
+
+	//! An id for a new connection, its slot taken until the connection is
+	//! added and removed. 0 if every slot is taken.
+	uint64_t NewId();
+
+	void AddConnection(intrusive_ptr<CConnection> client);
+
+	//! Remove the connection and free its slot. Returns false if it is
+	//! not there, that is, another thread removed it first.
+	bool RemoveConnection(uint64_t clientId);
+
+	intrusive_ptr<CConnection> GetConnection(uint64_t clientId);
+
+	void CloseAllConnections();
+
+	//! Remove the connections left, and add them to connections. For the
+	//! server's shutdown, once no worker thread is left to remove them.
+	void RemoveAllConnections(
+		std::vector< intrusive_ptr<CConnection> > &connections);
+
+private:
+
+	//! On a cache line of its own, as lookups write to it.
+#if defined(_MSC_VER)
+	struct __declspec(align(64)) CSlot
+#else
+	struct __attribute__((aligned(64))) CSlot
+#endif
+	{
+		CSlot();
+
+		//! A reference to the connection in the slot, if any.
+		intrusive_ptr<CConnection> Load();
+
+		//! Replace the connection if it is the one with the given id, or 
+		//! none if 0. Returns false otherwise.
+		bool Exchange(uint64_t expectedId, intrusive_ptr<CConnection> c);
+
+		//! The connection, which the slot holds a reference to, and above
+		//! its pointer's bits, the lookups taking a reference to it.
+		atomic<uint64_t> m_connection;
+
+		//! The id of the connection, 0 if none. Exchange decides on it
+		//! before the connection itself changes.
+		atomic<uint64_t> m_id;
+
+		//! The generation of the slot's next id. Only the thread that
+		//! holds the slot, between NewId and RemoveConnection, changes it.
+		uint32_t m_generation;
+
+		//! The slot below on the free stack, plus 1. 0 = none.
+		atomic<uint32_t> m_nextFree;
+	};
+
+	//! NULL if the slot was never allocated.
+	CSlot *GetSlot(uint32_t index);
+
+	//! A slot for NewId that was never used. Returns false if there is none
+	//! left.
+	bool AllocateSlot(uint32_t &index);
+
+	void FreeSlot(uint32_t index);
+
+	uint64_t m_idBase;
+
+	//! NumSegments pointers, each NULL until allocated.
+	atomic<CSlot *> *m_segments;
+
+	//! Slots allocated so far, used or free.
+	atomic<uint32_t> m_numSlots;
+
+	//! The free stack: the top slot's index plus 1 (0 = empty) in the low
+	//! 32 bits, and a count of the changes in the high ones, so that a pop
+	//! fails if the stack changed since it read the top slot.
+	atomic<uint64_t> m_freeSlots;
+};
+
+} } // end namespace
+#endif // CLIENTMANAGER_H_2010_09_25_00_05_01
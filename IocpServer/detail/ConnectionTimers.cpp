@@ -0,0 +1,289 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#include "StdAfx.h"
+#include "ConnectionTimers.h"
+#include "Utils.h"
+#include "../ServerOptions.h"
+
+namespace iocp { namespace detail {
+
+CConnectionTimers::CConnectionTimers()
+: m_tick(0)
+, m_active(false)
+, m_resolution(DefaultResolution)
+, m_startTime(GetMilliseconds())
+, m_hasDefaultTimeouts(false)
+{
+	for(uint32_t i = 0; i < NumTimeouts; ++i)
+	{
+		m_defaultTimeouts[i] = 0;
+	}
+}
+
+void CConnectionTimers::Configure( ServerOptions const &options )
+{
+	if(0 != options.m_timeoutResolution)
+	{
+		m_resolution = options.m_timeoutResolution;
+	}
+
+	m_defaultTimeouts[IdleTimeout] = ToTicks(options.m_idleTimeout);
+	m_defaultTimeouts[ReadTimeout] = ToTicks(options.m_readTimeout);
+	m_defaultTimeouts[WriteTimeout] = ToTicks(options.m_writeTimeout);
+
+	for(uint32_t i = 0; i < NumTimeouts; ++i)
+	{
+		if(0 != m_defaultTimeouts[i])
+		{
+			m_hasDefaultTimeouts = true;
+		}
+	}
+}
+
+DWORD CConnectionTimers::GetWaitTime() const
+{
+	if(false == m_active.load(boost::memory_order_relaxed))
+	{
+		return INFINITE;
+	}
+
+	// Tick n starts (n - 1) * m_resolution after tick 1.
+	uint64_t nextTick = m_startTime + GetTick() * m_resolution;
+	uint64_t now = GetMilliseconds();
+
+	return nextTick > now ? static_cast<DWORD>(nextTick - now) : 0;
+}
+
+void CConnectionTimers::Start( CConnection &c )
+{
+	if(false == m_hasDefaultTimeouts)
+	{
+		Received(c);
+		Sent(c);
+		return;
+	}
+
+	mutex::scoped_lock l(m_mutex);
+
+	uint64_t now = GetClockTick();
+
+	// The wheel may have stood still, and the current tick with it.
+	if(0 == m_wheel.GetNumTimers())
+	{
+		m_wheel.Advance(now, m_expired);
+		m_tick.store(now, boost::memory_order_relaxed);
+	}
+
+	c.m_lastReceive.store(now, boost::memory_order_relaxed);
+	c.m_lastSend.store(now, boost::memory_order_relaxed);
+
+	for(uint32_t i = 0; i < NumTimeouts; ++i)
+	{
+		c.m_timeouts[i] = m_defaultTimeouts[i];
+		c.m_timeoutStarts[i] = now;
+	}
+
+	Schedule(c, now, NULL);
+	UpdateActive();
+}
+
+bool CConnectionTimers::SetTimeout( CConnection &c,
+								   Timeout timeout,
+								   uint32_t milliseconds )
+{
+	mutex::scoped_lock l(m_mutex);
+
+	if(true == c.m_timersStopped)
+	{
+		return false;
+	}
+
+	uint64_t now = GetClockTick();
+
+	bool wasActive = (0 != m_wheel.GetNumTimers());
+	if(false == wasActive)
+	{
+		m_wheel.Advance(now, m_expired);
+		m_tick.store(now, boost::memory_order_relaxed);
+	}
+
+	c.m_timeouts[timeout] = ToTicks(milliseconds);
+	c.m_timeoutStarts[timeout] = now;
+	c.m_timedOut[timeout] = 0;
+
+	Schedule(c, now, NULL);
+	UpdateActive();
+
+	return (false == wasActive) && (0 != m_wheel.GetNumTimers());
+}
+
+bool CConnectionTimers::Stop( CConnection &c )
+{
+	mutex::scoped_lock l(m_mutex);
+
+	if(c.m_numTimeoutsReporting > 0)
+	{
+		c.m_disconnectDeferred = true;
+		return false;
+	}
+
+	c.m_timersStopped = true;
+
+	m_wheel.Cancel(c.m_timer);
+	UpdateActive();
+
+	return true;
+}
+
+void CConnectionTimers::Expire( ExpiryList_t &expired )
+{
+	uint64_t now = GetClockTick();
+	if(now <= GetTick())
+	{
+		return;
+	}
+
+	mutex::scoped_lock l(m_mutex, boost::try_to_lock);
+
+	// Another thread is going through the ticks.
+	if(false == l.owns_lock())
+	{
+		return;
+	}
+
+	m_wheel.Advance(now, m_expired);
+
+	for(size_t i = 0; i < m_expired.size(); ++i)
+	{
+		Schedule(
+			*static_cast<CConnection *>(m_expired[i]->m_owner),
+			now,
+			&expired);
+	}
+	m_expired.clear();
+
+	m_tick.store(now, boost::memory_order_relaxed);
+	UpdateActive();
+}
+
+bool CConnectionTimers::Reported( CConnection &c )
+{
+	mutex::scoped_lock l(m_mutex);
+
+	assert(c.m_numTimeoutsReporting > 0);
+
+	if( (0 == --c.m_numTimeoutsReporting) &&
+		(true == c.m_disconnectDeferred) )
+	{
+		c.m_disconnectDeferred = false;
+		return true;
+	}
+
+	return false;
+}
+
+uint64_t CConnectionTimers::GetClockTick() const
+{
+	return (GetMilliseconds() - m_startTime) / m_resolution + 1;
+}
+
+uint32_t CConnectionTimers::ToTicks( uint32_t milliseconds ) const
+{
+	// Never less than asked for, nor 0 unless asked for.
+	return milliseconds / m_resolution +
+		(0 != milliseconds % m_resolution ? 1 : 0);
+}
+
+uint64_t CConnectionTimers::GetLastActivity( CConnection &c, uint32_t timeout )
+{
+	uint64_t last = c.m_timeoutStarts[timeout];
+
+	switch(timeout)
+	{
+	case IdleTimeout:
+		last = (std::max)(last,
+			c.m_lastReceive.load(boost::memory_order_relaxed));
+		last = (std::max)(last,
+			c.m_lastSend.load(boost::memory_order_relaxed));
+		break;
+	case ReadTimeout:
+		last = (std::max)(last,
+			c.m_lastReceive.load(boost::memory_order_relaxed));
+		break;
+	case WriteTimeout:
+		if(0 == c.m_sendQueue.NumOutstandingContext())
+		{
+			return 0;
+		}
+		last = (std::max)(last,
+			c.m_lastSend.load(boost::memory_order_relaxed));
+		break;
+	default:
+		assert(false);
+	}
+
+	return last;
+}
+
+void CConnectionTimers::Schedule( CConnection &c,
+								 uint64_t now,
+								 ExpiryList_t *expired )
+{
+	// 0 = no deadline.
+	uint64_t next = 0;
+
+	for(uint32_t i = 0; i < NumTimeouts; ++i)
+	{
+		uint32_t timeout = c.m_timeouts[i];
+		if(0 == timeout)
+		{
+			continue;
+		}
+
+		// A timeout that watches nothing now, or was reported already, is
+		// looked at again one timeout later. Activity meanwhile only
+		// pushes its deadline further.
+		uint64_t deadline = now + timeout;
+
+		uint64_t last = GetLastActivity(c, i);
+		if( (0 != last) && (last != c.m_timedOut[i]) )
+		{
+			// The activity may have been late in its tick. One more, so
+			// that the timeout never passes early.
+			deadline = last + timeout + 1;
+
+			if( (deadline <= now) && (NULL != expired) )
+			{
+				c.m_timedOut[i] = last;
+				++c.m_numTimeoutsReporting;
+				expired->push_back(CExpiry(&c, static_cast<Timeout>(i)));
+
+				deadline = now + timeout;
+			}
+		}
+
+		if( (0 == next) || (deadline < next) )
+		{
+			next = deadline;
+		}
+	}
+
+	if(0 == next)
+	{
+		m_wheel.Cancel(c.m_timer);
+	}
+	else
+	{
+		m_wheel.Schedule(c.m_timer, next);
+	}
+}
+
+void CConnectionTimers::UpdateActive()
+{
+	m_active.store(0 != m_wheel.GetNumTimers(), boost::memory_order_relaxed);
+}
+
+} } // end namespace
@@ -0,0 +1,152 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef CONNECTIONTIMERS_H_2026_10_19_10_02_37
+#define CONNECTIONTIMERS_H_2026_10_19_10_02_37
+
+#include "TimerWheel.h"
+#include "Connection.h"
+#include "../Timeout.h"
+
+namespace iocp { class ServerOptions; }
+
+namespace iocp { namespace detail {
+
+//! @details
+//! The timeouts of a shard's connections, on one timing wheel. Each
+//! connection has one timer, due at the earliest of its deadlines, and
+//! the worker threads go through the ticks between completions.
+//!
+//! Activity does not move the timer. Completions only store the current
+//! tick in the connection, without a lock, and the deadlines are worked
+//! out from it when the timer comes due: a timeout is reported if one has
+//! passed, and the timer is scheduled again at the next one otherwise. A
+//! busy connection costs one timer expiry per timeout, rather than a
+//! lock of the wheel per completion.
+//!
+//! A timeout is reported once, until the activity it watches moves on.
+//! The connection is not removed while one is being reported, so that
+//! OnTimeout never comes after OnDisconnect.
+class CConnectionTimers : boost::noncopyable
+{
+public:
+
+	enum
+	{
+		//! ServerOptions::m_timeoutResolution
+		DefaultResolution = 100,
+	};
+
+	//! A timeout to report, the connection held until then.
+	struct CExpiry
+	{
+		CExpiry(CConnection *c, Timeout timeout)
+			: m_connection(c)
+			, m_timeout(timeout)
+		{
+		}
+
+		intrusive_ptr<CConnection> m_connection;
+		Timeout m_timeout;
+	};
+
+	typedef std::vector<CExpiry> ExpiryList_t;
+
+	CConnectionTimers();
+
+	//! The resolution and the timeouts of new connections.
+	void Configure(ServerOptions const &options);
+
+	//! The current tick, as of the last time the worker threads went
+	//! through the ticks.
+	uint64_t GetTick() const
+	{
+		return m_tick.load(boost::memory_order_relaxed);
+	}
+
+	//! Data was received on the connection.
+	void Received(CConnection &c)
+	{
+		c.m_lastReceive.store(GetTick(), boost::memory_order_relaxed);
+	}
+
+	//! A send on the connection completed, or the first one after none
+	//! were outstanding was queued.
+	void Sent(CConnection &c)
+	{
+		c.m_lastSend.store(GetTick(), boost::memory_order_relaxed);
+	}
+
+	//! How long a worker thread may wait for completions, in milliseconds:
+	//! until the next tick, or INFINITE if no timer is scheduled.
+	DWORD GetWaitTime() const;
+
+	//! Arm the timeouts of a new connection.
+	void Start(CConnection &c);
+
+	//! Change a timeout of the connection, counted from now. 0 cancels it.
+	//! Returns true if no timer was scheduled before, in which case the
+	//! worker threads may be waiting without a timeout.
+	bool SetTimeout(CConnection &c, Timeout timeout, uint32_t milliseconds);
+
+	//! Cancel the connection's timeouts for good, before it is removed.
+	//! Returns false if one is being reported. Reported then returns true,
+	//! and the disconnect is to be posted again.
+	bool Stop(CConnection &c);
+
+	//! Go through the ticks up to now, and add the timeouts that passed to
+	//! expired. Only one thread at a time does; the others return right
+	//! away.
+	void Expire(ExpiryList_t &expired);
+
+	//! A timeout added by Expire was reported. Returns true if the
+	//! connection's disconnect waited for it.
+	bool Reported(CConnection &c);
+
+private:
+
+	//! The tick of the clock.
+	uint64_t GetClockTick() const;
+
+	uint32_t ToTicks(uint32_t milliseconds) const;
+
+	//! The tick a timeout is counted from, or 0 if it watches nothing now.
+	uint64_t GetLastActivity(CConnection &c, uint32_t timeout);
+
+	//! Schedule the connection's timer at its next deadline, or cancel it.
+	//! If expired is not NULL, the timeouts that passed are added to it.
+	void Schedule(CConnection &c, uint64_t now, ExpiryList_t *expired);
+
+	//! Call with m_mutex held, after the wheel changed.
+	void UpdateActive();
+
+	//! Guards the wheel and the timer state of the connections.
+	mutex m_mutex;
+
+	CTimerWheel m_wheel;
+
+	//! The timers Advance returned, reused.
+	CTimerWheel::TimerList_t m_expired;
+
+	//! m_wheel.GetTick(), for the threads that don't hold m_mutex.
+	atomic<uint64_t> m_tick;
+
+	//! true while a timer is scheduled.
+	atomic<bool> m_active;
+
+	//! Milliseconds per tick.
+	uint32_t m_resolution;
+
+	//! The clock at tick 1, in milliseconds.
+	uint64_t m_startTime;
+
+	//! Ticks, 0 = none.
+	uint32_t m_defaultTimeouts[NumTimeouts];
+
+	bool m_hasDefaultTimeouts;
+};
+
+} } // end namespace
+#endif // CONNECTIONTIMERS_H_2026_10_19_10_02_37
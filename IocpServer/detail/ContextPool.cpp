@@ -0,0 +1,123 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#include "StdAfx.h"
+#include "ContextPool.h"
+#include "IocpContext.h"
+
+namespace iocp { namespace detail {
+
+CContextPool::CThreadCache::~CThreadCache()
+{
+	for(size_t i = 0; i < m_contexts.size(); ++i)
+	{
+		delete m_contexts[i];
+	}
+}
+
+CContextPool::CContextPool()
+{
+	// Never grown, so Spill does not allocate under the lock.
+	m_depot.reserve(MaxIdle);
+}
+
+CContextPool::~CContextPool()
+{
+	for(size_t i = 0; i < m_depot.size(); ++i)
+	{
+		delete m_depot[i];
+	}
+}
+
+CIocpContext * CContextPool::Get(SOCKET socket, uint64_t cid)
+{
+	CThreadCache &cache = GetThreadCache();
+
+	if(true == cache.m_contexts.empty())
+	{
+		mutex::scoped_lock l(m_mutex);
+
+		// Refill half of the cache, so that the next few calls stay away
+		// from the depot whether they get or put.
+		size_t count = (std::min)(
+			m_depot.size(),
+			static_cast<size_t>(ThreadCacheSize / 2));
+
+		cache.m_contexts.insert(
+			cache.m_contexts.end(),
+			m_depot.end() - count,
+			m_depot.end());
+		m_depot.resize(m_depot.size() - count);
+	}
+
+	if(true == cache.m_contexts.empty())
+	{
+		return new CIocpContext(socket, cid, CIocpContext::Send, 0);
+	}
+
+	CIocpContext *sendContext = cache.m_contexts.back();
+	cache.m_contexts.pop_back();
+
+	sendContext->Reset(socket, cid);
+	return sendContext;
+}
+
+void CContextPool::Put(CIocpContext *sendContext)
+{
+	assert(CIocpContext::Send == sendContext->m_type);
+
+	// Let go of the buffers and the file now rather than when the context
+	// is reused, which may be never.
+	sendContext->Reset(INVALID_SOCKET, 0);
+
+	CThreadCache &cache = GetThreadCache();
+
+	if(cache.m_contexts.size() >= ThreadCacheSize)
+	{
+		Spill(cache, ThreadCacheSize / 2);
+	}
+
+	cache.m_contexts.push_back(sendContext);
+}
+
+void CContextPool::FlushThreadCache()
+{
+	CThreadCache &cache = GetThreadCache();
+	Spill(cache, cache.m_contexts.size());
+}
+
+CContextPool::CThreadCache & CContextPool::GetThreadCache()
+{
+	CThreadCache *cache = m_threadCache.get();
+	if(NULL == cache)
+	{
+		cache = new CThreadCache;
+		cache->m_contexts.reserve(ThreadCacheSize);
+		m_threadCache.reset(cache);
+	}
+
+	return *cache;
+}
+
+void CContextPool::Spill(CThreadCache &cache, size_t count)
+{
+	mutex::scoped_lock l(m_mutex);
+
+	for(size_t i = 0; i < count; ++i)
+	{
+		if(m_depot.size() < MaxIdle)
+		{
+			m_depot.push_back(cache.m_contexts.back());
+		}
+		else
+		{
+			delete cache.m_contexts.back();
+		}
+
+		cache.m_contexts.pop_back();
+	}
+}
+
+} } // end namespace
@@ -0,0 +1,75 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef CONTEXTPOOL_H_2026_10_18_21_12_40
+#define CONTEXTPOOL_H_2026_10_18_21_12_40
+
+namespace iocp { namespace detail { class CIocpContext; } };
+
+namespace iocp { namespace detail {
+
+//! @details
+//! Send contexts shared by every connection of the server, so that a send
+//! does not allocate one and free it again once it completes.
+//!
+//! Same scheme as CBufferPool: each thread keeps a small cache and only
+//! goes to the shared depot, under its lock, to refill or spill half of it
+//! at a time. A context from the pool is an ordinary heap object, so one
+//! that never comes back, or is deleted instead, is not a leak.
+class CContextPool : boost::noncopyable
+{
+public:
+
+	enum
+	{
+		//! Contexts kept by each thread.
+		ThreadCacheSize = 64,
+
+		//! Contexts kept in the depot.
+		MaxIdle = 1024,
+	};
+
+	CContextPool();
+
+	~CContextPool();
+
+	//! A send context for the connection, as new.
+	CIocpContext *Get(SOCKET socket, uint64_t cid);
+
+	//! Take a send context back once it is done with. Its buffers are
+	//! released; move them out first to keep them.
+	void Put(CIocpContext *sendContext);
+
+	//! Move the calling thread's cache into the depot. Threads call this
+	//! before they exit; otherwise, their cache is freed with them.
+	void FlushThreadCache();
+
+private:
+
+	typedef std::vector<CIocpContext *> ContextList_t;
+
+	//! A thread's cache. Deletes what it holds when the thread exits.
+	struct CThreadCache
+	{
+		~CThreadCache();
+
+		ContextList_t m_contexts;
+	};
+
+	CThreadCache &GetThreadCache();
+
+	//! Move up to count contexts from the cache to the depot.
+	void Spill(CThreadCache &cache, size_t count);
+
+	thread_specific_ptr<CThreadCache> m_threadCache;
+
+	//! Guards m_depot.
+	mutex m_mutex;
+
+	ContextList_t m_depot;
+};
+
+} } // end namespace
+#endif // CONTEXTPOOL_H_2026_10_18_21_12_40
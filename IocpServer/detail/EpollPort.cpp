@@ -0,0 +1,927 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#include "StdAfx.h"
+#include "EpollPort.h"
+#include "SharedIocpData.h"
+#include "IocpContext.h"
+#include "Connection.h"
+#include "Utils.h"
+#include "../IocpHandler.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <linux/errqueue.h>
+#include <climits>
+
+namespace iocp { namespace detail {
+
+namespace {
+
+	//!************************************************************************
+	//! @details
+	//! Write as much of the context as the socket buffer accepts. The
+	//! context's WSA buffers are advanced past the written bytes, so a
+	//! partially written context can be resumed later. All the buffers of
+	//! a gather send go out in one call. Zero-copy contexts are written 
+	//! with MSG_ZEROCOPY, and each call is numbered.
+	//!
+	//! @return int
+	//! NO_ERROR if the whole context is written, EAGAIN if the socket buffer
+	//! is full, errno otherwise.
+	//!
+	//!************************************************************************
+	int WriteContext(CConnection &c, CIocpContext &sendContext)
+	{
+		SOCKET s = c.m_socket;
+
+		if(true == sendContext.IsFileSend())
+		{
+			return WriteFileContext(s, sendContext);
+		}
+
+		// SO_ZEROCOPY is set the first time the connection needs it.
+		if( (true == sendContext.m_zeroCopy) && (0 == c.m_zeroCopy) )
+		{
+			int enable = 1;
+			c.m_zeroCopy = ::setsockopt(
+				s, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) == 0 ? 
+				1 : -1;
+		}
+
+		bool zeroCopy = (true == sendContext.m_zeroCopy) && (1 == c.m_zeroCopy);
+		if( (true == zeroCopy) && (0 == sendContext.m_zeroCopyCalls) )
+		{
+			sendContext.m_zeroCopyFirst = c.m_zeroCopySeq;
+		}
+
+		while(sendContext.GetRemainingSize() > 0)
+		{
+			// WSABUF has the layout of struct iovec.
+			msghdr msg;
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = reinterpret_cast<iovec *>(
+				sendContext.GetWsaBuffers());
+			msg.msg_iovlen = std::min<size_t>(
+				sendContext.GetNumWsaBuffers(), IOV_MAX);
+
+			ssize_t written = ::sendmsg(
+				s, 
+				&msg, 
+				MSG_NOSIGNAL | (true == zeroCopy ? MSG_ZEROCOPY : 0));
+
+			if(written < 0)
+			{
+				if(EINTR == errno)
+				{
+					continue;
+				}
+
+				// No memory left to pin the pages. Copy the rest.
+				if( (ENOBUFS == errno) && (true == zeroCopy) )
+				{
+					zeroCopy = false;
+					continue;
+				}
+				return errno;
+			}
+
+			if(true == zeroCopy)
+			{
+				++sendContext.m_zeroCopyCalls;
+				++c.m_zeroCopySeq;
+			}
+
+			sendContext.ConsumeWsaBuffers(written);
+		}
+
+		return NO_ERROR;
+	}
+
+	int OpenReserveFd()
+	{
+		return ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+	}
+
+	//! The epoll key of the connection's socket. The listen socket's, for
+	//! NULL.
+	uint64_t KeyOf(CConnection *c)
+	{
+		if(NULL == c)
+		{
+			return CSharedIocpData::ListenKey;
+		}
+
+		return reinterpret_cast<uint64_t>(c);
+	}
+}
+
+CEpollPort::CEpollPort(CSharedIocpData &iocpData)
+: m_iocpData(iocpData)
+, m_epollFd(-1)
+, m_eventFd(-1)
+, m_acceptArmed(false)
+, m_reserveFd(-1)
+, m_acceptSuspended(false)
+, m_workerEpoch(&CEpollPort::KeepWorkerEpoch)
+, m_closed(false)
+, m_reclaimPending(false)
+{
+}
+
+CEpollPort::~CEpollPort()
+{
+	Close();
+
+	for(size_t i = 0; i < m_workerEpochs.size(); ++i)
+	{
+		delete m_workerEpochs[i];
+	}
+}
+
+int CEpollPort::Create()
+{
+	m_epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+	if(m_epollFd < 0)
+	{
+		return errno;
+	}
+
+	m_eventFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(m_eventFd < 0)
+	{
+		return errno;
+	}
+
+	// The eventfd is level triggered. It stays readable for as long as
+	// there are posted packets, so every idle worker may pick them up.
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.u64 = PostedKey;
+
+	if(::epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_eventFd, &ev) != 0)
+	{
+		return errno;
+	}
+
+	m_reserveFd = OpenReserveFd();
+	if(m_reserveFd < 0)
+	{
+		return errno;
+	}
+
+	return NO_ERROR;
+}
+
+void CEpollPort::Close()
+{
+	if(m_eventFd >= 0)
+	{
+		::close(m_eventFd);
+		m_eventFd = -1;
+	}
+
+	if(m_epollFd >= 0)
+	{
+		::close(m_epollFd);
+		m_epollFd = -1;
+	}
+
+	{
+		mutex::scoped_lock l(m_acceptMutex);
+		m_freeAccepts.clear();
+		m_acceptArmed = false;
+
+		if(m_reserveFd >= 0)
+		{
+			::close(m_reserveFd);
+			m_reserveFd = -1;
+		}
+	}
+
+	// No worker thread is left to hold a retired connection.
+	std::vector<CConnection *> reclaimed;
+	{
+		mutex::scoped_lock l(m_retiredMutex);
+		m_closed = true;
+
+		reclaimed.swap(m_retired);
+		reclaimed.insert(reclaimed.end(), m_grace.begin(), m_grace.end());
+		m_grace.clear();
+		m_reclaimPending.store(false);
+	}
+
+	for(size_t i = 0; i < reclaimed.size(); ++i)
+	{
+		delete reclaimed[i];
+	}
+
+	// Discard anything that nobody is going to pick up.
+	mutex::scoped_lock l(m_postedMutex);
+	while(false == m_postedPackets.empty())
+	{
+		CIocpContext *context = m_postedPackets.front().m_context;
+		m_postedPackets.pop_front();
+
+		// Disconnect contexts are not owned by anyone else.
+		if(NULL != context && CIocpContext::Disconnect == context->m_type)
+		{
+			delete context;
+		}
+	}
+}
+
+int CEpollPort::Associate(SOCKET s, CConnection *c)
+{
+	// Register with no interest. Events are armed by the Post* functions
+	// once an operation is outstanding.
+	epoll_event ev;
+	ev.events = EPOLLONESHOT;
+	ev.data.u64 = KeyOf(c);
+
+	if(::epoll_ctl(m_epollFd, EPOLL_CTL_ADD, s, &ev) != 0)
+	{
+		return errno;
+	}
+
+	if(NULL != c)
+	{
+		c->m_completionPort = m_iocpData.m_completionPort;
+	}
+
+	return NO_ERROR;
+}
+
+int CEpollPort::PostAccept(CIocpContext &acceptContext)
+{
+	mutex::scoped_lock l(m_acceptMutex);
+
+	m_freeAccepts.push_back(&acceptContext);
+
+	// Still waiting on the listen socket for the other contexts, or for
+	// a connection to close.
+	if( (true == m_acceptArmed) || (true == m_acceptSuspended.load()) )
+	{
+		return NO_ERROR;
+	}
+
+	return ArmListenSocket();
+}
+
+int CEpollPort::ArmListenSocket()
+{
+	epoll_event ev;
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.u64 = CSharedIocpData::ListenKey;
+
+	if(::epoll_ctl(
+		m_epollFd,
+		EPOLL_CTL_MOD,
+		m_iocpData.m_listenSocket,
+		&ev) != 0)
+	{
+		return errno;
+	}
+
+	m_acceptArmed = true;
+	return NO_ERROR;
+}
+
+int CEpollPort::PostRecv(CConnection &c)
+{
+	mutex::scoped_lock l(c.m_connectionMutex);
+
+	c.m_rcvPosted = true;
+
+	int lastError = Rearm(c);
+	if(NO_ERROR != lastError)
+	{
+		c.m_rcvPosted = false;
+		return lastError;
+	}
+
+	return WSA_IO_PENDING;
+}
+
+int CEpollPort::PostSend(CConnection &c, CIocpContext &sendContext)
+{
+	mutex::scoped_lock l(c.m_connectionMutex);
+
+	// Like an overlapped WSASend, try to complete right away. This is only
+	// allowed when nothing is queued ahead, otherwise data is reordered.
+	if(c.m_pendingSends.empty())
+	{
+		int lastError = WriteContext(c, sendContext);
+
+		if(NO_ERROR == lastError)
+		{
+			CompleteWrite(c, Packet(
+				&sendContext,
+				static_cast<DWORD>(sendContext.GetSendSize())));
+			return WSA_IO_PENDING;
+		}
+
+		if(EAGAIN != lastError)
+		{
+			// Nothing went out, so fail the call and let the user recover
+			// the data. Otherwise, report it as a failed completion.
+			if(sendContext.GetRemainingSize() == sendContext.GetSendSize())
+			{
+				return lastError;
+			}
+
+			CompleteWrite(c, Packet(&sendContext, 0));
+			return WSA_IO_PENDING;
+		}
+	}
+
+	c.m_pendingSends.push_back(&sendContext);
+
+	int lastError = Rearm(c);
+	if(NO_ERROR != lastError)
+	{
+		c.m_pendingSends.pop_back();
+		return lastError;
+	}
+
+	return WSA_IO_PENDING;
+}
+
+void CEpollPort::PostCompletion(CIocpContext *context, DWORD bytesTransferred)
+{
+	mutex::scoped_lock l(m_postedMutex);
+
+	bool wasEmpty = m_postedPackets.empty();
+
+	m_postedPackets.push_back(Packet(context, bytesTransferred));
+
+	// Only the empty to non-empty transition needs a wake up. Workers
+	// drain the whole queue each time they see the eventfd.
+	if(true == wasEmpty)
+	{
+		uint64_t one = 1;
+		ssize_t rc = ::write(m_eventFd, &one, sizeof(one));
+		(void)rc;
+	}
+}
+
+int CEpollPort::GetQueuedCompletions(PacketList_t &packets, DWORD timeout)
+{
+	epoll_event events[MaxEvents];
+
+	CWorkerEpoch &workerEpoch = GetWorkerEpoch();
+
+	for(;;)
+	{
+		// Odd until the events are handled. The packets only hold contexts
+		// that are outstanding, which keep their connection.
+		workerEpoch.m_epoch.fetch_add(1);
+
+		// Never without end, so that the epoch moves on on a quiet server.
+		bool reclaimPending = m_reclaimPending.load(boost::memory_order_relaxed);
+		DWORD waitTime = timeout;
+		if(INFINITE == timeout)
+		{
+			waitTime = true == reclaimPending ? ReclaimWait : IdleWait;
+		}
+
+		int numEvents = ::epoll_wait(
+			m_epollFd, 
+			events, 
+			MaxEvents, 
+			static_cast<int>(waitTime));
+		int lastError = numEvents < 0 ? errno : NO_ERROR;
+
+		for(int i = 0; i < numEvents; ++i)
+		{
+			uint64_t key = events[i].data.u64;
+
+			if(PostedKey == key)
+			{
+				DrainPostedPackets(packets);
+			}
+			else if(CSharedIocpData::ListenKey == key)
+			{
+				HandleListenSocket(packets);
+			}
+			else
+			{
+				HandleSocket(
+					*reinterpret_cast<CConnection *>(key), 
+					events[i].events, 
+					packets);
+			}
+		}
+
+		uint64_t epoch = workerEpoch.m_epoch.fetch_add(1) + 1;
+
+		// A worker with nothing else to do tries every time.
+		if( (true == m_reclaimPending.load(boost::memory_order_relaxed)) &&
+			( (0 == numEvents) || (0 == (epoch / 2) % ReclaimInterval) ) )
+		{
+			Reclaim();
+		}
+
+		if(EINTR == lastError)
+		{
+			continue;
+		}
+
+		if(NO_ERROR != lastError)
+		{
+			return lastError;
+		}
+
+		// Spurious wake ups (another worker drained the posted queue, or
+		// a socket was not ready after all) go back to waiting, unless the
+		// wait is timed, in which case the caller decides.
+		if(false == packets.empty())
+		{
+			return NO_ERROR;
+		}
+
+		if(INFINITE != timeout)
+		{
+			return WAIT_TIMEOUT;
+		}
+	}
+}
+
+void CEpollPort::DrainPostedPackets(PacketList_t &packets)
+{
+	mutex::scoped_lock l(m_postedMutex);
+
+	while(false == m_postedPackets.empty())
+	{
+		Packet p = m_postedPackets.front();
+		m_postedPackets.pop_front();
+		packets.push_back(p);
+
+		// Each shutdown packet is meant for exactly one worker thread.
+		if(NULL == p.m_context)
+		{
+			break;
+		}
+	}
+
+	if(true == m_postedPackets.empty())
+	{
+		uint64_t value = 0;
+		ssize_t rc = ::read(m_eventFd, &value, sizeof(value));
+		(void)rc;
+	}
+}
+
+void CEpollPort::HandleListenSocket(PacketList_t &packets)
+{
+	int lastError = NO_ERROR;
+
+	{
+		mutex::scoped_lock l(m_acceptMutex);
+
+		// EPOLLONESHOT disarmed the listen socket.
+		m_acceptArmed = false;
+
+		// The error leaves the connection in the backlog, and the listen
+		// socket ready. Arming it again would only repeat the error.
+		bool suspend = false;
+
+		// Take as many connections off the backlog as there are free accept
+		// contexts, rather than one per wake up. The contexts are posted
+		// again by the accept handler, exactly like AcceptEx is re-posted
+		// on Windows.
+		while(false == m_freeAccepts.empty())
+		{
+			SOCKET s = ::accept4(
+				m_iocpData.m_listenSocket,
+				NULL,
+				NULL,
+				SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+			if(INVALID_SOCKET == s)
+			{
+				int error = errno;
+
+				// The client already gave up. Try the next one.
+				if( (EINTR == error) || (true == IsAcceptedConnectionError(error)) )
+				{
+					continue;
+				}
+
+				// EAGAIN means the backlog is empty.
+				if(EAGAIN == error)
+				{
+					break;
+				}
+
+				lastError = error;
+
+				// Out of file descriptors. Turn the connection away rather
+				// than leave it in the backlog, which keeps the listen 
+				// socket ready. Accept fails the same once the backlog is 
+				// empty.
+				if( (EMFILE == error) || (ENFILE == error) )
+				{
+					error = DropPendingConnection();
+
+					if( (NO_ERROR == error) || 
+						(true == IsAcceptedConnectionError(error)) )
+					{
+						continue;
+					}
+
+					if(EAGAIN == error)
+					{
+						break;
+					}
+				}
+
+				suspend = true;
+				break;
+			}
+
+			CIocpContext *acceptContext = m_freeAccepts.back();
+			m_freeAccepts.pop_back();
+
+			acceptContext->m_socket = s;
+			packets.push_back(Packet(acceptContext, 0));
+		}
+
+		// Otherwise, the next PostAccept arms it, or the next connection 
+		// to close.
+		if(true == suspend)
+		{
+			m_acceptSuspended.store(true);
+		}
+		else if(false == m_freeAccepts.empty())
+		{
+			int armError = ArmListenSocket();
+			if(NO_ERROR != armError)
+			{
+				lastError = armError;
+			}
+		}
+	}
+
+	if(NO_ERROR != lastError && m_iocpData.m_iocpHandler != NULL)
+	{
+		m_iocpData.m_iocpHandler->OnServerError(lastError);
+	}
+}
+
+int CEpollPort::DropPendingConnection()
+{
+	if(m_reserveFd < 0)
+	{
+		return EMFILE;
+	}
+
+	::close(m_reserveFd);
+
+	int error = NO_ERROR;
+
+	SOCKET s;
+	do
+	{
+		s = ::accept4(m_iocpData.m_listenSocket, NULL, NULL, SOCK_CLOEXEC);
+	} while( (INVALID_SOCKET == s) && (EINTR == errno) );
+
+	if(INVALID_SOCKET == s)
+	{
+		error = errno;
+	}
+	else
+	{
+		::close(s);
+	}
+
+	// Another thread may have taken the descriptor meanwhile. There is no
+	// reserve then until a connection is closed.
+	m_reserveFd = OpenReserveFd();
+
+	return error;
+}
+
+void CEpollPort::ResumeAccept()
+{
+	int lastError = NO_ERROR;
+
+	{
+		mutex::scoped_lock l(m_acceptMutex);
+
+		if(false == m_acceptSuspended.load())
+		{
+			return;
+		}
+
+		m_acceptSuspended.store(false);
+
+		if(m_reserveFd < 0)
+		{
+			m_reserveFd = OpenReserveFd();
+		}
+
+		if( (false == m_acceptArmed) && (false == m_freeAccepts.empty()) )
+		{
+			lastError = ArmListenSocket();
+		}
+	}
+
+	if(NO_ERROR != lastError && m_iocpData.m_iocpHandler != NULL)
+	{
+		m_iocpData.m_iocpHandler->OnServerError(lastError);
+	}
+}
+
+void CEpollPort::HandleSocket(CConnection &c, uint32_t events, PacketList_t &packets)
+{
+	mutex::scoped_lock l(c.m_connectionMutex);
+
+	// The event was taken just before the connection was retired.
+	if(INVALID_SOCKET == c.m_socket)
+	{
+		return;
+	}
+
+	// EPOLLONESHOT disarmed the socket when this event was delivered.
+	c.m_pollEvents = 0;
+
+	if( (true == c.m_rcvPosted) &&
+		(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) )
+	{
+		CIocpContext &rcvContext = c.m_rcvContext;
+
+		// Idle connections hold no buffer. Only take one now that there
+		// is something to read.
+		m_iocpData.m_bufferPool->Bind(rcvContext);
+
+		ssize_t bytesRead = 0;
+		do
+		{
+			bytesRead = ::recv(
+				c.m_socket,
+				rcvContext.m_wsaBuffer.buf,
+				rcvContext.m_wsaBuffer.len,
+				0);
+		} while(bytesRead < 0 && EINTR == errno);
+
+		if(bytesRead >= 0 || EAGAIN != errno)
+		{
+			// 0 bytes (or an error) is how IOCP reports a closed socket.
+			c.m_rcvPosted = false;
+			packets.push_back(Packet(
+				&rcvContext,
+				bytesRead > 0 ? static_cast<DWORD>(bytesRead) : 0));
+		}
+		else
+		{
+			m_iocpData.m_bufferPool->Release(rcvContext);
+		}
+	}
+
+	if( (false == c.m_pendingSends.empty()) &&
+		(events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) )
+	{
+		HandleWrite(c, packets);
+	}
+
+	// Zero-copy notifications come through the error queue.
+	if( (1 == c.m_zeroCopy) && (events & EPOLLERR) )
+	{
+		ReadZeroCopyNotifications(c, packets);
+	}
+
+	int lastError = Rearm(c);
+	if(NO_ERROR != lastError && m_iocpData.m_iocpHandler != NULL)
+	{
+		m_iocpData.m_iocpHandler->OnServerError(lastError);
+	}
+}
+
+void CEpollPort::HandleWrite(CConnection &c, PacketList_t &packets)
+{
+	while(false == c.m_pendingSends.empty())
+	{
+		CIocpContext &sendContext = *c.m_pendingSends.front();
+
+		int lastError = WriteContext(c, sendContext);
+		if(EAGAIN == lastError)
+		{
+			break;
+		}
+
+		// A failed send completes with 0 bytes, same as IOCP. The contexts
+		// queued behind it will fail the same way.
+		c.m_pendingSends.pop_front();
+
+		Packet packet(
+			&sendContext,
+			NO_ERROR == lastError ?
+				static_cast<DWORD>(sendContext.GetSendSize()) : 0);
+
+		if(false == c.HoldZeroCopySend(packet))
+		{
+			packets.push_back(packet);
+		}
+	}
+}
+
+void CEpollPort::CompleteWrite(CConnection &c, Packet const &packet)
+{
+	if(false == c.HoldZeroCopySend(packet))
+	{
+		PostCompletion(packet.m_context, packet.m_bytesTransferred);
+		return;
+	}
+
+	// Wait for the notification.
+	int lastError = Rearm(c);
+	if(NO_ERROR != lastError && m_iocpData.m_iocpHandler != NULL)
+	{
+		m_iocpData.m_iocpHandler->OnServerError(lastError);
+	}
+}
+
+void CEpollPort::ReadZeroCopyNotifications(CConnection &c, PacketList_t &packets)
+{
+	for(;;)
+	{
+		char control[CMSG_SPACE(sizeof(sock_extended_err)) + 
+			CMSG_SPACE(sizeof(sockaddr_in))];
+
+		msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if(::recvmsg(c.m_socket, &msg, MSG_ERRQUEUE) < 0)
+		{
+			if(EINTR == errno)
+			{
+				continue;
+			}
+			break;
+		}
+
+		for(cmsghdr *cm = CMSG_FIRSTHDR(&msg); NULL != cm; 
+			cm = CMSG_NXTHDR(&msg, cm))
+		{
+			if(SOL_IP != cm->cmsg_level || IP_RECVERR != cm->cmsg_type)
+			{
+				continue;
+			}
+
+			// The calls numbered ee_info to ee_data are done with.
+			sock_extended_err const *err = 
+				reinterpret_cast<sock_extended_err const *>(CMSG_DATA(cm));
+
+			if( (0 == err->ee_errno) && 
+				(SO_EE_ORIGIN_ZEROCOPY == err->ee_origin) )
+			{
+				c.ZeroCopyNotified(err->ee_info, err->ee_data);
+			}
+		}
+	}
+
+	c.ReleaseZeroCopySends(packets);
+}
+
+int CEpollPort::Rearm(CConnection &c)
+{
+	uint32_t events = 0;
+
+	if(true == c.m_rcvPosted)
+	{
+		events |= EPOLLIN | EPOLLRDHUP;
+	}
+
+	if(false == c.m_pendingSends.empty())
+	{
+		events |= EPOLLOUT;
+	}
+
+	if(false == c.m_zeroCopySends.empty())
+	{
+		events |= EPOLLERR;
+	}
+
+	// Nothing outstanding, or already armed for exactly this. If the event
+	// is being delivered right now, its handler re-arms when it is done.
+	if(0 == events || c.m_pollEvents == events)
+	{
+		return NO_ERROR;
+	}
+
+	epoll_event ev;
+	ev.events = events | EPOLLONESHOT;
+	ev.data.u64 = KeyOf(&c);
+
+	if(::epoll_ctl(m_epollFd, EPOLL_CTL_MOD, c.m_socket, &ev) != 0)
+	{
+		return errno;
+	}
+
+	c.m_pollEvents = events;
+
+	return NO_ERROR;
+}
+
+void CEpollPort::Retire(CConnection *c)
+{
+	// The socket leaves epoll with the close. Only the events taken 
+	// before may still come to the connection.
+	{
+		mutex::scoped_lock l(c->m_connectionMutex);
+		closesocket(c->m_socket);
+		c->m_socket = INVALID_SOCKET;
+	}
+
+	// A file descriptor is free again, as may be whatever else accept ran
+	// out of.
+	if(true == m_acceptSuspended.load(boost::memory_order_relaxed))
+	{
+		ResumeAccept();
+	}
+
+	{
+		mutex::scoped_lock l(m_retiredMutex);
+		if(false == m_closed)
+		{
+			m_retired.push_back(c);
+			m_reclaimPending.store(true);
+			return;
+		}
+	}
+
+	delete c;
+}
+
+CEpollPort::CWorkerEpoch & CEpollPort::GetWorkerEpoch()
+{
+	CWorkerEpoch *workerEpoch = m_workerEpoch.get();
+	if(NULL == workerEpoch)
+	{
+		workerEpoch = new CWorkerEpoch;
+		m_workerEpoch.reset(workerEpoch);
+
+		mutex::scoped_lock l(m_retiredMutex);
+		m_workerEpochs.push_back(workerEpoch);
+	}
+
+	return *workerEpoch;
+}
+
+void CEpollPort::KeepWorkerEpoch(CWorkerEpoch *)
+{
+}
+
+void CEpollPort::Reclaim()
+{
+	std::vector<CConnection *> reclaimed;
+	{
+		// Another worker is at it.
+		mutex::scoped_try_lock l(m_retiredMutex);
+		if(false == l.owns_lock())
+		{
+			return;
+		}
+
+		// A worker that was waiting, or handling events, when m_grace was
+		// started may still hold one of them until it is done. A worker 
+		// that waits from then on takes no event of a closed socket. One
+		// with no event holds m_grace back until its wait times out, 
+		// IdleWait at most.
+		for(size_t i = 0; i < m_graceEpochs.size(); ++i)
+		{
+			uint64_t epoch = m_graceEpochs[i];
+
+			if( (1 == (epoch & 1)) && 
+				(epoch == m_workerEpochs[i]->m_epoch.load()) )
+			{
+				return;
+			}
+		}
+
+		reclaimed.swap(m_grace);
+		m_grace.swap(m_retired);
+
+		m_graceEpochs.resize(m_workerEpochs.size());
+		for(size_t i = 0; i < m_workerEpochs.size(); ++i)
+		{
+			m_graceEpochs[i] = m_workerEpochs[i]->m_epoch.load();
+		}
+
+		m_reclaimPending.store(false == m_grace.empty());
+	}
+
+	for(size_t i = 0; i < reclaimed.size(); ++i)
+	{
+		delete reclaimed[i];
+	}
+}
+
+} } // end namespace
@@ -0,0 +1,203 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef EPOLLPORT_H_2026_10_18_09_40_12
+#define EPOLLPORT_H_2026_10_18_09_40_12
+
+#include "CompletionPort.h"
+#include "RingQueue.h"
+
+namespace iocp { namespace detail { class CSharedIocpData; } };
+
+namespace iocp { namespace detail {
+
+//! @details
+//! Emulates an IO completion port on top of epoll, so that the worker
+//! threads see the same completion packets as they do on Windows.
+//!
+//! Every socket is registered once with EPOLLONESHOT. The operations
+//! outstanding on a connection (its receive context and its ordered list
+//! of unwritten send contexts) decide which events are re-armed. When a
+//! socket becomes ready, the worker thread performs the non-blocking
+//! system call on behalf of the context and turns the result into a
+//! completion packet.
+//!
+//! Packets that do not come from a socket (disconnect contexts, sends
+//! that were written immediately, shutdown) are posted to a queue that
+//! is signaled through an eventfd, like PostQueuedCompletionStatus.
+//!
+//! Zero-copy sends are written with MSG_ZEROCOPY. Once written, they wait
+//! for the kernel's notification on the socket's error queue, signaled 
+//! by EPOLLERR, before they complete.
+//!
+//! A connection's socket is keyed by the connection's address, so an 
+//! event needs no lookup. An event may be taken from epoll just before
+//! the last reference to its connection goes, so connections are retired
+//! rather than deleted: the socket is closed at once, and the memory is 
+//! freed once every worker thread has handled the events it took until 
+//! then. Each worker counts its waits for that (see CWorkerEpoch), on its
+//! own cache line, and the connection's count is never touched.
+class CEpollPort : public CCompletionPort
+{
+public:
+
+	explicit CEpollPort(CSharedIocpData &iocpData);
+
+	~CEpollPort();
+
+	virtual int Create();
+
+	virtual void Close();
+
+	virtual int Associate(SOCKET s, CConnection *c);
+
+	virtual int PostAccept(CIocpContext &acceptContext);
+
+	virtual int PostRecv(CConnection &c);
+
+	virtual int PostSend(CConnection &c, CIocpContext &sendContext);
+
+	virtual void PostCompletion(CIocpContext *context, DWORD bytesTransferred);
+
+	virtual int GetQueuedCompletions(PacketList_t &packets, DWORD timeout);
+
+	//! Close the socket, and free the connection once no worker thread 
+	//! can still hold an event of it.
+	virtual void Retire(CConnection *c);
+
+private:
+
+	//! @details
+	//! A worker thread's count of its waits for events. Odd from the start
+	//! of a wait until the events it returned are handled, which is when
+	//! the thread may hold a connection retired meanwhile. Only its thread
+	//! writes it.
+	struct CWorkerEpoch
+	{
+		CWorkerEpoch()
+			: m_epoch(0)
+		{
+		}
+
+		atomic<uint64_t> m_epoch;
+
+		//! Keeps the next one off the cache line.
+		char m_padding[64];
+	};
+
+	enum 
+	{ 
+		MaxEvents = 16,
+
+		//! A worker tries to free retired connections once in this many
+		//! waits, as it reads every other worker's epoch to do so.
+		ReclaimInterval = 16,
+
+		//! The longest a worker waits for events at once, in milliseconds,
+		//! and while there are retired connections to free. A worker that
+		//! waited through their retirement holds them until it wakes up.
+		IdleWait = 1000,
+		ReclaimWait = 10,
+	};
+
+	//! epoll key of the eventfd that signals m_postedPackets
+	static uint64_t const PostedKey = ~0ULL;
+
+	void DrainPostedPackets(PacketList_t &packets);
+
+	//! m_acceptMutex must be held.
+	int ArmListenSocket();
+
+	void HandleListenSocket(PacketList_t &packets);
+
+	//! Out of file descriptors, take the next connection off the backlog
+	//! with the reserve descriptor, and close it. Returns NO_ERROR, or the
+	//! error of accept, EMFILE if there is no reserve descriptor. 
+	//! m_acceptMutex must be held.
+	int DropPendingConnection();
+
+	//! Arm the listen socket again after an accept error, once a connection
+	//! is closed.
+	void ResumeAccept();
+
+	void HandleSocket(CConnection &c, uint32_t events, PacketList_t &packets);
+
+	void HandleWrite(CConnection &c, PacketList_t &packets);
+
+	//! Post the completion of a context written from PostSend, or hold it
+	//! back if the kernel still reads its buffers.
+	void CompleteWrite(CConnection &c, Packet const &packet);
+
+	//! Read MSG_ZEROCOPY notifications, and complete the contexts that the
+	//! kernel is done with.
+	void ReadZeroCopyNotifications(CConnection &c, PacketList_t &packets);
+
+	int Rearm(CConnection &c);
+
+	//! The calling worker thread's, registered on first use.
+	CWorkerEpoch &GetWorkerEpoch();
+
+	//! m_workerEpoch does not own them, m_workerEpochs does.
+	static void KeepWorkerEpoch(CWorkerEpoch *);
+
+	//! Free the retired connections that no worker thread can reach any
+	//! more, and start the wait for the ones retired since.
+	void Reclaim();
+
+private:
+
+	CSharedIocpData &m_iocpData;
+
+	int m_epollFd;
+
+	int m_eventFd;
+
+	mutex m_postedMutex;
+
+	CRingQueue<Packet> m_postedPackets;
+
+	//! Guards the members below.
+	mutex m_acceptMutex;
+
+	//! true while the listen socket is armed in epoll
+	bool m_acceptArmed;
+
+	//! accept contexts waiting for a connection
+	std::vector<CIocpContext *> m_freeAccepts;
+
+	//! Open on /dev/null, to be closed for DropPendingConnection. -1 if it
+	//! could not be opened again since.
+	int m_reserveFd;
+
+	//! true while the listen socket is left disarmed after an accept error
+	//! that would repeat at once, the connection still in the backlog. 
+	//! Read without the lock by Retire.
+	atomic<bool> m_acceptSuspended;
+
+	thread_specific_ptr<CWorkerEpoch> m_workerEpoch;
+
+	//! Guards the members below.
+	mutex m_retiredMutex;
+
+	//! One per worker thread that ever waited, deleted with the port.
+	std::vector<CWorkerEpoch *> m_workerEpochs;
+
+	//! Connections retired since the last Reclaim.
+	std::vector<CConnection *> m_retired;
+
+	//! Connections retired before it, and the worker epochs as of then. 
+	//! They are freed once no worker is still in the wait it was in.
+	std::vector<CConnection *> m_grace;
+	std::vector<uint64_t> m_graceEpochs;
+
+	//! true once Close is called. Connections are deleted right away.
+	bool m_closed;
+
+	//! m_retired or m_grace is not empty. Read without the lock.
+	atomic<bool> m_reclaimPending;
+};
+
+} } // end namespace
+#endif // EPOLLPORT_H_2026_10_18_09_40_12
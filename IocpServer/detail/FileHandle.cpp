@@ -0,0 +1,57 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#include "StdAfx.h"
+#include "FileHandle.h"
+
+namespace iocp { namespace detail {
+
+shared_ptr<CFileHandle> CFileHandle::Duplicate( HANDLE file )
+{
+	HANDLE duplicate = INVALID_HANDLE_VALUE;
+
+#if defined(_WIN32)
+	if(FALSE == ::DuplicateHandle(
+		::GetCurrentProcess(), 
+		file, 
+		::GetCurrentProcess(), 
+		&duplicate, 
+		0, 
+		FALSE, 
+		DUPLICATE_SAME_ACCESS))
+	{
+		return shared_ptr<CFileHandle>();
+	}
+#else
+	duplicate = ::fcntl(file, F_DUPFD_CLOEXEC, 0);
+	if(duplicate < 0)
+	{
+		return shared_ptr<CFileHandle>();
+	}
+#endif
+
+	return shared_ptr<CFileHandle>(new CFileHandle(duplicate));
+}
+
+CFileHandle::CFileHandle( HANDLE file )
+: m_file(file)
+{
+}
+
+CFileHandle::~CFileHandle()
+{
+#if defined(_WIN32)
+	::CloseHandle(m_file);
+#else
+	::close(m_file);
+#endif
+}
+
+HANDLE CFileHandle::Get() const
+{
+	return m_file;
+}
+
+} } // end namespace
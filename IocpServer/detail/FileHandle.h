@@ -0,0 +1,35 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef FILEHANDLE_H_2026_10_18_20_12_44
+#define FILEHANDLE_H_2026_10_18_20_12_44
+
+namespace iocp { namespace detail {
+
+//! @details
+//! The server's own copy of a file handle passed to SendFile, so that 
+//! the user may close theirs as soon as SendFile returns. The send 
+//! contexts that read from the file share it, and the last one to go 
+//! closes it.
+class CFileHandle : boost::noncopyable
+{
+public:
+
+	//! Duplicate file. NULL on failure, with the error in GetLastError().
+	static shared_ptr<CFileHandle> Duplicate(HANDLE file);
+
+	~CFileHandle();
+
+	HANDLE Get() const;
+
+private:
+
+	explicit CFileHandle(HANDLE file);
+
+	HANDLE m_file;
+};
+
+} } // end namespace
+#endif // FILEHANDLE_H_2026_10_18_20_12_44
@@ -0,0 +1,125 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#include "StdAfx.h"
+#include "HostNameCache.h"
+#include "Utils.h"
+
+namespace iocp { namespace detail {
+
+CHostNameCache::CHostNameCache(size_t capacity)
+: m_capacity(capacity)
+{
+	assert(m_capacity > 0);
+}
+
+bool CHostNameCache::Find(uint32_t address, tstring &hostName)
+{
+	mutex::scoped_lock l(m_mutex);
+
+	LruMap_t::iterator itr = m_index.find(address);
+	if(m_index.end() == itr)
+	{
+		return false;
+	}
+
+	CEntry &entry = *itr->second;
+	if(0 != entry.m_expiry && GetMilliseconds() >= entry.m_expiry)
+	{
+		m_lru.erase(itr->second);
+		m_index.erase(itr);
+		return false;
+	}
+
+	// Move it to the front. splice() keeps the iterator valid.
+	m_lru.splice(m_lru.begin(), m_lru, itr->second);
+
+	hostName = entry.m_hostName;
+	return true;
+}
+
+bool CHostNameCache::Resolve(uint32_t address, tstring &hostName)
+{
+	if(true == Find(address, hostName))
+	{
+		return false == hostName.empty();
+	}
+
+	sockaddr_in name;
+	memset(&name, 0, sizeof(name));
+	name.sin_family = AF_INET;
+	name.sin_addr.s_addr = address;
+
+	// The lock is not held here. Concurrent misses on the same address
+	// resolve it twice, which is harmless.
+	TCHAR resolved[NI_MAXHOST] = {0};
+
+#ifdef UNICODE
+	if(GetNameInfoW(
+		(sockaddr *) &name,
+		sizeof (name), 
+		resolved, // hostname
+		NI_MAXHOST, // size of host name
+		NULL,  // no service info
+		0,
+		0) != 0)
+#else
+	if(getnameinfo(
+		(sockaddr *) &name,
+		sizeof (name), 
+		resolved, // hostname
+		NI_MAXHOST, // size of host name
+		NULL,  // no service info
+		0,
+		0) != 0)
+#endif 
+	{
+		resolved[0] = 0;
+	}
+
+	hostName = resolved;
+
+	uint64_t expiry = 0;
+	if(true == hostName.empty())
+	{
+		expiry = GetMilliseconds() + FailureLifetime;
+	}
+
+	Insert(address, hostName, expiry);
+
+	return false == hostName.empty();
+}
+
+void CHostNameCache::Insert(uint32_t address, 
+							tstring const &hostName, 
+							uint64_t expiry)
+{
+	mutex::scoped_lock l(m_mutex);
+
+	LruMap_t::iterator itr = m_index.find(address);
+	if(m_index.end() != itr)
+	{
+		itr->second->m_hostName = hostName;
+		itr->second->m_expiry = expiry;
+		m_lru.splice(m_lru.begin(), m_lru, itr->second);
+		return;
+	}
+
+	if(m_index.size() >= m_capacity)
+	{
+		m_index.erase(m_lru.back().m_address);
+		m_lru.pop_back();
+	}
+
+	CEntry entry;
+	entry.m_address = address;
+	entry.m_hostName = hostName;
+	entry.m_expiry = expiry;
+
+	m_lru.push_front(entry);
+	m_index[address] = m_lru.begin();
+}
+
+} } // end namespace
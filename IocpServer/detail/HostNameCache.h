@@ -0,0 +1,68 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef HOSTNAMECACHE_H_2026_10_18_16_02_44
+#define HOSTNAMECACHE_H_2026_10_18_16_02_44
+
+namespace iocp { namespace detail {
+
+//! @details
+//! Reverse DNS results by IPv4 address, least recently used first out.
+//! Failed lookups are cached as well, so that an address without a name
+//! does not go to the resolver every time, but only for FailureLifetime:
+//! the resolver may only have been unreachable.
+class CHostNameCache : boost::noncopyable
+{
+public:
+
+	enum
+	{
+		//! How long a failed lookup is cached, in milliseconds.
+		FailureLifetime = 30 * 1000,
+	};
+
+	explicit CHostNameCache(size_t capacity);
+
+	//! Look up an address without resolving it. Returns false if the
+	//! address has not been resolved yet, or if its failure has expired.
+	bool Find(uint32_t address, tstring &hostName);
+
+	//! Look up an address, and resolve it on a miss. This blocks for as
+	//! long as the resolver takes. Returns false if it has no name.
+	bool Resolve(uint32_t address, tstring &hostName);
+
+private:
+
+	//! expiry is 0 for entries that do not expire.
+	void Insert(uint32_t address, tstring const &hostName, uint64_t expiry);
+
+	struct CEntry
+	{
+		uint32_t m_address;
+		tstring m_hostName;
+
+		//! GetMilliseconds() when the entry is dropped, or 0 for never.
+		uint64_t m_expiry;
+	};
+
+	typedef std::list<CEntry> LruList_t;
+
+	typedef std::map<
+		uint32_t,
+		LruList_t::iterator
+	> LruMap_t;
+
+	size_t m_capacity;
+
+	//! most recently used first
+	LruList_t m_lru;
+
+	LruMap_t m_index;
+
+	mutex m_mutex;
+};
+
+} } // end namespace
+#endif // HOSTNAMECACHE_H_2026_10_18_16_02_44
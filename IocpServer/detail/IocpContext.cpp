@@ -1,43 +1,235 @@
-//! Copyright Alan Ning 2010
-//! Distributed under the Boost Software License, Version 1.0.
-//! (See accompanying file LICENSE_1_0.txt or copy at
-//! http://www.boost.org/LICENSE_1_0.txt)
-
-#include "StdAfx.h"
-#include "IocpContext.h"
-
-namespace iocp { namespace detail {
-
-CIocpContext::CIocpContext(SOCKET socket, 
-						   uint64_t cid, 
-						   CIocpContext::Type t,
-						   uint32_t rcvBufferSize)
-: m_socket(socket)
-, m_cid(cid)
-, m_type(t)
-, m_rcvBufferSize(rcvBufferSize)
-{
-	if(Rcv == t || Accept == t)
-	{
-		m_data.resize(m_rcvBufferSize);
-		ResetWsaBuf();
-	}
-	
-	// Clear out the overlapped struct. Apparently, you must be do this, 
-	// otherwise the overlap object will be rejected.
-	memset(this, 0, sizeof(OVERLAPPED));
-}
-
-CIocpContext::~CIocpContext()
-{
-}
-
-void CIocpContext::ResetWsaBuf()
-{
-	m_wsaBuffer.buf = reinterpret_cast<char *>(&m_data[0]);
-	m_wsaBuffer.len = static_cast<u_long>(
-		m_data.size() * sizeof(m_data[0])
-		);
-}
-
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#include "StdAfx.h"
+#include "IocpContext.h"
+
+namespace iocp { namespace detail {
+
+CSendQueueNode::CSendQueueNode()
+: m_next(NULL)
+{
+}
+
+CIocpContext::CIocpContext(SOCKET socket, 
+						   uint64_t cid, 
+						   CIocpContext::Type t,
+						   uint32_t rcvBufferSize)
+: m_socket(socket)
+, m_cid(cid)
+, m_connection(NULL)
+, m_type(t)
+, m_rcvBufferSize(rcvBufferSize)
+, m_firstWsaBuffer(0)
+, m_fileOffset(0)
+, m_fileSize(0)
+, m_fileRemaining(0)
+, m_windowed(false)
+{
+	// Receive contexts get their buffer from CBufferPool, and only while 
+	// a receive is outstanding.
+	if(Accept == t)
+	{
+		m_data.resize(m_rcvBufferSize);
+	}
+
+	ResetWsaBuf();
+	
+#if !defined(_WIN32)
+	m_zeroCopy = false;
+	m_zeroCopyFirst = 0;
+	m_zeroCopyCalls = 0;
+	m_zeroCopyDone = 0;
+	m_pipe[0] = -1;
+	m_pipe[1] = -1;
+	m_pipeBytes = 0;
+#endif
+
+#if defined(_WIN32)
+	// Clear out the overlapped struct. Apparently, you must be do this, 
+	// otherwise the overlap object will be rejected.
+	memset(this, 0, sizeof(OVERLAPPED));
+#endif
+}
+
+CIocpContext::~CIocpContext()
+{
+#if !defined(_WIN32)
+	if(m_pipe[0] >= 0)
+	{
+		::close(m_pipe[0]);
+		::close(m_pipe[1]);
+	}
+#endif
+}
+
+void CIocpContext::Reset(SOCKET socket, uint64_t cid)
+{
+	assert(Send == m_type);
+
+	m_socket = socket;
+	m_cid = cid;
+	m_connection = NULL;
+
+	std::vector<uint8_t>().swap(m_data);
+	m_sharedData = CSharedBuffer();
+	m_gatherData.clear();
+
+	m_file.reset();
+	m_fileOffset = 0;
+	m_fileSize = 0;
+	m_fileRemaining = 0;
+
+	m_next.store(NULL, boost::memory_order_relaxed);
+	m_windowed = false;
+
+	ResetWsaBuf();
+
+#if !defined(_WIN32)
+	m_zeroCopy = false;
+	m_zeroCopyFirst = 0;
+	m_zeroCopyCalls = 0;
+	m_zeroCopyDone = 0;
+	if(m_pipe[0] >= 0)
+	{
+		::close(m_pipe[0]);
+		::close(m_pipe[1]);
+		m_pipe[0] = -1;
+		m_pipe[1] = -1;
+	}
+	m_pipeBytes = 0;
+#endif
+
+#if defined(_WIN32)
+	memset(static_cast<OVERLAPPED *>(this), 0, sizeof(OVERLAPPED));
+#endif
+}
+
+void CIocpContext::ResetWsaBuf()
+{
+	std::vector<uint8_t> const &data = 
+		m_sharedData.IsEmpty() ? m_data : m_sharedData.GetData();
+
+	// Sends only read from the buffer.
+	m_wsaBuffer.buf = data.empty() ? NULL : 
+		reinterpret_cast<char *>(const_cast<uint8_t *>(&data[0]));
+	m_wsaBuffer.len = static_cast<u_long>(
+		data.size() * sizeof(data[0])
+		);
+
+	m_gatherWsaBuffers.clear();
+	m_firstWsaBuffer = 0;
+
+	for(size_t i = 0; i < m_gatherData.size(); ++i)
+	{
+		if(false == m_gatherData[i].empty())
+		{
+			WSABUF wsaBuffer;
+			wsaBuffer.buf = reinterpret_cast<char *>(&m_gatherData[i][0]);
+			wsaBuffer.len = static_cast<u_long>(m_gatherData[i].size());
+			m_gatherWsaBuffers.push_back(wsaBuffer);
+		}
+	}
+}
+
+bool CIocpContext::IsFileSend() const
+{
+	return m_file != NULL;
+}
+
+CIocpContext * CIocpContext::Next() const
+{
+	return static_cast<CIocpContext *>(
+		m_next.load(boost::memory_order_relaxed));
+}
+
+WSABUF * CIocpContext::GetWsaBuffers()
+{
+	if(true == m_gatherData.empty())
+	{
+		return &m_wsaBuffer;
+	}
+
+	return m_firstWsaBuffer < m_gatherWsaBuffers.size() ? 
+		&m_gatherWsaBuffers[m_firstWsaBuffer] : NULL;
+}
+
+DWORD CIocpContext::GetNumWsaBuffers() const
+{
+	if(true == m_gatherData.empty())
+	{
+		return 1;
+	}
+
+	return static_cast<DWORD>(m_gatherWsaBuffers.size() - m_firstWsaBuffer);
+}
+
+uint64_t CIocpContext::GetSendSize() const
+{
+	uint64_t sendSize = m_data.size() + m_sharedData.GetData().size() + 
+		m_fileSize;
+	for(size_t i = 0; i < m_gatherData.size(); ++i)
+	{
+		sendSize += m_gatherData[i].size();
+	}
+
+	return sendSize;
+}
+
+uint64_t CIocpContext::GetRemainingSize() const
+{
+	if(true == IsFileSend())
+	{
+		return m_fileRemaining;
+	}
+
+	if(true == m_gatherData.empty())
+	{
+		return m_wsaBuffer.len;
+	}
+
+	uint64_t remaining = 0;
+	for(size_t i = m_firstWsaBuffer; i < m_gatherWsaBuffers.size(); ++i)
+	{
+		remaining += m_gatherWsaBuffers[i].len;
+	}
+
+	return remaining;
+}
+
+void CIocpContext::ConsumeWsaBuffers(size_t bytesSent)
+{
+	if(true == IsFileSend())
+	{
+		assert(bytesSent <= m_fileRemaining);
+		m_fileOffset += bytesSent;
+		m_fileRemaining -= static_cast<uint32_t>(bytesSent);
+		return;
+	}
+
+	if(true == m_gatherData.empty())
+	{
+		assert(bytesSent <= m_wsaBuffer.len);
+		m_wsaBuffer.buf += bytesSent;
+		m_wsaBuffer.len -= static_cast<u_long>(bytesSent);
+		return;
+	}
+
+	while(bytesSent > 0 && m_firstWsaBuffer < m_gatherWsaBuffers.size())
+	{
+		WSABUF &wsaBuffer = m_gatherWsaBuffers[m_firstWsaBuffer];
+		if(bytesSent < wsaBuffer.len)
+		{
+			wsaBuffer.buf += bytesSent;
+			wsaBuffer.len -= static_cast<u_long>(bytesSent);
+			return;
+		}
+
+		bytesSent -= wsaBuffer.len;
+		++m_firstWsaBuffer;
+	}
+}
+
 } } // namespace
\ No newline at end of file
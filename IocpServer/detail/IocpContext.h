@@ -1,60 +1,165 @@
-//! Copyright Alan Ning 2010
-//! Distributed under the Boost Software License, Version 1.0.
-//! (See accompanying file LICENSE_1_0.txt or copy at
-//! http://www.boost.org/LICENSE_1_0.txt)
-
-#ifndef IOCPCONTEXT_H_2010_09_25_17_35_46
-#define IOCPCONTEXT_H_2010_09_25_17_35_46
-
-namespace iocp { namespace detail {
-
-//! @details
-//! The overlapped object in IOCP serves as a context (or metadata) for
-//! each completion packet. Each overlapped operations has its unique
-//! context data, so that we know how to route and operate on them.
-//! The overlapped data structure is very C-like, and requires special
-//! care of start and stops. 
-class CIocpContext : public OVERLAPPED
-{
-public:
-
-	enum Type
-	{ 
-		Rcv,
-		Send,
-		Accept,
-		Disconnect,
-	};
-
-
-	CIocpContext(
-		SOCKET socket, 
-		uint64_t cid, 
-		CIocpContext::Type t, 
-		uint32_t rcvBufferSize);
-
-	~CIocpContext();
-
-	//! Reset the WSA buffer. Should be called each time the context is used.
-	void ResetWsaBuf();
-
-	//! the actual buffer that holds all the data
-	std::vector<uint8_t> m_data;
-
-	//! ptr to the winsock buffer (which points to m_data)
-	WSABUF m_wsaBuffer;
-
-	//! the socket for this connection
-	SOCKET m_socket;
-
-	//! connection id
-	uint64_t m_cid;
-
-	//! the type of iocp context
-	Type m_type;
-
-	uint32_t m_rcvBufferSize;
-};
-
-} } // end namespace
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef IOCPCONTEXT_H_2010_09_25_17_35_46
+#define IOCPCONTEXT_H_2010_09_25_17_35_46
+
+#include "../SharedBuffer.h"
+#include "FileHandle.h"
+
+namespace iocp { namespace detail { class CConnection; } };
+namespace iocp { namespace detail {
+
+//! @details
+//! The link of a send context in CSendQueue. The queue's stub is only 
+//! this, not a whole context.
+struct CSendQueueNode
+{
+	CSendQueueNode();
+
+	atomic<CSendQueueNode *> m_next;
+};
+
+//! @details
+//! The overlapped object in IOCP serves as a context (or metadata) for
+//! each completion packet. Each overlapped operations has its unique
+//! context data, so that we know how to route and operate on them.
+//! The overlapped data structure is very C-like, and requires special
+//! care of start and stops. 
+//!
+//! On POSIX, there is no OVERLAPPED structure. The context pointer itself
+//! travels through the completion port emulation (see CEpollPort).
+class CIocpContext
+#if defined(_WIN32)
+	: public OVERLAPPED
+	, public CSendQueueNode
+#else
+	: public CSendQueueNode
+#endif
+{
+public:
+
+	enum Type
+	{ 
+		Rcv,
+		Send,
+		Accept,
+		Disconnect,
+
+		//! Only wakes a worker thread, to wait again with a timeout. See
+		//! CConnectionTimers.
+		Timer,
+	};
+
+
+	CIocpContext(
+		SOCKET socket, 
+		uint64_t cid, 
+		CIocpContext::Type t, 
+		uint32_t rcvBufferSize);
+
+	~CIocpContext();
+
+	//! Make a used send context as good as new, for the given connection.
+	//! The buffers it holds are freed, but not their lists.
+	void Reset(SOCKET socket, uint64_t cid);
+
+	//! Reset the WSA buffer. Should be called each time the context is used.
+	void ResetWsaBuf();
+
+	//! Whether this context sends part of a file rather than buffers.
+	bool IsFileSend() const;
+
+	//! Send contexts only. The next one in CSendQueue, or in a list linked
+	//! for it, read by the thread that linked it.
+	CIocpContext *Next() const;
+
+	//! The WSA buffers left to send, and how many there are. Only m_data's
+	//! unless this is a gather send.
+	WSABUF *GetWsaBuffers();
+	DWORD GetNumWsaBuffers() const;
+
+	//! The number of bytes the context sends in total. A gather send may
+	//! hold more than 4 GB.
+	uint64_t GetSendSize() const;
+
+	//! The number of bytes not sent yet.
+	uint64_t GetRemainingSize() const;
+
+	//! Advance the WSA buffers, or the file offset, past bytes that are 
+	//! sent, so a partially sent context can be resumed.
+	void ConsumeWsaBuffers(size_t bytesSent);
+
+	//! the actual buffer that holds all the data
+	std::vector<uint8_t> m_data;
+
+	//! ptr to the winsock buffer (which points to m_data)
+	WSABUF m_wsaBuffer;
+
+	//! the socket for this connection
+	SOCKET m_socket;
+
+	//! connection id
+	uint64_t m_cid;
+
+	//! Receive and send contexts only. The connection they belong to, 
+	//! which stays in its table while they are outstanding, so that a 
+	//! completion needs no lookup. NULL otherwise.
+	CConnection *m_connection;
+
+	//! the type of iocp context
+	Type m_type;
+
+	uint32_t m_rcvBufferSize;
+
+	//! Shared sends only. Sent in place of m_data, and held until the 
+	//! context is deleted.
+	CSharedBuffer m_sharedData;
+
+	//! Gather sends only. The buffers to send one after another, in place
+	//! of m_data.
+	std::vector< std::vector<uint8_t> > m_gatherData;
+
+	//! One WSA buffer per non empty buffer in m_gatherData, the sent ones
+	//! first.
+	std::vector<WSABUF> m_gatherWsaBuffers;
+
+	//! The first buffer in m_gatherWsaBuffers not completely sent.
+	size_t m_firstWsaBuffer;
+
+	//! File sends only. The file, the offset of the next byte to send, 
+	//! and how many bytes this context sends from it in total and has 
+	//! left to send.
+	shared_ptr<CFileHandle> m_file;
+	uint64_t m_fileOffset;
+	uint32_t m_fileSize;
+	uint32_t m_fileRemaining;
+
+	//! Send contexts only. Counted in the connection's send window, see
+	//! QueueWindowedSend.
+	bool m_windowed;
+
+#if !defined(_WIN32)
+	//! io_uring gather sends only. The kernel reads it after submission.
+	msghdr m_msg;
+
+	//! Zero-copy sends only (ServerOptions::m_zeroCopyThreshold). The 
+	//! kernel reads the buffers until it has notified every zero-copy 
+	//! call made for the context, so the context is not completed before.
+	//! With epoll, the calls are numbered from m_zeroCopyFirst.
+	bool m_zeroCopy;
+	uint32_t m_zeroCopyFirst;
+	uint32_t m_zeroCopyCalls;
+	uint32_t m_zeroCopyDone;
+
+	//! io_uring file sends only. The pipe the file is spliced through, 
+	//! created when the context is posted, and the bytes in it.
+	int m_pipe[2];
+	uint32_t m_pipeBytes;
+#endif
+};
+
+} } // end namespace
 #endif // IOCPCONTEXT_H_2010_09_25_17_35_46
\ No newline at end of file
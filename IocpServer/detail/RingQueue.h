@@ -0,0 +1,131 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef RINGQUEUE_H_2026_10_18_21_40_12
+#define RINGQUEUE_H_2026_10_18_21_40_12
+
+namespace iocp { namespace detail {
+
+//! @details
+//! A first in, first out queue in a ring buffer that doubles when full and
+//! never shrinks. Unlike std::deque, which allocates and frees a block
+//! every few elements as they go through, a queue that stays about the
+//! same length does not allocate once it has grown to it.
+//!
+//! The names follow std::deque, for the part of it the queues of the
+//! engines use.
+template <class T>
+class CRingQueue
+{
+public:
+
+	CRingQueue()
+		: m_first(0)
+		, m_size(0)
+	{
+	}
+
+	bool empty() const
+	{
+		return 0 == m_size;
+	}
+
+	size_t size() const
+	{
+		return m_size;
+	}
+
+	T &front()
+	{
+		assert(m_size > 0);
+		return m_items[m_first];
+	}
+
+	T &back()
+	{
+		assert(m_size > 0);
+		return m_items[(m_first + m_size - 1) & (m_items.size() - 1)];
+	}
+
+	//! The i-th item from the front.
+	T &operator[](size_t i)
+	{
+		assert(i < m_size);
+		return m_items[(m_first + i) & (m_items.size() - 1)];
+	}
+
+	void push_back(T const &item)
+	{
+		if(m_size == m_items.size())
+		{
+			// The item may be one of those moved.
+			Grow(T(item));
+		}
+		else
+		{
+			m_items[(m_first + m_size) & (m_items.size() - 1)] = item;
+		}
+
+		++m_size;
+	}
+
+	void pop_front()
+	{
+		assert(m_size > 0);
+		m_first = (m_first + 1) & (m_items.size() - 1);
+		--m_size;
+	}
+
+	void pop_back()
+	{
+		assert(m_size > 0);
+		--m_size;
+	}
+
+	void clear()
+	{
+		m_first = 0;
+		m_size = 0;
+	}
+
+private:
+
+	enum
+	{
+		//! The capacity on first use. A power of 2, as every capacity.
+		InitialSize = 8,
+	};
+
+	//! Double the capacity and add item at the back. The free slots are 
+	//! filled with copies of it, so that T needs no default constructor.
+	void Grow(T const &item)
+	{
+		size_t capacity = m_items.empty() ? 
+			static_cast<size_t>(InitialSize) : 
+			m_items.size() * 2;
+
+		std::vector<T> items;
+		items.reserve(capacity);
+
+		for(size_t i = 0; i < m_size; ++i)
+		{
+			items.push_back(m_items[(m_first + i) & (m_items.size() - 1)]);
+		}
+		items.resize(capacity, item);
+
+		m_items.swap(items);
+		m_first = 0;
+	}
+
+	std::vector<T> m_items;
+
+	//! The index of the front item.
+	size_t m_first;
+
+	size_t m_size;
+};
+
+} } // end namespace
+#endif // RINGQUEUE_H_2026_10_18_21_40_12
@@ -1,59 +1,163 @@
-//! Copyright Alan Ning 2010
-//! Distributed under the Boost Software License, Version 1.0.
-//! (See accompanying file LICENSE_1_0.txt or copy at
-//! http://www.boost.org/LICENSE_1_0.txt)
-
-#include "StdAfx.h"
-#include "SendQueue.h"
-#include "IocpContext.h"
-
-namespace iocp { namespace detail {
-
-
-CSendQueue::~CSendQueue()
-{
-	// This shouldn't be necessary because the server is programmed to
-	// wait for all outstanding context to come back before going down.
-	// But just in case...
-	CloseAllSends();
-}
-
-void CSendQueue::AddSendContext( shared_ptr<CIocpContext> sendContext )
-{
-	mutex::scoped_lock l(m_mutex);
-
-	bool inserted = m_sendContextMap.insert(
-		std::make_pair(sendContext.get(), sendContext)
-		).second;
-	assert(true == inserted);
-}
-
-int CSendQueue::RemoveSendContext( CIocpContext* sendContext )
-{
-	mutex::scoped_lock l(m_mutex);
-	m_sendContextMap.erase(sendContext);
-	return m_sendContextMap.size();
-}
-
-uint32_t CSendQueue::NumOutstandingContext()
-{
-	mutex::scoped_lock l(m_mutex);
-	return m_sendContextMap.size();
-}
-
-void CSendQueue::CloseAllSends()
-{
-	mutex::scoped_lock l(m_mutex);
-
-	SendContextMap_t::iterator itr = m_sendContextMap.begin();
-	while(m_sendContextMap.end() != itr)
-	{
-		if(INVALID_HANDLE_VALUE != itr->second->hEvent)
-		{
-			CloseHandle(itr->second->hEvent);
-			itr->second->hEvent = INVALID_HANDLE_VALUE;
-		}
-		++itr;
-	}
-}
-} } // end namespace
\ No newline at end of file
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#include "StdAfx.h"
+#include "SendQueue.h"
+
+namespace iocp { namespace detail {
+
+CSendQueue::CSendQueue()
+: m_head(&m_stub)
+, m_tail(&m_stub)
+, m_stub()
+, m_numQueued(0)
+, m_numOutstanding(0)
+{
+}
+
+CSendQueue::~CSendQueue()
+{
+	// This shouldn't be necessary because the server is programmed to
+	// wait for all outstanding context to come back before going down.
+	// But just in case...
+	while(::InterlockedExchangeAdd(&m_numQueued, 0) > 0)
+	{
+		CIocpContext *sendContext = TryPop();
+		if(NULL == sendContext)
+		{
+			break;
+		}
+
+		delete sendContext;
+		::InterlockedDecrement(&m_numQueued);
+	}
+}
+
+bool CSendQueue::Push( CIocpContext *sendContext )
+{
+	return Push(sendContext, sendContext, 1);
+}
+
+bool CSendQueue::Push( CIocpContext *first, 
+					  CIocpContext *last, 
+					  uint32_t numContexts )
+{
+	Link(first, last);
+
+	long count = static_cast<long>(numContexts);
+
+	::InterlockedExchangeAdd(&m_numOutstanding, count);
+
+	return 0 == ::InterlockedExchangeAdd(&m_numQueued, count);
+}
+
+CIocpContext * CSendQueue::Pop()
+{
+	// The context is counted, so it is in the queue. A producer may still
+	// be linking one ahead of it though.
+	CIocpContext *sendContext = TryPop();
+	while(NULL == sendContext)
+	{
+		boost::this_thread::yield();
+		sendContext = TryPop();
+	}
+
+	return sendContext;
+}
+
+bool CSendQueue::Popped()
+{
+	return ::InterlockedDecrement(&m_numQueued) > 0;
+}
+
+uint32_t CSendQueue::Complete()
+{
+	return static_cast<uint32_t>(
+		::InterlockedDecrement(&m_numOutstanding));
+}
+
+uint32_t CSendQueue::CompleteUnlessLast()
+{
+	// A stale read only costs one more exchange.
+	long numOutstanding = m_numOutstanding;
+
+	while(numOutstanding > 1)
+	{
+		long previous = ::InterlockedCompareExchange(
+			&m_numOutstanding, 
+			numOutstanding - 1, 
+			numOutstanding);
+
+		if(previous == numOutstanding)
+		{
+			return static_cast<uint32_t>(numOutstanding - 1);
+		}
+
+		numOutstanding = previous;
+	}
+
+	return 0;
+}
+
+uint32_t CSendQueue::NumOutstandingContext()
+{
+	return static_cast<uint32_t>(
+		::InterlockedExchangeAdd(&m_numOutstanding, 0));
+}
+
+void CSendQueue::Link( CSendQueueNode *first, CSendQueueNode *last )
+{
+	last->m_next.store(NULL, boost::memory_order_relaxed);
+
+	CSendQueueNode *previous = m_head.exchange(
+		last, boost::memory_order_acq_rel);
+
+	// Until this store, the writer sees the queue end at previous.
+	previous->m_next.store(first, boost::memory_order_release);
+}
+
+CIocpContext * CSendQueue::TryPop()
+{
+	CSendQueueNode *tail = m_tail;
+	CSendQueueNode *next = tail->m_next.load(boost::memory_order_acquire);
+
+	if(&m_stub == tail)
+	{
+		if(NULL == next)
+		{
+			return NULL;
+		}
+
+		m_tail = next;
+		tail = next;
+		next = next->m_next.load(boost::memory_order_acquire);
+	}
+
+	if(NULL != next)
+	{
+		m_tail = next;
+		return static_cast<CIocpContext *>(tail);
+	}
+
+	// tail looks like the last one. Unless a producer is in the middle of
+	// adding one after it, put the stub back behind it so it can be taken.
+	if(tail != m_head.load(boost::memory_order_acquire))
+	{
+		return NULL;
+	}
+
+	Link(&m_stub, &m_stub);
+
+	next = tail->m_next.load(boost::memory_order_acquire);
+	if(NULL != next)
+	{
+		m_tail = next;
+		return static_cast<CIocpContext *>(tail);
+	}
+
+	return NULL;
+}
+
+} } // end namespace
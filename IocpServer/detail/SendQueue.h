@@ -1,37 +1,86 @@
-//! Copyright Alan Ning 2010
-//! Distributed under the Boost Software License, Version 1.0.
-//! (See accompanying file LICENSE_1_0.txt or copy at
-//! http://www.boost.org/LICENSE_1_0.txt)
-
-#ifndef SENDQUEUE_H_2010_09_26_12_39_06
-#define SENDQUEUE_H_2010_09_26_12_39_06
-
-namespace iocp { namespace detail { class CIocpContext; } };
-
-namespace iocp { namespace detail {
-
-class CSendQueue
-{
-public:
-	~CSendQueue();
-
-	void AddSendContext(shared_ptr<CIocpContext> sendContext);
-
-	int RemoveSendContext(CIocpContext *sendContext);
-
-	void CloseAllSends();
-
-	uint32_t NumOutstandingContext();
-
-private:
-	typedef std::map<
-		CIocpContext *, shared_ptr<CIocpContext> 
-	> SendContextMap_t;
-
-	SendContextMap_t m_sendContextMap;
-
-	mutex m_mutex;
-};
-
-} } // end namespace
-#endif // SENDQUEUE_H_2010_09_26_12_39_06
\ No newline at end of file
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef SENDQUEUE_H_2010_09_26_12_39_06
+#define SENDQUEUE_H_2010_09_26_12_39_06
+
+#include "IocpContext.h"
+
+namespace iocp { namespace detail {
+
+//! @details
+//! The send contexts of a connection, from Send to their completion. Any
+//! thread may add a context, without a lock. The thread that adds a 
+//! context to an empty queue drains it: it takes the contexts out and 
+//! posts them, including the ones other threads add meanwhile, until the
+//! queue is empty again. Only one thread posts at a time, so the data goes
+//! out in the order the contexts were added, even if Send is called from 
+//! several threads at once.
+//!
+//! This is Dmitry Vyukov's intrusive multiple producer, single consumer
+//! queue, linked through CSendQueueNode::m_next.
+class CSendQueue : boost::noncopyable
+{
+public:
+	CSendQueue();
+
+	//! Delete the contexts that were never posted. The ones posted are 
+	//! deleted when they complete.
+	~CSendQueue();
+
+	//! Add a context at the back. Returns true if the queue was empty. The
+	//! caller must then drain it, with Pop and Popped.
+	bool Push(CIocpContext *sendContext);
+
+	//! Add several contexts at the back at once, so that no other thread's
+	//! context goes in between. They are linked from first to last through
+	//! m_next already. Otherwise the same as Push above.
+	bool Push(CIocpContext *first, CIocpContext *last, uint32_t numContexts);
+
+	//! The draining thread only. Take the context at the front out.
+	CIocpContext *Pop();
+
+	//! The draining thread only, once the context it took out is posted. 
+	//! Returns true if there are more to take out.
+	bool Popped();
+
+	//! Count a context out once it has completed. The caller deletes it. 
+	//! Returns the number of contexts still outstanding.
+	uint32_t Complete();
+
+	//! The same as Complete, unless the context is the last one 
+	//! outstanding. Then it is not counted out, and this returns 0.
+	uint32_t CompleteUnlessLast();
+
+	//! Contexts queued or in flight.
+	uint32_t NumOutstandingContext();
+
+private:
+	//! Add contexts linked from first to last at the back, without 
+	//! counting them.
+	void Link(CSendQueueNode *first, CSendQueueNode *last);
+
+	//! NULL if the queue is empty, or if the front is not linked yet.
+	CIocpContext *TryPop();
+
+	//! The last context added, or the stub. Producers only.
+	atomic<CSendQueueNode *> m_head;
+
+	//! The next context to take out, or the stub. The draining thread 
+	//! only.
+	CSendQueueNode *m_tail;
+
+	//! Keeps the queue linked when it is empty.
+	CSendQueueNode m_stub;
+
+	//! Contexts added and not taken out yet.
+	long m_numQueued;
+
+	//! Contexts added and not completed yet.
+	long m_numOutstanding;
+};
+
+} } // end namespace
+#endif // SENDQUEUE_H_2010_09_26_12_39_06
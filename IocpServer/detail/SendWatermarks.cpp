@@ -0,0 +1,190 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#include "StdAfx.h"
+#include "SendWatermarks.h"
+#include "Connection.h"
+
+#include <algorithm>
+
+namespace iocp { namespace detail {
+
+CSendWatermarks::CSendWatermarks(uint64_t highWatermark, 
+								 uint64_t lowWatermark, 
+								 uint64_t globalHighWatermark, 
+								 uint64_t globalLowWatermark)
+: m_highWatermark(static_cast<int64_t>(highWatermark))
+, m_lowWatermark(static_cast<int64_t>(lowWatermark))
+, m_globalHighWatermark(static_cast<int64_t>(globalHighWatermark))
+, m_globalLowWatermark(static_cast<int64_t>(globalLowWatermark))
+, m_numBytesQueued(0)
+{
+}
+
+void CSendWatermarks::Queued( CConnection &c, int64_t numBytes )
+{
+	c.m_numBytesQueued.fetch_add(numBytes);
+
+	// Only counted for a server wide watermark, as it is shared by every
+	// thread.
+	if(m_globalHighWatermark > 0)
+	{
+		m_numBytesQueued.fetch_add(numBytes);
+	}
+}
+
+bool CSendWatermarks::CanQueue( CConnection &c )
+{
+	if(false == IsOver(c))
+	{
+		return true;
+	}
+
+	::InterlockedCompareExchange(&c.m_writeBlocked, Blocked, NotBlocked);
+	Wait(c);
+
+	// A send may have completed in between, without seeing the mark. Take
+	// the data after all rather than wait for a report that won't come.
+	if( (true == IsWritable(c)) && (true == Release(c)) )
+	{
+		return true;
+	}
+
+	return false;
+}
+
+void CSendWatermarks::Sent( CConnection &c, 
+						   uint64_t numBytes, 
+						   WritableList_t &writable )
+{
+	c.m_numBytesQueued.fetch_sub(static_cast<int64_t>(numBytes));
+	CountOut(static_cast<int64_t>(numBytes), writable);
+
+	if(NotBlocked == ::InterlockedExchangeAdd(&c.m_writeBlocked, 0))
+	{
+		return;
+	}
+
+	// Only the server wide count may still be too high. Then the 
+	// completion that brings it down reports this connection.
+	Wait(c);
+
+	if( (true == IsWritable(c)) && (true == Release(c)) )
+	{
+		writable.push_back(intrusive_ptr<CConnection>(&c));
+	}
+}
+
+void CSendWatermarks::Closed( CConnection &c, 
+							 WritableList_t &writable )
+{
+	CountOut(c.m_numBytesQueued.exchange(0), writable);
+
+	// m_waiters would hold it, and its socket, until the server wide count
+	// comes down.
+	if(Waiting == ::InterlockedExchange(&c.m_writeBlocked, NotBlocked))
+	{
+		mutex::scoped_lock l(m_mutex);
+		m_waiters.erase(
+			std::remove(m_waiters.begin(), m_waiters.end(), &c), 
+			m_waiters.end());
+	}
+}
+
+void CSendWatermarks::CountOut( int64_t numBytes, 
+							   WritableList_t &writable )
+{
+	if(0 == m_globalHighWatermark)
+	{
+		return;
+	}
+
+	int64_t before = m_numBytesQueued.fetch_sub(numBytes);
+	int64_t after = before - numBytes;
+
+	if( (before > m_globalLowWatermark) && 
+		(after <= m_globalLowWatermark) )
+	{
+		WakeWaiters(writable);
+	}
+}
+
+bool CSendWatermarks::IsOver( CConnection &c ) const
+{
+	if( (m_highWatermark > 0) && 
+		(c.m_numBytesQueued.load() >= m_highWatermark) )
+	{
+		return true;
+	}
+
+	return (m_globalHighWatermark > 0) && 
+		(m_numBytesQueued.load() >= m_globalHighWatermark);
+}
+
+bool CSendWatermarks::IsLow( CConnection &c ) const
+{
+	return (0 == m_highWatermark) || 
+		(c.m_numBytesQueued.load() <= m_lowWatermark);
+}
+
+bool CSendWatermarks::IsWritable( CConnection &c ) const
+{
+	if(false == IsLow(c))
+	{
+		return false;
+	}
+
+	return (0 == m_globalHighWatermark) || 
+		(m_numBytesQueued.load() <= m_globalLowWatermark);
+}
+
+void CSendWatermarks::Wait( CConnection &c )
+{
+	if( (0 == m_globalHighWatermark) || (false == IsLow(c)) )
+	{
+		return;
+	}
+
+	if(Blocked == ::InterlockedCompareExchange(
+		&c.m_writeBlocked, Waiting, Blocked))
+	{
+		mutex::scoped_lock l(m_mutex);
+		m_waiters.push_back(intrusive_ptr<CConnection>(&c));
+	}
+}
+
+bool CSendWatermarks::Release( CConnection &c )
+{
+	return NotBlocked != ::InterlockedExchange(&c.m_writeBlocked, NotBlocked);
+}
+
+void CSendWatermarks::WakeWaiters( WritableList_t &writable )
+{
+	WaiterList_t waiters;
+	{
+		mutex::scoped_lock l(m_mutex);
+		waiters.swap(m_waiters);
+	}
+
+	WaiterList_t::iterator itr = waiters.begin();
+	for(; waiters.end() != itr; ++itr)
+	{
+		CConnection &c = **itr;
+
+		// Waiting on its own sends again. Those report it.
+		if(false == IsLow(c))
+		{
+			::InterlockedCompareExchange(&c.m_writeBlocked, Blocked, Waiting);
+			continue;
+		}
+
+		if(true == Release(c))
+		{
+			writable.push_back(*itr);
+		}
+	}
+}
+
+} } // end namespace
@@ -0,0 +1,103 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef SENDWATERMARKS_H_2026_10_18_19_40_27
+#define SENDWATERMARKS_H_2026_10_18_19_40_27
+
+namespace iocp { namespace detail { class CConnection; } };
+
+namespace iocp { namespace detail {
+
+//! @details
+//! Send backpressure. Counts the bytes queued for sending, per connection
+//! and over the whole server, and decides when TrySend refuses data and 
+//! when a refused connection is writable again. A zero high watermark 
+//! means no limit.
+//!
+//! A refused connection is marked blocked. The completion that brings it
+//! back down to the low watermarks clears the mark and reports it, once.
+//! Connections that only wait on the server wide count have no send of 
+//! their own in flight to do that, so they wait in a list for the 
+//! completion that brings the server wide count down.
+class CSendWatermarks : boost::noncopyable
+{
+public:
+
+	CSendWatermarks(
+		uint64_t highWatermark, 
+		uint64_t lowWatermark, 
+		uint64_t globalHighWatermark, 
+		uint64_t globalLowWatermark);
+
+	//! Count bytes queued on a connection. Negative to take back bytes 
+	//! that failed to queue.
+	void Queued(CConnection &c, int64_t numBytes);
+
+	//! Whether more data may be queued on the connection. If not, the 
+	//! connection is blocked until it is reported writable.
+	bool CanQueue(CConnection &c);
+
+	typedef std::vector< intrusive_ptr<CConnection> > WritableList_t;
+
+	//! Count bytes out once their send completes, and add the connections 
+	//! that are writable again to writable.
+	void Sent(
+		CConnection &c, 
+		uint64_t numBytes, 
+		WritableList_t &writable);
+
+	//! Count out what is left of a connection once it is removed, which 
+	//! is at most the sends it held back, and stop it waiting.
+	void Closed(CConnection &c, WritableList_t &writable);
+
+	//! CConnection::m_writeBlocked
+	enum
+	{
+		NotBlocked = 0,
+		Blocked = 1,
+		//! blocked, and in m_waiters
+		Waiting = 2,
+	};
+
+private:
+
+	//! Take bytes off the server wide count.
+	void CountOut(int64_t numBytes, WritableList_t &writable);
+
+	bool IsOver(CConnection &c) const;
+
+	//! Whether the connection's own count is at or below its low 
+	//! watermark.
+	bool IsLow(CConnection &c) const;
+
+	bool IsWritable(CConnection &c) const;
+
+	//! Wait for the server wide count to come down, if the connection's 
+	//! own count is low enough and it is not waiting already.
+	void Wait(CConnection &c);
+
+	//! Clear the blocked mark. Returns true for the one caller that does.
+	static bool Release(CConnection &c);
+
+	//! Report the waiters whose own count is low enough.
+	void WakeWaiters(WritableList_t &writable);
+
+	typedef std::vector< intrusive_ptr<CConnection> > WaiterList_t;
+
+	int64_t const m_highWatermark;
+	int64_t const m_lowWatermark;
+	int64_t const m_globalHighWatermark;
+	int64_t const m_globalLowWatermark;
+
+	//! Bytes queued over all connections.
+	atomic<int64_t> m_numBytesQueued;
+
+	WaiterList_t m_waiters;
+
+	mutex m_mutex;
+};
+
+} } // end namespace
+#endif // SENDWATERMARKS_H_2026_10_18_19_40_27
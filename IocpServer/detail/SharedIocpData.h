@@ -1,61 +1,127 @@
-//! Copyright Alan Ning 2010
-//! Distributed under the Boost Software License, Version 1.0.
-//! (See accompanying file LICENSE_1_0.txt or copy at
-//! http://www.boost.org/LICENSE_1_0.txt)
-
-#ifndef SHAREDIOCPDATA_H_2010_09_21_23_51_40
-#define SHAREDIOCPDATA_H_2010_09_21_23_51_40
-
-#include "ConnectionManager.h"
-#include "IocpContext.h"
-#include "../ConnectionInformation.h"
-
-namespace iocp { class CIocpHandler; }
-
-namespace iocp { namespace detail {
-
-class CSharedIocpData : boost::noncopyable
-{
-public:
-	CSharedIocpData() 
-		: m_shutdownEvent(INVALID_HANDLE_VALUE)
-		, m_ioCompletionPort(INVALID_HANDLE_VALUE)
-		, m_listenSocket(INVALID_SOCKET)
-		, m_acceptContext(INVALID_SOCKET, 0, CIocpContext::Accept, 4096)
-		, m_rcvBufferSize(0)
-		, m_currentId(0)
-		, m_acceptExFn(NULL)
-
-	{
-
-	}
-
-
-	LONGLONG GetNextId()
-	{
-		{
-			mutex::scoped_lock l(m_cidMutex);
-			++m_currentId;
-		}
-
-		return m_currentId;
-	}
-
-
-	HANDLE m_shutdownEvent;
-	HANDLE m_ioCompletionPort;
-	SOCKET m_listenSocket;
-	CConnectionManager m_connectionManager;
-	shared_ptr<CIocpHandler> m_iocpHandler;
-	CIocpContext m_acceptContext;
-	uint32_t m_rcvBufferSize;
-	LPFN_ACCEPTEX m_acceptExFn;
-
-private:
-	mutex m_cidMutex;
-	LONGLONG m_currentId;
-};
-
-} } // end namespace
-
-#endif // SHAREDIOCPDATA_H_2010_09_21_23_51_40
\ No newline at end of file
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef SHAREDIOCPDATA_H_2010_09_21_23_51_40
+#define SHAREDIOCPDATA_H_2010_09_21_23_51_40
+
+#include "ConnectionManager.h"
+#include "IocpContext.h"
+#include "HostNameCache.h"
+#include "BufferPool.h"
+#include "ContextPool.h"
+#include "SendWatermarks.h"
+#include "ConnectionTimers.h"
+#include "../ConnectionInformation.h"
+
+#if !defined(_WIN32)
+#include "CompletionPort.h"
+#endif
+
+namespace iocp { class CIocpHandler; }
+
+namespace iocp { namespace detail {
+
+class CSharedIocpData : boost::noncopyable
+{
+public:
+
+	//! The shard index lives in the top bits of every connection id, so
+	//! that an id can be routed back to its shard. The connection table 
+	//! makes the rest, see CConnectionManager.
+	enum 
+	{ 
+		ShardShift = CConnectionManager::IdBits,
+		MaxShards = 1 << 16,
+	};
+
+	//! The key the listen socket is associated with. Connection ids are
+	//! never 0, nor are the connection addresses that epoll keys by.
+	static uint64_t const ListenKey = 0;
+
+	typedef std::vector< shared_ptr<CIocpContext> > AcceptContextList_t;
+
+	explicit CSharedIocpData(uint32_t shardIndex) 
+		: m_listenSocket(INVALID_SOCKET)
+		, m_connectionManager(static_cast<uint64_t>(shardIndex) << ShardShift)
+		, m_rcvBufferSize(0)
+		, m_minRcvBufferSize(0)
+		, m_maxRcvBufferSize(0)
+		, m_zeroByteReceive(false)
+		, m_coalesceSends(false)
+		, m_zeroCopyThreshold(0)
+		, m_sendWindow(0)
+		, m_timerContext(INVALID_SOCKET, 0, CIocpContext::Timer, 0)
+#if defined(_WIN32)
+		, m_shutdownEvent(INVALID_HANDLE_VALUE)
+		, m_ioCompletionPort(INVALID_HANDLE_VALUE)
+		, m_acceptExFn(NULL)
+		, m_transmitFileFn(NULL)
+#endif
+	{
+
+	}
+
+
+	static uint32_t ShardOf(uint64_t cid)
+	{
+		return static_cast<uint32_t>(cid >> ShardShift);
+	}
+
+	SOCKET m_listenSocket;
+	CConnectionManager m_connectionManager;
+	shared_ptr<CIocpHandler> m_iocpHandler;
+	AcceptContextList_t m_acceptContexts;
+	uint32_t m_rcvBufferSize;
+
+	//! Bounds of the adaptive receive size. Both are m_rcvBufferSize if 
+	//! it is fixed.
+	uint32_t m_minRcvBufferSize;
+	uint32_t m_maxRcvBufferSize;
+
+	//! ServerOptions::m_zeroByteReceive, if the engine needs it.
+	bool m_zeroByteReceive;
+
+	//! ServerOptions::m_coalesceSends
+	bool m_coalesceSends;
+
+	//! ServerOptions::m_zeroCopyThreshold. Always 0 on Windows.
+	uint32_t m_zeroCopyThreshold;
+
+	//! ServerOptions::m_sendWindow
+	uint32_t m_sendWindow;
+
+	//! The shard's own.
+	shared_ptr<CBufferPool> m_bufferPool;
+
+	//! The shard's own.
+	shared_ptr<CContextPool> m_contextPool;
+
+	//! Shared by all shards. NULL if host names are not resolved.
+	shared_ptr<CHostNameCache> m_hostNameCache;
+
+	//! Shared by all shards. NULL if no send watermark is set.
+	shared_ptr<CSendWatermarks> m_sendWatermarks;
+
+	//! The timeouts of the shard's connections. Declared after 
+	//! m_connectionManager, so that it goes first.
+	CConnectionTimers m_timers;
+
+	//! Posted to wake a worker thread when the first timer is scheduled,
+	//! any number of times at once.
+	CIocpContext m_timerContext;
+
+#if defined(_WIN32)
+	HANDLE m_shutdownEvent;
+	HANDLE m_ioCompletionPort;
+	LPFN_ACCEPTEX m_acceptExFn;
+	LPFN_TRANSMITFILE m_transmitFileFn;
+#else
+	shared_ptr<CCompletionPort> m_completionPort;
+#endif
+};
+
+} } // end namespace
+
+#endif // SHAREDIOCPDATA_H_2010_09_21_23_51_40
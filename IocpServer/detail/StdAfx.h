@@ -1,11 +1,11 @@
-//! Copyright Alan Ning 2010
-//! Distributed under the Boost Software License, Version 1.0.
-//! (See accompanying file LICENSE_1_0.txt or copy at
-//! http://www.boost.org/LICENSE_1_0.txt)
-
-#ifndef STDAFX_H_2010_09_21_23_24_12
-#define STDAFX_H_2010_09_21_23_24_12
-
-#include "../ExternalLibraries.h"
-
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef STDAFX_H_2010_09_21_23_24_12
+#define STDAFX_H_2010_09_21_23_24_12
+
+#include "../ExternalLibraries.h"
+
 #endif // STDAFX_H_2010_09_21_23_24_12
\ No newline at end of file
@@ -0,0 +1,192 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#include "StdAfx.h"
+#include "TimerWheel.h"
+
+namespace iocp { namespace detail {
+
+namespace {
+
+	uint64_t const SlotMask = CTimerWheel::NumSlots - 1;
+
+	//! The ticks a slot of the level spans.
+	uint64_t SlotSpan(uint32_t level)
+	{
+		return static_cast<uint64_t>(1) << (level * CTimerWheel::SlotBits);
+	}
+}
+
+CTimerWheel::CTimer::CTimer()
+: m_owner(NULL)
+, m_prev(NULL)
+, m_next(NULL)
+, m_tick(0)
+{
+
+}
+
+CTimerWheel::CTimerWheel(uint64_t tick)
+: m_slots(new CTimer[NumLevels * NumSlots])
+, m_tick(tick)
+, m_numTimers(0)
+{
+	for(uint32_t i = 0; i < NumLevels * NumSlots; ++i)
+	{
+		m_slots[i].m_prev = &m_slots[i];
+		m_slots[i].m_next = &m_slots[i];
+	}
+}
+
+CTimerWheel::~CTimerWheel()
+{
+	// The timers outlive the wheel. They are just no longer scheduled.
+	for(uint32_t i = 0; i < NumLevels * NumSlots; ++i)
+	{
+		CTimer &head = m_slots[i];
+		while(head.m_next != &head)
+		{
+			Unlink(*head.m_next);
+		}
+	}
+
+	delete [] m_slots;
+}
+
+uint64_t CTimerWheel::GetTick() const
+{
+	return m_tick;
+}
+
+size_t CTimerWheel::GetNumTimers() const
+{
+	return m_numTimers;
+}
+
+bool CTimerWheel::IsScheduled( CTimer const &timer )
+{
+	return NULL != timer.m_next;
+}
+
+uint64_t CTimerWheel::GetTick( CTimer const &timer )
+{
+	return timer.m_tick;
+}
+
+void CTimerWheel::Schedule( CTimer &timer, uint64_t tick )
+{
+	if(true == IsScheduled(timer))
+	{
+		Unlink(timer);
+		--m_numTimers;
+	}
+
+	// The current tick's slot is done with.
+	timer.m_tick = (std::max)(tick, m_tick + 1);
+
+	Place(timer);
+	++m_numTimers;
+}
+
+void CTimerWheel::Cancel( CTimer &timer )
+{
+	if(true == IsScheduled(timer))
+	{
+		Unlink(timer);
+		--m_numTimers;
+	}
+}
+
+void CTimerWheel::Advance( uint64_t tick, TimerList_t &expired )
+{
+	while(m_tick < tick)
+	{
+		// Nothing to go through.
+		if(0 == m_numTimers)
+		{
+			m_tick = tick;
+			break;
+		}
+
+		++m_tick;
+
+		// Each level whose slot the tick starts brings it down first.
+		for(uint32_t level = 1; level < NumLevels; ++level)
+		{
+			if(0 != (m_tick & (SlotSpan(level) - 1)))
+			{
+				break;
+			}
+
+			Cascade(level,
+				static_cast<uint32_t>((m_tick >> (level * SlotBits)) & SlotMask));
+		}
+
+		CTimer &head = m_slots[m_tick & SlotMask];
+		while(head.m_next != &head)
+		{
+			CTimer &timer = *head.m_next;
+			Unlink(timer);
+			--m_numTimers;
+
+			expired.push_back(&timer);
+		}
+	}
+}
+
+void CTimerWheel::Place( CTimer &timer )
+{
+	uint64_t tick = timer.m_tick;
+	uint64_t delay = tick - m_tick;
+
+	uint32_t level = 0;
+	while( (level < NumLevels - 1) && (delay >= SlotSpan(level + 1)) )
+	{
+		++level;
+	}
+
+	// Beyond the last level, wait in its furthest slot, which comes
+	// around last.
+	if(delay >= SlotSpan(NumLevels))
+	{
+		tick = m_tick + SlotSpan(NumLevels) - 1;
+	}
+
+	uint64_t slot = (tick >> (level * SlotBits)) & SlotMask;
+
+	Link(m_slots[level * NumSlots + slot], timer);
+}
+
+void CTimerWheel::Cascade( uint32_t level, uint32_t slot )
+{
+	CTimer &head = m_slots[level * NumSlots + slot];
+
+	// Every timer in the slot is due within its span from now, so none of
+	// them goes back to it.
+	while(head.m_next != &head)
+	{
+		CTimer &timer = *head.m_next;
+		Unlink(timer);
+		Place(timer);
+	}
+}
+
+void CTimerWheel::Link( CTimer &head, CTimer &timer )
+{
+	timer.m_prev = head.m_prev;
+	timer.m_next = &head;
+	head.m_prev->m_next = &timer;
+	head.m_prev = &timer;
+}
+
+void CTimerWheel::Unlink( CTimer &timer )
+{
+	timer.m_prev->m_next = timer.m_next;
+	timer.m_next->m_prev = timer.m_prev;
+	timer.m_prev = NULL;
+	timer.m_next = NULL;
+}
+
+} } // end namespace
@@ -0,0 +1,106 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef TIMERWHEEL_H_2026_10_19_09_12_44
+#define TIMERWHEEL_H_2026_10_19_09_12_44
+
+namespace iocp { namespace detail {
+
+//! @details
+//! A hierarchical timing wheel (Varghese and Lauck). Time goes in ticks.
+//! There are NumLevels wheels of NumSlots slots each, a slot of level n
+//! spanning NumSlots^n ticks. A timer goes in the slot of the lowest level
+//! that reaches its tick, and moves down a level each time the level below
+//! wraps around to it, so it moves at most NumLevels - 1 times before it
+//! is due. Scheduling and cancelling a timer are O(1), and so is a tick
+//! besides the timers that move or expire in it. Timers further than the
+//! wheels reach wait in the last slot, and are placed again from there.
+//!
+//! Timers are intrusive, linked in a list per slot, and never allocated.
+//! The wheel is not thread safe.
+class CTimerWheel : boost::noncopyable
+{
+public:
+
+	enum
+	{
+		SlotBits = 8,
+		NumSlots = 1 << SlotBits,
+		NumLevels = 4,
+	};
+
+	class CTimer : boost::noncopyable
+	{
+	public:
+		CTimer();
+
+		//! Whatever the timer is for. The wheel never reads it.
+		void *m_owner;
+
+	private:
+		friend class CTimerWheel;
+
+		//! NULL while not scheduled.
+		CTimer *m_prev;
+		CTimer *m_next;
+
+		//! The tick the timer is due.
+		uint64_t m_tick;
+	};
+
+	typedef std::vector<CTimer *> TimerList_t;
+
+	//! tick is the current tick. The first one due is the next.
+	explicit CTimerWheel(uint64_t tick = 0);
+
+	~CTimerWheel();
+
+	//! The last tick Advance went through.
+	uint64_t GetTick() const;
+
+	//! The timers scheduled.
+	size_t GetNumTimers() const;
+
+	static bool IsScheduled(CTimer const &timer);
+
+	//! The tick timer is due, if scheduled.
+	static uint64_t GetTick(CTimer const &timer);
+
+	//! Schedule timer at tick, or move it there if already scheduled. A
+	//! tick that is not after the current one is due at the next.
+	void Schedule(CTimer &timer, uint64_t tick);
+
+	//! Does nothing if timer is not scheduled.
+	void Cancel(CTimer &timer);
+
+	//! Go through the ticks up to and including tick, and add the timers
+	//! that are due by then to expired, no longer scheduled, earliest
+	//! first.
+	void Advance(uint64_t tick, TimerList_t &expired);
+
+private:
+
+	//! Put timer in its slot, from the current tick. The tick is not
+	//! before the current one.
+	void Place(CTimer &timer);
+
+	//! Place again the timers of a slot of a level above 0.
+	void Cascade(uint32_t level, uint32_t slot);
+
+	static void Link(CTimer &head, CTimer &timer);
+
+	static void Unlink(CTimer &timer);
+
+	//! The slots of each level, in order. A slot is the head of a circular
+	//! list, empty when it points to itself.
+	CTimer *m_slots;
+
+	uint64_t m_tick;
+
+	size_t m_numTimers;
+};
+
+} } // end namespace
+#endif // TIMERWHEEL_H_2026_10_19_09_12_44
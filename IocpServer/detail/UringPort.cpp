@@ -0,0 +1,1267 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#include "StdAfx.h"
+#include "UringPort.h"
+#include "SharedIocpData.h"
+#include "IocpContext.h"
+#include "Connection.h"
+#include "Utils.h"
+#include "../IocpHandler.h"
+
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <climits>
+
+namespace iocp { namespace detail {
+
+namespace {
+
+	//! The port whose completions the calling thread is processing, if any.
+	//! Worker threads defer their submissions to the next io_uring_enter.
+	__thread CUringPort const *t_reaperPort = NULL;
+
+	unsigned LoadAcquire(unsigned const *p)
+	{
+		return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+	}
+
+	void StoreRelease(unsigned *p, unsigned value)
+	{
+		__atomic_store_n(p, value, __ATOMIC_RELEASE);
+	}
+
+	//! How long an accept waits to be tried again after an error such as
+	//! EMFILE, 100 ms. The kernel reads it when the timeout is submitted.
+	__kernel_timespec const AcceptRetryDelay = { 0, 100 * 1000000LL };
+}
+
+CUringPort::CUringPort(CSharedIocpData &iocpData, bool multishot)
+: m_iocpData(iocpData)
+, m_ringFd(-1)
+, m_eventFd(-1)
+, m_wakeValue(0)
+, m_ringMemory(MAP_FAILED)
+, m_ringMemorySize(0)
+, m_sqes(NULL)
+, m_sqesSize(0)
+, m_sqHead(NULL)
+, m_sqTail(NULL)
+, m_sqArray(NULL)
+, m_sqMask(0)
+, m_sqEntries(0)
+, m_cqHead(NULL)
+, m_cqTail(NULL)
+, m_cqMask(0)
+, m_cqes(NULL)
+, m_wakePending(false)
+, m_sqeHeld(false)
+, m_zeroCopy(true)
+, m_multishot(multishot)
+, m_skipSuccess(false)
+, m_buffersProvided(0)
+, m_listenContext(
+	INVALID_SOCKET, 
+	CSharedIocpData::ListenKey, 
+	CIocpContext::Accept, 
+	0)
+, m_acceptArmed(false)
+, m_acceptRetryArmed(false)
+{
+}
+
+CUringPort::~CUringPort()
+{
+	Close();
+}
+
+int CUringPort::Create()
+{
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	// Keep submitting the rest of a batch when one entry fails to prepare.
+	params.flags = IORING_SETUP_CLAMP | IORING_SETUP_SUBMIT_ALL;
+
+	m_ringFd = static_cast<int>(
+		::syscall(__NR_io_uring_setup, RingEntries, &params));
+
+	if(m_ringFd < 0 && EINVAL == errno)
+	{
+		// IORING_SETUP_SUBMIT_ALL is 5.18+
+		memset(&params, 0, sizeof(params));
+		params.flags = IORING_SETUP_CLAMP;
+
+		m_ringFd = static_cast<int>(
+			::syscall(__NR_io_uring_setup, RingEntries, &params));
+	}
+
+	if(m_ringFd < 0)
+	{
+		return errno;
+	}
+
+	// Completion queue overflow must not drop completions, sockets that
+	// are not ready must be polled internally rather than punted to a
+	// kernel thread, and waits must take a timeout for the connection
+	// timeouts. Older kernels are better served by epoll.
+	unsigned const requiredFeatures =
+		IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_FAST_POLL |
+		IORING_FEAT_EXT_ARG;
+
+	if((params.features & requiredFeatures) != requiredFeatures)
+	{
+		Close();
+		return EOPNOTSUPP;
+	}
+
+	size_t sqRingSize = params.sq_off.array +
+		params.sq_entries * sizeof(unsigned);
+	size_t cqRingSize = params.cq_off.cqes +
+		params.cq_entries * sizeof(io_uring_cqe);
+
+	m_ringMemorySize = std::max(sqRingSize, cqRingSize);
+	m_ringMemory = ::mmap(
+		NULL,
+		m_ringMemorySize,
+		PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE,
+		m_ringFd,
+		IORING_OFF_SQ_RING);
+
+	if(MAP_FAILED == m_ringMemory)
+	{
+		int lastError = errno;
+		Close();
+		return lastError;
+	}
+
+	m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+	void *sqes = ::mmap(
+		NULL,
+		m_sqesSize,
+		PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE,
+		m_ringFd,
+		IORING_OFF_SQES);
+
+	if(MAP_FAILED == sqes)
+	{
+		int lastError = errno;
+		Close();
+		return lastError;
+	}
+
+	m_sqes = static_cast<io_uring_sqe *>(sqes);
+
+	char *ring = static_cast<char *>(m_ringMemory);
+
+	m_sqHead = reinterpret_cast<unsigned *>(ring + params.sq_off.head);
+	m_sqTail = reinterpret_cast<unsigned *>(ring + params.sq_off.tail);
+	m_sqArray = reinterpret_cast<unsigned *>(ring + params.sq_off.array);
+	m_sqMask = *reinterpret_cast<unsigned *>(ring + params.sq_off.ring_mask);
+	m_sqEntries = params.sq_entries;
+
+	m_cqHead = reinterpret_cast<unsigned *>(ring + params.cq_off.head);
+	m_cqTail = reinterpret_cast<unsigned *>(ring + params.cq_off.tail);
+	m_cqMask = *reinterpret_cast<unsigned *>(ring + params.cq_off.ring_mask);
+	m_cqes = reinterpret_cast<io_uring_cqe *>(ring + params.cq_off.cqes);
+
+	// Entry i of the submission array always refers to sqe i.
+	for(unsigned i = 0; i < m_sqEntries; ++i)
+	{
+		m_sqArray[i] = i;
+	}
+
+	m_eventFd = ::eventfd(0, EFD_CLOEXEC);
+	if(m_eventFd < 0)
+	{
+		int lastError = errno;
+		Close();
+		return lastError;
+	}
+
+	// Recycled buffers do not need a completion of their own.
+	m_skipSuccess = (0 != (params.features & IORING_FEAT_CQE_SKIP));
+
+	if(true == m_multishot)
+	{
+		CreateBuffers();
+	}
+
+	// Only published here. The first worker thread submits it, so that
+	// the read is not tied to the lifetime of the constructing thread.
+	mutex::scoped_lock l(m_sqMutex);
+	PrepareWakeRead();
+
+	return NO_ERROR;
+}
+
+void CUringPort::CreateBuffers()
+{
+	size_t bufferSize = m_iocpData.m_rcvBufferSize;
+
+	size_t numBuffers = MaxBuffers;
+	while(numBuffers > 1 && numBuffers * bufferSize > MaxBufferMemory)
+	{
+		numBuffers /= 2;
+	}
+
+	m_buffers.resize(numBuffers, std::vector<uint8_t>(bufferSize));
+
+	// These are submitted ahead of any receive.
+	mutex::scoped_lock l(m_bufferMutex);
+	mutex::scoped_lock sq(m_sqMutex);
+	for(size_t i = 0; i < numBuffers; ++i)
+	{
+		ProvideBuffer(static_cast<uint16_t>(i));
+	}
+}
+
+void CUringPort::Close()
+{
+	// Closing the ring cancels everything that is still in flight.
+	if(m_ringFd >= 0)
+	{
+		::close(m_ringFd);
+		m_ringFd = -1;
+	}
+
+	if(NULL != m_sqes)
+	{
+		::munmap(m_sqes, m_sqesSize);
+		m_sqes = NULL;
+	}
+
+	if(MAP_FAILED != m_ringMemory)
+	{
+		::munmap(m_ringMemory, m_ringMemorySize);
+		m_ringMemory = MAP_FAILED;
+	}
+
+	if(m_eventFd >= 0)
+	{
+		::close(m_eventFd);
+		m_eventFd = -1;
+	}
+
+	m_buffers.clear();
+	m_heldSqes.clear();
+
+	{
+		// Accepted, but never made it to a connection.
+		mutex::scoped_lock l(m_acceptMutex);
+		while(false == m_acceptedSockets.empty())
+		{
+			closesocket(m_acceptedSockets.front());
+			m_acceptedSockets.pop_front();
+		}
+
+		m_freeAccepts.clear();
+		m_acceptArmed = false;
+
+		m_retryAccepts.clear();
+		m_acceptRetryArmed = false;
+	}
+
+	// Discard anything that nobody is going to pick up.
+	mutex::scoped_lock l(m_postedMutex);
+	while(false == m_postedPackets.empty())
+	{
+		CIocpContext *context = m_postedPackets.front().m_context;
+		m_postedPackets.pop_front();
+
+		// Disconnect contexts are not owned by anyone else.
+		if(NULL != context && CIocpContext::Disconnect == context->m_type)
+		{
+			delete context;
+		}
+	}
+}
+
+int CUringPort::Associate(SOCKET s, CConnection *)
+{
+	// Sockets are created non-blocking for epoll. io_uring waits for
+	// readiness internally, but only if the socket is allowed to block.
+	int flags = ::fcntl(s, F_GETFL);
+	if(flags < 0)
+	{
+		return errno;
+	}
+
+	if(0 != (flags & O_NONBLOCK))
+	{
+		if(::fcntl(s, F_SETFL, flags & ~O_NONBLOCK) != 0)
+		{
+			return errno;
+		}
+	}
+
+	return NO_ERROR;
+}
+
+int CUringPort::PostAccept(CIocpContext &acceptContext)
+{
+	if(true == m_multishot)
+	{
+		mutex::scoped_lock l(m_acceptMutex);
+
+		// The multishot accept is already armed. Hand out the next socket
+		// it accepted, if any, or wait for one.
+		if(true == m_acceptArmed)
+		{
+			if(true == m_acceptedSockets.empty())
+			{
+				m_freeAccepts.push_back(&acceptContext);
+				return NO_ERROR;
+			}
+
+			acceptContext.m_socket = m_acceptedSockets.front();
+			m_acceptedSockets.pop_front();
+
+			PostCompletion(&acceptContext, 0);
+			return NO_ERROR;
+		}
+
+		m_freeAccepts.push_back(&acceptContext);
+		m_acceptArmed = true;
+
+		mutex::scoped_lock sq(m_sqMutex);
+		PrepareMultishotAccept();
+	}
+	else
+	{
+		// One accept request per context.
+		mutex::scoped_lock l(m_sqMutex);
+		PrepareAccept(acceptContext);
+	}
+
+	SubmitOrWake();
+
+	return NO_ERROR;
+}
+
+int CUringPort::PostRecv(CConnection &c)
+{
+	{
+		mutex::scoped_lock l(m_sqMutex);
+
+		if(true == m_multishot)
+		{
+			PrepareMultishotRecv(c.m_socket, c.m_rcvContext);
+		}
+		else
+		{
+			// In zero byte mode, the worker thread binds a buffer once the
+			// socket is readable, and posts the receive again.
+			if(false == m_iocpData.m_zeroByteReceive)
+			{
+				m_iocpData.m_bufferPool->Bind(c.m_rcvContext);
+			}
+			PrepareRecv(c.m_socket, c.m_rcvContext);
+		}
+	}
+
+	SubmitOrWake();
+
+	return WSA_IO_PENDING;
+}
+
+int CUringPort::PostSend(CConnection &c, CIocpContext &sendContext)
+{
+	// There is no sendfile operation. Files are spliced into a pipe, and 
+	// from the pipe to the socket, without a copy in user space.
+	if( (true == sendContext.IsFileSend()) && (sendContext.m_pipe[0] < 0) )
+	{
+		if(::pipe2(sendContext.m_pipe, O_CLOEXEC) != 0)
+		{
+			return errno;
+		}
+	}
+
+	{
+		mutex::scoped_lock l(c.m_connectionMutex);
+
+		c.m_pendingSends.push_back(&sendContext);
+
+		// Sends queued behind another one are issued when it completes.
+		if(c.m_pendingSends.size() > 1)
+		{
+			return WSA_IO_PENDING;
+		}
+
+		mutex::scoped_lock sq(m_sqMutex);
+		PrepareSend(c.m_socket, sendContext);
+	}
+
+	SubmitOrWake();
+
+	return WSA_IO_PENDING;
+}
+
+void CUringPort::PostCompletion(CIocpContext *context, DWORD bytesTransferred)
+{
+	{
+		mutex::scoped_lock l(m_postedMutex);
+		m_postedPackets.push_back(Packet(context, bytesTransferred));
+	}
+
+	// A worker thread picks up its own packets before it waits again.
+	if(this != t_reaperPort)
+	{
+		Wake();
+	}
+}
+
+void CUringPort::RecycleBuffer(std::vector<uint8_t> *buffer)
+{
+	// Resize it back to the original buffer size. The handler may have
+	// taken the buffer over, in which case this is a new one.
+	if(buffer->capacity() < m_iocpData.m_rcvBufferSize)
+	{
+		m_iocpData.m_bufferPool->Get(*buffer, m_iocpData.m_rcvBufferSize);
+	}
+	buffer->resize(m_iocpData.m_rcvBufferSize);
+
+	{
+		// Counted as the kernel's along with its entry, so that a receive
+		// armed again for it is queued after it.
+		mutex::scoped_lock l(m_bufferMutex);
+		mutex::scoped_lock sq(m_sqMutex);
+
+		ProvideBuffer(static_cast<uint16_t>(buffer - &m_buffers[0]));
+
+		// Queued after the buffer, so the kernel has it by then.
+		std::vector<CIocpContext *>::iterator itr = m_starvedReceives.begin();
+		for(; m_starvedReceives.end() != itr; ++itr)
+		{
+			PrepareMultishotRecv((*itr)->m_socket, **itr);
+		}
+		m_starvedReceives.clear();
+	}
+
+	SubmitOrWake();
+}
+
+bool CUringPort::NextReceive(CConnection &c, Packet &packet)
+{
+	mutex::scoped_lock l(c.m_connectionMutex);
+
+	if(true == c.m_rcvBacklog.empty())
+	{
+		c.m_rcvDelivering = false;
+		return false;
+	}
+
+	packet = c.m_rcvBacklog.front();
+	c.m_rcvBacklog.pop_front();
+
+	return true;
+}
+
+int CUringPort::GetQueuedCompletions(PacketList_t &packets, DWORD timeout)
+{
+	t_reaperPort = this;
+
+	for(;;)
+	{
+		// Packets this thread posted while it processed the last batch.
+		DrainPostedPackets(packets);
+
+		if(false == packets.empty())
+		{
+			FlushSubmissions();
+			return NO_ERROR;
+		}
+
+		if(false == m_cqMutex.try_lock())
+		{
+			// Another worker is waiting for completions. Hand it whatever
+			// this thread queued during its last batch, then line up. It
+			// may wait without a timeout, so this one keeps to its own.
+			FlushSubmissions();
+
+			if(INFINITE == timeout)
+			{
+				m_cqMutex.lock();
+			}
+			else if(false == m_cqMutex.timed_lock(
+				boost::posix_time::milliseconds(timeout)))
+			{
+				return WAIT_TIMEOUT;
+			}
+		}
+
+		{
+			timed_mutex::scoped_lock l(m_cqMutex, boost::adopt_lock);
+
+			ReapCompletions(packets);
+
+			if(true == packets.empty())
+			{
+				// Submit everything queued so far and wait, in one call.
+				// Unless the ring is full, and more may be held behind it.
+				unsigned toSubmit = NumUnsubmitted();
+				if(toSubmit >= m_sqEntries)
+				{
+					FlushSubmissions();
+					toSubmit = NumUnsubmitted();
+				}
+
+				int lastError = Enter(
+					toSubmit,
+					1,
+					IORING_ENTER_GETEVENTS,
+					timeout);
+
+				if( NO_ERROR != lastError &&
+					EINTR != lastError &&
+					EAGAIN != lastError &&
+					EBUSY != lastError &&
+					ETIME != lastError )
+				{
+					return lastError;
+				}
+
+				ReapCompletions(packets);
+			}
+		}
+
+		// Wake ups and partial sends produce no packet. Go back to waiting,
+		// unless the wait is timed, in which case the caller decides.
+		if(false == packets.empty())
+		{
+			FlushSubmissions();
+			return NO_ERROR;
+		}
+
+		if(INFINITE != timeout)
+		{
+			return WAIT_TIMEOUT;
+		}
+	}
+}
+
+int CUringPort::Enter(unsigned toSubmit, 
+					  unsigned minComplete, 
+					  unsigned flags, 
+					  DWORD timeout)
+{
+	io_uring_getevents_arg arg;
+	__kernel_timespec ts;
+
+	void *argp = NULL;
+	size_t argSize = 0;
+
+	if(INFINITE != timeout)
+	{
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000LL;
+
+		memset(&arg, 0, sizeof(arg));
+		arg.ts = reinterpret_cast<uint64_t>(&ts);
+
+		flags |= IORING_ENTER_EXT_ARG;
+		argp = &arg;
+		argSize = sizeof(arg);
+	}
+
+	if(::syscall(
+		__NR_io_uring_enter,
+		m_ringFd,
+		toSubmit,
+		minComplete,
+		flags,
+		argp,
+		argSize) < 0)
+	{
+		return errno;
+	}
+
+	return NO_ERROR;
+}
+
+unsigned CUringPort::NumUnsubmitted()
+{
+	mutex::scoped_lock l(m_sqMutex);
+	MoveHeldSqes();
+	return *m_sqTail - LoadAcquire(m_sqHead);
+}
+
+io_uring_sqe *CUringPort::GetSqe()
+{
+	// The queue only fills up when the workers are far behind. Only they
+	// may submit, so the entry waits outside the ring until they do, 
+	// behind those already waiting.
+	MoveHeldSqes();
+	if(*m_sqTail - LoadAcquire(m_sqHead) >= m_sqEntries)
+	{
+		io_uring_sqe sqe;
+		memset(&sqe, 0, sizeof(sqe));
+		m_heldSqes.push_back(sqe);
+		m_sqeHeld = true;
+		return &m_heldSqes.back();
+	}
+
+	io_uring_sqe *sqe = &m_sqes[*m_sqTail & m_sqMask];
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+void CUringPort::PublishSqe()
+{
+	if(true == m_sqeHeld)
+	{
+		m_sqeHeld = false;
+		return;
+	}
+
+	StoreRelease(m_sqTail, *m_sqTail + 1);
+}
+
+void CUringPort::MoveHeldSqes()
+{
+	while( (false == m_heldSqes.empty()) && 
+		(*m_sqTail - LoadAcquire(m_sqHead) < m_sqEntries) )
+	{
+		m_sqes[*m_sqTail & m_sqMask] = m_heldSqes.front();
+		m_heldSqes.pop_front();
+		StoreRelease(m_sqTail, *m_sqTail + 1);
+	}
+}
+
+void CUringPort::PrepareWakeRead()
+{
+	io_uring_sqe *sqe = GetSqe();
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = m_eventFd;
+	sqe->addr = reinterpret_cast<uint64_t>(&m_wakeValue);
+	sqe->len = sizeof(m_wakeValue);
+	sqe->user_data = WakeTag;
+	PublishSqe();
+}
+
+void CUringPort::PrepareSend(SOCKET s, CIocpContext &sendContext)
+{
+	io_uring_sqe *sqe = GetSqe();
+	sqe->fd = s;
+	sqe->user_data = reinterpret_cast<uint64_t>(&sendContext);
+
+	if(true == sendContext.IsFileSend())
+	{
+		sqe->opcode = IORING_OP_SPLICE;
+		sqe->off = static_cast<uint64_t>(-1);
+
+		if(0 == sendContext.m_pipeBytes)
+		{
+			// Fill the pipe from the file. Never more than the pipe holds,
+			// or the splice waits for a reader that never comes.
+			sqe->fd = sendContext.m_pipe[1];
+			sqe->splice_fd_in = sendContext.m_file->Get();
+			sqe->splice_off_in = sendContext.m_fileOffset;
+			sqe->len = static_cast<uint32_t>(std::min<uint64_t>(
+				sendContext.GetRemainingSize(), PipeSize));
+		}
+		else
+		{
+			// Then empty it into the socket.
+			sqe->splice_fd_in = sendContext.m_pipe[0];
+			sqe->splice_off_in = static_cast<uint64_t>(-1);
+			sqe->len = sendContext.m_pipeBytes;
+		}
+
+		PublishSqe();
+		return;
+	}
+
+	sqe->msg_flags = MSG_NOSIGNAL;
+
+	bool zeroCopy = (true == sendContext.m_zeroCopy) && (true == m_zeroCopy);
+
+	if(1 == sendContext.GetNumWsaBuffers())
+	{
+		WSABUF &wsaBuffer = *sendContext.GetWsaBuffers();
+		sqe->opcode = true == zeroCopy ? IORING_OP_SEND_ZC : IORING_OP_SEND;
+		sqe->addr = reinterpret_cast<uint64_t>(wsaBuffer.buf);
+		sqe->len = static_cast<uint32_t>(wsaBuffer.len);
+	}
+	else
+	{
+		// A gather send. WSABUF has the layout of struct iovec, and the
+		// message header lives in the context until the send completes.
+		msghdr &msg = sendContext.m_msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = reinterpret_cast<iovec *>(sendContext.GetWsaBuffers());
+		msg.msg_iovlen = std::min<size_t>(
+			sendContext.GetNumWsaBuffers(), IOV_MAX);
+
+		sqe->opcode = true == zeroCopy ? 
+			IORING_OP_SENDMSG_ZC : IORING_OP_SENDMSG;
+		sqe->addr = reinterpret_cast<uint64_t>(&msg);
+		sqe->len = 1;
+	}
+
+	PublishSqe();
+}
+
+void CUringPort::PrepareRecv(SOCKET s, CIocpContext &rcvContext)
+{
+	io_uring_sqe *sqe = GetSqe();
+	sqe->fd = s;
+	sqe->user_data = reinterpret_cast<uint64_t>(&rcvContext);
+
+	// Without a buffer, this is the zero byte read: wait for readiness.
+	if(true == rcvContext.m_data.empty())
+	{
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->poll32_events = POLLIN | POLLRDHUP;
+	}
+	else
+	{
+		sqe->opcode = IORING_OP_RECV;
+		sqe->addr = reinterpret_cast<uint64_t>(rcvContext.m_wsaBuffer.buf);
+		sqe->len = static_cast<uint32_t>(rcvContext.m_wsaBuffer.len);
+	}
+
+	PublishSqe();
+}
+
+void CUringPort::PrepareMultishotRecv(SOCKET s, CIocpContext &rcvContext)
+{
+	io_uring_sqe *sqe = GetSqe();
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = s;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = BufferGroup;
+	sqe->user_data = reinterpret_cast<uint64_t>(&rcvContext);
+	PublishSqe();
+}
+
+void CUringPort::PrepareMultishotAccept()
+{
+	io_uring_sqe *sqe = GetSqe();
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = m_iocpData.m_listenSocket;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_CLOEXEC;
+	sqe->user_data = reinterpret_cast<uint64_t>(&m_listenContext);
+	PublishSqe();
+}
+
+void CUringPort::ProvideBuffer(uint16_t bid)
+{
+	++m_buffersProvided;
+
+	io_uring_sqe *sqe = GetSqe();
+	sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+	sqe->fd = 1;
+	sqe->addr = reinterpret_cast<uint64_t>(&m_buffers[bid][0]);
+	sqe->len = static_cast<uint32_t>(m_buffers[bid].size());
+	sqe->off = bid;
+	sqe->buf_group = BufferGroup;
+	sqe->user_data = ProvideTag;
+
+	if(true == m_skipSuccess)
+	{
+		sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+	}
+
+	PublishSqe();
+}
+
+void CUringPort::PrepareAccept(CIocpContext &acceptContext)
+{
+	io_uring_sqe *sqe = GetSqe();
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = m_iocpData.m_listenSocket;
+	sqe->accept_flags = SOCK_CLOEXEC;
+	sqe->user_data = reinterpret_cast<uint64_t>(&acceptContext);
+	PublishSqe();
+}
+
+void CUringPort::SubmitOrWake()
+{
+	// A worker thread submits in bulk before it waits again.
+	if(this == t_reaperPort)
+	{
+		return;
+	}
+
+	Wake();
+}
+
+void CUringPort::FlushSubmissions()
+{
+	// A full ring may have more entries held behind it. They go in as 
+	// the kernel makes room. If it makes none, the completions are 
+	// reaped first.
+	unsigned toSubmit = NumUnsubmitted();
+	while(toSubmit > 0)
+	{
+		if( (NO_ERROR != Enter(toSubmit, 0, 0)) || (toSubmit < m_sqEntries) )
+		{
+			return;
+		}
+
+		toSubmit = NumUnsubmitted();
+	}
+}
+
+void CUringPort::Wake()
+{
+	{
+		mutex::scoped_lock l(m_sqMutex);
+
+		if(true == m_wakePending)
+		{
+			return;
+		}
+
+		m_wakePending = true;
+	}
+
+	uint64_t one = 1;
+	ssize_t rc = ::write(m_eventFd, &one, sizeof(one));
+	(void)rc;
+}
+
+void CUringPort::ReapCompletions(PacketList_t &packets)
+{
+	unsigned head = *m_cqHead;
+	unsigned tail = LoadAcquire(m_cqTail);
+
+	while(head != tail && packets.size() < MaxCompletions)
+	{
+		io_uring_cqe const &cqe = m_cqes[head & m_cqMask];
+		uint64_t userData = cqe.user_data;
+		int result = cqe.res;
+		uint32_t flags = cqe.flags;
+
+		++head;
+
+		HandleCompletion(userData, result, flags, packets);
+	}
+
+	StoreRelease(m_cqHead, head);
+}
+
+void CUringPort::HandleCompletion(uint64_t userData,
+								  int result,
+								  uint32_t flags,
+								  PacketList_t &packets)
+{
+	if(WakeTag == userData)
+	{
+		HandleWake(packets);
+		return;
+	}
+
+	if(AcceptRetryTag == userData)
+	{
+		HandleAcceptRetry();
+		return;
+	}
+
+	if(ProvideTag == userData)
+	{
+		// The buffer is lost to the kernel. Receives carry on with the
+		// others.
+		if(result < 0)
+		{
+			{
+				mutex::scoped_lock l(m_bufferMutex);
+				--m_buffersProvided;
+			}
+
+			if(m_iocpData.m_iocpHandler != NULL)
+			{
+				m_iocpData.m_iocpHandler->OnServerError(-result);
+			}
+		}
+		return;
+	}
+
+	CIocpContext &context = *reinterpret_cast<CIocpContext *>(userData);
+
+	switch(context.m_type)
+	{
+	case CIocpContext::Rcv:
+		if(true == m_multishot)
+		{
+			HandleMultishotRecv(context, result, flags, packets);
+		}
+		else if(-EINTR == result || -EAGAIN == result)
+		{
+			mutex::scoped_lock l(m_sqMutex);
+			PrepareRecv(context.m_socket, context);
+		}
+		else
+		{
+			// 0 bytes (or an error) is how IOCP reports a closed socket.
+			// A poll completes with 0 bytes too, like a zero byte read, 
+			// and the worker thread tells them apart by the missing buffer.
+			packets.push_back(Packet(
+				&context,
+				result > 0 && false == context.m_data.empty() ? 
+					static_cast<DWORD>(result) : 0));
+		}
+		break;
+
+	case CIocpContext::Send:
+		HandleSend(context, result, flags, packets);
+		break;
+
+	case CIocpContext::Accept:
+		if(true == m_multishot)
+		{
+			HandleMultishotAccept(result, flags, packets);
+		}
+		else if(result >= 0)
+		{
+			context.m_socket = result;
+			packets.push_back(Packet(&context, 0));
+		}
+		else if( (-EINTR == result) || 
+				 (-EAGAIN == result) || 
+				 (true == IsAcceptedConnectionError(-result)) )
+		{
+			mutex::scoped_lock l(m_sqMutex);
+			PrepareAccept(context);
+		}
+		else
+		{
+			if(m_iocpData.m_iocpHandler != NULL)
+			{
+				m_iocpData.m_iocpHandler->OnServerError(-result);
+			}
+
+			RetryAccept(&context);
+		}
+		break;
+
+	default:
+		assert(false);
+	}
+}
+
+void CUringPort::HandleMultishotRecv(CIocpContext &rcvContext,
+									 int result,
+									 uint32_t flags,
+									 PacketList_t &packets)
+{
+	std::vector<uint8_t> *buffer = NULL;
+
+	if(0 != (flags & IORING_CQE_F_BUFFER))
+	{
+		buffer = &m_buffers[flags >> IORING_CQE_BUFFER_SHIFT];
+
+		mutex::scoped_lock l(m_bufferMutex);
+		--m_buffersProvided;
+	}
+
+	if(result > 0)
+	{
+		assert(NULL != buffer);
+
+		// Shrink the buffer to fit the byte transferred
+		buffer->resize(result);
+
+		DeliverReceive(Packet(&rcvContext, result, buffer), packets);
+	}
+	else if(NULL != buffer)
+	{
+		RecycleBuffer(buffer);
+	}
+
+	// Still armed.
+	if(0 != (flags & IORING_CQE_F_MORE))
+	{
+		return;
+	}
+
+	if(result > 0 || -EINTR == result || -EAGAIN == result)
+	{
+		mutex::scoped_lock l(m_sqMutex);
+		PrepareMultishotRecv(rcvContext.m_socket, rcvContext);
+		return;
+	}
+
+	if(-ENOBUFS == result)
+	{
+		mutex::scoped_lock l(m_bufferMutex);
+
+		// Some buffers came back since the kernel ran out.
+		if(m_buffersProvided > 0)
+		{
+			mutex::scoped_lock sq(m_sqMutex);
+			PrepareMultishotRecv(rcvContext.m_socket, rcvContext);
+		}
+		else
+		{
+			m_starvedReceives.push_back(&rcvContext);
+		}
+		return;
+	}
+
+	// 0 bytes or an error. Either way, this is the end of the stream.
+	DeliverReceive(Packet(&rcvContext, 0), packets);
+}
+
+void CUringPort::HandleMultishotAccept(int result,
+									   uint32_t flags,
+									   PacketList_t &packets)
+{
+	if(result >= 0)
+	{
+		mutex::scoped_lock l(m_acceptMutex);
+
+		// Every accept context is busy. The next one to be posted again
+		// picks this socket up.
+		if(true == m_freeAccepts.empty())
+		{
+			m_acceptedSockets.push_back(result);
+		}
+		else
+		{
+			CIocpContext *acceptContext = m_freeAccepts.back();
+			m_freeAccepts.pop_back();
+
+			acceptContext->m_socket = result;
+			packets.push_back(Packet(acceptContext, 0));
+		}
+	}
+	else if( (-EINTR != result) && 
+			 (-EAGAIN != result) && 
+			 (false == IsAcceptedConnectionError(-result)) )
+	{
+		if(m_iocpData.m_iocpHandler != NULL)
+		{
+			m_iocpData.m_iocpHandler->OnServerError(-result);
+		}
+
+		if(0 == (flags & IORING_CQE_F_MORE))
+		{
+			RetryAccept(NULL);
+		}
+		return;
+	}
+
+	if(0 == (flags & IORING_CQE_F_MORE))
+	{
+		mutex::scoped_lock l(m_sqMutex);
+		PrepareMultishotAccept();
+	}
+}
+
+void CUringPort::RetryAccept(CIocpContext *acceptContext)
+{
+	mutex::scoped_lock l(m_acceptMutex);
+
+	m_retryAccepts.push_back(acceptContext);
+
+	// One timeout for all of them.
+	if(true == m_acceptRetryArmed)
+	{
+		return;
+	}
+
+	m_acceptRetryArmed = true;
+
+	mutex::scoped_lock sq(m_sqMutex);
+
+	io_uring_sqe *sqe = GetSqe();
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = reinterpret_cast<uint64_t>(&AcceptRetryDelay);
+	sqe->len = 1;
+	sqe->user_data = AcceptRetryTag;
+	PublishSqe();
+}
+
+void CUringPort::HandleAcceptRetry()
+{
+	mutex::scoped_lock l(m_acceptMutex);
+
+	m_acceptRetryArmed = false;
+
+	mutex::scoped_lock sq(m_sqMutex);
+
+	for(size_t i = 0; i < m_retryAccepts.size(); ++i)
+	{
+		if(NULL == m_retryAccepts[i])
+		{
+			PrepareMultishotAccept();
+		}
+		else
+		{
+			PrepareAccept(*m_retryAccepts[i]);
+		}
+	}
+
+	m_retryAccepts.clear();
+}
+
+void CUringPort::DeliverReceive(Packet const &packet, PacketList_t &packets)
+{
+	// The receive keeps the connection until the end of stream.
+	CConnection &c = *packet.m_context->m_connection;
+
+	mutex::scoped_lock l(c.m_connectionMutex);
+
+	if(true == c.m_rcvDelivering)
+	{
+		c.m_rcvBacklog.push_back(packet);
+	}
+	else
+	{
+		c.m_rcvDelivering = true;
+		packets.push_back(packet);
+	}
+}
+
+void CUringPort::HandleWake(PacketList_t &packets)
+{
+	{
+		mutex::scoped_lock l(m_sqMutex);
+		m_wakePending = false;
+		PrepareWakeRead();
+	}
+
+	DrainPostedPackets(packets);
+
+	bool morePackets = false;
+
+	{
+		mutex::scoped_lock l(m_postedMutex);
+		morePackets = (false == m_postedPackets.empty());
+	}
+
+	if(true == morePackets)
+	{
+		Wake();
+	}
+}
+
+void CUringPort::DrainPostedPackets(PacketList_t &packets)
+{
+	mutex::scoped_lock l(m_postedMutex);
+
+	while(false == m_postedPackets.empty())
+	{
+		Packet p = m_postedPackets.front();
+		m_postedPackets.pop_front();
+		packets.push_back(p);
+
+		// Each shutdown packet is meant for exactly one worker thread.
+		if(NULL == p.m_context)
+		{
+			break;
+		}
+	}
+}
+
+void CUringPort::HandleSend(CIocpContext &sendContext,
+							int result,
+							uint32_t flags,
+							PacketList_t &packets)
+{
+	// An outstanding send keeps the connection.
+	CConnection &c = *sendContext.m_connection;
+
+	mutex::scoped_lock l(c.m_connectionMutex);
+
+	// The kernel is done with the buffers of one zero-copy send. The 
+	// context may be complete already, and only waiting for this.
+	if(0 != (flags & IORING_CQE_F_NOTIF))
+	{
+		++sendContext.m_zeroCopyDone;
+		c.ReleaseZeroCopySends(packets);
+		return;
+	}
+
+	assert(&sendContext == c.m_pendingSends.front());
+
+	// A notification follows.
+	if(0 != (flags & IORING_CQE_F_MORE))
+	{
+		++sendContext.m_zeroCopyCalls;
+	}
+
+	// The kernel has no zero-copy send. Copy from now on.
+	if( (true == sendContext.m_zeroCopy) && 
+		(-EINVAL == result || -EOPNOTSUPP == result) )
+	{
+		sendContext.m_zeroCopy = false;
+
+		mutex::scoped_lock sq(m_sqMutex);
+		m_zeroCopy = false;
+		PrepareSend(c.m_socket, sendContext);
+		return;
+	}
+
+	if(true == sendContext.IsFileSend())
+	{
+		if(0 == sendContext.m_pipeBytes)
+		{
+			// The pipe is filled. Nothing read means the file is shorter 
+			// than the range asked for.
+			if(result > 0)
+			{
+				sendContext.m_pipeBytes = static_cast<uint32_t>(result);
+			}
+			else if(0 == result)
+			{
+				result = -EIO;
+			}
+		}
+		else if(result > 0)
+		{
+			sendContext.m_pipeBytes -= static_cast<uint32_t>(result);
+			sendContext.ConsumeWsaBuffers(result);
+		}
+	}
+	else if(result > 0)
+	{
+		sendContext.ConsumeWsaBuffers(result);
+	}
+
+	// Short write. Send the rest before anything queued behind it.
+	if( (sendContext.GetRemainingSize() > 0) &&
+		(result > 0 || -EINTR == result || -EAGAIN == result) )
+	{
+		mutex::scoped_lock sq(m_sqMutex);
+		PrepareSend(c.m_socket, sendContext);
+		return;
+	}
+
+	// A failed send completes with 0 bytes, same as IOCP. The contexts
+	// queued behind it will fail the same way.
+	bool succeeded = (result >= 0 && 0 == sendContext.GetRemainingSize());
+
+	c.m_pendingSends.pop_front();
+
+	Packet packet(
+		&sendContext,
+		true == succeeded ?
+			static_cast<DWORD>(sendContext.GetSendSize()) : 0);
+
+	if(false == c.HoldZeroCopySend(packet))
+	{
+		packets.push_back(packet);
+	}
+
+	if(false == c.m_pendingSends.empty())
+	{
+		mutex::scoped_lock sq(m_sqMutex);
+		PrepareSend(c.m_socket, *c.m_pendingSends.front());
+	}
+}
+
+} } // end namespace
@@ -0,0 +1,276 @@
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef URINGPORT_H_2026_10_18_13_40_55
+#define URINGPORT_H_2026_10_18_13_40_55
+
+#include "CompletionPort.h"
+#include "RingQueue.h"
+#include "IocpContext.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace iocp { namespace detail { class CSharedIocpData; } };
+
+namespace iocp { namespace detail {
+
+//! @details
+//! Completion port on top of io_uring. This is the closest match to IOCP
+//! on Linux: each posted context becomes one submission queue entry
+//! whose user_data is the context itself, and worker threads reap the
+//! completion queue in batches. There is no readiness step, so a receive
+//! costs no extra system call once the data is there.
+//!
+//! All workers share one ring. The thread that owns the completion queue
+//! lock waits in io_uring_enter; the others line up behind it and take
+//! the next batch.
+//!
+//! Submissions made by a worker thread while it processes a batch are
+//! not submitted right away. They are flushed by the io_uring_enter call
+//! that waits for the next batch, so one system call covers every
+//! receive and send issued from the callbacks of the previous batch.
+//!
+//! Other threads (typically the user calling Send) never call
+//! io_uring_enter. The kernel cancels requests when the task that
+//! submitted them exits, so their entries are handed to the workers by
+//! waking them through an eventfd instead. The same eventfd carries
+//! posted completion packets.
+//!
+//! Sends are issued one at a time per connection. io_uring does not order
+//! independent sends on the same socket once one of them has to wait.
+//! File sends alternate between splicing the file into a pipe and the 
+//! pipe into the socket. Zero-copy sends complete once the kernel posts 
+//! the notification that follows each of their completions.
+//!
+//! In multishot mode, the listen socket and every connection have one
+//! request armed for their whole lifetime, and receives pick a buffer
+//! from a group provided to the kernel (IORING_OP_PROVIDE_BUFFERS). The
+//! buffer goes up to OnReceiveData in the packet and is provided again
+//! through RecycleBuffer, in the same batched submission as everything
+//! else. If every buffer is out, receives stop until one comes back.
+class CUringPort : public CCompletionPort
+{
+public:
+
+	CUringPort(CSharedIocpData &iocpData, bool multishot);
+
+	~CUringPort();
+
+	virtual int Create();
+
+	virtual void Close();
+
+	virtual int Associate(SOCKET s, CConnection *c);
+
+	virtual int PostAccept(CIocpContext &acceptContext);
+
+	virtual int PostRecv(CConnection &c);
+
+	virtual int PostSend(CConnection &c, CIocpContext &sendContext);
+
+	virtual void PostCompletion(CIocpContext *context, DWORD bytesTransferred);
+
+	virtual int GetQueuedCompletions(PacketList_t &packets, DWORD timeout);
+
+	virtual void RecycleBuffer(std::vector<uint8_t> *buffer);
+
+	virtual bool NextReceive(CConnection &c, Packet &packet);
+
+private:
+
+	enum
+	{
+		RingEntries = 4096,
+		MaxCompletions = 32,
+
+		//! Provided receive buffers. Fewer if they would exceed
+		//! MaxBufferMemory together.
+		MaxBuffers = 1024,
+		MaxBufferMemory = 16 * 1024 * 1024,
+
+		BufferGroup = 0,
+
+		//! Bytes spliced from a file at a time. A pipe holds at least 
+		//! this much.
+		PipeSize = 64 * 1024,
+	};
+
+	//! user_data of the eventfd read. Contexts are never at address 1.
+	static uint64_t const WakeTag = 1;
+
+	//! user_data of IORING_OP_PROVIDE_BUFFERS
+	static uint64_t const ProvideTag = 2;
+
+	//! user_data of the timeout before the accepts are tried again
+	static uint64_t const AcceptRetryTag = 3;
+
+	//! timeout applies to waits (IORING_ENTER_GETEVENTS), in milliseconds.
+	int Enter(unsigned toSubmit, 
+		unsigned minComplete, 
+		unsigned flags, 
+		DWORD timeout = INFINITE);
+
+	io_uring_sqe *GetSqe();
+
+	void PublishSqe();
+
+	//! Move the entries held while the ring was full into it, as far as
+	//! there is room.
+	void MoveHeldSqes();
+
+	unsigned NumUnsubmitted();
+
+	void PrepareWakeRead();
+
+	void PrepareSend(SOCKET s, CIocpContext &sendContext);
+
+	void PrepareRecv(SOCKET s, CIocpContext &rcvContext);
+
+	void PrepareAccept(CIocpContext &acceptContext);
+
+	void PrepareMultishotRecv(SOCKET s, CIocpContext &rcvContext);
+
+	void PrepareMultishotAccept();
+
+	//! An accept failed with an error that leaves the connection in the 
+	//! backlog. Prepare it again a little later rather than at once, which
+	//! would only repeat the error. NULL for the multishot 
+	//! accept.
+	void RetryAccept(CIocpContext *acceptContext);
+
+	//! The timeout of RetryAccept passed.
+	void HandleAcceptRetry();
+
+	void CreateBuffers();
+
+	//! m_bufferMutex must be held, as well as m_sqMutex.
+	void ProvideBuffer(uint16_t bid);
+
+	void SubmitOrWake();
+
+	void FlushSubmissions();
+
+	void Wake();
+
+	void ReapCompletions(PacketList_t &packets);
+
+	void HandleCompletion(uint64_t userData, 
+		int result, 
+		uint32_t flags, 
+		PacketList_t &packets);
+
+	void HandleMultishotRecv(CIocpContext &rcvContext, 
+		int result, 
+		uint32_t flags, 
+		PacketList_t &packets);
+
+	void HandleMultishotAccept(int result, 
+		uint32_t flags, 
+		PacketList_t &packets);
+
+	void DeliverReceive(Packet const &packet, PacketList_t &packets);
+
+	void DrainPostedPackets(PacketList_t &packets);
+
+	void HandleWake(PacketList_t &packets);
+
+	void HandleSend(
+		CIocpContext &sendContext, 
+		int result, 
+		uint32_t flags, 
+		PacketList_t &packets);
+
+private:
+
+	CSharedIocpData &m_iocpData;
+
+	int m_ringFd;
+
+	int m_eventFd;
+
+	//! the eventfd counter is read into this
+	uint64_t m_wakeValue;
+
+	void *m_ringMemory;
+	size_t m_ringMemorySize;
+
+	io_uring_sqe *m_sqes;
+	size_t m_sqesSize;
+
+	unsigned *m_sqHead;
+	unsigned *m_sqTail;
+	unsigned *m_sqArray;
+	unsigned m_sqMask;
+	unsigned m_sqEntries;
+
+	unsigned *m_cqHead;
+	unsigned *m_cqTail;
+	unsigned m_cqMask;
+	io_uring_cqe *m_cqes;
+
+	//! Guards the submission queue and m_wakePending. The Prepare*
+	//! functions must be called with it held.
+	mutex m_sqMutex;
+
+	//! true while an eventfd write has not been reaped yet
+	bool m_wakePending;
+
+	//! Entries prepared while the ring was full, in order. Guarded by 
+	//! m_sqMutex, as the flag below: the entry GetSqe returned is held.
+	CRingQueue<io_uring_sqe> m_heldSqes;
+	bool m_sqeHeld;
+
+	//! false once the kernel turns a zero-copy send down. Sends are then
+	//! copied. Guarded by m_sqMutex too.
+	bool m_zeroCopy;
+
+	//! Only one thread at a time waits in and reaps the completion queue.
+	timed_mutex m_cqMutex;
+
+	mutex m_postedMutex;
+
+	CRingQueue<Packet> m_postedPackets;
+
+	bool m_multishot;
+
+	//! IORING_FEAT_CQE_SKIP
+	bool m_skipSuccess;
+
+	//! Provided receive buffers. The index is the buffer id.
+	std::vector< std::vector<uint8_t> > m_buffers;
+
+	//! Guards the two members below. Taken before m_sqMutex.
+	mutex m_bufferMutex;
+
+	//! Buffers the kernel has: provided, and not picked since. A buffer
+	//! the kernel failed to take is not counted.
+	size_t m_buffersProvided;
+
+	//! receive contexts whose multishot receive ended for lack of buffers
+	std::vector<CIocpContext *> m_starvedReceives;
+
+	//! user_data of the multishot accept
+	CIocpContext m_listenContext;
+
+	//! Multishot accept. Each accepted socket is handed to a free accept 
+	//! context; the ones accepted while every context is busy wait here. 
+	//! Guarded by m_acceptMutex.
+	mutex m_acceptMutex;
+
+	bool m_acceptArmed;
+
+	std::vector<CIocpContext *> m_freeAccepts;
+
+	std::deque<SOCKET> m_acceptedSockets;
+
+	//! Accepts waiting for the timeout of RetryAccept, and whether it is 
+	//! armed. Guarded by m_acceptMutex as well.
+	std::vector<CIocpContext *> m_retryAccepts;
+	bool m_acceptRetryArmed;
+};
+
+} } // end namespace
+#endif // URINGPORT_H_2026_10_18_13_40_55
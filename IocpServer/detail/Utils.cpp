@@ -1,291 +1,850 @@
-//! Copyright Alan Ning 2010
-//! Distributed under the Boost Software License, Version 1.0.
-//! (See accompanying file LICENSE_1_0.txt or copy at
-//! http://www.boost.org/LICENSE_1_0.txt)
-
-#include "StdAfx.h"
-#include "Utils.h"
-#include "SharedIocpData.h"
-#include "IocpContext.h"
-#include "Connection.h"
-#include "../IocpHandler.h"
-namespace iocp { namespace detail {
-
-	SOCKET CreateOverlappedSocket()
-	{
-		return WSASocket(
-			AF_INET, 
-			SOCK_STREAM, 
-			IPPROTO_TCP, 
-			NULL, 
-			0, 
-			WSA_FLAG_OVERLAPPED);
-	}
-
-
-	//****************************************************************************
-	//! @details
-	//! This method extracts the Connection Information object in real time.
-	//! Therefore, the accept socket must be valid.
-	//!
-	//! @param[in] socket 
-	//! The socket to extract connection information from
-	//!
-	//! @return ndc::tcpip::ConnectionInformation
-	//! Returns the Connection Information based on the accept socket
-	//!
-	//! @remark
-	//! If the returned Connection Information object holds no information,
-	//! it implies that the function has failed.
-	//!
-	//****************************************************************************
-	ConnectionInformation GetConnectionInformation(SOCKET socket)
-	{
-		ConnectionInformation ci;
-
-		// initialize the sockaddr_in object and its length
-		sockaddr_in name;
-		memset(&name, 0, sizeof(name));
-		int namelen = sizeof(name);
-
-		// getpeername to extract the remote party information
-		if(::getpeername(socket, (sockaddr *) &name, &namelen) !=0)
-		{
-			return ci;
-		}
-
-#ifdef UNICODE
-		// Unicode version of converting address to a unicode string
-		int ansiLen = lstrlenA(inet_ntoa(name.sin_addr));
-		LPWSTR unicodeIp = (LPWSTR)malloc((ansiLen) * sizeof(TCHAR));
-		if(::MultiByteToWideChar(
-			CP_ACP, 
-			0, 
-			inet_ntoa(name.sin_addr), 
-			ansiLen, 
-			unicodeIp, 
-			ansiLen) != 0)
-		{
-			// The converted unicode IP address string is not NULL
-			// terminated. So we need to append the exact count.
-			ci.m_remoteIpAddress.append(unicodeIp, ansiLen);
-		}
-		
-		free(unicodeIp);
-
-#else
-		ci.m_remoteIpAddress = inet_ntoa(name.sin_addr);
-#endif
-		ci.m_remotePortNumber = ntohs(name.sin_port);
-
-		// Call getnameinfo to extract the hostname from the IP address
-		TCHAR hostname[NI_MAXHOST] = {0};
-		TCHAR servInfo[NI_MAXSERV] = {0};
-
-#ifdef UNICODE
-		if(GetNameInfoW(
-			(sockaddr *) &name,
-			sizeof (sockaddr), 
-			hostname, // hostname
-			NI_MAXHOST, // size of host name
-			servInfo,  // service info = port
-			NI_MAXSERV, // size of service info
-			NI_NUMERICSERV) != 0) // use numeric port option
-		{
-			return ci;
-		}
-#else
-		if(getnameinfo(
-			(sockaddr *) &name,
-			sizeof (sockaddr), 
-			hostname, // hostname
-			NI_MAXHOST, // size of host name
-			servInfo,  // service info = port
-			NI_MAXSERV, // size of service info
-			NI_NUMERICSERV) != 0) // use numeric port option
-		{
-			return ci;
-		}
-#endif 
-
-		ci.m_remoteHostName = hostname;
-
-		return ci;
-	}
-
-	void PostAccept(CSharedIocpData &iocpData) 
-	{
-		DWORD bytesReceived_ = 0;
-		DWORD addressSize = sizeof(sockaddr_in) + 16;
-
-		if (iocpData.m_acceptExFn(
-			iocpData.m_listenSocket,  // listen socket
-			iocpData.m_acceptContext.m_socket, // accept socket
-			&iocpData.m_acceptContext.m_data[0], // holds local/remote address
-			0, // receive data length = 0 for no receive on accept
-			addressSize, // local address length
-			addressSize, // remote address length
-			&bytesReceived_,
-			&iocpData.m_acceptContext) == FALSE)
-		{
-			DWORD lastError = GetLastError();
-			if (lastError != ERROR_IO_PENDING)
-			{
-				if(iocpData.m_iocpHandler != NULL)
-				{
-					iocpData.m_iocpHandler->OnServerError(lastError);
-				}
-			}
-		}
-		else
-		{
-			PostQueuedCompletionStatus(
-				iocpData.m_ioCompletionPort, 
-				0, 
-				(DWORD) 
-				(ULONG_PTR)&iocpData, 
-				&iocpData.m_acceptContext);
-		}
-	}
-
-
-	int PostRecv( CIocpContext &iocpContext ) 
-	{
-		DWORD dwBytes = 0, dwFlags = 0;
-
-		if(WSARecv(
-			iocpContext.m_socket,
-			&iocpContext.m_wsaBuffer, 
-			1, 
-			&dwBytes, 
-			&dwFlags, 
-			&iocpContext, 
-			NULL) == SOCKET_ERROR)
-		{
-			return WSAGetLastError();
-		}
-
-		return WSA_IO_PENDING;
-	}
-
-
-	int PostSend( CIocpContext &iocpContext )
-	{
-		DWORD dwBytes = 0;
-
-		if(WSASend(
-			iocpContext.m_socket, 
-			&iocpContext.m_wsaBuffer, 
-			1, 
-			&dwBytes, 
-			0, 
-			&iocpContext, 
-			NULL) == SOCKET_ERROR)
-		{
-			return WSAGetLastError();
-		}
-
-		return WSA_IO_PENDING;
-	}
-
-	void AssociateDevice(HANDLE h, CSharedIocpData &iocpData) 
-	{
-		if (::CreateIoCompletionPort(
-			h, 
-			iocpData.m_ioCompletionPort, 
-			(ULONG_PTR)&iocpData, 
-			0) != iocpData.m_ioCompletionPort)
-		{
-			if(iocpData.m_iocpHandler != NULL)
-			{
-				iocpData.m_iocpHandler->OnServerError(::GetLastError());
-			}
-		}
-	}
-
-	HANDLE CreateIocp(int maxConcurrency)
-	{
-		//Create I/O completion port
-		// See http://msdn.microsoft.com/en-us/library/aa363862%28VS.85%29.aspx
-		HANDLE h = CreateIoCompletionPort(
-			INVALID_HANDLE_VALUE, 
-			NULL, 
-			0, 
-			maxConcurrency
-			);
-
-		assert(NULL != h);
-
-		return h;
-	}
-
-	int GetNumIocpThreads()
-	{
-		SYSTEM_INFO si;
-		GetSystemInfo(&si);
-		return si.dwNumberOfProcessors*2;
-	}
-
-	int PostDisconnect(CSharedIocpData &iocpData, CConnection &c)
-	{
-		CIocpContext * disconnectContext = new CIocpContext(
-			c.m_socket, 
-			c.m_id, 
-			CIocpContext::Disconnect,
-			0);
-
-		//Help threads get out of blocking - GetQueuedCompletionStatus()
-		if(PostQueuedCompletionStatus(
-			iocpData.m_ioCompletionPort,
-			0, 
-			(ULONG_PTR)&iocpData, 
-			(LPOVERLAPPED)disconnectContext) == FALSE)
-		{
-			return GetLastError();
-		}
-
-		return NO_ERROR;
-	}
-
-	//!***************************************************************************
-	//! @details
-	//! From Network Programming for Microsoft Windows - APIs and Scalability
-	//!
-	//! Quote:
-	//! Applications should always load the extension functions themselves to 
-	//! avoid the performance penalty of the exported extension functions from 
-	//! MSWSOCK.DLL, because for each call they simply end up loading the 
-	//! same function.
-	//!
-	//! @param[in] s
-	//! Listen socket
-	//!
-	//! @return LPFN_ACCEPTEX
-	//! AcceptEx function, NULL if not found.
-	//!
-	//!***************************************************************************
-	LPFN_ACCEPTEX LoadAcceptEx(SOCKET s)
-	{
-		LPFN_ACCEPTEX lpfnAcceptEx=NULL;
-		DWORD dwBytes = 0;
-
-		GUID GuidAcceptEx=WSAID_ACCEPTEX;
-
-		if(WSAIoctl(
-			s,
-			SIO_GET_EXTENSION_FUNCTION_POINTER,
-			&GuidAcceptEx,
-			sizeof(GuidAcceptEx),
-			&lpfnAcceptEx,
-			sizeof(lpfnAcceptEx),
-			&dwBytes,
-			NULL,
-			NULL
-			) == SOCKET_ERROR)
-		{
-			return NULL;
-		}
-
-		return lpfnAcceptEx;
-	}
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#include "StdAfx.h"
+#include "Utils.h"
+#include "SharedIocpData.h"
+#include "IocpContext.h"
+#include "Connection.h"
+#include "../IocpHandler.h"
+
+#if !defined(_WIN32)
+#include <sys/sendfile.h>
+#include <time.h>
+#endif
+
+namespace iocp { namespace detail {
+
+	uint64_t GetMilliseconds()
+	{
+#if defined(_WIN32)
+		return GetTickCount64();
+#else
+		timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		return static_cast<uint64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+#endif
+	}
+
+	SOCKET CreateOverlappedSocket()
+	{
+#if defined(_WIN32)
+		return WSASocket(
+			AF_INET, 
+			SOCK_STREAM, 
+			IPPROTO_TCP, 
+			NULL, 
+			0, 
+			WSA_FLAG_OVERLAPPED);
+#else
+		// The epoll engine never blocks in a system call on behalf of a 
+		// context, so every socket it touches is non-blocking.
+		return ::socket(
+			AF_INET, 
+			SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 
+			IPPROTO_TCP);
+#endif
+	}
+
+
+	//****************************************************************************
+	//! @details
+	//! This method extracts the Connection Information object in real time.
+	//! Therefore, the accept socket must be valid.
+	//!
+	//! @param[in] socket 
+	//! The socket to extract connection information from
+	//!
+	//! @return ndc::tcpip::ConnectionInformation
+	//! Returns the Connection Information based on the accept socket
+	//!
+	//! @remark
+	//! If the returned Connection Information object holds no information,
+	//! it implies that the function has failed.
+	//!
+	//! m_remoteHostName is left empty. See CHostNameCache.
+	//!
+	//****************************************************************************
+	ConnectionInformation GetConnectionInformation(SOCKET socket)
+	{
+		ConnectionInformation ci;
+
+		// initialize the sockaddr_in object and its length
+		sockaddr_in name;
+		memset(&name, 0, sizeof(name));
+		socklen_t namelen = sizeof(name);
+
+		// getpeername to extract the remote party information
+		if(::getpeername(socket, (sockaddr *) &name, &namelen) !=0)
+		{
+			return ci;
+		}
+
+#ifdef UNICODE
+		// Unicode version of converting address to a unicode string
+		int ansiLen = lstrlenA(inet_ntoa(name.sin_addr));
+		LPWSTR unicodeIp = (LPWSTR)malloc((ansiLen) * sizeof(TCHAR));
+		if(::MultiByteToWideChar(
+			CP_ACP, 
+			0, 
+			inet_ntoa(name.sin_addr), 
+			ansiLen, 
+			unicodeIp, 
+			ansiLen) != 0)
+		{
+			// The converted unicode IP address string is not NULL
+			// terminated. So we need to append the exact count.
+			ci.m_remoteIpAddress.append(unicodeIp, ansiLen);
+		}
+		
+		free(unicodeIp);
+
+#else
+		ci.m_remoteIpAddress = inet_ntoa(name.sin_addr);
+#endif
+		ci.m_remotePortNumber = ntohs(name.sin_port);
+		ci.m_remoteAddress = name.sin_addr.s_addr;
+
+		// The host name is resolved on request, never here. A reverse DNS
+		// lookup can take seconds, and this runs in the accept path.
+
+		return ci;
+	}
+
+#if defined(_WIN32)
+
+	void PostAccept(CSharedIocpData &iocpData, CIocpContext &acceptContext) 
+	{
+		DWORD bytesReceived_ = 0;
+		DWORD addressSize = sizeof(sockaddr_in) + 16;
+
+		if (iocpData.m_acceptExFn(
+			iocpData.m_listenSocket,  // listen socket
+			acceptContext.m_socket, // accept socket
+			&acceptContext.m_data[0], // holds local/remote address
+			0, // receive data length = 0 for no receive on accept
+			addressSize, // local address length
+			addressSize, // remote address length
+			&bytesReceived_,
+			&acceptContext) == FALSE)
+		{
+			DWORD lastError = GetLastError();
+			if (lastError != ERROR_IO_PENDING)
+			{
+				if(iocpData.m_iocpHandler != NULL)
+				{
+					iocpData.m_iocpHandler->OnServerError(lastError);
+				}
+			}
+		}
+		else
+		{
+			PostQueuedCompletionStatus(
+				iocpData.m_ioCompletionPort, 
+				0, 
+				(DWORD) 
+				(ULONG_PTR)&iocpData, 
+				&acceptContext);
+		}
+	}
+
+
+	int PostRecv( CSharedIocpData &iocpData, CConnection &c ) 
+	{
+		DWORD dwBytes = 0, dwFlags = 0;
+
+		// WSARecv needs the buffer for as long as it is pending. In zero 
+		// byte mode, the first read has no buffer at all. It completes once
+		// there is data, and the worker thread binds a buffer then.
+		if(false == iocpData.m_zeroByteReceive)
+		{
+			iocpData.m_bufferPool->Bind(c.m_rcvContext);
+		}
+
+		if(WSARecv(
+			c.m_rcvContext.m_socket,
+			&c.m_rcvContext.m_wsaBuffer, 
+			1, 
+			&dwBytes, 
+			&dwFlags, 
+			&c.m_rcvContext, 
+			NULL) == SOCKET_ERROR)
+		{
+			return WSAGetLastError();
+		}
+
+		return WSA_IO_PENDING;
+	}
+
+
+	int PostSend( CSharedIocpData &iocpData, CConnection &, CIocpContext &iocpContext )
+	{
+		if(true == iocpContext.IsFileSend())
+		{
+			// The file offset to start from goes in the overlapped struct.
+			iocpContext.Offset = static_cast<DWORD>(iocpContext.m_fileOffset);
+			iocpContext.OffsetHigh = 
+				static_cast<DWORD>(iocpContext.m_fileOffset >> 32);
+
+			if(FALSE == iocpData.m_transmitFileFn(
+				iocpContext.m_socket, 
+				iocpContext.m_file->Get(), 
+				iocpContext.m_fileSize, 
+				0, 
+				&iocpContext, 
+				NULL, 
+				0))
+			{
+				int lastError = WSAGetLastError();
+				if(WSA_IO_PENDING != lastError)
+				{
+					return lastError;
+				}
+			}
+
+			return WSA_IO_PENDING;
+		}
+
+		DWORD dwBytes = 0;
+
+		if(WSASend(
+			iocpContext.m_socket, 
+			iocpContext.GetWsaBuffers(), 
+			iocpContext.GetNumWsaBuffers(), 
+			&dwBytes, 
+			0, 
+			&iocpContext, 
+			NULL) == SOCKET_ERROR)
+		{
+			return WSAGetLastError();
+		}
+
+		return WSA_IO_PENDING;
+	}
+
+	void AssociateDevice(SOCKET s, CConnection * /*c*/, CSharedIocpData &iocpData) 
+	{
+		// The completion key is always the shared data, as packets posted
+		// with PostQueuedCompletionStatus share the port. The connection 
+		// travels with each overlapped context instead, see 
+		// CIocpContext::m_connection.
+		if (::CreateIoCompletionPort(
+			(HANDLE)s, 
+			iocpData.m_ioCompletionPort, 
+			(ULONG_PTR)&iocpData, 
+			0) != iocpData.m_ioCompletionPort)
+		{
+			if(iocpData.m_iocpHandler != NULL)
+			{
+				iocpData.m_iocpHandler->OnServerError(::GetLastError());
+			}
+		}
+	}
+
+	HANDLE CreateIocp(int maxConcurrency)
+	{
+		//Create I/O completion port
+		// See http://msdn.microsoft.com/en-us/library/aa363862%28VS.85%29.aspx
+		HANDLE h = CreateIoCompletionPort(
+			INVALID_HANDLE_VALUE, 
+			NULL, 
+			0, 
+			maxConcurrency
+			);
+
+		assert(NULL != h);
+
+		return h;
+	}
+
+	int GetNumIocpThreads()
+	{
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		return si.dwNumberOfProcessors*2;
+	}
+
+	int UpdateAcceptContext(CSharedIocpData &iocpData, SOCKET acceptSocket)
+	{
+		// Update the socket option with SO_UPDATE_ACCEPT_CONTEXT so that
+		// getpeername will work on the accept socket.
+		if(setsockopt(
+			acceptSocket, 
+			SOL_SOCKET, 
+			SO_UPDATE_ACCEPT_CONTEXT, 
+			(char *)&iocpData.m_listenSocket, 
+			sizeof(iocpData.m_listenSocket)
+			) != 0)
+		{
+			return WSAGetLastError();
+		}
+
+		return NO_ERROR;
+	}
+
+	int PostDisconnect(CSharedIocpData &iocpData, CConnection &c)
+	{
+		CIocpContext * disconnectContext = new CIocpContext(
+			c.m_socket, 
+			c.m_id, 
+			CIocpContext::Disconnect,
+			0);
+
+		//Help threads get out of blocking - GetQueuedCompletionStatus()
+		if(PostQueuedCompletionStatus(
+			iocpData.m_ioCompletionPort,
+			0, 
+			(ULONG_PTR)&iocpData, 
+			(LPOVERLAPPED)disconnectContext) == FALSE)
+		{
+			return GetLastError();
+		}
+
+		return NO_ERROR;
+	}
+
+	//!***************************************************************************
+	//! @details
+	//! From Network Programming for Microsoft Windows - APIs and Scalability
+	//!
+	//! Quote:
+	//! Applications should always load the extension functions themselves to 
+	//! avoid the performance penalty of the exported extension functions from 
+	//! MSWSOCK.DLL, because for each call they simply end up loading the 
+	//! same function.
+	//!
+	//! @param[in] s
+	//! Listen socket
+	//!
+	//! @return LPFN_ACCEPTEX
+	//! AcceptEx function, NULL if not found.
+	//!
+	//!***************************************************************************
+	LPFN_ACCEPTEX LoadAcceptEx(SOCKET s)
+	{
+		LPFN_ACCEPTEX lpfnAcceptEx=NULL;
+		DWORD dwBytes = 0;
+
+		GUID GuidAcceptEx=WSAID_ACCEPTEX;
+
+		if(WSAIoctl(
+			s,
+			SIO_GET_EXTENSION_FUNCTION_POINTER,
+			&GuidAcceptEx,
+			sizeof(GuidAcceptEx),
+			&lpfnAcceptEx,
+			sizeof(lpfnAcceptEx),
+			&dwBytes,
+			NULL,
+			NULL
+			) == SOCKET_ERROR)
+		{
+			return NULL;
+		}
+
+		return lpfnAcceptEx;
+	}
+
+	//!***************************************************************************
+	//! @details
+	//! Same as LoadAcceptEx, for TransmitFile.
+	//!
+	//! @param[in] s
+	//! Listen socket
+	//!
+	//! @return LPFN_TRANSMITFILE
+	//! TransmitFile function, NULL if not found.
+	//!
+	//!***************************************************************************
+	LPFN_TRANSMITFILE LoadTransmitFile(SOCKET s)
+	{
+		LPFN_TRANSMITFILE lpfnTransmitFile=NULL;
+		DWORD dwBytes = 0;
+
+		GUID GuidTransmitFile=WSAID_TRANSMITFILE;
+
+		if(WSAIoctl(
+			s,
+			SIO_GET_EXTENSION_FUNCTION_POINTER,
+			&GuidTransmitFile,
+			sizeof(GuidTransmitFile),
+			&lpfnTransmitFile,
+			sizeof(lpfnTransmitFile),
+			&dwBytes,
+			NULL,
+			NULL
+			) == SOCKET_ERROR)
+		{
+			return NULL;
+		}
+
+		return lpfnTransmitFile;
+	}
+
+#else // POSIX
+
+	void PostAccept(CSharedIocpData &iocpData, CIocpContext &acceptContext) 
+	{
+		int lastError = iocpData.m_completionPort->PostAccept(acceptContext);
+		if(NO_ERROR != lastError)
+		{
+			if(iocpData.m_iocpHandler != NULL)
+			{
+				iocpData.m_iocpHandler->OnServerError(lastError);
+			}
+		}
+	}
+
+	int PostRecv( CSharedIocpData &iocpData, CConnection &c ) 
+	{
+		return iocpData.m_completionPort->PostRecv(c);
+	}
+
+	int PostSend( CSharedIocpData &iocpData, CConnection &c, CIocpContext &iocpContext )
+	{
+		// Large sends are worth pinning rather than copying. The engine 
+		// may still copy them, if the kernel can't do otherwise.
+		iocpContext.m_zeroCopy = 
+			(iocpData.m_zeroCopyThreshold > 0) &&
+			(false == iocpContext.IsFileSend()) &&
+			(iocpContext.GetSendSize() >= iocpData.m_zeroCopyThreshold);
+
+		return iocpData.m_completionPort->PostSend(c, iocpContext);
+	}
+
+	void AssociateDevice(SOCKET s, CConnection *c, CSharedIocpData &iocpData) 
+	{
+		int lastError = iocpData.m_completionPort->Associate(s, c);
+		if(NO_ERROR != lastError)
+		{
+			if(iocpData.m_iocpHandler != NULL)
+			{
+				iocpData.m_iocpHandler->OnServerError(lastError);
+			}
+		}
+	}
+
+	int UpdateAcceptContext(CSharedIocpData &, SOCKET)
+	{
+		// accept4() hands out a fully established socket. There is no
+		// listen socket context to inherit.
+		return NO_ERROR;
+	}
+
+	int GetNumProcessors()
+	{
+		long numProcessors = sysconf(_SC_NPROCESSORS_ONLN);
+		if(numProcessors < 1)
+		{
+			numProcessors = 1;
+		}
+		return static_cast<int>(numProcessors);
+	}
+
+	int GetNumIocpThreads()
+	{
+		return GetNumProcessors()*2;
+	}
+
+	void BindCurrentThread(int cpu)
+	{
+		cpu_set_t cpuSet;
+		CPU_ZERO(&cpuSet);
+		CPU_SET(cpu % GetNumProcessors(), &cpuSet);
+
+		// Best effort. The thread still works anywhere.
+		pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+	}
+
+	int PostDisconnect(CSharedIocpData &iocpData, CConnection &c)
+	{
+		CIocpContext * disconnectContext = new CIocpContext(
+			c.m_socket, 
+			c.m_id, 
+			CIocpContext::Disconnect,
+			0);
+
+		iocpData.m_completionPort->PostCompletion(disconnectContext, 0);
+
+		return NO_ERROR;
+	}
+
+	int WriteFileContext(SOCKET s, CIocpContext &sendContext)
+	{
+		while(sendContext.GetRemainingSize() > 0)
+		{
+			// sendfile advances offset, never the file's own position.
+			off_t offset = static_cast<off_t>(sendContext.m_fileOffset);
+
+			ssize_t written = ::sendfile(
+				s, 
+				sendContext.m_file->Get(), 
+				&offset, 
+				static_cast<size_t>(sendContext.GetRemainingSize()));
+
+			if(written < 0)
+			{
+				if(EINTR == errno)
+				{
+					continue;
+				}
+				return errno;
+			}
+
+			// The file is shorter than the range asked for.
+			if(0 == written)
+			{
+				return EIO;
+			}
+
+			sendContext.ConsumeWsaBuffers(written);
+		}
+
+		return NO_ERROR;
+	}
+
+
+	bool IsAcceptedConnectionError(int error)
+	{
+		switch(error)
+		{
+		case ECONNABORTED:
+		case EPROTO:
+		case EPERM:
+		case ENETDOWN:
+		case ENETUNREACH:
+		case ENONET:
+		case EHOSTDOWN:
+		case EHOSTUNREACH:
+		case ENOPROTOOPT:
+		case EOPNOTSUPP:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+#endif
+
+	int ShutdownSocket(CConnection &c, int how)
+	{
+		mutex::scoped_lock l(c.m_connectionMutex);
+
+		int result = NO_ERROR;
+
+		// The receiving side closes right away, whatever is still being 
+		// sent.
+		if(SD_SEND != how)
+		{
+			::InterlockedExchange(&c.m_rcvShutdown, 1);
+
+			if(SOCKET_ERROR == ::shutdown(c.m_socket, SD_RECEIVE))
+			{
+				result = WSAGetLastError();
+			}
+		}
+
+		if(SD_RECEIVE == how)
+		{
+			return result;
+		}
+
+		// Sends are still queued in user space. Closing the sending side 
+		// now would drop them, where Winsock would send them first. 
+		// CConnection::CompleteSend finishes the shutdown once they are 
+		// all sent.
+		::InterlockedExchange(&c.m_pendingShutdown, SD_SEND);
+
+		if(c.m_sendQueue.NumOutstandingContext() > 0)
+		{
+			return result;
+		}
+
+		::InterlockedExchange(&c.m_pendingShutdown, -1);
+
+		if( (SOCKET_ERROR == ::shutdown(c.m_socket, SD_SEND)) &&
+			(NO_ERROR == result) )
+		{
+			result = WSAGetLastError();
+		}
+
+		return result;
+	}
+
+	int AbortSocket(CConnection &c)
+	{
+		mutex::scoped_lock l(c.m_connectionMutex);
+
+		// Whatever ShutdownSocket deferred is done here.
+		::InterlockedExchange(&c.m_pendingShutdown, -1);
+		::InterlockedExchange(&c.m_rcvShutdown, 1);
+
+		int result = ::shutdown(c.m_socket, SD_BOTH);
+
+#if defined(_WIN32)
+		// Sends the peer does not take stay pending through a shutdown.
+		::CancelIoEx(reinterpret_cast<HANDLE>(c.m_socket), NULL);
+#endif
+
+		return result;
+	}
+
+	//!***************************************************************************
+	//! @details
+	//! Queue a send context on the connection, and post it right away unless
+	//! another thread is posting the connection's sends. The connection's 
+	//! send queue owns it from now on.
+	//!
+	//! @return int
+	//! WSA_IO_PENDING, or the error posting sendContext itself. The caller
+	//! then gets it back, to delete.
+	//!
+	//!***************************************************************************
+	int QueueSend(CSharedIocpData &iocpData, CConnection &c, CIocpContext &sendContext)
+	{
+		return QueueSend(iocpData, c, sendContext, sendContext, 1);
+	}
+
+	//!***************************************************************************
+	//! @details
+	//! Same as above, for several contexts linked through m_next, which go
+	//! out one after the other. Only the error posting first is returned.
+	//! The others complete like any context queued behind it.
+	//!
+	//!***************************************************************************
+	int QueueSend(CSharedIocpData &iocpData, 
+		CConnection &c, 
+		CIocpContext &first, 
+		CIocpContext &last, 
+		uint32_t numContexts)
+	{
+		return QueueSend(iocpData, c, first, last, numContexts, &first);
+	}
+
+	//!***************************************************************************
+	//! @details
+	//! Same as above, returning the error posting ownContext only. If NULL,
+	//! every context that fails completes as a failed send.
+	//!
+	//!***************************************************************************
+	int QueueSend(CSharedIocpData &iocpData, 
+		CConnection &c, 
+		CIocpContext &first, 
+		CIocpContext &last, 
+		uint32_t numContexts,
+		CIocpContext *ownContext)
+	{
+		// The write timeout counts from the first send after none were
+		// outstanding, not from the last one that completed.
+		if(0 == c.m_sendQueue.NumOutstandingContext())
+		{
+			iocpData.m_timers.Sent(c);
+		}
+
+		if(false == c.m_sendQueue.Push(&first, &last, numContexts))
+		{
+			// The thread draining the queue posts it, after the ones ahead.
+			return WSA_IO_PENDING;
+		}
+
+		return PostQueuedSends(iocpData, c, ownContext);
+	}
+
+	//!***************************************************************************
+	//! @details
+	//! Queue a send context behind the connection's send window 
+	//! (ServerOptions::m_sendWindow). It is queued right away if the window
+	//! has room and nothing waits for it; otherwise, it waits, and 
+	//! ReleaseWindowedSends queues it once the sends ahead complete. Sends
+	//! queued with QueueSend never wait, so they only follow what is 
+	//! already in the window.
+	//!
+	//! @return int
+	//! WSA_IO_PENDING, or the error posting sendContext itself, as 
+	//! QueueSend.
+	//!
+	//!***************************************************************************
+	int QueueWindowedSend(CSharedIocpData &iocpData, CConnection &c, CIocpContext &sendContext)
+	{
+		return QueueWindowedSend(iocpData, c, sendContext, sendContext, 1);
+	}
+
+	//!***************************************************************************
+	//! @details
+	//! Same as above, for several contexts linked through m_next. They are 
+	//! one message: they wait and go together, so that no other send gets
+	//! in between.
+	//!
+	//!***************************************************************************
+	int QueueWindowedSend(CSharedIocpData &iocpData, 
+		CConnection &c, 
+		CIocpContext &first, 
+		CIocpContext &last, 
+		uint32_t numContexts)
+	{
+		return QueueWindowedSend(
+			iocpData, c, first, last, numContexts, &first);
+	}
+
+	//! Same as above, returning the error posting ownContext only, as the 
+	//! QueueSend that takes it.
+	int QueueWindowedSend(CSharedIocpData &iocpData, 
+		CConnection &c, 
+		CIocpContext &first, 
+		CIocpContext &last, 
+		uint32_t numContexts,
+		CIocpContext *ownContext)
+	{
+		if(0 == iocpData.m_sendWindow)
+		{
+			return QueueSend(
+				iocpData, c, first, last, numContexts, ownContext);
+		}
+
+		CConnection::CWindowedSend windowedSend;
+		windowedSend.m_first = &first;
+		windowedSend.m_last = &last;
+		windowedSend.m_numContexts = numContexts;
+		windowedSend.m_numBytes = 0;
+
+		CIocpContext *sendContext = &first;
+		for(uint32_t i = 0; i < numContexts; ++i)
+		{
+			sendContext->m_windowed = true;
+			windowedSend.m_numBytes += sendContext->GetSendSize();
+			sendContext = sendContext->Next();
+		}
+
+		mutex::scoped_lock l(c.m_windowMutex);
+
+		// Queued under the lock, so that sends leave the window in order.
+		if( (false == c.m_windowedSends.empty()) ||
+			(c.m_numBytesInWindow >= iocpData.m_sendWindow) )
+		{
+			c.m_windowedSends.push_back(windowedSend);
+			return WSA_IO_PENDING;
+		}
+
+		c.m_numBytesInWindow += windowedSend.m_numBytes;
+
+		int lastError = QueueSend(
+			iocpData, c, first, last, numContexts, ownContext);
+		if(WSA_IO_PENDING != lastError)
+		{
+			// The others complete, and leave the window, as failed sends.
+			c.m_numBytesInWindow -= ownContext->GetSendSize();
+		}
+
+		return lastError;
+	}
+
+	//!***************************************************************************
+	//! @details
+	//! Take a completed send out of the connection's send window, and queue
+	//! the sends waiting for it that now fit. Contexts that fail complete
+	//! as failed sends.
+	//!
+	//! @param[in] numBytes
+	//! The size of the completed context, sent or not.
+	//!
+	//!***************************************************************************
+	void ReleaseWindowedSends(CSharedIocpData &iocpData, CConnection &c, uint64_t numBytes)
+	{
+		mutex::scoped_lock l(c.m_windowMutex);
+
+		c.m_numBytesInWindow -= numBytes;
+
+		while( (false == c.m_windowedSends.empty()) &&
+			(c.m_numBytesInWindow < iocpData.m_sendWindow) )
+		{
+			CConnection::CWindowedSend windowedSend = 
+				c.m_windowedSends.front();
+			c.m_windowedSends.pop_front();
+
+			c.m_numBytesInWindow += windowedSend.m_numBytes;
+
+			if(true == c.m_sendQueue.Push(
+				windowedSend.m_first, 
+				windowedSend.m_last, 
+				windowedSend.m_numContexts))
+			{
+				PostQueuedSends(iocpData, c, NULL);
+			}
+		}
+	}
+
+	//!***************************************************************************
+	//! @details
+	//! Drain the connection's send queue: post its contexts in order, until 
+	//! no thread adds more. Contexts that fail complete as failed sends, 
+	//! except ownContext.
+	//!
+	//! @return int
+	//! WSA_IO_PENDING, or the error posting ownContext.
+	//!
+	//!***************************************************************************
+	int PostQueuedSends(CSharedIocpData &iocpData, CConnection &c, CIocpContext *ownContext)
+	{
+		int ownError = WSA_IO_PENDING;
+
+		do
+		{
+			CIocpContext *sendContext = c.m_sendQueue.Pop();
+
+			int lastError = PostSend(iocpData, c, *sendContext);
+			if(WSA_IO_PENDING == lastError)
+			{
+				continue;
+			}
+
+			if(sendContext == ownContext)
+			{
+				ownError = lastError;
+				c.CompleteSend();
+			}
+			else
+			{
+				PostSendFailure(iocpData, *sendContext);
+			}
+		}
+		while(true == c.m_sendQueue.Popped());
+
+		return ownError;
+	}
+
+	void PostSendFailure(CSharedIocpData &iocpData, CIocpContext &sendContext)
+	{
+		// A failed send completes with 0 bytes, same as IOCP.
+#if defined(_WIN32)
+		PostQueuedCompletionStatus(
+			iocpData.m_ioCompletionPort, 
+			0, 
+			(ULONG_PTR)&iocpData, 
+			&sendContext);
+#else
+		iocpData.m_completionPort->PostCompletion(&sendContext, 0);
+#endif
+	}
+
+	//! Queue the connection's send batch, if there is one. Call with 
+	//! m_sendBatchMutex held.
+	void QueueSendBatch(CSharedIocpData &iocpData, CConnection &c)
+	{
+		if(NULL == c.m_sendBatch)
+		{
+			return;
+		}
+
+		CIocpContext *sendBatch = c.m_sendBatch;
+		c.m_sendBatch = NULL;
+
+		sendBatch->ResetWsaBuf();
+
+		// If it fails, it completes as a failed send, as the ones that 
+		// another thread posts.
+		QueueWindowedSend(iocpData, c, *sendBatch, *sendBatch, 1, NULL);
+	}
+
 } } // end namespace
\ No newline at end of file
@@ -1,49 +1,140 @@
-//! Copyright Alan Ning 2010
-//! Distributed under the Boost Software License, Version 1.0.
-//! (See accompanying file LICENSE_1_0.txt or copy at
-//! http://www.boost.org/LICENSE_1_0.txt)
-
-#ifndef UTILS_H_2010_09_28_10_55_30
-#define UTILS_H_2010_09_28_10_55_30
-
-#include "../ConnectionInformation.h"
-
-namespace iocp { namespace detail { class CSharedIocpData; } };
-namespace iocp { namespace detail { class CIocpContext; } };
-namespace iocp { namespace detail { class CConnection; } };
-
-namespace iocp { namespace detail {
-
-	int 
-	GetNumIocpThreads();
-
-	SOCKET 
-	CreateOverlappedSocket();
-
-	ConnectionInformation 
-	GetConnectionInformation(SOCKET socket);
-
-	void 
-	PostAccept(CSharedIocpData &iocpData);
-
-	int 
-	PostRecv( CIocpContext &iocpContext );
-
-	int 
-	PostSend(CIocpContext &iocpContext );
-
-	int 
-	PostDisconnect(CSharedIocpData &iocpData, CConnection &c);
-
-	void 
-	AssociateDevice(HANDLE h, CSharedIocpData &iocpData);
-
-	HANDLE 
-	CreateIocp(int maxConcurrency = 0);
-
-	LPFN_ACCEPTEX
-	LoadAcceptEx(SOCKET s);
-
-
-} } // end namespace
-#endif // UTILS_H_2010_09_28_10_55_30
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef UTILS_H_2010_09_28_10_55_30
+#define UTILS_H_2010_09_28_10_55_30
+
+#include "../ConnectionInformation.h"
+
+namespace iocp { namespace detail { class CSharedIocpData; } };
+namespace iocp { namespace detail { class CIocpContext; } };
+namespace iocp { namespace detail { class CConnection; } };
+
+namespace iocp { namespace detail {
+
+	int 
+	GetNumIocpThreads();
+
+	SOCKET 
+	CreateOverlappedSocket();
+
+	ConnectionInformation 
+	GetConnectionInformation(SOCKET socket);
+
+	void 
+	PostAccept(CSharedIocpData &iocpData, CIocpContext &acceptContext);
+
+	int 
+	PostRecv(CSharedIocpData &iocpData, CConnection &c);
+
+	int 
+	PostSend(CSharedIocpData &iocpData, CConnection &c, CIocpContext &sendContext);
+
+	int 
+	PostDisconnect(CSharedIocpData &iocpData, CConnection &c);
+
+	int 
+	QueueSend(CSharedIocpData &iocpData, CConnection &c, CIocpContext &sendContext);
+
+	int 
+	QueueSend(
+		CSharedIocpData &iocpData, 
+		CConnection &c, 
+		CIocpContext &first, 
+		CIocpContext &last, 
+		uint32_t numContexts);
+
+	int 
+	QueueSend(
+		CSharedIocpData &iocpData, 
+		CConnection &c, 
+		CIocpContext &first, 
+		CIocpContext &last, 
+		uint32_t numContexts,
+		CIocpContext *ownContext);
+
+	int 
+	QueueWindowedSend(CSharedIocpData &iocpData, CConnection &c, CIocpContext &sendContext);
+
+	int 
+	QueueWindowedSend(
+		CSharedIocpData &iocpData, 
+		CConnection &c, 
+		CIocpContext &first, 
+		CIocpContext &last, 
+		uint32_t numContexts);
+
+	int 
+	QueueWindowedSend(
+		CSharedIocpData &iocpData, 
+		CConnection &c, 
+		CIocpContext &first, 
+		CIocpContext &last, 
+		uint32_t numContexts,
+		CIocpContext *ownContext);
+
+	void 
+	ReleaseWindowedSends(CSharedIocpData &iocpData, CConnection &c, uint64_t numBytes);
+
+	int 
+	PostQueuedSends(CSharedIocpData &iocpData, CConnection &c, CIocpContext *ownContext);
+
+	void 
+	PostSendFailure(CSharedIocpData &iocpData, CIocpContext &sendContext);
+
+	void 
+	QueueSendBatch(CSharedIocpData &iocpData, CConnection &c);
+
+	//! c is the socket's connection, or NULL for the listen socket.
+	void 
+	AssociateDevice(SOCKET s, CConnection *c, CSharedIocpData &iocpData);
+
+	int
+	UpdateAcceptContext(CSharedIocpData &iocpData, SOCKET acceptSocket);
+
+	//! Returns NO_ERROR, or the error of the first side that failed. The 
+	//! sending side's shutdown waits for the sends queued, and its error is
+	//! not reported then.
+	int
+	ShutdownSocket(CConnection &c, int how);
+
+	//! Shut both ways down right away, and fail the sends still out.
+	int
+	AbortSocket(CConnection &c);
+
+	//! A monotonic clock, in milliseconds.
+	uint64_t
+	GetMilliseconds();
+
+#if defined(_WIN32)
+	HANDLE 
+	CreateIocp(int maxConcurrency = 0);
+
+	LPFN_ACCEPTEX
+	LoadAcceptEx(SOCKET s);
+
+	LPFN_TRANSMITFILE
+	LoadTransmitFile(SOCKET s);
+#else
+	int
+	GetNumProcessors();
+
+	void
+	BindCurrentThread(int cpu);
+
+	//! Send what is left of a file send context, without blocking on the 
+	//! socket. Returns NO_ERROR once it is all sent, or errno (EAGAIN if 
+	//! the socket is full).
+	int
+	WriteFileContext(SOCKET s, CIocpContext &sendContext);
+
+	//! Errors of accept that belong to the connection it took off the 
+	//! backlog, which is gone. The next one may be accepted right away.
+	bool
+	IsAcceptedConnectionError(int error);
+#endif
+
+} } // end namespace
+#endif // UTILS_H_2010_09_28_10_55_30
@@ -1,336 +1,619 @@
-//! Copyright Alan Ning 2010
-//! Distributed under the Boost Software License, Version 1.0.
-//! (See accompanying file LICENSE_1_0.txt or copy at
-//! http://www.boost.org/LICENSE_1_0.txt)
-
-#include "StdAfx.h"
-#include "WorkerThread.h"
-#include "SharedIocpData.h"
-#include "IocpContext.h"
-#include "Connection.h"
-#include "Utils.h"
-
-#include "../IocpHandler.h"
-
-namespace iocp { namespace detail {
-
-CWorkerThread::CWorkerThread(CSharedIocpData &iocpData)
-: m_iocpData(iocpData)
-{
-	m_thread = thread(bind(&CWorkerThread::Run, this));
-}
-
-CWorkerThread::~CWorkerThread()
-{
-	m_thread.join();
-}
-
-void CWorkerThread::Run()
-{
-	for(;;)
-	{
-		void *key = NULL;
-		OVERLAPPED *overlapped = NULL;
-		DWORD bytesTransferred = 0;
-
-		BOOL completionStatus = GetQueuedCompletionStatus(
-			m_iocpData.m_ioCompletionPort,
-			&bytesTransferred,
-			(LPDWORD)&key,
-			&overlapped,
-			INFINITE);
-
-		if(FALSE == completionStatus)
-		{
-			HandleCompletionFailure(overlapped, bytesTransferred, GetLastError());
-			continue;
-		}
-
-		// NULL key packet is a special status that unblocks the worker
-		// thread to initial a shutdown sequence. The thread should be going
-		// down soon.
-		if(NULL == key)
-		{
-			break;
-		}
-
-		CIocpContext &iocpContext = 
-			*reinterpret_cast<CIocpContext *>(overlapped);
-
-		HandleIocpContext(iocpContext, bytesTransferred);
-	}
-}
-
-void CWorkerThread::HandleReceive( CIocpContext &rcvContext, DWORD bytesTransferred )
-{
-	shared_ptr<CConnection> c = 
-		m_iocpData.m_connectionManager.GetConnection(rcvContext.m_cid);
-	if(c == NULL)
-	{
-		assert(false);
-		return;
-	}
-
-	// If nothing is transferred, we are about to be disconnected. In this
-	// case, don't notify the client that nothing is received because
-	// they are about to get a disconnection callback.
-	if(0 != bytesTransferred)
-	{
-		// Shrink the buffer to fit the byte transferred
-		rcvContext.m_data.resize(bytesTransferred);
-		assert(rcvContext.m_data.size() == bytesTransferred);
-
-		if(m_iocpData.m_iocpHandler != NULL)
-		{
-			// Invoke the callback for the client
-			m_iocpData.m_iocpHandler->OnReceiveData(
-				rcvContext.m_cid,
-				rcvContext.m_data);
-		}
-	}
-
-	// Resize it back to the original buffer size and prepare to post
-	// another completion status.
-	rcvContext.m_data.resize(rcvContext.m_rcvBufferSize);
-	rcvContext.ResetWsaBuf();
-
-	int lastError = NO_ERROR;
-
-	// 0 bytes transferred, or if a recv context can't be posted to the 
-	// IO completion port, that implies the socket at least half-closed.
-	if( (0 == bytesTransferred) || 
-		WSA_IO_PENDING != (lastError = PostRecv(rcvContext)) )
-	{
-		uint64_t cid = rcvContext.m_cid;
-		if (c->CloseRcvContext() == true)
-		{
-			::shutdown(c->m_socket, SD_RECEIVE);
-
-			if(m_iocpData.m_iocpHandler != NULL)
-			{
-				m_iocpData.m_iocpHandler->OnClientDisconnect(
-					cid,
-					lastError);
-			}
-		}
-	}
-}
-
-void CWorkerThread::HandleSend( CIocpContext &iocpContext, DWORD bytesTransferred )
-{
-	shared_ptr<CConnection> c = 
-		m_iocpData.m_connectionManager.GetConnection(iocpContext.m_cid);
-	if(c == NULL)
-	{
-		assert(false);
-		return;
-	}
-
-	uint64_t cid = iocpContext.m_cid;
-
-	if(bytesTransferred > 0 )
-	{
-		if(m_iocpData.m_iocpHandler != NULL)
-		{
-			m_iocpData.m_iocpHandler->OnSentData(cid, bytesTransferred);
-		}
-	}
-	//No bytes transferred, that means send has failed.
-	else
-	{
-		// what to do here?
-	}
-
-	//! @remark
-	//! Remove the send context after notifying the user. Otherwise
-	//! there is a race condition where a disconnect context maybe waiting 
-	//! for the send queue to go to zero at the same time. In this case,
-	//! the disconnect notification will come before we notify the user.
-	int outstandingSend = c->m_sendQueue.RemoveSendContext(&iocpContext);
-
-	// If there is no outstanding send context, that means all sends 
-	// are completed for the moment. At this point, if we have a half-closed 
-	// socket, and the connection is pending to be disconnected, post a 
-	// disconnect context for a graceful shutdown.
-	if(0 == outstandingSend)
-	{
-		if( (::InterlockedExchangeAdd(&c->m_rcvClosed, 0) > 0) &&
-			(::InterlockedExchangeAdd(&c->m_disconnectPending, 0) > 0) )
-		{
-			// Disconnect context is special (hacked) because it is not
-			// tied to a connection. During graceful shutdown, it is very
-			// difficult to determine when exactly is a good time to 
-			// remove the connection. For example, a disconnect context 
-			// might have already been sent by the user code, and you
-			// wouldn't know it unless mutex are used. To keep it as 
-			// lock-free as possible, the disconnect handler
-			// will gracefully handle redundant disconnect context.
-			PostDisconnect(m_iocpData, *c);
-		}
-	}
-}
-
-void CWorkerThread::HandleAccept( CIocpContext &acceptContext, DWORD bytesTransferred )
-{
-	// We should be accepting immediately without waiting for any data.
-	// If this has change, we need to account for that accept buffer and post
-	// it to the receive side.
-	assert(0 == bytesTransferred);
-
-	// Update the socket option with SO_UPDATE_ACCEPT_CONTEXT so that
-	// getpeername will work on the accept socket.
-	if(setsockopt(
-		acceptContext.m_socket, 
-		SOL_SOCKET, 
-		SO_UPDATE_ACCEPT_CONTEXT, 
-		(char *)&m_iocpData.m_listenSocket, 
-		sizeof(m_iocpData.m_listenSocket)
-		) != 0)
-	{
-		if(m_iocpData.m_iocpHandler != NULL)
-		{
-			// This shouldn't happen, but if it does, report the error. 
-			// Since the connection has not been established, it is not necessary
-			// to notify the client to remove any connections.
-			m_iocpData.m_iocpHandler->OnServerError(WSAGetLastError());
-		}
-	}
-	// If the socket is up, allocate the connection and notify the client.
-	else
-	{
-		ConnectionInformation cinfo = 
-			GetConnectionInformation(acceptContext.m_socket);
-
-		shared_ptr<CConnection> c(new CConnection(
-			acceptContext.m_socket, 
-			m_iocpData.GetNextId(),
-			m_iocpData.m_rcvBufferSize
-			));
-
-		m_iocpData.m_connectionManager.AddConnection(c);
-
-		AssociateDevice((HANDLE)c->m_socket, m_iocpData);
-
-		if(m_iocpData.m_iocpHandler != NULL)
-		{
-			m_iocpData.m_iocpHandler->OnNewConnection(c->m_id, cinfo);
-		}
-
-		int lasterror = PostRecv(c->m_rcvContext);
-
-		// Failed to post a queue a receive context. It is likely that the
-		// connection is already terminated at this point (by user or client).
-		// In such case, just remove the connection.
-		if( WSA_IO_PENDING != lasterror)
-		{
-			if(true == c->CloseRcvContext())
-			{
-				PostDisconnect(m_iocpData, *c);
-			}
-		}
-	}
-
-	// Post another Accept context to IOCP for another new connection.
-	//! @remark
-	//! For higher performance, it is possible to preallocate these sockets
-	//! and have a pool of accept context waiting. That adds complexity, and
-	//! unnecessary for now.
-	acceptContext.m_socket = CreateOverlappedSocket();
-
-	if(INVALID_SOCKET != acceptContext.m_socket)
-	{
-		PostAccept(m_iocpData);
-	}
-	else
-	{
-		if(m_iocpData.m_iocpHandler != NULL)
-		{
-			m_iocpData.m_iocpHandler->OnServerError(WSAGetLastError());
-		}
-	}
-}
-
-void CWorkerThread::HandleIocpContext(CIocpContext &iocpContext, 
-									  DWORD bytesTransferred )
-{
-	switch(iocpContext.m_type)
-	{
-	case CIocpContext::Rcv:
-		HandleReceive(iocpContext, bytesTransferred);
-		break;
-	case CIocpContext::Send:
-		HandleSend(iocpContext, bytesTransferred);
-		break;
-	case CIocpContext::Accept:
-		HandleAccept(iocpContext, bytesTransferred);
-		break;
-	case CIocpContext::Disconnect:
-		HandleDisconnect(iocpContext);
-		break;
-	default:
-		assert(false);
-	}
-}
-
-void CWorkerThread::HandleCompletionFailure(OVERLAPPED * overlapped, 
-											DWORD bytesTransferred, 
-											int error )
-{
-	if (NULL != overlapped ) 
-	{
-		// Process a failed completed I/O request
-		// dwError contains the reason for failure
-		CIocpContext &iocpContext = 
-			*reinterpret_cast<CIocpContext *>(overlapped);
-		HandleIocpContext(iocpContext, bytesTransferred);
-	} 
-	else 
-	{
-		// Currently, GetQueuedCompletionStatus is called with an INFINITE
-		// timeout flag, so it should not be possible for the status to 
-		// timeout.
-		assert(WAIT_TIMEOUT != error);
-		
-		if(m_iocpData.m_iocpHandler != NULL)
-		{
-			// GetQueuedCompletionStatus failed. Notify the user on this event.
-			m_iocpData.m_iocpHandler->OnServerError(error);
-		}
-	}
-}
-
-void CWorkerThread::HandleDisconnect( CIocpContext &iocpContext )
-{
-	uint64_t cid = iocpContext.m_cid;
-
-	// Disconnect context isn't tied to the connection. Therefore, it must
-	// be deleted manually at all times.
-	delete &iocpContext;
-
-	shared_ptr<CConnection> c = 
-		m_iocpData.m_connectionManager.GetConnection(cid);
-	if(c == NULL)
-	{
-		//! @remark
-		//! Disconnect context may come from several different source at 
-		//! once, and only the first one to remove the connection. If the
-		//! connection is already removed, gracefully handle it.
-
-		//std::cout <<"Extra disconnect packet received" << std::endl;
-		return;
-	}
-
-	if(c->HasOutstandingContext() == true)
-	{
-		return;
-	}
-
-	if(true == m_iocpData.m_connectionManager.RemoveConnection(cid) )
-	{
-		if(m_iocpData.m_iocpHandler != NULL)
-		{
-			m_iocpData.m_iocpHandler->OnDisconnect(cid,0);
-		}
-	}
-}
-} } // end namespace
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#include "StdAfx.h"
+#include "WorkerThread.h"
+#include "SharedIocpData.h"
+#include "IocpContext.h"
+#include "Connection.h"
+#include "Utils.h"
+
+#include "../IocpHandler.h"
+
+namespace iocp { namespace detail {
+
+CWorkerThread::CWorkerThread(CSharedIocpData &iocpData, int cpu)
+: m_iocpData(iocpData)
+, m_cpu(cpu)
+{
+	m_thread = thread(bind(&CWorkerThread::Run, this));
+}
+
+CWorkerThread::~CWorkerThread()
+{
+	m_thread.join();
+}
+
+#if defined(_WIN32)
+
+void CWorkerThread::Run()
+{
+	for(;;)
+	{
+		void *key = NULL;
+		OVERLAPPED *overlapped = NULL;
+		DWORD bytesTransferred = 0;
+
+		BOOL completionStatus = GetQueuedCompletionStatus(
+			m_iocpData.m_ioCompletionPort,
+			&bytesTransferred,
+			(LPDWORD)&key,
+			&overlapped,
+			m_iocpData.m_timers.GetWaitTime());
+
+		if(FALSE == completionStatus)
+		{
+			HandleCompletionFailure(overlapped, bytesTransferred, GetLastError());
+			HandleTimeouts();
+			continue;
+		}
+
+		// NULL key packet is a special status that unblocks the worker
+		// thread to initial a shutdown sequence. The thread should be going
+		// down soon.
+		if(NULL == key)
+		{
+			break;
+		}
+
+		CIocpContext &iocpContext = 
+			*reinterpret_cast<CIocpContext *>(overlapped);
+
+		HandleIocpContext(iocpContext, bytesTransferred);
+
+		HandleTimeouts();
+	}
+
+	m_iocpData.m_bufferPool->FlushThreadCache();
+	m_iocpData.m_contextPool->FlushThreadCache();
+}
+
+#else // POSIX
+
+void CWorkerThread::Run()
+{
+	if(m_cpu >= 0)
+	{
+		BindCurrentThread(m_cpu);
+	}
+
+	CCompletionPort::PacketList_t packets;
+
+	for(;;)
+	{
+		packets.clear();
+
+		int lastError = m_iocpData.m_completionPort->GetQueuedCompletions(
+			packets,
+			m_iocpData.m_timers.GetWaitTime());
+
+		if(WAIT_TIMEOUT == lastError)
+		{
+			HandleTimeouts();
+			continue;
+		}
+
+		if(NO_ERROR != lastError)
+		{
+			if(m_iocpData.m_iocpHandler != NULL)
+			{
+				m_iocpData.m_iocpHandler->OnServerError(lastError);
+			}
+			continue;
+		}
+
+		// NULL context packet is a special status that unblocks the worker
+		// thread to initial a shutdown sequence. Finish the rest of the 
+		// batch first, so that no completion is lost.
+		bool shutdown = false;
+
+		CCompletionPort::PacketList_t::iterator itr = packets.begin();
+		for(; packets.end() != itr; ++itr)
+		{
+			if(NULL == itr->m_context)
+			{
+				shutdown = true;
+				continue;
+			}
+
+			if(NULL != itr->m_buffer)
+			{
+				HandleBufferedReceive(*itr);
+			}
+			else
+			{
+				HandleIocpContext(*itr->m_context, itr->m_bytesTransferred);
+			}
+		}
+
+		if(true == shutdown)
+		{
+			break;
+		}
+
+		HandleTimeouts();
+	}
+
+	m_iocpData.m_bufferPool->FlushThreadCache();
+	m_iocpData.m_contextPool->FlushThreadCache();
+}
+
+void CWorkerThread::HandleBufferedReceive(CCompletionPort::Packet packet)
+{
+	CConnection &c = *packet.m_context->m_connection;
+
+	// Held from the end of stream on, which may let the connection go.
+	intrusive_ptr<CConnection> pin;
+
+	// The receive stays armed, so there is nothing to post here. Deliver
+	// whatever else arrived for this connection in the meantime.
+	do 
+	{
+		if(NULL == packet.m_buffer)
+		{
+			// End of stream.
+			pin = &c;
+			HandleReceive(*packet.m_context, packet.m_bytesTransferred);
+			continue;
+		}
+
+		m_iocpData.m_timers.Received(c);
+
+		// The server shut the receiving side down. The data Linux still
+		// returns until the end of stream is dropped.
+		bool rcvShutdown = (0 != ::InterlockedExchangeAdd(&c.m_rcvShutdown, 0));
+
+		if( (m_iocpData.m_iocpHandler != NULL) && (false == rcvShutdown) )
+		{
+			CReceiveBuffer data(*packet.m_buffer, *m_iocpData.m_bufferPool);
+
+			// Invoke the callback for the client
+			m_iocpData.m_iocpHandler->OnReceiveBuffer(
+				packet.m_context->m_cid,
+				c.m_userContext,
+				data);
+		}
+
+		m_iocpData.m_completionPort->RecycleBuffer(packet.m_buffer);
+
+	} while(true == m_iocpData.m_completionPort->NextReceive(c, packet));
+}
+
+#endif
+
+void CWorkerThread::HandleReceive( CIocpContext &rcvContext, DWORD bytesTransferred )
+{
+	// The receive keeps the connection until it is closed.
+	CConnection &c = *rcvContext.m_connection;
+
+	// The server shut the receiving side down. Drop whatever arrived since
+	// and close the receive, as at the end of stream.
+	bool rcvShutdown = (0 != ::InterlockedExchangeAdd(&c.m_rcvShutdown, 0));
+	if(true == rcvShutdown)
+	{
+		bytesTransferred = 0;
+	}
+
+	// A zero byte read completed: the client sent something, or closed the
+	// connection. Either way, a real read tells.
+	bool dataReady = (true == m_iocpData.m_zeroByteReceive) &&
+		(false == rcvShutdown) &&
+		(0 == bytesTransferred) && 
+		(true == rcvContext.m_data.empty());
+
+	// If nothing is transferred, we are about to be disconnected. In this
+	// case, don't notify the client that nothing is received because
+	// they are about to get a disconnection callback.
+	if(0 != bytesTransferred)
+	{
+		// Shrink the buffer to fit the byte transferred
+		rcvContext.m_data.resize(bytesTransferred);
+		assert(rcvContext.m_data.size() == bytesTransferred);
+
+		m_iocpData.m_timers.Received(c);
+
+		if(m_iocpData.m_iocpHandler != NULL)
+		{
+			CReceiveBuffer data(rcvContext.m_data, *m_iocpData.m_bufferPool);
+
+			// Invoke the callback for the client
+			m_iocpData.m_iocpHandler->OnReceiveBuffer(
+				rcvContext.m_cid,
+				c.m_userContext,
+				data);
+		}
+
+		// Size the next receive after this one.
+		if(m_iocpData.m_minRcvBufferSize < m_iocpData.m_maxRcvBufferSize)
+		{
+			c.AdaptRcvBufferSize(
+				bytesTransferred, 
+				m_iocpData.m_minRcvBufferSize,
+				m_iocpData.m_maxRcvBufferSize);
+		}
+	}
+
+	if(true == dataReady)
+	{
+		m_iocpData.m_bufferPool->Bind(rcvContext);
+	}
+	else
+	{
+		// Give the buffer back until the next receive needs one. If the 
+		// handler took the buffer over, there is nothing left to give.
+		m_iocpData.m_bufferPool->Release(rcvContext);
+	}
+
+	int lastError = NO_ERROR;
+
+	// 0 bytes transferred, or if a recv context can't be posted to the 
+	// IO completion port, that implies the socket at least half-closed.
+	if( (0 == bytesTransferred && false == dataReady) || 
+		WSA_IO_PENDING != (lastError = PostRecv(m_iocpData, c)) )
+	{
+		uint64_t cid = rcvContext.m_cid;
+
+		// Once closed, the connection may be removed by any thread.
+		intrusive_ptr<CConnection> pin(&c);
+
+		if (c.CloseRcvContext() == true)
+		{
+			::shutdown(c.m_socket, SD_RECEIVE);
+
+			if(m_iocpData.m_iocpHandler != NULL)
+			{
+				m_iocpData.m_iocpHandler->OnClientDisconnect(
+					cid,
+					c.m_userContext,
+					lastError);
+			}
+		}
+	}
+}
+
+void CWorkerThread::HandleSend( CIocpContext &iocpContext, DWORD bytesTransferred )
+{
+	// The send keeps the connection until it is counted out.
+	CConnection &c = *iocpContext.m_connection;
+
+	uint64_t cid = iocpContext.m_cid;
+
+	// Everything in the context is counted out, sent or not.
+	uint64_t numBytes = iocpContext.GetSendSize();
+
+	if(bytesTransferred > 0 )
+	{
+		m_iocpData.m_timers.Sent(c);
+
+		if(m_iocpData.m_iocpHandler != NULL)
+		{
+			m_iocpData.m_iocpHandler->OnSentData(cid, c.m_userContext, bytesTransferred);
+		}
+	}
+	//No bytes transferred, that means send has failed.
+	else
+	{
+		// what to do here?
+	}
+
+	// The data is sent. Keep the memory for receive buffers.
+	m_iocpData.m_bufferPool->Put(iocpContext.m_data);
+	for(size_t i = 0; i < iocpContext.m_gatherData.size(); ++i)
+	{
+		m_iocpData.m_bufferPool->Put(iocpContext.m_gatherData[i]);
+	}
+
+	//! @remark
+	//! Remove the send context after notifying the user. Otherwise
+	//! there is a race condition where a disconnect context maybe waiting 
+	//! for the send queue to go to zero at the same time. In this case,
+	//! the disconnect notification will come before we notify the user.
+	uint32_t outstandingSend = 0;
+
+	// The sends waiting for room in the window go first, as they were 
+	// queued before anything held back now. This one is still counted 
+	// out after them, as below.
+	if(true == iocpContext.m_windowed)
+	{
+		ReleaseWindowedSends(m_iocpData, c, numBytes);
+	}
+
+	CSendWatermarks::WritableList_t writable;
+	if(m_iocpData.m_sendWatermarks != NULL)
+	{
+		m_iocpData.m_sendWatermarks->Sent(c, numBytes, writable);
+	}
+
+	// Held only if this is the last send out, from then on.
+	intrusive_ptr<CConnection> pin;
+
+	if(true == m_iocpData.m_coalesceSends)
+	{
+		mutex::scoped_lock l(c.m_sendBatchMutex);
+
+		// The sends held back while this one was in flight go now. Queue
+		// them before this one is counted out, so the queue never looks
+		// idle in between.
+		QueueSendBatch(m_iocpData, c);
+		outstandingSend = c.CompleteSend(&pin);
+	}
+	else
+	{
+		outstandingSend = c.CompleteSend(&pin);
+	}
+
+	m_iocpData.m_contextPool->Put(&iocpContext);
+
+	NotifyWritable(writable);
+
+	// If there is no outstanding send context, that means all sends 
+	// are completed for the moment. At this point, if we have a half-closed 
+	// socket, and the connection is pending to be disconnected, post a 
+	// disconnect context for a graceful shutdown.
+	if(0 == outstandingSend)
+	{
+		if( (::InterlockedExchangeAdd(&c.m_rcvClosed, 0) > 0) &&
+			(::InterlockedExchangeAdd(&c.m_disconnectPending, 0) > 0) )
+		{
+			// Disconnect context is special (hacked) because it is not
+			// tied to a connection. During graceful shutdown, it is very
+			// difficult to determine when exactly is a good time to 
+			// remove the connection. For example, a disconnect context 
+			// might have already been sent by the user code, and you
+			// wouldn't know it unless mutex are used. To keep it as 
+			// lock-free as possible, the disconnect handler
+			// will gracefully handle redundant disconnect context.
+			PostDisconnect(m_iocpData, c);
+		}
+	}
+}
+
+void CWorkerThread::HandleAccept( CIocpContext &acceptContext, DWORD bytesTransferred )
+{
+	// We should be accepting immediately without waiting for any data.
+	// If this has change, we need to account for that accept buffer and post
+	// it to the receive side.
+	assert(0 == bytesTransferred);
+
+	int lastError = UpdateAcceptContext(m_iocpData, acceptContext.m_socket);
+
+	uint64_t cid = 0;
+	if(NO_ERROR == lastError)
+	{
+		// If the connection table is full, turn the connection away.
+		cid = m_iocpData.m_connectionManager.NewId();
+		if(0 == cid)
+		{
+			closesocket(acceptContext.m_socket);
+			lastError = WSAENOBUFS;
+		}
+	}
+
+	if(NO_ERROR != lastError)
+	{
+		if(m_iocpData.m_iocpHandler != NULL)
+		{
+			// This shouldn't happen, but if it does, report the error. 
+			// Since the connection has not been established, it is not necessary
+			// to notify the client to remove any connections.
+			m_iocpData.m_iocpHandler->OnServerError(lastError);
+		}
+	}
+	// If the socket is up, allocate the connection and notify the client.
+	else
+	{
+		ConnectionInformation cinfo = 
+			GetConnectionInformation(acceptContext.m_socket);
+
+		// Only what is already known. Resolving is up to the user.
+		if(m_iocpData.m_hostNameCache != NULL)
+		{
+			m_iocpData.m_hostNameCache->Find(
+				cinfo.m_remoteAddress, 
+				cinfo.m_remoteHostName);
+		}
+
+		intrusive_ptr<CConnection> c(new CConnection(
+			acceptContext.m_socket, 
+			cid,
+			m_iocpData.m_rcvBufferSize
+			));
+
+		m_iocpData.m_connectionManager.AddConnection(c);
+
+		AssociateDevice(c->m_socket, c.get(), m_iocpData);
+
+		if(m_iocpData.m_iocpHandler != NULL)
+		{
+			m_iocpData.m_iocpHandler->OnNewConnection(c->m_id, cinfo, c->m_userContext);
+		}
+
+		// After OnNewConnection, which may set the connection's timeouts
+		// itself.
+		m_iocpData.m_timers.Start(*c);
+
+		int lasterror = PostRecv(m_iocpData, *c);
+
+		// Failed to post a queue a receive context. It is likely that the
+		// connection is already terminated at this point (by user or client).
+		// In such case, just remove the connection.
+		if( WSA_IO_PENDING != lasterror)
+		{
+			if(true == c->CloseRcvContext())
+			{
+				PostDisconnect(m_iocpData, *c);
+			}
+		}
+	}
+
+	// Post this accept context again for another new connection. The
+	// other contexts in the pool are still waiting meanwhile.
+#if defined(_WIN32)
+	acceptContext.m_socket = CreateOverlappedSocket();
+
+	if(INVALID_SOCKET != acceptContext.m_socket)
+	{
+		PostAccept(m_iocpData, acceptContext);
+	}
+	else
+	{
+		if(m_iocpData.m_iocpHandler != NULL)
+		{
+			m_iocpData.m_iocpHandler->OnServerError(WSAGetLastError());
+		}
+	}
+#else
+	// accept4() creates the socket, so there is nothing to preallocate.
+	acceptContext.m_socket = INVALID_SOCKET;
+
+	PostAccept(m_iocpData, acceptContext);
+#endif
+}
+
+void CWorkerThread::HandleIocpContext(CIocpContext &iocpContext, 
+									  DWORD bytesTransferred )
+{
+	switch(iocpContext.m_type)
+	{
+	case CIocpContext::Rcv:
+		HandleReceive(iocpContext, bytesTransferred);
+		break;
+	case CIocpContext::Send:
+		HandleSend(iocpContext, bytesTransferred);
+		break;
+	case CIocpContext::Accept:
+		HandleAccept(iocpContext, bytesTransferred);
+		break;
+	case CIocpContext::Disconnect:
+		HandleDisconnect(iocpContext);
+		break;
+	case CIocpContext::Timer:
+		// The wait is timed again from now on.
+		break;
+	default:
+		assert(false);
+	}
+}
+
+#if defined(_WIN32)
+void CWorkerThread::HandleCompletionFailure(OVERLAPPED * overlapped, 
+											DWORD bytesTransferred, 
+											int error )
+{
+	if (NULL != overlapped ) 
+	{
+		// Process a failed completed I/O request
+		// dwError contains the reason for failure
+		CIocpContext &iocpContext = 
+			*reinterpret_cast<CIocpContext *>(overlapped);
+		HandleIocpContext(iocpContext, bytesTransferred);
+	} 
+	else 
+	{
+		// The wait timed out, for the next tick of the timers. 
+		if(WAIT_TIMEOUT == error)
+		{
+			return;
+		}
+		
+		if(m_iocpData.m_iocpHandler != NULL)
+		{
+			// GetQueuedCompletionStatus failed. Notify the user on this event.
+			m_iocpData.m_iocpHandler->OnServerError(error);
+		}
+	}
+}
+#endif
+
+void CWorkerThread::HandleDisconnect( CIocpContext &iocpContext )
+{
+	uint64_t cid = iocpContext.m_cid;
+
+	// Disconnect context isn't tied to the connection. Therefore, it must
+	// be deleted manually at all times.
+	delete &iocpContext;
+
+	intrusive_ptr<CConnection> c = 
+		m_iocpData.m_connectionManager.GetConnection(cid);
+	if(c == NULL)
+	{
+		//! @remark
+		//! Disconnect context may come from several different source at 
+		//! once, and only the first one to remove the connection. If the
+		//! connection is already removed, gracefully handle it.
+
+		//std::cout <<"Extra disconnect packet received" << std::endl;
+		return;
+	}
+
+	if(c->HasOutstandingContext() == true)
+	{
+		return;
+	}
+
+	// A timeout being reported posts the disconnect again once it is.
+	if(false == m_iocpData.m_timers.Stop(*c))
+	{
+		return;
+	}
+
+	if(true == m_iocpData.m_connectionManager.RemoveConnection(cid) )
+	{
+		if(m_iocpData.m_iocpHandler != NULL)
+		{
+			m_iocpData.m_iocpHandler->OnDisconnect(cid, c->m_userContext, 0);
+		}
+
+		// Sends held back and never sent still count against the server 
+		// wide watermark.
+		if(m_iocpData.m_sendWatermarks != NULL)
+		{
+			CSendWatermarks::WritableList_t writable;
+			m_iocpData.m_sendWatermarks->Closed(*c, writable);
+			NotifyWritable(writable);
+		}
+	}
+}
+
+void CWorkerThread::HandleTimeouts()
+{
+	m_iocpData.m_timers.Expire(m_timeouts);
+
+	for(size_t i = 0; i < m_timeouts.size(); ++i)
+	{
+		CConnection &c = *m_timeouts[i].m_connection;
+
+		if(m_iocpData.m_iocpHandler != NULL)
+		{
+			m_iocpData.m_iocpHandler->OnTimeout(
+				c.m_id, 
+				c.m_userContext,
+				m_timeouts[i].m_timeout);
+		}
+
+		if(true == m_iocpData.m_timers.Reported(c))
+		{
+			PostDisconnect(m_iocpData, c);
+		}
+	}
+
+	m_timeouts.clear();
+}
+
+void CWorkerThread::NotifyWritable( CSendWatermarks::WritableList_t const &writable )
+{
+	if(m_iocpData.m_iocpHandler == NULL)
+	{
+		return;
+	}
+
+	for(size_t i = 0; i < writable.size(); ++i)
+	{
+		m_iocpData.m_iocpHandler->OnWritable(
+			writable[i]->m_id, 
+			writable[i]->m_userContext);
+	}
+}
+} } // end namespace
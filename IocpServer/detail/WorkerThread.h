@@ -1,44 +1,69 @@
-//! Copyright Alan Ning 2010
-//! Distributed under the Boost Software License, Version 1.0.
-//! (See accompanying file LICENSE_1_0.txt or copy at
-//! http://www.boost.org/LICENSE_1_0.txt)
-
-#ifndef WORKERTHREAD_H_2010_09_22_22_50_27
-#define WORKERTHREAD_H_2010_09_22_22_50_27
-
-namespace iocp { namespace detail { class CSharedIocpData; } }
-namespace iocp { namespace detail { class CIocpContext; } }
-
-namespace iocp { namespace detail {
-
-class CWorkerThread
-{
-public:
-
-	explicit CWorkerThread(CSharedIocpData &sharedData);
-
-	~CWorkerThread();
-
-	void Run();
-
-private:
-	void HandleIocpContext( CIocpContext &iocpContext, DWORD bytesTransferred );
-
-	void HandleCompletionFailure( OVERLAPPED * overlapped, DWORD bytesTransferred, int error );
-
-	void HandleReceive( CIocpContext &iocpContext, DWORD bytesTransferred );
-
-	void HandleSend( CIocpContext &iocpContext, DWORD bytesTransferred );
-
-	void HandleAccept(CIocpContext &iocpContext, DWORD bytesTransferred );
-
-	void HandleDisconnect(CIocpContext &iocpContext);
-private:
-
-	boost::thread m_thread;
-
-	CSharedIocpData &m_iocpData;
-};
-
-} } // end namespace
+//! Copyright Alan Ning 2010
+//! Distributed under the Boost Software License, Version 1.0.
+//! (See accompanying file LICENSE_1_0.txt or copy at
+//! http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef WORKERTHREAD_H_2010_09_22_22_50_27
+#define WORKERTHREAD_H_2010_09_22_22_50_27
+
+namespace iocp { namespace detail { class CSharedIocpData; } }
+namespace iocp { namespace detail { class CIocpContext; } }
+
+#include "ConnectionTimers.h"
+#include "SendWatermarks.h"
+
+#if !defined(_WIN32)
+#include "CompletionPort.h"
+#endif
+
+namespace iocp { namespace detail {
+
+class CWorkerThread
+{
+public:
+
+	//! cpu: the processor to run on, -1 = any. Ignored on Windows.
+	CWorkerThread(CSharedIocpData &sharedData, int cpu = -1);
+
+	~CWorkerThread();
+
+	void Run();
+
+private:
+	void HandleIocpContext( CIocpContext &iocpContext, DWORD bytesTransferred );
+
+#if defined(_WIN32)
+	void HandleCompletionFailure( OVERLAPPED * overlapped, DWORD bytesTransferred, int error );
+#else
+	void HandleBufferedReceive( CCompletionPort::Packet packet );
+#endif
+
+	void HandleReceive( CIocpContext &iocpContext, DWORD bytesTransferred );
+
+	void HandleSend( CIocpContext &iocpContext, DWORD bytesTransferred );
+
+	void HandleAccept(CIocpContext &iocpContext, DWORD bytesTransferred );
+
+	void HandleDisconnect(CIocpContext &iocpContext);
+
+	//! Call OnWritable for connections that are back under their send 
+	//! watermarks.
+	void NotifyWritable(CSendWatermarks::WritableList_t const &writable);
+
+	//! Call OnTimeout for the timeouts that passed, if this thread is the
+	//! one to go through the ticks.
+	void HandleTimeouts();
+private:
+
+	boost::thread m_thread;
+
+	CSharedIocpData &m_iocpData;
+
+	int m_cpu;
+
+	//! Reused by HandleTimeouts.
+	CConnectionTimers::ExpiryList_t m_timeouts;
+};
+
+} } // end namespace
 #endif // WORKERTHREAD_H_2010_09_22_22_50_27
\ No newline at end of file